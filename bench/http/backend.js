@@ -0,0 +1,73 @@
+/*
+ * Copyright Splunk Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Everything the server under test talks to, in a process of its own so that
+// it doesn't compete with the load generator: the downstream service called
+// by the request handlers and an OTLP sink taking in spans and profiles,
+// counting the bytes exported.
+// Started by run.js, reports its port over IPC.
+
+const http = require('http');
+
+const INVENTORY_SIZE = 32;
+
+function inventory(id) {
+  const items = [];
+
+  for (let i = 0; i < INVENTORY_SIZE; i++) {
+    items.push({ sku: `${id}-${i}`, stock: (id * 31 + i * 17) % 100 });
+  }
+
+  return JSON.stringify({ id, items });
+}
+
+const exported = { requests: 0, bytes: 0 };
+
+const server = http.createServer((req, res) => {
+  if (req.method === 'POST') {
+    // OTLP over HTTP, an empty body is a valid response for every signal.
+    req.on('data', (chunk) => {
+      exported.bytes += chunk.length;
+    });
+    req.on('end', () => {
+      exported.requests++;
+      res.writeHead(200, { 'content-type': 'application/x-protobuf' });
+      res.end();
+    });
+    return;
+  }
+
+  if (req.url === '/__exported') {
+    res.end(JSON.stringify(exported));
+    return;
+  }
+
+  const url = new URL(req.url, 'http://localhost');
+  const id = Number(url.searchParams.get('id')) || 0;
+
+  // A bit of latency, as if the inventory came from a database.
+  setTimeout(() => {
+    res.writeHead(200, { 'content-type': 'application/json' });
+    res.end(inventory(id));
+  }, 1);
+});
+
+server.keepAliveTimeout = 60_000;
+server.listen(0, '127.0.0.1', () => {
+  process.send({ port: server.address().port });
+});
+
+process.on('disconnect', () => process.exit(0));
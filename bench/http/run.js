@@ -0,0 +1,297 @@
+/*
+ * Copyright Splunk Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Latency tax of the SDK on an HTTP service under load. Each scenario starts
+// a fresh server.js, drives it with a fixed number of keep-alive connections
+// issuing requests back to back, and reports the throughput, latency
+// percentiles, event loop delay and peak RSS of the measured period. The
+// profiler scenarios run once per sampling interval.
+//
+//   npm run compile && node bench/http/run.js
+//
+// Options (defaults in parentheses):
+//
+//   --scenarios none,tracing,profiling,snapshot
+//   --intervals 1,10,100           sampling intervals in milliseconds
+//   --connections 64
+//   --duration 20                  measured seconds, after --warmup 5
+//   --collection-interval 5000     profile collect interval in milliseconds
+//   --json FILE                    also write the results as JSON
+//
+// Other SDK settings are taken from the environment as usual, e.g.
+// SPLUNK_SNAPSHOT_SELECTION_PROBABILITY for the share of traces snapshotted.
+//
+// Comparable numbers need a quiet machine, run it a few times before drawing
+// conclusions from a few percent.
+
+const fs = require('fs');
+const http = require('http');
+const path = require('path');
+const { fork } = require('child_process');
+
+const PROFILER_SCENARIOS = ['profiling', 'snapshot'];
+
+function parseArgs(argv) {
+  const options = {
+    scenarios: ['none', 'tracing', 'profiling', 'snapshot'],
+    intervals: [1, 10, 100],
+    connections: 64,
+    duration: 20,
+    warmup: 5,
+    collectionInterval: 5000,
+    json: undefined,
+  };
+
+  for (let i = 2; i < argv.length; i += 2) {
+    const value = argv[i + 1];
+
+    switch (argv[i]) {
+      case '--scenarios':
+        options.scenarios = value.split(',');
+        break;
+      case '--intervals':
+        options.intervals = value.split(',').map(Number);
+        break;
+      case '--connections':
+        options.connections = Number(value);
+        break;
+      case '--duration':
+        options.duration = Number(value);
+        break;
+      case '--warmup':
+        options.warmup = Number(value);
+        break;
+      case '--collection-interval':
+        options.collectionInterval = Number(value);
+        break;
+      case '--json':
+        options.json = value;
+        break;
+      default:
+        throw new Error(`unknown option ${argv[i]}`);
+    }
+  }
+
+  return options;
+}
+
+function startChild(script, env) {
+  const child = fork(path.join(__dirname, script), [], {
+    env: { ...process.env, ...env },
+  });
+
+  return new Promise((resolve, reject) => {
+    child.once('message', ({ port }) => resolve({ child, port }));
+    child.once('exit', (code) =>
+      reject(new Error(`${script} exited with ${code}`))
+    );
+  });
+}
+
+function stopChild(child) {
+  return new Promise((resolve) => {
+    child.once('exit', resolve);
+    child.disconnect();
+  });
+}
+
+function request(agent, port, path) {
+  return new Promise((resolve, reject) => {
+    const req = http.get({ host: '127.0.0.1', port, path, agent }, (res) => {
+      let body = '';
+      res.setEncoding('utf8');
+      res.on('data', (chunk) => (body += chunk));
+      res.on('end', () => resolve({ status: res.statusCode, body }));
+      res.on('error', reject);
+    });
+    req.on('error', reject);
+  });
+}
+
+async function generateLoad(agent, port, connections, seconds) {
+  const latencies = [];
+  let errors = 0;
+  let nextId = 0;
+  const end = process.hrtime.bigint() + BigInt(Math.round(seconds * 1e9));
+
+  async function connection() {
+    while (process.hrtime.bigint() < end) {
+      const start = process.hrtime.bigint();
+
+      try {
+        const path = `/order?id=${nextId++ % 1000}`;
+        const { status } = await request(agent, port, path);
+
+        if (status !== 200) {
+          errors++;
+          continue;
+        }
+      } catch (e) {
+        errors++;
+        continue;
+      }
+
+      latencies.push(Number(process.hrtime.bigint() - start) / 1e6);
+    }
+  }
+
+  await Promise.all(Array.from({ length: connections }, connection));
+  return { latencies, errors };
+}
+
+function percentile(sorted, p) {
+  if (sorted.length === 0) {
+    return NaN;
+  }
+
+  const index = Math.floor((sorted.length * p) / 100);
+  return sorted[Math.min(sorted.length - 1, index)];
+}
+
+async function exportedBytes(agent, backendPort) {
+  const { body } = await request(agent, backendPort, '/__exported');
+  return JSON.parse(body).bytes;
+}
+
+async function runScenario(options, backendPort, scenario, samplingInterval) {
+  const { child, port } = await startChild('server.js', {
+    BENCH_SCENARIO: scenario,
+    BENCH_SAMPLING_INTERVAL_MS: String(samplingInterval ?? ''),
+    BENCH_COLLECTION_INTERVAL_MS: String(options.collectionInterval),
+    BENCH_BACKEND_PORT: String(backendPort),
+  });
+  const agent = new http.Agent({
+    keepAlive: true,
+    maxSockets: options.connections,
+  });
+
+  try {
+    await generateLoad(agent, port, options.connections, options.warmup);
+    await request(agent, port, '/__reset');
+    const exportedBefore = await exportedBytes(agent, backendPort);
+
+    const { latencies, errors } = await generateLoad(
+      agent,
+      port,
+      options.connections,
+      options.duration
+    );
+    const { body } = await request(agent, port, '/__stats');
+    const serverStats = JSON.parse(body);
+    const exported = (await exportedBytes(agent, backendPort)) - exportedBefore;
+    latencies.sort((a, b) => a - b);
+
+    return {
+      scenario,
+      samplingInterval,
+      requests: latencies.length,
+      errors,
+      throughput: latencies.length / options.duration,
+      p50: percentile(latencies, 50),
+      p99: percentile(latencies, 99),
+      exportedBytes: exported,
+      ...serverStats,
+    };
+  } finally {
+    agent.destroy();
+    await stopChild(child);
+  }
+}
+
+function formatRow(result, baseline) {
+  const change =
+    baseline && result !== baseline
+      ? `${((result.throughput / baseline.throughput - 1) * 100).toFixed(1)}%`
+      : '';
+  const interval =
+    result.samplingInterval === undefined ? '-' : `${result.samplingInterval}`;
+
+  return [
+    result.scenario.padEnd(10),
+    interval.padStart(8),
+    result.throughput.toFixed(0).padStart(10),
+    change.padStart(8),
+    result.p50.toFixed(2).padStart(8),
+    result.p99.toFixed(2).padStart(8),
+    result.eventLoopDelay.p99.toFixed(2).padStart(10),
+    (result.maxRss / 1024 / 1024).toFixed(1).padStart(9),
+    (result.exportedBytes / 1024).toFixed(0).padStart(11),
+    String(result.errors).padStart(7),
+  ].join(' ');
+}
+
+async function main() {
+  const options = parseArgs(process.argv);
+  const { child: backend, port: backendPort } = await startChild(
+    'backend.js',
+    {}
+  );
+  const results = [];
+
+  console.log(
+    [
+      'scenario'.padEnd(10),
+      'interval'.padStart(8),
+      'req/s'.padStart(10),
+      'vs none'.padStart(8),
+      'p50 ms'.padStart(8),
+      'p99 ms'.padStart(8),
+      'ELD p99 ms'.padStart(10),
+      'RSS MiB'.padStart(9),
+      'export KiB'.padStart(11),
+      'errors'.padStart(7),
+    ].join(' ')
+  );
+
+  try {
+    for (const scenario of options.scenarios) {
+      const intervals = PROFILER_SCENARIOS.includes(scenario)
+        ? options.intervals
+        : [undefined];
+
+      for (const samplingInterval of intervals) {
+        const result = await runScenario(
+          options,
+          backendPort,
+          scenario,
+          samplingInterval
+        );
+        results.push(result);
+
+        const baseline = results.find((r) => r.scenario === 'none');
+        console.log(formatRow(result, baseline));
+
+        if (result.profiler && result.profiler.activationsRecorded === 0) {
+          console.warn(`${scenario}: no activations were recorded`);
+        }
+      }
+    }
+  } finally {
+    await stopChild(backend);
+  }
+
+  if (options.json) {
+    fs.writeFileSync(
+      options.json,
+      JSON.stringify({ options, results }, null, 2)
+    );
+  }
+}
+
+main().catch((e) => {
+  console.error(e);
+  process.exitCode = 1;
+});
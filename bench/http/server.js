@@ -0,0 +1,185 @@
+/*
+ * Copyright Splunk Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// The service under test, started by run.js with one of the scenarios:
+//
+//   none       no SDK at all
+//   tracing    tracing only
+//   profiling  tracing and the continuous CPU profiler
+//   snapshot   tracing and the snapshot profiler
+//
+// The SDK is set up the way an application would, through start(), so context
+// switches go through ProfilingContextManager and the activation ring, and
+// profiles are collected and exported to the backend's OTLP sink.
+
+const scenario = process.env.BENCH_SCENARIO || 'none';
+const samplingIntervalMs = Number(process.env.BENCH_SAMPLING_INTERVAL_MS || 10);
+const collectionIntervalMs = Number(
+  process.env.BENCH_COLLECTION_INTERVAL_MS || 5000
+);
+const backendPort = Number(process.env.BENCH_BACKEND_PORT);
+
+let extension;
+
+if (scenario !== 'none') {
+  process.env.OTEL_EXPORTER_OTLP_ENDPOINT = `http://127.0.0.1:${backendPort}`;
+
+  if (scenario === 'snapshot') {
+    process.env.SPLUNK_SNAPSHOT_PROFILER_ENABLED = 'true';
+    process.env.SPLUNK_SNAPSHOT_SAMPLING_INTERVAL = String(samplingIntervalMs);
+    process.env.SPLUNK_CPU_PROFILER_COLLECTION_INTERVAL =
+      String(collectionIntervalMs);
+  }
+
+  // Before http is loaded, for it to be instrumented.
+  require('../../lib').start({
+    serviceName: 'http-load-bench',
+    metrics: false,
+    logging: false,
+    tracing: true,
+    profiling:
+      scenario === 'profiling'
+        ? {
+            callstackInterval: samplingIntervalMs,
+            collectionDuration: collectionIntervalMs,
+          }
+        : false,
+  });
+
+  if (scenario === 'profiling' || scenario === 'snapshot') {
+    extension = require('../../lib/profiling').loadExtension();
+  }
+}
+
+const http = require('http');
+const { monitorEventLoopDelay } = require('perf_hooks');
+
+const agent = new http.Agent({ keepAlive: true, maxSockets: 256 });
+
+function fetchInventory(id) {
+  return new Promise((resolve, reject) => {
+    const req = http.get(
+      {
+        host: '127.0.0.1',
+        port: backendPort,
+        path: `/inventory?id=${id}`,
+        agent,
+      },
+      (res) => {
+        let body = '';
+        res.setEncoding('utf8');
+        res.on('data', (chunk) => (body += chunk));
+        res.on('end', () => resolve(JSON.parse(body)));
+        res.on('error', reject);
+      }
+    );
+    req.on('error', reject);
+  });
+}
+
+async function price(item) {
+  // Each item resolves on a later tick, as a cache or a pool would.
+  await new Promise(setImmediate);
+  return { ...item, price: ((item.stock * 7919) % 1000) / 10 };
+}
+
+function render(order) {
+  const items = order.items
+    .filter((item) => item.stock > 10)
+    .sort((a, b) => b.price - a.price)
+    .map(
+      (item) =>
+        `<li>${item.sku}: ${item.price.toFixed(2)} (${item.stock})</li>`
+    );
+
+  const list = items.join('');
+  return `<html><body><h1>Order ${order.id}</h1><ul>${list}</ul></body></html>`;
+}
+
+async function handleOrder(id) {
+  const inventory = await fetchInventory(id);
+  const items = await Promise.all(inventory.items.map(price));
+  return render({ id, items });
+}
+
+const eventLoopDelay = monitorEventLoopDelay({ resolution: 10 });
+let maxRss = 0;
+
+function sampleRss() {
+  maxRss = Math.max(maxRss, process.memoryUsage.rss());
+}
+
+function stats() {
+  const millis = (nanos) => nanos / 1e6;
+  const result = {
+    eventLoopDelay: {
+      p50: millis(eventLoopDelay.percentile(50)),
+      p99: millis(eventLoopDelay.percentile(99)),
+      max: millis(eventLoopDelay.max),
+    },
+    maxRss,
+  };
+
+  if (extension) {
+    const profilerStats = extension.stats();
+    result.profiler = {
+      activationRingEvents: profilerStats.activationRingEvents,
+      activationsRecorded: profilerStats.activationsRecorded,
+      activationsDropped: profilerStats.activationsDropped,
+    };
+  }
+
+  return result;
+}
+
+const server = http.createServer((req, res) => {
+  if (req.url === '/__reset') {
+    eventLoopDelay.reset();
+    maxRss = 0;
+    sampleRss();
+    res.end();
+    return;
+  }
+
+  if (req.url === '/__stats') {
+    sampleRss();
+    res.end(JSON.stringify(stats()));
+    return;
+  }
+
+  const url = new URL(req.url, 'http://localhost');
+  const id = Number(url.searchParams.get('id')) || 0;
+
+  handleOrder(id).then(
+    (body) => {
+      res.writeHead(200, { 'content-type': 'text/html' });
+      res.end(body);
+    },
+    (err) => {
+      res.writeHead(500);
+      res.end(String(err));
+    }
+  );
+});
+
+server.keepAliveTimeout = 60_000;
+server.listen(0, '127.0.0.1', () => {
+  eventLoopDelay.enable();
+  setInterval(sampleRss, 100).unref();
+  process.send({ port: server.address().port });
+});
+
+process.on('disconnect', () => process.exit(0));
@@ -0,0 +1,180 @@
+/**
+ * Compares matching samples against span activations with a per-sample bin
+ * lookup (FindClosestActivation) and with a single sweep (ActivationMatcher),
+ * after inserting the activations into the bins.
+ */
+#include "activations.h"
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace Splunk::Profiling;
+
+namespace Bench {
+
+namespace {
+
+const int64_t kWindowDuration = 30000LL * kMillisecond;
+const int64_t kSamplingInterval = 1LL * kMillisecond;
+
+// Durations go past 32 bits, unlike what NextRandom returns.
+uint64_t NextRandom64(uint64_t* state) {
+  uint64_t high = NextRandom(state);
+  return high << 32 | NextRandom(state);
+}
+
+void FormatId(uint8_t* out, size_t length, uint64_t value) {
+  for (size_t i = 0; i < length; i++) {
+    out[i] = uint8_t(value >> ((i % 8) * 8));
+  }
+}
+
+/**
+ * Fills the window with request-like activations: a root span with a few
+ * nested child spans, all ending before their parent.
+ */
+void GenerateActivations(
+  ActivationBins* bins, int64_t count, int64_t maxDuration, uint64_t seed) {
+  uint64_t rng = seed;
+  int64_t spacing = kWindowDuration / count;
+  int64_t inserted = 0;
+
+  while (inserted < count) {
+    SpanActivation root;
+    memset(&root, 0, sizeof(root));
+    root.startTime = bins->startTime + inserted * spacing + 1;
+    root.endTime = root.startTime + 1 + int64_t(NextRandom64(&rng) % maxDuration);
+    FormatId(root.traceId, sizeof(root.traceId), NextRandom64(&rng));
+    FormatId(root.spanId, sizeof(root.spanId), NextRandom64(&rng));
+
+    int64_t children = int64_t(NextRandom64(&rng) % 4);
+    int64_t childStart = root.startTime;
+
+    for (int64_t i = 0; i < children && inserted + 1 < count; i++) {
+      SpanActivation child = root;
+      child.startTime = childStart + 1 + int64_t(NextRandom64(&rng) % 1000);
+
+      if (child.startTime >= root.endTime) {
+        break;
+      }
+
+      child.endTime =
+        child.startTime + int64_t(NextRandom64(&rng) % (root.endTime - child.startTime));
+      FormatId(child.spanId, sizeof(child.spanId), NextRandom64(&rng));
+
+      // Activations are recorded when they exit, children first.
+      InsertActivation(bins, &child);
+      inserted++;
+      childStart = child.endTime;
+    }
+
+    InsertActivation(bins, &root);
+    inserted++;
+  }
+}
+
+struct Result {
+  int64_t matched;
+  uint64_t checksum;
+};
+
+void Accumulate(Result* result, const SpanActivation* match) {
+  if (!match) {
+    return;
+  }
+
+  result->matched++;
+  result->checksum = result->checksum * 31 + uint64_t(match->startTime);
+}
+
+Result RunBinLookup(ActivationBins* bins, int64_t sampleCount, const char* name) {
+  Result result = {0, 0};
+  BenchRun run;
+  BenchStart(&run, name);
+
+  for (int64_t i = 0; i < sampleCount; i++) {
+    int64_t ts = bins->startTime + i * kSamplingInterval;
+    Accumulate(&result, FindClosestActivation(bins, ts));
+  }
+
+  BenchStop(&run, sampleCount, nullptr);
+  return result;
+}
+
+Result RunSweep(ActivationBins* bins, int64_t sampleCount, const char* name) {
+  Result result = {0, 0};
+  BenchRun run;
+  BenchStart(&run, name);
+
+  ActivationMatcher matcher;
+  ActivationMatcherInit(&matcher, bins, sampleCount);
+
+  for (int64_t i = 0; i < sampleCount; i++) {
+    int64_t ts = bins->startTime + i * kSamplingInterval;
+    Accumulate(&result, ActivationMatcherFind(&matcher, ts));
+  }
+
+  BenchStop(&run, sampleCount, nullptr);
+  return result;
+}
+
+} // namespace
+
+bool RunMatching() {
+  struct Shape {
+    const char* label;
+    int64_t activationCount;
+    int64_t maxDuration;
+  };
+
+  // The last one resembles a streaming or long polling service.
+  const Shape shapes[] = {
+    {"10x50ms", 10, 50 * kMillisecond},
+    {"10kx50ms", 10000, 50 * kMillisecond},
+    {"1mx50ms", 1000000, 50 * kMillisecond},
+    {"10kx30s", 10000, kWindowDuration},
+  };
+  const int64_t sampleCount = kWindowDuration / kSamplingInterval;
+  bool ok = true;
+
+  for (const Shape& shape : shapes) {
+    char insertName[64];
+    char binsName[64];
+    char sweepName[64];
+    snprintf(insertName, sizeof(insertName), "matching/insert:%s", shape.label);
+    snprintf(binsName, sizeof(binsName), "matching/bins:%s", shape.label);
+    snprintf(sweepName, sizeof(sweepName), "matching/sweep:%s", shape.label);
+
+    if (!BenchSelected(insertName) && !BenchSelected(binsName) && !BenchSelected(sweepName)) {
+      continue;
+    }
+
+    PagedArena arena;
+    PagedArenaInit(&arena, kArenaPageSize);
+
+    ActivationBins bins;
+    ActivationBinsInit(&bins, &arena);
+    ActivationBinsReset(&bins, 1000 * kMillisecond, ActivationBinWidth(kSamplingInterval));
+
+    BenchRun run;
+    BenchStart(&run, insertName);
+    GenerateActivations(&bins, shape.activationCount, shape.maxDuration, 0x9e3779b97f4a7c15ULL);
+    BenchStop(&run, shape.activationCount, &arena);
+
+    Result binLookup = RunBinLookup(&bins, sampleCount, binsName);
+    Result sweep = RunSweep(&bins, sampleCount, sweepName);
+
+    if (binLookup.matched != sweep.matched || binLookup.checksum != sweep.checksum) {
+      fprintf(stderr, "%s: mismatch between bin lookup and sweep results\n", shape.label);
+      ok = false;
+    }
+
+    ActivationBinsFree(&bins);
+    PagedArenaDestroy(&arena);
+  }
+
+  return ok;
+}
+
+} // namespace Bench
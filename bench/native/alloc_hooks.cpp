@@ -0,0 +1,111 @@
+/**
+ * Counts heap allocations of the benchmarks by interposing malloc and friends
+ * over glibc's, which exports its implementation as __libc_* to forward to.
+ * Arenas map their pages directly, their memory is taken from their stats.
+ */
+#include "bench.h"
+#include <stdlib.h>
+
+#if defined(__GLIBC__)
+#include <errno.h>
+#include <malloc.h>
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* ptr);
+}
+#endif
+
+namespace Bench {
+
+HeapCounters heapCounters = {0, 0, 0};
+
+#if defined(__GLIBC__)
+
+bool HeapCountersTracked() { return true; }
+
+namespace {
+
+void* Allocated(void* ptr) {
+  if (ptr) {
+    heapCounters.allocations++;
+    heapCounters.liveBytes += int64_t(malloc_usable_size(ptr));
+
+    if (heapCounters.liveBytes > heapCounters.peakBytes) {
+      heapCounters.peakBytes = heapCounters.liveBytes;
+    }
+  }
+
+  return ptr;
+}
+
+void Released(void* ptr) {
+  if (ptr) {
+    heapCounters.liveBytes -= int64_t(malloc_usable_size(ptr));
+  }
+}
+
+} // namespace
+
+#else
+
+bool HeapCountersTracked() { return false; }
+
+#endif
+
+} // namespace Bench
+
+#if defined(__GLIBC__)
+
+using Bench::Allocated;
+using Bench::Released;
+
+extern "C" {
+
+void* malloc(size_t size) { return Allocated(__libc_malloc(size)); }
+
+void* calloc(size_t count, size_t size) { return Allocated(__libc_calloc(count, size)); }
+
+void* realloc(void* ptr, size_t size) {
+  Released(ptr);
+  void* result = __libc_realloc(ptr, size);
+
+  // The original block is left alone on failure, or freed for a size of 0.
+  if (!result && ptr && size > 0) {
+    Bench::heapCounters.liveBytes += int64_t(malloc_usable_size(ptr));
+    return nullptr;
+  }
+
+  return Allocated(result);
+}
+
+void free(void* ptr) {
+  Released(ptr);
+  __libc_free(ptr);
+}
+
+void* memalign(size_t alignment, size_t size) {
+  return Allocated(__libc_memalign(alignment, size));
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+  return Allocated(__libc_memalign(alignment, size));
+}
+
+int posix_memalign(void** out, size_t alignment, size_t size) {
+  void* ptr = Allocated(__libc_memalign(alignment, size));
+
+  if (!ptr) {
+    return ENOMEM;
+  }
+
+  *out = ptr;
+  return 0;
+}
+
+} // extern "C"
+
+#endif
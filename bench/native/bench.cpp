@@ -0,0 +1,205 @@
+#include "bench.h"
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace Bench {
+
+using namespace Splunk::Profiling;
+
+namespace {
+
+const char* const* benchFilters = nullptr;
+int benchFilterCount = 0;
+
+struct Request {
+  int32_t contextId;
+  int32_t depth;
+  int32_t maxDepth;
+  uint64_t traceId;
+};
+
+void FormatId(uint8_t* out, size_t length, uint64_t value) {
+  for (size_t i = 0; i < length; i++) {
+    out[i] = uint8_t(value >> ((i % 8) * 8));
+  }
+}
+
+} // namespace
+
+int64_t NowNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+           std::chrono::steady_clock::now().time_since_epoch())
+    .count();
+}
+
+uint64_t NextRandom(uint64_t* state) {
+  // xorshift64, the low bits of consecutive outputs are correlated.
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  *state = x;
+  return x >> 32;
+}
+
+void BenchSetFilters(const char* const* filters, int count) {
+  benchFilters = filters;
+  benchFilterCount = count;
+}
+
+bool BenchSelected(const char* name) {
+  if (benchFilterCount == 0) {
+    return true;
+  }
+
+  for (int i = 0; i < benchFilterCount; i++) {
+    if (strstr(name, benchFilters[i])) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void BenchPrintHeader() {
+  printf("%-48s %12s %10s %12s %12s\n", "benchmark", "ops", "ns/op", "allocs", "peak KiB");
+}
+
+void BenchStart(BenchRun* run, const char* name) {
+  run->name = name;
+  run->startAllocations = heapCounters.allocations;
+  run->startLiveBytes = heapCounters.liveBytes;
+  heapCounters.peakBytes = heapCounters.liveBytes;
+  // Last, so that the bookkeeping isn't timed.
+  run->startNanos = NowNanos();
+}
+
+void BenchStop(BenchRun* run, int64_t ops, const PagedArena* arena) {
+  int64_t elapsed = NowNanos() - run->startNanos;
+
+  if (!BenchSelected(run->name)) {
+    return;
+  }
+
+  int64_t peakBytes = heapCounters.peakBytes - run->startLiveBytes;
+
+  if (arena) {
+    PagedArenaStats stats;
+    PagedArenaGetStats(arena, &stats);
+    peakBytes += int64_t(stats.peakCommitted);
+  }
+
+  double nanosPerOp = ops > 0 ? double(elapsed) / double(ops) : 0.0;
+
+  if (HeapCountersTracked()) {
+    printf(
+      "%-48s %12lld %10.2f %12lld %12.1f\n", run->name, (long long)ops, nanosPerOp,
+      (long long)(heapCounters.allocations - run->startAllocations), double(peakBytes) / 1024.0);
+  } else {
+    printf(
+      "%-48s %12lld %10.2f %12s %12.1f\n", run->name, (long long)ops, nanosPerOp, "-",
+      double(peakBytes) / 1024.0);
+  }
+}
+
+void GenerateWorkload(
+  Workload* workload, size_t eventCount, int32_t inFlight, int64_t duration, uint64_t seed) {
+  uint64_t rng = seed;
+  int32_t nextContextId = 1;
+  int64_t startTime = 1000 * kMillisecond;
+  int64_t spacing = duration / int64_t(eventCount);
+  tinystl::vector<Request> requests;
+
+  for (int32_t i = 0; i < inFlight; i++) {
+    Request request = {nextContextId++, 0, 0, NextRandom(&rng)};
+    requests.push_back(request);
+  }
+
+  snprintf(workload->name, sizeof(workload->name), "synthetic-%d", inFlight);
+  workload->events.clear();
+  workload->events.reserve(eventCount);
+
+  while (workload->events.size() < eventCount) {
+    Request* request = &requests[NextRandom(&rng) % requests.size()];
+
+    if (request->depth == 0 && request->maxDepth == 0) {
+      request->maxDepth = NextRandom(&rng) % 16 == 0 ? 8 : 1 + int32_t(NextRandom(&rng) % 3);
+    }
+
+    bool enter =
+      request->depth < request->maxDepth && (request->depth == 0 || NextRandom(&rng) % 2 == 0);
+
+    ActivationEvent event;
+    memset(&event, 0, sizeof(event));
+    event.contextId = request->contextId;
+    event.kind = enter ? ActivationEvent_Enter : ActivationEvent_Exit;
+    event.timestamp = startTime + int64_t(workload->events.size()) * spacing;
+
+    if (enter) {
+      FormatId(event.traceId, sizeof(event.traceId), request->traceId);
+      FormatId(event.spanId, sizeof(event.spanId), NextRandom(&rng) << 32 | NextRandom(&rng));
+    }
+
+    workload->events.push_back(event);
+
+    if (enter) {
+      request->depth++;
+      continue;
+    }
+
+    request->depth--;
+
+    if (request->depth == 0) {
+      request->contextId = nextContextId++;
+      request->maxDepth = 0;
+
+      // Every few hops the request completes and a new one takes its place.
+      if (NextRandom(&rng) % 4 == 0) {
+        request->traceId = NextRandom(&rng);
+      }
+    }
+  }
+}
+
+bool LoadWorkload(Workload* workload, const char* path) {
+  FILE* file = fopen(path, "rb");
+
+  if (!file) {
+    return false;
+  }
+
+  const char* name = strrchr(path, '/');
+  snprintf(workload->name, sizeof(workload->name), "%s", name ? name + 1 : path);
+  workload->events.clear();
+
+  ActivationEvent event;
+  while (fread(&event, sizeof(event), 1, file) == 1) {
+    if (event.kind == ActivationEvent_Enter || event.kind == ActivationEvent_Exit) {
+      workload->events.push_back(event);
+    }
+  }
+
+  bool ok = !ferror(file);
+  fclose(file);
+  return ok;
+}
+
+void WorkloadSampleEvery(Workload* workload, int64_t samplingInterval) {
+  workload->samplingInterval = samplingInterval;
+  workload->samples.clear();
+
+  if (workload->events.empty()) {
+    return;
+  }
+
+  int64_t startTime = workload->events[0].timestamp;
+  int64_t endTime = workload->events[workload->events.size() - 1].timestamp;
+
+  for (int64_t ts = startTime; ts <= endTime; ts += samplingInterval) {
+    workload->samples.push_back(ts);
+  }
+}
+
+} // namespace Bench
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "activations.h"
+#include "tinystl/vector.h"
+#include "util/arena.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Shared harness of the native benchmarks (native_bench). Each benchmark is
+ * timed between BenchStart and BenchStop, which print a row with the time per
+ * operation, the heap allocations made and the peak memory taken.
+ *
+ * Heap allocations are counted by interposing malloc and friends, which is
+ * only done with glibc (see alloc_hooks.cpp), elsewhere only the memory
+ * committed by arenas is reported.
+ */
+namespace Bench {
+
+const int64_t kMillisecond = 1000000LL;
+const size_t kArenaPageSize = 1024ULL * 1024ULL * 64ULL;
+
+int64_t NowNanos();
+uint64_t NextRandom(uint64_t* state);
+
+/* Kept up to date by the allocation hooks. */
+struct HeapCounters {
+  int64_t allocations;
+  // Live bytes, as reported by malloc_usable_size.
+  int64_t liveBytes;
+  int64_t peakBytes;
+};
+
+extern HeapCounters heapCounters;
+/* Whether the allocation hooks are compiled in. */
+bool HeapCountersTracked();
+
+struct BenchRun {
+  const char* name;
+  int64_t startNanos;
+  int64_t startAllocations;
+  int64_t startLiveBytes;
+};
+
+/* Only rows whose name contains one of the filters are printed, all without any. */
+void BenchSetFilters(const char* const* filters, int count);
+/* Whether a benchmark of that name would be printed, to skip the setup of the others. */
+bool BenchSelected(const char* name);
+void BenchPrintHeader();
+void BenchStart(BenchRun* run, const char* name);
+/**
+ * Prints the row of the run, ops being the number of operations timed. The
+ * peak memory committed by the arena, if any, is added to the heap peak.
+ */
+void BenchStop(BenchRun* run, int64_t ops, const PagedArena* arena);
+
+/**
+ * Context enter and exit events to replay, in the layout of the activation
+ * ring (ActivationEvent), and the timestamps to take samples at.
+ */
+struct Workload {
+  char name[64];
+  tinystl::vector<Splunk::Profiling::ActivationEvent> events;
+  tinystl::vector<int64_t> samples;
+  int64_t samplingInterval;
+};
+
+/**
+ * Interleaves inFlight concurrent requests over duration nanoseconds. Each
+ * enters a few nested spans on its context and exits them again, continuing
+ * on a new context (the next async hop) once it is left empty. A few requests
+ * nest deeper than the inline stack holds.
+ */
+void GenerateWorkload(
+  Workload* workload, size_t eventCount, int32_t inFlight, int64_t duration, uint64_t seed);
+/**
+ * Loads events recorded with record_activations.js: ActivationEvent records
+ * back to back, in the byte order of the machine they were recorded on.
+ * Returns false if the file can't be read.
+ */
+bool LoadWorkload(Workload* workload, const char* path);
+/* Sample timestamps every samplingInterval over the span of the events. */
+void WorkloadSampleEvery(Workload* workload, int64_t samplingInterval);
+
+/* Suites, each prints its rows and returns false on inconsistent results. */
+bool RunPrimitives();
+bool RunMatching();
+bool RunContextStacks(const Workload* workload);
+bool RunReplay(const Workload* workload);
+
+} // namespace Bench
@@ -0,0 +1,166 @@
+/**
+ * Replays the context enters and exits of a workload against the context
+ * stack table (ContextStacks) and against the khash map it replaced.
+ */
+#include "activations.h"
+#include "bench.h"
+#include "context_stacks.h"
+#include "khash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace Splunk::Profiling;
+
+KHASH_MAP_INIT_INT(ActivationStack, ActivationStack);
+
+namespace Bench {
+
+namespace {
+
+const int kRounds = 5;
+
+struct Result {
+  size_t entries;
+  uint64_t checksum;
+};
+
+void Accumulate(Result* result, const SpanActivation* activation) {
+  if (activation) {
+    result->checksum = result->checksum * 31 + uint64_t(activation->startTime);
+  }
+}
+
+Result RunKhash(const Workload* workload, const char* name) {
+  const tinystl::vector<ActivationEvent>& trace = workload->events;
+  Result result = {0, 0};
+  PagedArena arena;
+  PagedArenaInit(&arena, kArenaPageSize);
+  khash_t(ActivationStack)* stacks = kh_init(ActivationStack);
+  BenchRun run;
+  BenchStart(&run, name);
+
+  for (int round = 0; round < kRounds; round++) {
+    kh_clear(ActivationStack, stacks);
+    PagedArenaReset(&arena);
+    result.checksum = 0;
+
+    for (size_t i = 0; i < trace.size(); i++) {
+      const ActivationEvent& event = trace[i];
+      khiter_t it = kh_get(ActivationStack, stacks, event.contextId);
+
+      if (event.kind == ActivationEvent_Enter) {
+        if (it == kh_end(stacks)) {
+          int ret;
+          it = kh_put(ActivationStack, stacks, event.contextId, &ret);
+          ActivationStackInit(&kh_value(stacks, it));
+        }
+
+        SpanActivation* activation = ActivationStackPush(&kh_value(stacks, it), &arena, nullptr);
+
+        if (activation) {
+          activation->startTime = int64_t(i);
+        }
+
+        continue;
+      }
+
+      if (it == kh_end(stacks)) {
+        continue;
+      }
+
+      ActivationStack* stack = &kh_value(stacks, it);
+      Accumulate(&result, ActivationStackPop(stack));
+
+      if (stack->count == 0) {
+        kh_del(ActivationStack, stacks, it);
+      }
+    }
+  }
+
+  BenchStop(&run, int64_t(trace.size()) * kRounds, &arena);
+  result.entries = kh_size(stacks);
+  kh_destroy(ActivationStack, stacks);
+  PagedArenaDestroy(&arena);
+  return result;
+}
+
+Result RunFlat(const Workload* workload, const char* name) {
+  const tinystl::vector<ActivationEvent>& trace = workload->events;
+  Result result = {0, 0};
+  PagedArena arena;
+  PagedArenaInit(&arena, kArenaPageSize);
+  ContextStacks stacks;
+  ContextStacksInit(&stacks);
+  BenchRun run;
+  BenchStart(&run, name);
+
+  for (int round = 0; round < kRounds; round++) {
+    ContextStacksClear(&stacks);
+    PagedArenaReset(&arena);
+    result.checksum = 0;
+
+    for (size_t i = 0; i < trace.size(); i++) {
+      const ActivationEvent& event = trace[i];
+
+      if (event.kind == ActivationEvent_Enter) {
+        ActivationStack* stack = ContextStacksFindOrInsert(&stacks, event.contextId);
+
+        if (!stack) {
+          continue;
+        }
+
+        SpanActivation* activation = ActivationStackPush(stack, &arena, &stacks.spills);
+
+        if (activation) {
+          activation->startTime = int64_t(i);
+        }
+
+        continue;
+      }
+
+      ActivationStack* stack = ContextStacksFind(&stacks, event.contextId);
+
+      if (!stack) {
+        continue;
+      }
+
+      Accumulate(&result, ActivationStackPop(stack));
+
+      if (stack->count == 0) {
+        ContextStacksErase(&stacks, stack);
+      }
+    }
+  }
+
+  BenchStop(&run, int64_t(trace.size()) * kRounds, &arena);
+  result.entries = stacks.size;
+  ContextStacksFree(&stacks);
+  PagedArenaDestroy(&arena);
+  return result;
+}
+
+} // namespace
+
+bool RunContextStacks(const Workload* workload) {
+  char khashName[96];
+  char flatName[96];
+  snprintf(khashName, sizeof(khashName), "context_stacks/khash:%s", workload->name);
+  snprintf(flatName, sizeof(flatName), "context_stacks/flat:%s", workload->name);
+
+  if (!BenchSelected(khashName) && !BenchSelected(flatName)) {
+    return true;
+  }
+
+  Result khash = RunKhash(workload, khashName);
+  Result flat = RunFlat(workload, flatName);
+
+  if (khash.checksum != flat.checksum || khash.entries != flat.entries) {
+    fprintf(stderr, "%s: mismatch between khash and context stack results\n", workload->name);
+    return false;
+  }
+
+  return true;
+}
+
+} // namespace Bench
@@ -0,0 +1,89 @@
+/**
+ * Microbenchmarks of the native profiler paths that don't depend on Node or
+ * V8, each printing the time per operation, heap allocations and peak memory.
+ *
+ * Build and run:
+ *   npx node-gyp rebuild -- -Dbuild_benchmarks=true
+ *   ./build/Release/native_bench [--trace FILE] [--interval-us N] [filter...]
+ *
+ * Without a trace, the replay suites run over synthetic workloads of a few
+ * concurrency levels. A trace of the context switches of a real service can be
+ * recorded with record_activations.js. Only the benchmarks whose name contains
+ * one of the filters run, e.g. `native_bench replay/ primitives/hex`.
+ *
+ * Exits with 1 if two implementations of the same lookup disagree.
+ */
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace Bench;
+
+namespace {
+
+const size_t kSyntheticEventCount = 4000000;
+const int64_t kSyntheticDuration = 30000LL * kMillisecond;
+
+int Usage(const char* program) {
+  fprintf(stderr, "usage: %s [--trace FILE] [--interval-us N] [filter...]\n", program);
+  return 2;
+}
+
+bool RunWorkload(const Workload* workload) {
+  bool ok = RunContextStacks(workload);
+  return RunReplay(workload) && ok;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const char* tracePath = nullptr;
+  int64_t samplingInterval = 10LL * kMillisecond;
+  tinystl::vector<const char*> filters;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+      tracePath = argv[++i];
+    } else if (strcmp(argv[i], "--interval-us") == 0 && i + 1 < argc) {
+      samplingInterval = strtoll(argv[++i], nullptr, 10) * 1000LL;
+
+      if (samplingInterval <= 0) {
+        return Usage(argv[0]);
+      }
+    } else if (argv[i][0] == '-') {
+      return Usage(argv[0]);
+    } else {
+      filters.push_back(argv[i]);
+    }
+  }
+
+  Workload trace;
+  if (tracePath && !LoadWorkload(&trace, tracePath)) {
+    fprintf(stderr, "unable to read %s\n", tracePath);
+    return 2;
+  }
+
+  BenchSetFilters(filters.empty() ? nullptr : &filters[0], int(filters.size()));
+  BenchPrintHeader();
+
+  bool ok = RunPrimitives();
+  ok = RunMatching() && ok;
+
+  if (tracePath) {
+    WorkloadSampleEvery(&trace, samplingInterval);
+    ok = RunWorkload(&trace) && ok;
+  } else {
+    const int32_t inFlightCounts[] = {16, 256, 4096, 65536};
+
+    for (int32_t inFlight : inFlightCounts) {
+      Workload workload;
+      GenerateWorkload(
+        &workload, kSyntheticEventCount, inFlight, kSyntheticDuration, 0x9e3779b97f4a7c15ULL);
+      WorkloadSampleEvery(&workload, samplingInterval);
+      ok = RunWorkload(&workload) && ok;
+    }
+  }
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,251 @@
+/**
+ * Building blocks of the profiler taken one at a time: id decoding, integer
+ * formatting, arena allocations, activation stacks and the sample aggregate
+ * map.
+ */
+#include "activations.h"
+#include "bench.h"
+#include "khash.h"
+#include "util/hex.h"
+#include "util/modp_numtoa.h"
+#include <stdio.h>
+#include <string.h>
+
+using namespace Splunk::Profiling;
+
+KHASH_MAP_INIT_INT64(BenchSampleAggregates, size_t);
+
+namespace Bench {
+
+namespace {
+
+const int64_t kIterations = 4000000;
+
+// Keeps the compiler from dropping results nothing reads.
+volatile uint64_t sink;
+
+bool BenchHexToBinary() {
+  static const char traceId[] = "0af7651916cd43dd8448eb211c80319c";
+  uint8_t buffer[kTraceIdSize];
+  uint64_t checksum = 0;
+  BenchRun run;
+  BenchStart(&run, "primitives/hex_to_binary");
+
+  for (int64_t i = 0; i < kIterations; i++) {
+    if (!HexToBinary(traceId, 32, buffer, sizeof(buffer))) {
+      return false;
+    }
+
+    checksum += buffer[i & 15];
+  }
+
+  BenchStop(&run, kIterations, nullptr);
+  sink = checksum;
+  return buffer[0] == 0x0a && buffer[15] == 0x9c;
+}
+
+bool BenchLitoa10() {
+  char buffer[24];
+  uint64_t checksum = 0;
+  BenchRun run;
+  BenchStart(&run, "primitives/modp_litoa10");
+
+  // Timestamps and durations, around the size pprof labels get.
+  for (int64_t i = 0; i < kIterations; i++) {
+    checksum += modp_litoa10(1700000000000000000LL + i * 7919, buffer);
+  }
+
+  BenchStop(&run, kIterations, nullptr);
+  sink = checksum;
+  return modp_litoa10(-1234567890123LL, buffer) == 14 && strcmp(buffer, "-1234567890123") == 0;
+}
+
+bool BenchArena() {
+  // A mix of activation bins, spill buffers and small nodes.
+  static const size_t kSizes[] = {sizeof(ActivationBin), 2 * sizeof(SpanActivation), 48, 16};
+  const int64_t kRounds = 8;
+  const int64_t allocationsPerRound = kIterations / kRounds;
+  PagedArena arena;
+  PagedArenaInit(&arena, kArenaPageSize);
+  BenchRun run;
+  BenchStart(&run, "primitives/paged_arena_alloc_reset");
+
+  for (int64_t round = 0; round < kRounds; round++) {
+    for (int64_t i = 0; i < allocationsPerRound; i++) {
+      void* memory = PagedArenaAlloc(&arena, kSizes[i & 3]);
+
+      if (!memory) {
+        PagedArenaDestroy(&arena);
+        return false;
+      }
+
+      sink = uintptr_t(memory);
+    }
+
+    PagedArenaReset(&arena);
+  }
+
+  BenchStop(&run, kRounds * allocationsPerRound, &arena);
+  PagedArenaDestroy(&arena);
+  return true;
+}
+
+// Address space of the pages the arena still links to, all of it has to be
+// accounted for in its stats.
+size_t ReachableReserved(const PagedArena* arena) {
+  size_t reserved = 0;
+
+  for (ArenaNode* node = arena->nodes; node; node = node->next) {
+    reserved += node->arena.capacity;
+  }
+
+  for (ArenaNode* node = arena->freeNodes; node; node = node->next) {
+    reserved += node->arena.capacity;
+  }
+
+  return reserved;
+}
+
+bool BenchArenaBurst() {
+  // Rotation resets the arena every window, a burst of activations spanning
+  // several pages is followed by quiet windows that only touch the first one.
+  const size_t kPageSize = 4ULL * 1024ULL * 1024ULL;
+  const size_t kBurstBytes = 4 * kPageSize;
+  const size_t kQuietBytes = 1024;
+  const size_t kAllocationSize = 256;
+  const int64_t kRounds = 64;
+  PagedArena arena;
+  PagedArenaInit(&arena, kPageSize);
+  int64_t allocations = 0;
+  bool ok = true;
+  BenchRun run;
+  BenchStart(&run, "primitives/paged_arena_burst_reset");
+
+  for (int64_t round = 0; round < kRounds && ok; round++) {
+    size_t bytes = round % 8 == 0 ? kBurstBytes : kQuietBytes;
+
+    for (size_t used = 0; used < bytes; used += kAllocationSize) {
+      void* memory = PagedArenaAllocUninitialized(&arena, kAllocationSize);
+
+      if (!memory) {
+        ok = false;
+        break;
+      }
+
+      sink = uintptr_t(memory);
+      allocations++;
+    }
+
+    PagedArenaReset(&arena);
+
+    PagedArenaStats stats;
+    PagedArenaGetStats(&arena, &stats);
+    ok = ok && stats.reserved == ReachableReserved(&arena);
+  }
+
+  BenchStop(&run, allocations, &arena);
+  PagedArenaDestroy(&arena);
+  return ok;
+}
+
+bool BenchActivationStack() {
+  PagedArena arena;
+  PagedArenaInit(&arena, kArenaPageSize);
+  ActivationSpillPool pool = {nullptr, 0};
+  ActivationStack stack;
+  ActivationStackInit(&stack);
+  uint64_t checksum = 0;
+  bool ok = true;
+  BenchRun run;
+  BenchStart(&run, "primitives/activation_stack_push_pop");
+
+  // Mostly within the inline activations, spilling every 16th round.
+  for (int64_t i = 0; i < kIterations; i++) {
+    int32_t depth = (i & 15) == 0 ? 6 : 1 + int32_t(i & 1);
+
+    for (int32_t d = 0; d < depth; d++) {
+      SpanActivation* activation = ActivationStackPush(&stack, &arena, &pool);
+
+      if (!activation) {
+        ok = false;
+        break;
+      }
+
+      activation->startTime = i + d;
+    }
+
+    for (int32_t d = 0; d < depth; d++) {
+      SpanActivation* activation = ActivationStackPop(&stack);
+      checksum += activation ? uint64_t(activation->startTime) : 0;
+    }
+  }
+
+  BenchStop(&run, kIterations, &arena);
+  sink = checksum;
+  ActivationSpillPoolClear(&pool);
+  PagedArenaDestroy(&arena);
+  return ok && stack.count == 0;
+}
+
+bool BenchSampleAggregates() {
+  // Distinct stacks a busy service samples within a collect interval.
+  const uint64_t kDistinctKeys = 4096;
+  khash_t(BenchSampleAggregates)* aggregates = kh_init(BenchSampleAggregates);
+  uint64_t rng = 0x9e3779b97f4a7c15ULL;
+  size_t next = 0;
+  BenchRun run;
+  BenchStart(&run, "primitives/khash_sample_aggregates");
+
+  for (int64_t i = 0; i < kIterations; i++) {
+    uint64_t key = (NextRandom(&rng) % kDistinctKeys) * 0x9E3779B97F4A7C15ULL;
+    int ret;
+    khiter_t it = kh_put(BenchSampleAggregates, aggregates, key, &ret);
+
+    if (ret == -1) {
+      kh_destroy(BenchSampleAggregates, aggregates);
+      return false;
+    }
+
+    if (ret != 0) {
+      kh_value(aggregates, it) = next++;
+    }
+  }
+
+  BenchStop(&run, kIterations, nullptr);
+  bool ok = kh_size(aggregates) == next && next <= kDistinctKeys;
+  kh_destroy(BenchSampleAggregates, aggregates);
+  return ok;
+}
+
+} // namespace
+
+bool RunPrimitives() {
+  typedef bool (*Benchmark)();
+  static const struct {
+    const char* name;
+    Benchmark run;
+  } benchmarks[] = {
+    {"primitives/hex_to_binary", BenchHexToBinary},
+    {"primitives/modp_litoa10", BenchLitoa10},
+    {"primitives/paged_arena_alloc_reset", BenchArena},
+    {"primitives/paged_arena_burst_reset", BenchArenaBurst},
+    {"primitives/activation_stack_push_pop", BenchActivationStack},
+    {"primitives/khash_sample_aggregates", BenchSampleAggregates},
+  };
+  bool ok = true;
+
+  for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++) {
+    if (!BenchSelected(benchmarks[i].name)) {
+      continue;
+    }
+
+    if (!benchmarks[i].run()) {
+      fprintf(stderr, "%s: unexpected result\n", benchmarks[i].name);
+      ok = false;
+    }
+  }
+
+  return ok;
+}
+
+} // namespace Bench
@@ -0,0 +1,67 @@
+/*
+ * Copyright Splunk Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Records the context enters and exits of a service with the profiler
+// running, for native_bench to replay. Every event written to the activation
+// ring is also appended to the file, in the same 40 byte layout.
+//
+//   npm run compile
+//   export SPLUNK_PROFILER_ENABLED=true
+//   SPLUNK_BENCH_ACTIVATIONS=/tmp/activations.bin \
+//     node -r ./bench/native/record_activations.js -r ./instrument.js app.js
+//   ./build/Release/native_bench --trace /tmp/activations.bin replay/
+
+const fs = require('fs');
+const { ActivationRing } = require('../../lib/profiling/ActivationRing');
+
+const EVENT_SIZE = 40;
+const BUFFERED_EVENTS = 4096;
+
+const path = process.env.SPLUNK_BENCH_ACTIVATIONS;
+
+if (!path) {
+  throw new Error('SPLUNK_BENCH_ACTIVATIONS has to name the file to record to');
+}
+
+const fd = fs.openSync(path, 'w');
+const buffer = Buffer.alloc(EVENT_SIZE * BUFFERED_EVENTS);
+let buffered = 0;
+
+function flush() {
+  if (buffered > 0) {
+    fs.writeSync(fd, buffer, 0, buffered * EVENT_SIZE);
+    buffered = 0;
+  }
+}
+
+const commit = ActivationRing.prototype._commit;
+
+ActivationRing.prototype._commit = function (offset, contextId, kind) {
+  commit.call(this, offset, contextId, kind);
+
+  // A drain only resets the count, the event is still in place.
+  const event = this._bytes.subarray(offset, offset + EVENT_SIZE);
+  buffer.set(event, buffered * EVENT_SIZE);
+
+  if (++buffered === BUFFERED_EVENTS) {
+    flush();
+  }
+};
+
+process.on('exit', () => {
+  flush();
+  fs.closeSync(fd);
+});
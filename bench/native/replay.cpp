@@ -0,0 +1,231 @@
+/**
+ * Replays a workload the way the profiler handles it between two collects:
+ * context enters and exits go through the context stacks, closed activations
+ * are coalesced and inserted into the bins, then the samples are matched
+ * against them and aggregated by stack and span.
+ */
+#include "activations.h"
+#include "bench.h"
+#include "context_stacks.h"
+#include "khash.h"
+#include "xxhash/xxh3.h"
+#include <stdio.h>
+#include <string.h>
+
+using namespace Splunk::Profiling;
+
+KHASH_MAP_INIT_INT64(BenchReplayAggregates, size_t);
+
+namespace Bench {
+
+namespace {
+
+// Distinct stacks the samples are spread over.
+const uint32_t kStackCount = 512;
+
+struct Replay {
+  PagedArena arena;
+  ContextStacks stacks;
+  ActivationBins bins;
+  int64_t samplingInterval;
+  int64_t dropped;
+  int64_t merged;
+};
+
+void ReplayEnter(Replay* replay, const ActivationEvent* event) {
+  ActivationStack* stack = ContextStacksFindOrInsert(&replay->stacks, event->contextId);
+
+  if (!stack) {
+    replay->dropped++;
+    return;
+  }
+
+  SpanActivation* activation = ActivationStackPush(stack, &replay->arena, &replay->stacks.spills);
+
+  if (!activation) {
+    replay->dropped++;
+    return;
+  }
+
+  memcpy(activation->traceId, event->traceId, kTraceIdSize);
+  memcpy(activation->spanId, event->spanId, kSpanIdSize);
+  activation->startTime = event->timestamp;
+}
+
+void ReplayExit(Replay* replay, const ActivationEvent* event) {
+  ActivationStack* stack = ContextStacksFind(&replay->stacks, event->contextId);
+
+  if (!stack) {
+    return;
+  }
+
+  SpanActivation* activation = ActivationStackPop(stack);
+
+  if (!activation) {
+    return;
+  }
+
+  activation->endTime = event->timestamp;
+
+  if (!stack->hasLastClosed) {
+    stack->lastClosed = *activation;
+    stack->hasLastClosed = true;
+  } else if (ActivationsCoalesce(&stack->lastClosed, activation, replay->samplingInterval)) {
+    replay->merged++;
+  } else {
+    InsertActivation(&replay->bins, &stack->lastClosed);
+    stack->lastClosed = *activation;
+  }
+}
+
+// Same as collecting a profile, see ProfilingFlushClosedActivations.
+void ReplayFlush(Replay* replay) {
+  ContextStacks* stacks = &replay->stacks;
+
+  for (size_t i = stacks->size; i-- > 0;) {
+    ActivationStack* stack = ContextStacksAt(stacks, i, nullptr);
+
+    if (stack->hasLastClosed) {
+      InsertActivation(&replay->bins, &stack->lastClosed);
+      stack->hasLastClosed = false;
+    }
+
+    if (stack->count == 0) {
+      ContextStacksErase(stacks, stack);
+    }
+  }
+}
+
+uint64_t SpanHash(const SpanActivation* activation) {
+  return XXH3_64bits_withSeed(
+    activation->spanId, sizeof(activation->spanId),
+    XXH3_64bits(activation->traceId, sizeof(activation->traceId)));
+}
+
+uint32_t SampleStack(size_t sampleIndex) {
+  return uint32_t((sampleIndex * 0x9E3779B1U) >> 7) % kStackCount;
+}
+
+} // namespace
+
+bool RunReplay(const Workload* workload) {
+  char names[4][96];
+  snprintf(names[0], sizeof(names[0]), "replay/enter_exit:%s", workload->name);
+  snprintf(names[1], sizeof(names[1]), "replay/find_closest:%s", workload->name);
+  snprintf(names[2], sizeof(names[2]), "replay/matcher:%s", workload->name);
+  snprintf(names[3], sizeof(names[3]), "replay/aggregate:%s", workload->name);
+
+  if (!BenchSelected(names[0]) && !BenchSelected(names[1]) && !BenchSelected(names[2]) &&
+      !BenchSelected(names[3])) {
+    return true;
+  }
+
+  const tinystl::vector<ActivationEvent>& events = workload->events;
+  const tinystl::vector<int64_t>& samples = workload->samples;
+
+  if (events.empty()) {
+    return true;
+  }
+
+  Replay replay;
+  PagedArenaInit(&replay.arena, kArenaPageSize);
+  ContextStacksInit(&replay.stacks);
+  ActivationBinsInit(&replay.bins, &replay.arena);
+  ActivationBinsReset(
+    &replay.bins, events[0].timestamp, ActivationBinWidth(workload->samplingInterval));
+  replay.samplingInterval = workload->samplingInterval;
+  replay.dropped = 0;
+  replay.merged = 0;
+
+  BenchRun run;
+  BenchStart(&run, names[0]);
+
+  for (size_t i = 0; i < events.size(); i++) {
+    const ActivationEvent* event = &events[i];
+
+    if (event->kind == ActivationEvent_Enter) {
+      ReplayEnter(&replay, event);
+    } else {
+      ReplayExit(&replay, event);
+    }
+  }
+
+  ReplayFlush(&replay);
+  BenchStop(&run, int64_t(events.size()), &replay.arena);
+
+  uint64_t lookupChecksum = 0;
+  int64_t lookupMatched = 0;
+  BenchStart(&run, names[1]);
+
+  for (size_t i = 0; i < samples.size(); i++) {
+    const SpanActivation* match = FindClosestActivation(&replay.bins, samples[i]);
+
+    if (match) {
+      lookupMatched++;
+      lookupChecksum = lookupChecksum * 31 + uint64_t(match->startTime);
+    }
+  }
+
+  BenchStop(&run, int64_t(samples.size()), nullptr);
+
+  tinystl::vector<SpanActivation*> matches;
+  matches.resize(samples.size());
+  uint64_t sweepChecksum = 0;
+  int64_t sweepMatched = 0;
+  BenchStart(&run, names[2]);
+
+  {
+    ActivationMatcher matcher;
+    ActivationMatcherInit(&matcher, &replay.bins, int64_t(samples.size()));
+
+    for (size_t i = 0; i < samples.size(); i++) {
+      SpanActivation* match = ActivationMatcherFind(&matcher, samples[i]);
+      matches[i] = match;
+
+      if (match) {
+        sweepMatched++;
+        sweepChecksum = sweepChecksum * 31 + uint64_t(match->startTime);
+      }
+    }
+  }
+
+  BenchStop(&run, int64_t(samples.size()), nullptr);
+
+  khash_t(BenchReplayAggregates)* aggregates = kh_init(BenchReplayAggregates);
+  size_t aggregateCount = 0;
+  bool ok = true;
+  BenchStart(&run, names[3]);
+
+  for (size_t i = 0; i < samples.size(); i++) {
+    uint32_t nodeId = SampleStack(i);
+    uint64_t key =
+      XXH3_64bits_withSeed(&nodeId, sizeof(nodeId), matches[i] ? SpanHash(matches[i]) : 0);
+
+    int ret;
+    khiter_t it = kh_put(BenchReplayAggregates, aggregates, key, &ret);
+
+    if (ret == -1) {
+      ok = false;
+      break;
+    }
+
+    if (ret != 0) {
+      kh_value(aggregates, it) = aggregateCount++;
+    }
+  }
+
+  BenchStop(&run, int64_t(samples.size()), nullptr);
+  kh_destroy(BenchReplayAggregates, aggregates);
+
+  if (lookupMatched != sweepMatched || lookupChecksum != sweepChecksum) {
+    fprintf(stderr, "%s: mismatch between bin lookup and sweep results\n", workload->name);
+    ok = false;
+  }
+
+  ActivationBinsFree(&replay.bins);
+  ContextStacksFree(&replay.stacks);
+  PagedArenaDestroy(&replay.arena);
+  return ok;
+}
+
+} // namespace Bench
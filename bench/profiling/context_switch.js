@@ -0,0 +1,133 @@
+/*
+ * Copyright Splunk Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Per-call cost of recording a context enter/exit pair: calling the extension
+// with the context identified by an object (identity hash, regular callback)
+// or by an integer id (V8 fast API call once optimized), and appending to the
+// shared activation ring without calling into the extension.
+//
+// The integer id cases are given ready-made ids. ProfilingContextManager looks
+// the id of each context up in a WeakMap instead, and assigns one to every new
+// context. The "weakmap" cases include that, with a fresh context object per
+// enter/exit pair the way context.with() creates them.
+//
+//   npm run compile && node bench/profiling/context_switch.js
+//
+// To compare against the regular callbacks only:
+//
+//   node --no-turbo-fast-api-calls bench/profiling/context_switch.js
+
+const path = require('path');
+const { profiling } = require('node-gyp-build')(path.join(__dirname, '../..'));
+const { ActivationRing } = require('../../lib/profiling/ActivationRing');
+
+const ITERATIONS = 2_000_000;
+const ROUNDS = 5;
+
+const traceId = '0af7651916cd43dd8448eb211c80319c';
+const spanId = 'b7ad6b7169203331';
+
+function runObjects(contexts) {
+  const start = process.hrtime.bigint();
+
+  for (let i = 0; i < ITERATIONS; i++) {
+    const context = contexts[i & 1023];
+    profiling.enterContext(context, traceId, spanId);
+    profiling.exitContext(context);
+  }
+
+  return process.hrtime.bigint() - start;
+}
+
+function runIds() {
+  const start = process.hrtime.bigint();
+
+  for (let i = 0; i < ITERATIONS; i++) {
+    const id = i & 1023;
+    profiling.enterContext(id, traceId, spanId);
+    profiling.exitContext(id);
+  }
+
+  return process.hrtime.bigint() - start;
+}
+
+function runRing(ring) {
+  const start = process.hrtime.bigint();
+
+  for (let i = 0; i < ITERATIONS; i++) {
+    const id = i & 1023;
+    ring.enterContext(id, traceId, spanId);
+    ring.exitContext(id);
+  }
+
+  return process.hrtime.bigint() - start;
+}
+
+// Same as ProfilingContextManager's _enterContextOverride/_exitContextOverride.
+function runWeakMap(recorder) {
+  const contextIds = new WeakMap();
+  let nextContextId = 0;
+  const start = process.hrtime.bigint();
+
+  for (let i = 0; i < ITERATIONS; i++) {
+    const context = {};
+    let id = contextIds.get(context);
+
+    if (id === undefined) {
+      id = nextContextId;
+      nextContextId = (nextContextId + 1) | 0;
+      contextIds.set(context, id);
+    }
+
+    recorder.enterContext(id, traceId, spanId);
+
+    const exitId = contextIds.get(context);
+
+    if (exitId !== undefined) {
+      recorder.exitContext(exitId);
+    }
+  }
+
+  return process.hrtime.bigint() - start;
+}
+
+function report(name, run) {
+  let best = Infinity;
+
+  for (let i = 0; i < ROUNDS; i++) {
+    best = Math.min(best, Number(run()));
+  }
+
+  const perCall = best / ITERATIONS / 2;
+  console.log(`${name.padEnd(16)} ${perCall.toFixed(1).padStart(8)} ns/call`);
+}
+
+const handle = profiling.getOrCreateCpuProfiler({
+  name: 'context-switch-bench',
+  samplingIntervalMicroseconds: 10_000,
+});
+profiling.startCpuProfiler(handle);
+
+const contexts = Array.from({ length: 1024 }, () => ({}));
+const ring = new ActivationRing(profiling);
+
+report('object context', () => runObjects(contexts));
+report('integer id', runIds);
+report('activation ring', () => runRing(ring));
+report('weakmap id', () => runWeakMap(profiling));
+report('weakmap ring', () => runWeakMap(ring));
+
+profiling.stop(handle);
@@ -1,4 +1,7 @@
 {
+  "variables": {
+    "build_benchmarks%": "false"
+  },
   "targets": [{
     "target_name": "metrics",
     "variables": {
@@ -7,9 +10,15 @@
     "sources": [
       "src/native_ext/util/arena.cpp",
       "src/native_ext/util/hex.cpp",
+      "src/native_ext/util/protobuf.cpp",
+      "src/native_ext/activations.cpp",
+      "src/native_ext/context_stacks.cpp",
+      "src/native_ext/frame_rules.cpp",
+      "src/native_ext/frames.cpp",
       "src/native_ext/module.cpp",
       "src/native_ext/metrics.cpp",
       "src/native_ext/memory_profiling.cpp",
+      "src/native_ext/pprof.cpp",
       "src/native_ext/profiling.cpp",
       "src/native_ext/util/modp_numtoa.cpp",
       "src/native_ext/util/platform.cpp",
@@ -59,5 +68,47 @@
         },
       }],
     ]
-  }]
+  }],
+  "conditions": [
+    ["build_benchmarks == 'true'", {
+      "targets": [{
+        "target_name": "native_bench",
+        "type": "executable",
+        "sources": [
+          "bench/native/activations.cpp",
+          "bench/native/alloc_hooks.cpp",
+          "bench/native/bench.cpp",
+          "bench/native/context_stacks.cpp",
+          "bench/native/main.cpp",
+          "bench/native/primitives.cpp",
+          "bench/native/replay.cpp",
+          "src/native_ext/activations.cpp",
+          "src/native_ext/context_stacks.cpp",
+          "src/native_ext/util/arena.cpp",
+          "src/native_ext/util/hex.cpp",
+          "src/native_ext/util/modp_numtoa.cpp",
+          "src/native_ext/xxhash/xxhash.cpp"
+        ],
+        "include_dirs": [
+          "src/native_ext"
+        ],
+        "conditions": [
+          ["OS == 'linux'", {
+            "cflags": [
+              "-std=c++11",
+              "-O2"
+            ]
+          }],
+          ["OS == 'mac'", {
+            "xcode_settings": {
+              "OTHER_CFLAGS": [
+                "-std=c++20",
+                "-stdlib=libc++"
+              ]
+            }
+          }]
+        ]
+      }]
+    }]
+  ]
 }
@@ -14,23 +14,30 @@
  * limitations under the License.
  */
 
-import { Histogram, metrics, Meter } from '@opentelemetry/api';
+import { Counter, Histogram, metrics, Meter } from '@opentelemetry/api';
 import { ViewOptions, AggregationType } from '@opentelemetry/sdk-metrics';
+import type { ProfilingStats, PseudoFrameTicks } from '../profiling/types';
 
 interface Meters {
   meter: Meter;
   cpuProfilerStartDuration: Histogram;
   cpuProfilerStopDuration: Histogram;
   cpuProfilerProcessingStepDuration: Histogram;
+  cpuProfilerSampleGap: Histogram;
+  cpuProfilerPseudoFrames: Counter;
   heapProfilerCollectDuration: Histogram;
   heapProfilerProcessingStepDuration: Histogram;
 }
 
 let meters: Meters | undefined;
+// Set once the profiler is started, polled whenever the metrics are read.
+let profilingStats: (() => ProfilingStats) | undefined;
 
 const instrumentCpuProfilerStart = 'splunk.profiler.cpu.start.duration';
 const instrumentCpuProfilerStop = 'splunk.profiler.cpu.stop.duration';
 const instrumentCpuProfilerProcess = 'splunk.profiler.cpu.process.duration';
+const instrumentCpuProfilerSampleGap = 'splunk.profiler.cpu.sample.gap';
+const instrumentCpuProfilerPseudoFrames = 'splunk.profiler.cpu.pseudo_frames';
 const instrumentHeapProfilerCollect = 'splunk.profiler.heap.collect.duration';
 const instrumentHeapProfilerProcess = 'splunk.profiler.heap.process.duration';
 
@@ -49,6 +56,15 @@ export function enableDebugMetrics() {
     instrumentCpuProfilerProcess,
     opts
   );
+  const cpuProfilerSampleGap = meter.createHistogram(
+    instrumentCpuProfilerSampleGap,
+    opts
+  );
+  // Samples of (idle), (program) and (garbage collector), which are counted
+  // instead of exported.
+  const cpuProfilerPseudoFrames = meter.createCounter(
+    instrumentCpuProfilerPseudoFrames
+  );
   const heapProfilerCollectDuration = meter.createHistogram(
     instrumentHeapProfilerCollect,
     opts
@@ -58,20 +74,124 @@ export function enableDebugMetrics() {
     opts
   );
 
+  observeProfilingStats(meter);
+
   meters = {
     meter,
     cpuProfilerStartDuration,
     cpuProfilerStopDuration,
     cpuProfilerProcessingStepDuration,
+    cpuProfilerSampleGap,
+    cpuProfilerPseudoFrames,
     heapProfilerCollectDuration,
     heapProfilerProcessingStepDuration,
   };
 }
 
+export function setProfilingStatsSource(
+  source: (() => ProfilingStats) | undefined
+) {
+  profilingStats = source;
+}
+
+function observeProfilingStats(meter: Meter) {
+  const contextSwitches = meter.createObservableCounter(
+    'splunk.profiler.context.switches'
+  );
+  // Extrapolated from the timed calls.
+  const contextSwitchTime = meter.createObservableCounter(
+    'splunk.profiler.context.switch.time',
+    { unit: 'ns' }
+  );
+  const activations = meter.createObservableCounter(
+    'splunk.profiler.activations'
+  );
+  const overflowBins = meter.createObservableCounter(
+    'splunk.profiler.activation.overflow_bins'
+  );
+  const ringOverflows = meter.createObservableCounter(
+    'splunk.profiler.activation_ring.overflows'
+  );
+  const samplesDiscarded = meter.createObservableCounter(
+    'splunk.profiler.samples.discarded'
+  );
+  const samplesDropped = meter.createObservableCounter(
+    'splunk.profiler.samples.dropped'
+  );
+  const arenaMemory = meter.createObservableGauge(
+    'splunk.profiler.arena.memory',
+    { unit: 'By' }
+  );
+  const contextStacks = meter.createObservableGauge(
+    'splunk.profiler.context_stacks'
+  );
+  const traceIdFilters = meter.createObservableGauge(
+    'splunk.profiler.trace_id_filters'
+  );
+
+  // A single stats() call for all of them.
+  meter.addBatchObservableCallback(
+    (result) => {
+      if (profilingStats === undefined) {
+        return;
+      }
+
+      const stats = profilingStats();
+      const switches = {
+        enter: stats.enterContext,
+        exit: stats.exitContext,
+      };
+
+      for (const [kind, timings] of Object.entries(switches)) {
+        result.observe(contextSwitches, timings.calls, { kind });
+        result.observe(
+          contextSwitchTime,
+          timings.timedNanos * stats.timedCallInterval,
+          { kind }
+        );
+      }
+
+      result.observe(activations, stats.activationsRecorded, {
+        state: 'recorded',
+      });
+      result.observe(activations, stats.activationsDropped, {
+        state: 'dropped',
+      });
+      result.observe(overflowBins, stats.overflowBins);
+      result.observe(ringOverflows, stats.activationRingOverflows);
+      result.observe(samplesDiscarded, stats.samplesDiscarded);
+      result.observe(samplesDropped, stats.samplesDropped);
+      result.observe(arenaMemory, stats.arenaUsedBytes, { state: 'used' });
+      result.observe(arenaMemory, stats.arenaCommittedBytes, {
+        state: 'committed',
+      });
+      result.observe(arenaMemory, stats.arenaReservedBytes, {
+        state: 'reserved',
+      });
+      result.observe(contextStacks, stats.contextStacks);
+      result.observe(traceIdFilters, stats.traceIdFilters);
+    },
+    [
+      contextSwitches,
+      contextSwitchTime,
+      activations,
+      overflowBins,
+      ringOverflows,
+      samplesDiscarded,
+      samplesDropped,
+      arenaMemory,
+      contextStacks,
+      traceIdFilters,
+    ]
+  );
+}
+
 export function recordCpuProfilerMetrics(metrics: {
   profilerStartDuration: number;
   profilerStopDuration: number;
   profilerProcessingStepDuration: number;
+  profilerSampleGap: number;
+  pseudoFrameTicks?: PseudoFrameTicks;
 }) {
   if (meters === undefined) {
     return;
@@ -82,6 +202,15 @@ export function recordCpuProfilerMetrics(metrics: {
   meters.cpuProfilerProcessingStepDuration.record(
     metrics.profilerProcessingStepDuration
   );
+  meters.cpuProfilerSampleGap.record(metrics.profilerSampleGap);
+
+  const ticks = metrics.pseudoFrameTicks;
+  if (ticks !== undefined) {
+    const pseudoFrames = meters.cpuProfilerPseudoFrames;
+    pseudoFrames.add(ticks.idle, { category: 'idle' });
+    pseudoFrames.add(ticks.program, { category: 'program' });
+    pseudoFrames.add(ticks.gc, { category: 'gc' });
+  }
 }
 
 export function recordHeapProfilerMetrics(metrics: {
@@ -103,6 +232,7 @@ export function getDebugMetricsViews(): ViewOptions[] {
     instrumentCpuProfilerStart,
     instrumentCpuProfilerStop,
     instrumentCpuProfilerProcess,
+    instrumentCpuProfilerSampleGap,
   ].map((instrumentName) => ({
     instrumentName,
     aggregation: {
@@ -0,0 +1,622 @@
+#include "activations.h"
+#include "util/reservoir.h"
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+
+namespace Splunk {
+namespace Profiling {
+
+void ActivationStackInit(ActivationStack* stack) {
+  // Runs for every new context, activations are only read after being pushed.
+  stack->count = 0;
+  stack->capacity = ActivationStack::kMaxActivations;
+  stack->extra = nullptr;
+  stack->hasLastClosed = false;
+}
+
+namespace {
+
+// Takes the first pooled buffer holding at least capacity activations, the
+// capacity actually available is stored back.
+SpanActivation* AllocSpill(PagedArena* arena, ActivationSpillPool* pool, int32_t* capacity) {
+  if (pool) {
+    for (ActivationSpill** it = &pool->head; *it; it = &(*it)->next) {
+      ActivationSpill* spill = *it;
+
+      if (spill->capacity >= *capacity) {
+        *it = spill->next;
+        *capacity = spill->capacity;
+        pool->bytes -= sizeof(SpanActivation) * spill->capacity;
+        return (SpanActivation*)spill;
+      }
+    }
+  }
+
+  // Entries are only read after being pushed.
+  return (SpanActivation*)PagedArenaAllocUninitialized(
+    arena, sizeof(SpanActivation) * *capacity);
+}
+
+void FreeSpill(ActivationSpillPool* pool, SpanActivation* buffer, int32_t capacity) {
+  if (!pool) {
+    return;
+  }
+
+  static_assert(
+    sizeof(ActivationSpill) <= sizeof(SpanActivation), "spill buffers too small to pool");
+  ActivationSpill* spill = (ActivationSpill*)buffer;
+  spill->next = pool->head;
+  spill->capacity = capacity;
+  pool->head = spill;
+  pool->bytes += sizeof(SpanActivation) * capacity;
+}
+
+} // namespace
+
+SpanActivation* ActivationStackPush(
+  ActivationStack* stack, PagedArena* arena, ActivationSpillPool* pool) {
+  if (!stack->extra) {
+    if (stack->count < ActivationStack::kMaxActivations) {
+      return &stack->activations[stack->count++];
+    }
+
+    int32_t newCapacity = ActivationStack::kMaxActivations * 4;
+    stack->extra = AllocSpill(arena, pool, &newCapacity);
+
+    if (!stack->extra) {
+      return nullptr;
+    }
+
+    for (int32_t i = 0; i < stack->count; i++) {
+      stack->extra[i] = stack->activations[i];
+    }
+
+    stack->capacity = newCapacity;
+  }
+
+  if (stack->count < stack->capacity) {
+    return &stack->extra[stack->count++];
+  }
+
+  int32_t newCapacity = stack->capacity * 1.5;
+  SpanActivation* extra = AllocSpill(arena, pool, &newCapacity);
+
+  if (!extra) {
+    return nullptr;
+  }
+
+  for (int32_t i = 0; i < stack->count; i++) {
+    extra[i] = stack->extra[i];
+  }
+
+  FreeSpill(pool, stack->extra, stack->capacity);
+  stack->extra = extra;
+  stack->capacity = newCapacity;
+
+  return &stack->extra[stack->count++];
+}
+
+void ActivationStackRelease(ActivationStack* stack, ActivationSpillPool* pool) {
+  if (stack->extra) {
+    FreeSpill(pool, stack->extra, stack->capacity);
+  }
+
+  ActivationStackInit(stack);
+}
+
+void ActivationSpillPoolClear(ActivationSpillPool* pool) {
+  pool->head = nullptr;
+  pool->bytes = 0;
+}
+
+SpanActivation* ActivationStackPop(ActivationStack* stack) {
+  if (stack->count == 0) {
+    return nullptr;
+  }
+
+  int32_t index = stack->count - 1;
+  stack->count--;
+
+  if (!stack->extra) {
+    return &stack->activations[index];
+  }
+
+  return &stack->extra[index];
+}
+
+bool ActivationsCoalesce(SpanActivation* last, const SpanActivation* next, int64_t maxGap) {
+  if (
+    memcmp(last->spanId, next->spanId, kSpanIdSize) != 0 ||
+    memcmp(last->traceId, next->traceId, kTraceIdSize) != 0) {
+    return false;
+  }
+
+  // Either one may have started first when nested.
+  if (next->startTime - last->endTime >= maxGap || last->startTime - next->endTime >= maxGap) {
+    return false;
+  }
+
+  if (next->startTime < last->startTime) {
+    last->startTime = next->startTime;
+  }
+
+  if (next->endTime > last->endTime) {
+    last->endTime = next->endTime;
+  }
+
+  return true;
+}
+
+namespace {
+
+ActivationSlot* ActivationBinsGetOrCreate(ActivationBins* bins, int64_t binIndex) {
+  int64_t page = binIndex / kActivationSlotsPerPage;
+
+  if (page >= bins->pageCount) {
+    int64_t pageCount = bins->pageCount < 16 ? 16 : bins->pageCount;
+    while (pageCount <= page) {
+      pageCount *= 2;
+    }
+
+    ActivationSlot** pages =
+      (ActivationSlot**)realloc(bins->pages, sizeof(ActivationSlot*) * pageCount);
+
+    if (!pages) {
+      return nullptr;
+    }
+
+    memset(&pages[bins->pageCount], 0, sizeof(ActivationSlot*) * (pageCount - bins->pageCount));
+    bins->pages = pages;
+    bins->pageCount = pageCount;
+  }
+
+  if (!bins->pages[page]) {
+    bins->pages[page] =
+      (ActivationSlot*)PagedArenaAlloc(bins->arena, sizeof(ActivationSlot) * kActivationSlotsPerPage);
+
+    if (!bins->pages[page]) {
+      return nullptr;
+    }
+  }
+
+  return &bins->pages[page][binIndex % kActivationSlotsPerPage];
+}
+
+// Makes sure the slot's last bin has room for one more activation.
+bool SlotReserve(ActivationBins* bins, ActivationSlot* slot) {
+  ActivationBin* bin = slot->tail;
+
+  if (bin && bin->count < kActivationsPerBin) {
+    return true;
+  }
+
+  ActivationBin* newBin = (ActivationBin*)PagedArenaAlloc(bins->arena, sizeof(ActivationBin));
+
+  if (!newBin) {
+    return false;
+  }
+
+  if (bin) {
+    bin->next = newBin;
+    bins->stats.overflowBins++;
+  } else {
+    slot->head = newBin;
+  }
+
+  slot->tail = newBin;
+  return true;
+}
+
+bool SlotInsertActivation(
+  ActivationBins* bins, ActivationSlot* slot, const SpanActivation* activation) {
+  if (!SlotReserve(bins, slot)) {
+    return false;
+  }
+
+  ActivationBin* bin = slot->tail;
+  bin->activations[bin->count++] = *activation;
+  return true;
+}
+
+bool ReservoirInsertActivation(ActivationBins* bins, const SpanActivation* activation) {
+  ActivationReservoir* reservoir = &bins->reservoir;
+
+  if (reservoir->capacity == 0) {
+    bins->stats.dropped++;
+    return false;
+  }
+
+  int64_t index = ReservoirIndex(++reservoir->offered, reservoir->capacity, &reservoir->random);
+
+  if (index < 0) {
+    bins->stats.dropped++;
+    return false;
+  }
+
+  if (index == reservoir->count) {
+    reservoir->count++;
+  } else {
+    // Takes the place of one kept earlier.
+    bins->stats.dropped++;
+  }
+
+  reservoir->activations[index] = *activation;
+  bins->stats.inserted++;
+  return true;
+}
+
+// By start time, for equal starts the outer (later ending) activation first,
+// so that the innermost one ends up on top of the matcher's stack.
+int CompareActivations(const void* a, const void* b) {
+  const SpanActivation* lhs = *(const SpanActivation* const*)a;
+  const SpanActivation* rhs = *(const SpanActivation* const*)b;
+
+  if (lhs->startTime != rhs->startTime) {
+    return lhs->startTime < rhs->startTime ? -1 : 1;
+  }
+
+  if (lhs->endTime != rhs->endTime) {
+    return lhs->endTime > rhs->endTime ? -1 : 1;
+  }
+
+  return 0;
+}
+
+bool ActivationLess(const SpanActivation* lhs, const SpanActivation* rhs) {
+  if (lhs->startTime != rhs->startTime) {
+    return lhs->startTime < rhs->startTime;
+  }
+
+  return lhs->endTime > rhs->endTime;
+}
+
+void SortActivations(SpanActivation** activations, size_t count) {
+  std::sort(activations, activations + count, ActivationLess);
+}
+
+// Short activations are copied into every slot they overlap, only the copy in
+// the slot they started in is taken. The others started before the slot did.
+// Pass -1 to take all of them.
+void MatcherAddSlot(
+  ActivationMatcher* matcher, const ActivationBins* bins, const ActivationSlot* slot,
+  int64_t binIndex) {
+  int64_t slotStart = binIndex > 0 ? bins->startTime + binIndex * bins->binWidth : INT64_MIN;
+
+  for (ActivationBin* bin = slot->head; bin; bin = bin->next) {
+    for (int64_t i = 0; i < bin->count; i++) {
+      SpanActivation* activation = &bin->activations[i];
+
+      if (activation->startTime >= slotStart) {
+        matcher->activations.push_back(activation);
+      }
+    }
+  }
+}
+
+// A lookup goes through the activations in the slot of its timestamp, the long
+// ones and the reservoir. The sweep goes through all of them once, but takes
+// about ten times as long per activation to collect and sort it.
+bool MatcherPrefersLookups(const ActivationBins* bins, int64_t sampleCount) {
+  const int64_t kLookupCost = 8;
+  const int64_t kSweepCost = 10;
+
+  if (bins->usedSlots == 0) {
+    return false;
+  }
+
+  int64_t perLookup =
+    kLookupCost + bins->slotCopies / bins->usedSlots + bins->longCount + bins->reservoir.count;
+  return sampleCount * perLookup < bins->slotCopies * kSweepCost;
+}
+
+} // namespace
+
+int64_t ActivationBinWidth(int64_t samplingIntervalNanos) {
+  // A handful of samples per slot, so that each lookup only has to consider the
+  // activations around the sample, but no finer than needed to keep the slot
+  // table small for long windows and slow sampling.
+  const int64_t kMinBinWidth = 10LL * 1000000LL;
+  const int64_t kMaxBinWidth = 1000LL * 1000000LL;
+  int64_t width = samplingIntervalNanos * 8;
+
+  if (width < kMinBinWidth) {
+    return kMinBinWidth;
+  }
+
+  if (width > kMaxBinWidth) {
+    return kMaxBinWidth;
+  }
+
+  return width;
+}
+
+void ActivationBinsInit(ActivationBins* bins, PagedArena* arena) {
+  memset(bins, 0, sizeof(ActivationBins));
+  bins->arena = arena;
+  bins->binWidth = ActivationBinWidth(0);
+  bins->reservoir.random = 0x9e3779b97f4a7c15ULL;
+}
+
+void ActivationBinsFree(ActivationBins* bins) {
+  free(bins->pages);
+  bins->pages = nullptr;
+  bins->pageCount = 0;
+  free(bins->reservoir.activations);
+  bins->reservoir.activations = nullptr;
+  bins->reservoir.capacity = 0;
+  bins->reservoir.count = 0;
+}
+
+bool ActivationBinsSetReservoir(ActivationBins* bins, int64_t capacity) {
+  ActivationReservoir* reservoir = &bins->reservoir;
+
+  if (capacity == reservoir->capacity) {
+    return true;
+  }
+
+  if (capacity == 0) {
+    free(reservoir->activations);
+    reservoir->activations = nullptr;
+  } else {
+    SpanActivation* activations = (SpanActivation*)realloc(
+      reservoir->activations, sizeof(SpanActivation) * capacity);
+
+    if (!activations) {
+      return false;
+    }
+
+    reservoir->activations = activations;
+  }
+
+  if (reservoir->count > capacity) {
+    bins->stats.dropped += reservoir->count - capacity;
+    reservoir->count = capacity;
+  }
+
+  reservoir->capacity = capacity;
+  return true;
+}
+
+void ActivationBinsReset(ActivationBins* bins, int64_t startTime, int64_t binWidth) {
+  // The pages themselves went away with the arena reset.
+  if (bins->pages) {
+    memset(bins->pages, 0, sizeof(ActivationSlot*) * bins->pageCount);
+  }
+
+  bins->longActivations.head = nullptr;
+  bins->longActivations.tail = nullptr;
+  bins->longCount = 0;
+  bins->slotCopies = 0;
+  bins->usedSlots = 0;
+  bins->reservoir.count = 0;
+  bins->reservoir.offered = 0;
+  bins->startTime = startTime;
+  bins->binWidth = binWidth;
+}
+
+int64_t ActivationBinIndex(const ActivationBins* bins, int64_t timestamp) {
+  int64_t delta = timestamp - bins->startTime;
+
+  // Anything from before the window goes into the first slot.
+  if (delta < 0) {
+    return 0;
+  }
+
+  return delta / bins->binWidth;
+}
+
+ActivationSlot* ActivationBinsGet(const ActivationBins* bins, int64_t binIndex) {
+  int64_t page = binIndex / kActivationSlotsPerPage;
+
+  if (page >= bins->pageCount || !bins->pages[page]) {
+    return nullptr;
+  }
+
+  return &bins->pages[page][binIndex % kActivationSlotsPerPage];
+}
+
+bool InsertActivation(ActivationBins* bins, const SpanActivation* activation) {
+  int64_t startBinIndex = ActivationBinIndex(bins, activation->startTime);
+  int64_t endBinIndex = ActivationBinIndex(bins, activation->endTime);
+  bool inserted;
+
+  if (endBinIndex - startBinIndex >= kMaxActivationSlots) {
+    inserted = SlotInsertActivation(bins, &bins->longActivations, activation);
+    bins->longCount += inserted;
+  } else {
+    // Spread the activation into every slot it overlaps. Room is made in all of
+    // them up front, so it is either in each of them or in none.
+    ActivationSlot* slots[kMaxActivationSlots];
+    int64_t slotCount = endBinIndex > startBinIndex ? endBinIndex - startBinIndex + 1 : 1;
+    inserted = true;
+
+    for (int64_t i = 0; i < slotCount && inserted; i++) {
+      slots[i] = ActivationBinsGetOrCreate(bins, startBinIndex + i);
+      inserted = slots[i] && SlotReserve(bins, slots[i]);
+    }
+
+    if (inserted) {
+      for (int64_t i = 0; i < slotCount; i++) {
+        // The first bin of a slot stays empty until the first copy goes in.
+        if (slots[i]->head->count == 0) {
+          bins->usedSlots++;
+        }
+
+        ActivationBin* bin = slots[i]->tail;
+        bin->activations[bin->count++] = *activation;
+      }
+
+      bins->slotCopies += slotCount;
+    } else {
+      // Still found by the matcher and lookups from the long ones.
+      inserted = SlotInsertActivation(bins, &bins->longActivations, activation);
+      bins->longCount += inserted;
+    }
+  }
+
+  if (!inserted) {
+    return ReservoirInsertActivation(bins, activation);
+  }
+
+  bins->stats.inserted++;
+  return true;
+}
+
+SpanActivation* FindClosestActivation(const ActivationBins* bins, int64_t ts) {
+  SpanActivation* t = nullptr;
+  const ActivationSlot* slots[2] = {
+    ActivationBinsGet(bins, ActivationBinIndex(bins, ts)),
+    &bins->longActivations,
+  };
+
+  for (const ActivationSlot* slot : slots) {
+    if (!slot) {
+      continue;
+    }
+
+    for (ActivationBin* bin = slot->head; bin; bin = bin->next) {
+      for (int64_t i = 0; i < bin->count; i++) {
+        SpanActivation* activation = &bin->activations[i];
+        if (activation->startTime <= ts && ts <= activation->endTime) {
+          if (!t || activation->startTime > t->startTime) {
+            t = activation;
+          }
+        }
+      }
+    }
+  }
+
+  const ActivationReservoir* reservoir = &bins->reservoir;
+
+  for (int64_t i = 0; i < reservoir->count; i++) {
+    SpanActivation* activation = &reservoir->activations[i];
+    if (activation->startTime <= ts && ts <= activation->endTime) {
+      if (!t || activation->startTime > t->startTime) {
+        t = activation;
+      }
+    }
+  }
+
+  return t;
+}
+
+void ActivationMatcherInit(
+  ActivationMatcher* matcher, const ActivationBins* bins, int64_t sampleCount) {
+  ActivationMatcherInitWith(matcher, bins, nullptr, 0, sampleCount);
+}
+
+void ActivationMatcherInitWith(
+  ActivationMatcher* matcher, const ActivationBins* bins, SpanActivation* extra, size_t count,
+  int64_t sampleCount) {
+  matcher->activations.clear();
+  matcher->active.clear();
+  matcher->next = 0;
+  matcher->lastTs = INT64_MIN;
+  matcher->bins = nullptr;
+
+  tinystl::vector<SpanActivation*>& activations = matcher->activations;
+
+  if (MatcherPrefersLookups(bins, sampleCount)) {
+    matcher->bins = bins;
+
+    for (size_t i = 0; i < count; i++) {
+      activations.push_back(&extra[i]);
+    }
+
+    SortActivations(activations.data(), activations.size());
+    return;
+  }
+
+  // Slots hold the activations that started in them, so sorting each one on its
+  // own sorts all of them.
+  for (int64_t page = 0; page < bins->pageCount; page++) {
+    ActivationSlot* slots = bins->pages[page];
+
+    if (!slots) {
+      continue;
+    }
+
+    for (int64_t i = 0; i < kActivationSlotsPerPage; i++) {
+      size_t begin = activations.size();
+      MatcherAddSlot(matcher, bins, &slots[i], page * kActivationSlotsPerPage + i);
+      SortActivations(activations.data() + begin, activations.size() - begin);
+    }
+  }
+
+  size_t binned = activations.size();
+  MatcherAddSlot(matcher, bins, &bins->longActivations, -1);
+
+  for (int64_t i = 0; i < bins->reservoir.count; i++) {
+    activations.push_back(&bins->reservoir.activations[i]);
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    activations.push_back(&extra[i]);
+  }
+
+  size_t restCount = activations.size() - binned;
+
+  if (restCount == 0) {
+    return;
+  }
+
+  // The rest is usually short, merged into the binned ones from the back.
+  tinystl::vector<SpanActivation*>& rest = matcher->active;
+  rest.resize(restCount);
+  memcpy(rest.data(), activations.data() + binned, sizeof(SpanActivation*) * restCount);
+  SortActivations(rest.data(), restCount);
+
+  size_t i = binned;
+  size_t j = restCount;
+  size_t k = activations.size();
+
+  while (j > 0) {
+    if (i > 0 && CompareActivations(&activations[i - 1], &rest[j - 1]) > 0) {
+      activations[--k] = activations[--i];
+    } else {
+      activations[--k] = rest[--j];
+    }
+  }
+
+  rest.clear();
+}
+
+SpanActivation* ActivationMatcherFind(ActivationMatcher* matcher, int64_t ts) {
+  if (ts < matcher->lastTs) {
+    matcher->next = 0;
+    matcher->active.clear();
+  }
+
+  matcher->lastTs = ts;
+
+  tinystl::vector<SpanActivation*>& activations = matcher->activations;
+  tinystl::vector<SpanActivation*>& active = matcher->active;
+
+  while (matcher->next < activations.size() && activations[matcher->next]->startTime <= ts) {
+    active.push_back(activations[matcher->next++]);
+  }
+
+  // Timestamps only grow, so a finished activation on top is never needed again.
+  // Finished ones further down are popped once they surface.
+  while (!active.empty() && active.back()->endTime < ts) {
+    active.pop_back();
+  }
+
+  SpanActivation* swept = active.empty() ? nullptr : active.back();
+
+  if (!matcher->bins) {
+    return swept;
+  }
+
+  SpanActivation* found = FindClosestActivation(matcher->bins, ts);
+
+  if (!swept || (found && found->startTime > swept->startTime)) {
+    return found;
+  }
+
+  return swept;
+}
+
+} // namespace Profiling
+} // namespace Splunk
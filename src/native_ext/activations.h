@@ -0,0 +1,261 @@
+#pragma once
+
+#include "tinystl/vector.h"
+#include "util/arena.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* Collecting debug info is not compiled in by default to reduce memory usage.
+ */
+#ifndef PROFILER_DEBUG_EXPORT
+#define PROFILER_DEBUG_EXPORT 0
+#endif
+
+namespace Splunk {
+namespace Profiling {
+
+/**
+ * Completed span activations are indexed by time slots, each slot covering a
+ * few sampling intervals (see ActivationBinWidth). This is done to ease matching against stacktrace
+ * timestamps without requiring more complicated data structures (interval
+ * trees) or matching against the whole profiling period.
+ *
+ * The slot table is directly addressable: slots are grouped into pages that
+ * are only allocated once something is inserted into them, and each slot
+ * holds a chain of fixed size bins, also allocated on first insert. An idle
+ * profiler only keeps the (small) page directory around.
+ *
+ * Short activations are copied into every slot they overlap so that a lookup
+ * only has to scan a single slot. Activations overlapping more than
+ * kMaxActivationSlots slots (long running requests, streams, websockets) are
+ * stored once in a separate list instead, which is consulted on every lookup.
+ * This keeps memory proportional to the number of activations rather than to
+ * their duration.
+ */
+const int64_t kActivationsPerBin = 32;
+const int64_t kActivationSlotsPerPage = 64;
+const int64_t kMaxActivationSlots = 8;
+const size_t kTraceIdSize = 16;
+const size_t kSpanIdSize = 8;
+
+struct SpanActivation {
+  // Binary ids, decoded from hex once when the context is entered.
+  uint8_t traceId[kTraceIdSize];
+  uint8_t spanId[kSpanIdSize];
+  int64_t startTime;
+  int64_t endTime;
+#if PROFILER_DEBUG_EXPORT
+  int32_t depth;
+  bool is_intersected;
+#endif
+};
+
+struct ActivationBin {
+  SpanActivation activations[kActivationsPerBin];
+  int64_t count;
+  ActivationBin* next;
+};
+
+struct ActivationSlot {
+  ActivationBin* head;
+  // Last bin of the chain, appended to.
+  ActivationBin* tail;
+};
+
+/* Counted since ActivationBinsInit, kept across resets. */
+struct ActivationBinsStats {
+  int64_t inserted;
+  // Dropped on allocation failure, or sampled out of the reservoir.
+  int64_t dropped;
+  // Bins appended to a slot whose last bin was full.
+  int64_t overflowBins;
+};
+
+/**
+ * Once the arena is out of memory (see PagedArenaSetLimit), activations that
+ * no longer fit into the bins are reservoir sampled into a fixed buffer, so
+ * that the ones kept are spread over the whole window rather than bunched up
+ * at its start. Lookups and the matcher consider them along with the bins.
+ */
+struct ActivationReservoir {
+  // malloc'd, kept across resets.
+  SpanActivation* activations;
+  int64_t capacity;
+  int64_t count;
+  // Activations offered since the last reset.
+  int64_t offered;
+  uint64_t random;
+};
+
+/* Completed activations of a single profiling window. */
+struct ActivationBins {
+  // Slots and bins are allocated from the arena.
+  PagedArena* arena;
+  // Page directory, malloc'd and kept across resets.
+  ActivationSlot** pages;
+  int64_t pageCount;
+  // Activations overlapping more than kMaxActivationSlots slots.
+  ActivationSlot longActivations;
+  int64_t longCount;
+  // Activation copies in the slots and slots holding any, for the matcher to
+  // estimate a lookup with.
+  int64_t slotCopies;
+  int64_t usedSlots;
+  // Nanoseconds each slot represents.
+  int64_t binWidth;
+  // Monotonic timestamp the first slot starts at.
+  int64_t startTime;
+  ActivationReservoir reservoir;
+  ActivationBinsStats stats;
+};
+
+/**
+ * Context enter and exit events appended from JS to a SharedArrayBuffer and
+ * replayed natively, see ActivationRing in src/profiling. The buffer starts
+ * with an ActivationRingHeader followed by capacity events, the JS side keeps
+ * the same layout.
+ */
+enum ActivationEventKind {
+  ActivationEvent_Enter = 1,
+  ActivationEvent_Exit = 2,
+};
+
+struct ActivationEvent {
+  int32_t contextId;
+  int32_t kind;
+  // process.hrtime() nanoseconds.
+  int64_t timestamp;
+  uint8_t traceId[kTraceIdSize];
+  uint8_t spanId[kSpanIdSize];
+};
+
+struct ActivationRingHeader {
+  // Events written since the last drain.
+  int32_t count;
+  // Events dropped because the ring was full, only ever incremented.
+  int32_t overflowCount;
+  int32_t capacity;
+  // JS requests a drain once count reaches this.
+  int32_t highWaterMark;
+  // Set while any profiler is running, no events are written otherwise.
+  int32_t active;
+  int32_t reserved[3];
+};
+
+// Mirrored in src/profiling/ActivationRing.ts.
+static_assert(sizeof(ActivationEvent) == 40, "unexpected ActivationEvent layout");
+static_assert(sizeof(ActivationRingHeader) == 32, "unexpected ActivationRingHeader layout");
+
+const int32_t kActivationRingCapacity = 4096;
+
+/* Only used while tracking activations */
+struct ActivationStack {
+  static const int32_t kMaxActivations = 2;
+  int32_t count;
+  int32_t capacity;
+  SpanActivation activations[kMaxActivations];
+  SpanActivation* extra;
+  // The activation closed last on this context, held back from the bins so
+  // that the next ones can be coalesced into it (see ActivationsCoalesce).
+  SpanActivation lastClosed;
+  bool hasLastClosed;
+};
+
+/**
+ * Spill buffers given up by context stacks, reused before anything new is
+ * allocated from the arena. The list is threaded through the buffers, so it
+ * is only valid until the arena they came from is reset.
+ */
+struct ActivationSpill {
+  ActivationSpill* next;
+  int32_t capacity;
+};
+
+struct ActivationSpillPool {
+  ActivationSpill* head;
+  // Bytes of the buffers in the list.
+  size_t bytes;
+};
+
+void ActivationStackInit(ActivationStack* stack);
+/* The pool is optional, spill buffers come from the arena without one. */
+SpanActivation* ActivationStackPush(
+  ActivationStack* stack, PagedArena* arena, ActivationSpillPool* pool);
+SpanActivation* ActivationStackPop(ActivationStack* stack);
+/* Hands the spill buffer of the stack over to the pool, the stack is left empty. */
+void ActivationStackRelease(ActivationStack* stack, ActivationSpillPool* pool);
+void ActivationSpillPoolClear(ActivationSpillPool* pool);
+
+/**
+ * Extends last to cover next when both are activations of the same span less
+ * than maxGap apart, a gap no sample can tell from the activation going on.
+ * Returns false if they were left apart.
+ */
+bool ActivationsCoalesce(SpanActivation* last, const SpanActivation* next, int64_t maxGap);
+
+/* Bin width to use for the given sampling interval. */
+int64_t ActivationBinWidth(int64_t samplingIntervalNanos);
+void ActivationBinsInit(ActivationBins* bins, PagedArena* arena);
+/* Releases the page directory and the reservoir, the arena is left alone. */
+void ActivationBinsFree(ActivationBins* bins);
+/**
+ * Sizes the reservoir, 0 drops the activations that don't fit instead. Kept
+ * activations past the new capacity are dropped. Returns false on allocation
+ * failure, leaving the reservoir as it was.
+ */
+bool ActivationBinsSetReservoir(ActivationBins* bins, int64_t capacity);
+/**
+ * Drops all activations and starts a new window, the arena must have been
+ * reset beforehand.
+ */
+void ActivationBinsReset(ActivationBins* bins, int64_t startTime, int64_t binWidth);
+int64_t ActivationBinIndex(const ActivationBins* bins, int64_t timestamp);
+/* Returns nullptr if the slot was never inserted into. */
+ActivationSlot* ActivationBinsGet(const ActivationBins* bins, int64_t binIndex);
+/**
+ * Returns false if the activation was dropped, either on allocation failure or
+ * because it was sampled out of the reservoir.
+ */
+bool InsertActivation(ActivationBins* bins, const SpanActivation* activation);
+/**
+ * Looks up the innermost activation covering ts by scanning its slot, the long
+ * activations and the reservoir.
+ */
+SpanActivation* FindClosestActivation(const ActivationBins* bins, int64_t ts);
+
+/**
+ * Matches sample timestamps against activations in a single merge pass.
+ * Activations are sorted by start time once, then for increasing timestamps
+ * the started ones are pushed on a stack and the finished ones are popped off
+ * its top. Since the stack is ordered by start time, its top is the innermost
+ * activation covering the timestamp.
+ *
+ * With far more activations than timestamps to match, sorting all of them costs
+ * more than looking up the slot of each timestamp. The bins are then looked up
+ * instead (FindClosestActivation), and only the activations outside of them are
+ * swept.
+ */
+struct ActivationMatcher {
+  tinystl::vector<SpanActivation*> activations;
+  tinystl::vector<SpanActivation*> active;
+  size_t next;
+  int64_t lastTs;
+  // Set when the bins are looked up per timestamp.
+  const ActivationBins* bins;
+};
+
+/* sampleCount is the number of timestamps expected to be matched. */
+void ActivationMatcherInit(
+  ActivationMatcher* matcher, const ActivationBins* bins, int64_t sampleCount);
+/**
+ * Also matches count activations outside of the bins, such as the ones still
+ * in progress. They have to outlive the matcher.
+ */
+void ActivationMatcherInitWith(
+  ActivationMatcher* matcher, const ActivationBins* bins, SpanActivation* extra, size_t count,
+  int64_t sampleCount);
+/* Fastest with non-decreasing timestamps, going back in time restarts the sweep. */
+SpanActivation* ActivationMatcherFind(ActivationMatcher* matcher, int64_t ts);
+
+} // namespace Profiling
+} // namespace Splunk
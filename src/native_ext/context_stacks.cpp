@@ -0,0 +1,288 @@
+#include "context_stacks.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CONTEXT_STACKS_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace Splunk {
+namespace Profiling {
+
+namespace {
+
+const size_t kGroupWidth = 16;
+const size_t kMinCapacity = 64;
+const uint8_t kEmpty = 0x80;
+
+// Context ids are handed out sequentially, so the id itself is the slot: ids
+// entered around the same time end up next to each other and rarely collide.
+size_t HomeSlot(const ContextStacks* map, int32_t contextId) {
+  return size_t(uint32_t(contextId)) & (map->slotCapacity - 1);
+}
+
+// 7 bits of a hash of the id, so that colliding ids get told apart without
+// touching their slots. Full control bytes keep the top bit clear.
+uint8_t ContextTag(int32_t contextId) { return uint8_t((uint32_t(contextId) * 0x9E3779B1U) >> 25); }
+
+uint32_t TrailingZeros(uint32_t bits) {
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward(&index, bits);
+  return uint32_t(index);
+#else
+  return uint32_t(__builtin_ctz(bits));
+#endif
+}
+
+// Bit i is set if control byte i of the group holds tag.
+uint32_t GroupMatch(const uint8_t* group, uint8_t tag) {
+#if CONTEXT_STACKS_SSE2
+  __m128i bytes = _mm_loadu_si128((const __m128i*)group);
+  return uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(char(tag)))));
+#else
+  uint32_t bits = 0;
+  for (size_t i = 0; i < kGroupWidth; i++) {
+    bits |= uint32_t(group[i] == tag) << i;
+  }
+  return bits;
+#endif
+}
+
+uint32_t GroupMatchEmpty(const uint8_t* group) {
+#if CONTEXT_STACKS_SSE2
+  // Only empty bytes have the top bit set.
+  return uint32_t(_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group)));
+#else
+  return GroupMatch(group, kEmpty);
+#endif
+}
+
+void SetCtrl(ContextStacks* map, size_t slot, uint8_t value) {
+  map->ctrl[slot] = value;
+
+  if (slot < kGroupWidth - 1) {
+    map->ctrl[map->slotCapacity + slot] = value;
+  }
+}
+
+// Probe distance of the slot's key from its home slot.
+size_t SlotDistance(const ContextStacks* map, size_t slot) {
+  return (slot - HomeSlot(map, map->slots[slot].contextId)) & (map->slotCapacity - 1);
+}
+
+// Returns the slot of the key, or slotCapacity if it isn't there.
+size_t FindSlot(const ContextStacks* map, int32_t contextId) {
+  if (map->slotCapacity == 0) {
+    return 0;
+  }
+
+  size_t mask = map->slotCapacity - 1;
+  size_t pos = HomeSlot(map, contextId);
+  uint8_t tag = ContextTag(contextId);
+
+  // Sequential ids mostly sit in their home slot.
+  if (map->ctrl[pos] == tag && map->slots[pos].contextId == contextId) {
+    return pos;
+  }
+
+  for (;;) {
+    const uint8_t* group = &map->ctrl[pos];
+    uint32_t empty = GroupMatchEmpty(group);
+    uint32_t match = GroupMatch(group, tag);
+
+    // Nothing past the first empty slot belongs to this probe sequence.
+    if (empty) {
+      match &= (empty & (0 - empty)) - 1;
+    }
+
+    while (match) {
+      size_t slot = (pos + TrailingZeros(match)) & mask;
+
+      if (map->slots[slot].contextId == contextId) {
+        return slot;
+      }
+
+      match &= match - 1;
+    }
+
+    if (empty) {
+      return map->slotCapacity;
+    }
+
+    pos = (pos + kGroupWidth) & mask;
+  }
+}
+
+/**
+ * Robin Hood insertion: walking from its home slot, the key takes the place
+ * of the first key closer to its own home and carries on inserting that one.
+ * Keys of a run stay ordered by home slot, which is what lets erase stop early.
+ */
+void InsertSlot(ContextStacks* map, ContextStackSlot carried) {
+  size_t mask = map->slotCapacity - 1;
+  size_t slot = HomeSlot(map, carried.contextId);
+  size_t distance = 0;
+
+  while (!(map->ctrl[slot] & kEmpty)) {
+    size_t slotDistance = SlotDistance(map, slot);
+
+    if (slotDistance < distance) {
+      ContextStackSlot displaced = map->slots[slot];
+      map->slots[slot] = carried;
+      SetCtrl(map, slot, ContextTag(carried.contextId));
+      map->entries[carried.entry].slot = uint32_t(slot);
+      carried = displaced;
+      distance = slotDistance;
+    }
+
+    slot = (slot + 1) & mask;
+    distance++;
+  }
+
+  map->slots[slot] = carried;
+  SetCtrl(map, slot, ContextTag(carried.contextId));
+  map->entries[carried.entry].slot = uint32_t(slot);
+}
+
+// Shifts the rest of the run back into the hole, up to the first key already
+// in its home slot. No tombstones are left behind.
+void EraseSlot(ContextStacks* map, size_t hole) {
+  size_t mask = map->slotCapacity - 1;
+  size_t next = (hole + 1) & mask;
+
+  while (!(map->ctrl[next] & kEmpty) && SlotDistance(map, next) > 0) {
+    map->slots[hole] = map->slots[next];
+    SetCtrl(map, hole, map->ctrl[next]);
+    map->entries[map->slots[hole].entry].slot = uint32_t(hole);
+    hole = next;
+    next = (next + 1) & mask;
+  }
+
+  SetCtrl(map, hole, kEmpty);
+}
+
+bool ResizeSlots(ContextStacks* map, size_t capacity) {
+  uint8_t* ctrl = (uint8_t*)malloc(capacity + kGroupWidth - 1);
+  ContextStackSlot* slots = (ContextStackSlot*)malloc(sizeof(ContextStackSlot) * capacity);
+
+  if (!ctrl || !slots) {
+    free(ctrl);
+    free(slots);
+    return false;
+  }
+
+  free(map->ctrl);
+  free(map->slots);
+  memset(ctrl, kEmpty, capacity + kGroupWidth - 1);
+  map->ctrl = ctrl;
+  map->slots = slots;
+  map->slotCapacity = capacity;
+
+  // The entries hold all the keys, no need to walk the old slots.
+  for (size_t i = 0; i < map->size; i++) {
+    ContextStackSlot slot = {map->entries[i].contextId, uint32_t(i)};
+    InsertSlot(map, slot);
+  }
+
+  return true;
+}
+
+bool ReserveEntry(ContextStacks* map) {
+  if (map->size == map->entryCapacity) {
+    size_t capacity = map->entryCapacity == 0 ? kMinCapacity / 2 : map->entryCapacity * 2;
+    ContextStackEntry* entries =
+      (ContextStackEntry*)realloc(map->entries, sizeof(ContextStackEntry) * capacity);
+
+    if (!entries) {
+      return false;
+    }
+
+    map->entries = entries;
+    map->entryCapacity = capacity;
+  }
+
+  // Keeps runs short and guarantees an empty slot to end every probe.
+  if ((map->size + 1) * 4 > map->slotCapacity * 3) {
+    size_t capacity = map->slotCapacity == 0 ? kMinCapacity : map->slotCapacity * 2;
+    return ResizeSlots(map, capacity);
+  }
+
+  return true;
+}
+
+} // namespace
+
+void ContextStacksInit(ContextStacks* map) { memset(map, 0, sizeof(ContextStacks)); }
+
+void ContextStacksFree(ContextStacks* map) {
+  free(map->ctrl);
+  free(map->slots);
+  free(map->entries);
+  ContextStacksInit(map);
+}
+
+void ContextStacksClear(ContextStacks* map) {
+  if (map->ctrl) {
+    memset(map->ctrl, kEmpty, map->slotCapacity + kGroupWidth - 1);
+  }
+
+  map->size = 0;
+  ActivationSpillPoolClear(&map->spills);
+}
+
+ActivationStack* ContextStacksFind(ContextStacks* map, int32_t contextId) {
+  size_t slot = FindSlot(map, contextId);
+
+  if (slot >= map->slotCapacity) {
+    return nullptr;
+  }
+
+  return &map->entries[map->slots[slot].entry].stack;
+}
+
+ActivationStack* ContextStacksFindOrInsert(ContextStacks* map, int32_t contextId) {
+  size_t slot = FindSlot(map, contextId);
+
+  if (slot < map->slotCapacity) {
+    return &map->entries[map->slots[slot].entry].stack;
+  }
+
+  if (!ReserveEntry(map)) {
+    return nullptr;
+  }
+
+  ContextStackEntry* entry = &map->entries[map->size];
+  entry->contextId = contextId;
+  ActivationStackInit(&entry->stack);
+
+  ContextStackSlot inserted = {contextId, uint32_t(map->size++)};
+  InsertSlot(map, inserted);
+  return &entry->stack;
+}
+
+void ContextStacksErase(ContextStacks* map, ActivationStack* stack) {
+  ContextStackEntry* entry =
+    (ContextStackEntry*)((uint8_t*)stack - offsetof(ContextStackEntry, stack));
+  size_t index = size_t(entry - map->entries);
+
+  ActivationStackRelease(stack, &map->spills);
+  EraseSlot(map, entry->slot);
+
+  // The last stack moves into the erased one's place.
+  size_t last = map->size - 1;
+  if (index != last) {
+    *entry = map->entries[last];
+    map->slots[entry->slot].entry = uint32_t(index);
+  }
+
+  map->size--;
+}
+
+} // namespace Profiling
+} // namespace Splunk
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "activations.h"
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Splunk {
+namespace Profiling {
+
+/**
+ * Activation stacks of the async contexts, keyed by context id. Every context
+ * switch looks its context up, so the stacks live inline in a dense array,
+ * indexed by an open addressed table of small slots, rather than behind a
+ * generic hash map.
+ *
+ * Each slot has a control byte holding 7 bits of the key's hash, or kEmpty.
+ * Lookups compare a group of control bytes at once (SSE2 where available) and
+ * only touch the slots whose byte matches. Probing is linear, so an erase
+ * shifts the following slots of the run back instead of leaving a tombstone
+ * behind, and a lookup can stop at the first empty slot. The erased stack is
+ * replaced by the last one, keeping the array dense.
+ *
+ * Spill buffers of erased stacks go to a pool shared by the stacks, see
+ * ActivationSpillPool, the pool has to be cleared whenever the arena is reset.
+ */
+struct ContextStackEntry {
+  int32_t contextId;
+  // Slot indexing the entry, so that erasing it takes no lookup.
+  uint32_t slot;
+  ActivationStack stack;
+};
+
+struct ContextStackSlot {
+  int32_t contextId;
+  uint32_t entry;
+};
+
+struct ContextStacks {
+  // slotCapacity control bytes, followed by copies of the first
+  // kGroupWidth - 1 so that a group can be loaded from any slot.
+  uint8_t* ctrl;
+  ContextStackSlot* slots;
+  // A power of two, 0 until the first insert.
+  size_t slotCapacity;
+  ContextStackEntry* entries;
+  size_t entryCapacity;
+  size_t size;
+  ActivationSpillPool spills;
+};
+
+void ContextStacksInit(ContextStacks* map);
+void ContextStacksFree(ContextStacks* map);
+/* Drops all stacks and their spill buffers, keeping the memory allocated. */
+void ContextStacksClear(ContextStacks* map);
+
+/* Pointers into the map are only valid until the next insert or erase. */
+ActivationStack* ContextStacksFind(ContextStacks* map, int32_t contextId);
+/* Finds or adds an empty stack, nullptr on allocation failure. */
+ActivationStack* ContextStacksFindOrInsert(ContextStacks* map, int32_t contextId);
+/**
+ * Erases a stack found in the map and returns its spill buffer to the pool.
+ * The last stack takes the place of the erased one, iterate backwards to erase
+ * while iterating.
+ */
+void ContextStacksErase(ContextStacks* map, ActivationStack* stack);
+
+/* Stacks by index, from 0 to size. */
+inline ActivationStack* ContextStacksAt(ContextStacks* map, size_t index, int32_t* contextId) {
+  ContextStackEntry* entry = &map->entries[index];
+
+  if (contextId) {
+    *contextId = entry->contextId;
+  }
+
+  return &entry->stack;
+}
+
+} // namespace Profiling
+} // namespace Splunk
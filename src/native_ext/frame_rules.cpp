@@ -0,0 +1,85 @@
+#include "frame_rules.h"
+#include <stdlib.h>
+#include <string.h>
+
+namespace Splunk {
+namespace Profiling {
+
+void FrameRulesInit(FrameRules* rules) { memset(rules, 0, sizeof(FrameRules)); }
+
+void FrameRulesFree(FrameRules* rules) {
+  free(rules->excludedPrefixes);
+  free(rules->excludedPrefixLengths);
+  rules->excludedPrefixes = nullptr;
+  rules->excludedPrefixLengths = nullptr;
+  rules->excludedPrefixCount = 0;
+}
+
+bool FrameRulesSetExcludedPrefixes(FrameRules* rules, const char* const* prefixes, size_t count) {
+  FrameRulesFree(rules);
+
+  size_t size = 0;
+  size_t kept = 0;
+  for (size_t i = 0; i < count; i++) {
+    size_t length = strlen(prefixes[i]);
+
+    // An empty prefix would exclude everything.
+    if (length > 0) {
+      size += length + 1;
+      kept++;
+    }
+  }
+
+  if (kept == 0) {
+    return true;
+  }
+
+  char* storage = (char*)malloc(size);
+  uint32_t* lengths = (uint32_t*)malloc(sizeof(uint32_t) * kept);
+
+  if (!storage || !lengths) {
+    free(storage);
+    free(lengths);
+    return false;
+  }
+
+  size_t offset = 0;
+  size_t index = 0;
+  for (size_t i = 0; i < count; i++) {
+    size_t length = strlen(prefixes[i]);
+
+    if (length > 0) {
+      memcpy(storage + offset, prefixes[i], length + 1);
+      lengths[index++] = uint32_t(length);
+      offset += length + 1;
+    }
+  }
+
+  rules->excludedPrefixes = storage;
+  rules->excludedPrefixLengths = lengths;
+  rules->excludedPrefixCount = int32_t(kept);
+  return true;
+}
+
+bool FrameRulesActive(const FrameRules* rules) {
+  return rules->excludedPrefixCount > 0 || rules->maxStackDepth > 0 || rules->foldRecursion;
+}
+
+bool FrameRulesExcludes(const FrameRules* rules, const char* scriptName) {
+  const char* prefix = rules->excludedPrefixes;
+
+  for (int32_t i = 0; i < rules->excludedPrefixCount; i++) {
+    uint32_t length = rules->excludedPrefixLengths[i];
+
+    if (strncmp(scriptName, prefix, length) == 0) {
+      return true;
+    }
+
+    prefix += length + 1;
+  }
+
+  return false;
+}
+
+} // namespace Profiling
+} // namespace Splunk
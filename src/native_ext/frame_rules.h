@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Splunk {
+namespace Profiling {
+
+/**
+ * Rules applied to the frames of a profile while its stacks are built, see
+ * RawProfileCopy. All of them are off by default.
+ *
+ * - Frames whose script path starts with one of the excluded prefixes are
+ *   dropped, their children are attached to the closest kept ancestor.
+ * - Runs of identical frames (direct recursion) are folded into their first
+ *   frame, which carries the length of the run as its repeat count.
+ * - Stacks deeper than maxStackDepth keep their maxStackDepth / 2 outermost
+ *   and their innermost frames, with a single "(truncated)" frame standing in
+ *   for the dropped ones.
+ */
+struct FrameRules {
+  // NUL terminated prefixes stored back to back, a single allocation.
+  char* excludedPrefixes;
+  uint32_t* excludedPrefixLengths;
+  int32_t excludedPrefixCount;
+  // 0 for no limit.
+  int32_t maxStackDepth;
+  bool foldRecursion;
+};
+
+const char* const kTruncatedFrameName = "(truncated)";
+
+void FrameRulesInit(FrameRules* rules);
+void FrameRulesFree(FrameRules* rules);
+/* Copies the prefixes, returns false on allocation failure. */
+bool FrameRulesSetExcludedPrefixes(FrameRules* rules, const char* const* prefixes, size_t count);
+bool FrameRulesActive(const FrameRules* rules);
+bool FrameRulesExcludes(const FrameRules* rules, const char* scriptName);
+
+} // namespace Profiling
+} // namespace Splunk
@@ -0,0 +1,223 @@
+#include "frames.h"
+#include "khash.h"
+#include "tinystl/vector.h"
+#include "xxhash/xxh3.h"
+#include <stdlib.h>
+#include <string.h>
+
+namespace Splunk {
+namespace Profiling {
+
+namespace {
+
+KHASH_MAP_INIT_INT64(FrameIds, int32_t);
+
+struct FrameEntry {
+  // Both names share a single allocation, owned by the entry.
+  Frame frame;
+  uint64_t hash;
+  // Neighbours in the recency list, -1 at either end.
+  int32_t prev;
+  int32_t next;
+  // Collection the frame was last used in.
+  uint32_t epoch;
+  // Whether the consumer was told about the frame.
+  bool announced;
+};
+
+} // namespace
+
+struct FrameDictionary {
+  // Indexed by frame id.
+  tinystl::vector<FrameEntry> entries;
+  khash_t(FrameIds)* ids;
+  // Most and least recently used frames.
+  int32_t head;
+  int32_t tail;
+  size_t maxFrames;
+  uint32_t epoch;
+  // Filled by FrameDictionaryDelta.
+  tinystl::vector<int32_t> added;
+  tinystl::vector<int32_t> evicted;
+};
+
+namespace {
+
+uint64_t FrameHash(const Frame* frame) {
+  int32_t key[3] = {frame->scriptId, frame->lineNumber, frame->columnNumber};
+  return XXH3_64bits_withSeed(
+    frame->functionName, strlen(frame->functionName), XXH3_64bits(key, sizeof(key)));
+}
+
+void Unlink(FrameDictionary* dictionary, int32_t id) {
+  FrameEntry* entry = &dictionary->entries[id];
+
+  if (entry->prev >= 0) {
+    dictionary->entries[entry->prev].next = entry->next;
+  } else {
+    dictionary->head = entry->next;
+  }
+
+  if (entry->next >= 0) {
+    dictionary->entries[entry->next].prev = entry->prev;
+  } else {
+    dictionary->tail = entry->prev;
+  }
+}
+
+void LinkFirst(FrameDictionary* dictionary, int32_t id) {
+  FrameEntry* entry = &dictionary->entries[id];
+  entry->prev = -1;
+  entry->next = dictionary->head;
+
+  if (dictionary->head >= 0) {
+    dictionary->entries[dictionary->head].prev = id;
+  } else {
+    dictionary->tail = id;
+  }
+
+  dictionary->head = id;
+}
+
+// Unlinks the frame and releases its names, the slot is reused by the caller.
+void Evict(FrameDictionary* dictionary, int32_t id) {
+  FrameEntry* entry = &dictionary->entries[id];
+  Unlink(dictionary, id);
+
+  khiter_t it = kh_get(FrameIds, dictionary->ids, entry->hash);
+  if (it != kh_end(dictionary->ids)) {
+    kh_del(FrameIds, dictionary->ids, it);
+  }
+
+  // The consumer never saw a frame that was not announced.
+  if (entry->announced) {
+    dictionary->evicted.push_back(id);
+  }
+
+  free((void*)entry->frame.functionName);
+}
+
+} // namespace
+
+FrameDictionary* FrameDictionaryNew(size_t maxFrames) {
+  FrameDictionary* dictionary = new FrameDictionary();
+  dictionary->ids = kh_init(FrameIds);
+  dictionary->head = -1;
+  dictionary->tail = -1;
+  dictionary->maxFrames = maxFrames;
+  dictionary->epoch = 0;
+  return dictionary;
+}
+
+void FrameDictionaryFree(FrameDictionary* dictionary) {
+  for (size_t i = 0; i < dictionary->entries.size(); i++) {
+    free((void*)dictionary->entries[i].frame.functionName);
+  }
+
+  kh_destroy(FrameIds, dictionary->ids);
+  delete dictionary;
+}
+
+size_t FrameDictionarySize(const FrameDictionary* dictionary) {
+  return dictionary->entries.size();
+}
+
+void FrameDictionaryBeginCollection(FrameDictionary* dictionary) { dictionary->epoch++; }
+
+int32_t FrameDictionaryIntern(FrameDictionary* dictionary, const Frame* frame) {
+  uint64_t hash = FrameHash(frame);
+  khiter_t it = kh_get(FrameIds, dictionary->ids, hash);
+
+  if (it != kh_end(dictionary->ids)) {
+    int32_t id = kh_value(dictionary->ids, it);
+
+    if (dictionary->head != id) {
+      Unlink(dictionary, id);
+      LinkFirst(dictionary, id);
+    }
+
+    dictionary->entries[id].epoch = dictionary->epoch;
+    return id;
+  }
+
+  size_t functionNameLength = strlen(frame->functionName);
+  size_t scriptNameLength = strlen(frame->scriptName);
+  char* names = (char*)malloc(functionNameLength + scriptNameLength + 2);
+
+  if (!names) {
+    return -1;
+  }
+
+  int ret;
+  it = kh_put(FrameIds, dictionary->ids, hash, &ret);
+
+  if (ret == -1) {
+    free(names);
+    return -1;
+  }
+
+  int32_t tail = dictionary->tail;
+  int32_t id;
+
+  if (
+    dictionary->entries.size() >= dictionary->maxFrames && tail >= 0 &&
+    dictionary->entries[tail].epoch != dictionary->epoch) {
+    id = tail;
+    Evict(dictionary, id);
+  } else {
+    id = int32_t(dictionary->entries.size());
+    dictionary->entries.resize(dictionary->entries.size() + 1);
+  }
+
+  memcpy(names, frame->functionName, functionNameLength + 1);
+  memcpy(names + functionNameLength + 1, frame->scriptName, scriptNameLength + 1);
+
+  FrameEntry* entry = &dictionary->entries[id];
+  entry->frame = *frame;
+  entry->frame.functionName = names;
+  entry->frame.scriptName = names + functionNameLength + 1;
+  entry->hash = hash;
+  entry->epoch = dictionary->epoch;
+  entry->announced = false;
+  LinkFirst(dictionary, id);
+
+  kh_value(dictionary->ids, it) = id;
+  return id;
+}
+
+const Frame* FrameDictionaryGet(const FrameDictionary* dictionary, int32_t id) {
+  if (id < 0 || size_t(id) >= dictionary->entries.size()) {
+    return nullptr;
+  }
+
+  return &dictionary->entries[id].frame;
+}
+
+void FrameDictionaryDelta(
+  FrameDictionary* dictionary, const int32_t** added, size_t* addedCount, const int32_t** evicted,
+  size_t* evictedCount) {
+  dictionary->added.clear();
+
+  for (size_t i = 0; i < dictionary->entries.size(); i++) {
+    if (!dictionary->entries[i].announced) {
+      dictionary->added.push_back(int32_t(i));
+    }
+  }
+
+  *added = dictionary->added.data();
+  *addedCount = dictionary->added.size();
+  *evicted = dictionary->evicted.data();
+  *evictedCount = dictionary->evicted.size();
+}
+
+void FrameDictionaryCommit(FrameDictionary* dictionary) {
+  for (size_t i = 0; i < dictionary->added.size(); i++) {
+    dictionary->entries[dictionary->added[i]].announced = true;
+  }
+
+  dictionary->added.clear();
+  dictionary->evicted.clear();
+}
+
+} // namespace Profiling
+} // namespace Splunk
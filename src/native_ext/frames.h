@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Splunk {
+namespace Profiling {
+
+/**
+ * Frames interned across collections, keyed by script id, function name, line
+ * and column. Each frame keeps the same id for as long as it stays in the
+ * dictionary, so a consumer only has to be told about the frames added since
+ * the previous collection and the ones evicted meanwhile.
+ *
+ * The dictionary is bounded: once maxFrames are held, the least recently used
+ * frame is evicted and its id reused. Frames used by the collection in
+ * progress are never evicted, the dictionary grows past maxFrames instead.
+ */
+struct FrameDictionary;
+
+struct Frame {
+  const char* functionName;
+  const char* scriptName;
+  int32_t scriptId;
+  int32_t lineNumber;
+  int32_t columnNumber;
+};
+
+const size_t kDefaultMaxFrames = 16384;
+
+FrameDictionary* FrameDictionaryNew(size_t maxFrames);
+void FrameDictionaryFree(FrameDictionary* dictionary);
+size_t FrameDictionarySize(const FrameDictionary* dictionary);
+
+/* Starts a new collection, frames interned from now on are protected from eviction. */
+void FrameDictionaryBeginCollection(FrameDictionary* dictionary);
+/* Returns the id of the frame, -1 on allocation failure. Names are copied. */
+int32_t FrameDictionaryIntern(FrameDictionary* dictionary, const Frame* frame);
+/* The frame with the given id, nullptr for ids not in use. */
+const Frame* FrameDictionaryGet(const FrameDictionary* dictionary, int32_t id);
+
+/**
+ * Ids of the frames the consumer was not told about yet, in increasing order,
+ * and the ids of the frames evicted since the last commit. An evicted id may
+ * have been reused by an added frame, the consumer has to apply the evictions
+ * first. Both are only cleared once FrameDictionaryCommit confirms that they
+ * were handed over, a failed collection leaves them for the next one.
+ */
+void FrameDictionaryDelta(
+  FrameDictionary* dictionary, const int32_t** added, size_t* addedCount, const int32_t** evicted,
+  size_t* evictedCount);
+void FrameDictionaryCommit(FrameDictionary* dictionary);
+
+} // namespace Profiling
+} // namespace Splunk
@@ -0,0 +1,357 @@
+#include "pprof.h"
+#include "khash.h"
+#include "util/protobuf.h"
+#include "xxhash/xxh3.h"
+#include <stdlib.h>
+#include <string.h>
+
+namespace Splunk {
+namespace Profiling {
+
+namespace {
+
+enum PprofProfileField {
+  ProfileField_SampleType = 1,
+  ProfileField_Sample = 2,
+  ProfileField_Location = 4,
+  ProfileField_Function = 5,
+  ProfileField_StringTable = 6,
+};
+
+enum PprofValueTypeField {
+  ValueTypeField_Type = 1,
+  ValueTypeField_Unit = 2,
+};
+
+enum PprofSampleField {
+  SampleField_LocationId = 1,
+  SampleField_Value = 2,
+  SampleField_Label = 3,
+};
+
+enum PprofLabelField {
+  LabelField_Key = 1,
+  LabelField_Str = 2,
+  LabelField_Num = 3,
+};
+
+enum PprofLocationField {
+  LocationField_Id = 1,
+  LocationField_Line = 4,
+};
+
+enum PprofLineField {
+  LineField_FunctionId = 1,
+  LineField_Line = 2,
+};
+
+enum PprofFunctionField {
+  FunctionField_Id = 1,
+  FunctionField_Name = 2,
+  FunctionField_SystemName = 3,
+  FunctionField_Filename = 4,
+};
+
+KHASH_MAP_INIT_INT64(PprofStrings, int64_t);
+KHASH_MAP_INIT_INT64(PprofIds, uint64_t);
+
+} // namespace
+
+struct PprofBuilder {
+  khash_t(PprofStrings) * strings;
+  khash_t(PprofIds) * functions;
+  khash_t(PprofIds) * locations;
+  int64_t stringCount;
+  uint64_t functionCount;
+  uint64_t locationCount;
+  size_t sampleCount;
+  ProtobufBuffer sampleTypeData;
+  ProtobufBuffer sampleData;
+  ProtobufBuffer locationData;
+  ProtobufBuffer functionData;
+  ProtobufBuffer stringData;
+};
+
+namespace {
+
+// Returns false on allocation failure.
+bool InternId(khash_t(PprofIds) * ids, uint64_t key, khiter_t* it, bool* isNew) {
+  int ret;
+  *it = kh_put(PprofIds, ids, key, &ret);
+
+  if (ret == -1) {
+    return false;
+  }
+
+  *isNew = ret != 0;
+  return true;
+}
+
+size_t LabelSize(const PprofLabel* label) {
+  return ProtobufVarintFieldSize(LabelField_Key, label->key) +
+         (label->isString ? ProtobufVarintFieldSize(LabelField_Str, label->str)
+                          : ProtobufVarintFieldSize(LabelField_Num, label->num));
+}
+
+uint64_t FunctionId(PprofBuilder* builder, const char* fileName, const char* functionName) {
+  int64_t name = PprofStringIndex(builder, functionName, strlen(functionName));
+  int64_t file = PprofStringIndex(builder, fileName, strlen(fileName));
+
+  if (name < 0 || file < 0) {
+    return 0;
+  }
+
+  khiter_t it;
+  bool isNew;
+  uint64_t key = (uint64_t(name) << 32) | uint64_t(file);
+
+  if (!InternId(builder->functions, key, &it, &isNew)) {
+    return 0;
+  }
+
+  if (!isNew) {
+    return kh_value(builder->functions, it);
+  }
+
+  uint64_t id = ++builder->functionCount;
+  kh_value(builder->functions, it) = id;
+
+  size_t size = ProtobufVarintFieldSize(FunctionField_Id, int64_t(id)) +
+                ProtobufVarintFieldSize(FunctionField_Name, name) +
+                ProtobufVarintFieldSize(FunctionField_SystemName, name) +
+                ProtobufVarintFieldSize(FunctionField_Filename, file);
+
+  ProtobufBuffer* out = &builder->functionData;
+  bool ok = ProtobufWriteLengthDelimitedHeader(out, ProfileField_Function, size) &&
+            ProtobufWriteVarintField(out, FunctionField_Id, int64_t(id)) &&
+            ProtobufWriteVarintField(out, FunctionField_Name, name) &&
+            ProtobufWriteVarintField(out, FunctionField_SystemName, name) &&
+            ProtobufWriteVarintField(out, FunctionField_Filename, file);
+
+  return ok ? id : 0;
+}
+
+} // namespace
+
+PprofBuilder* PprofBuilderNew() {
+  PprofBuilder* builder = (PprofBuilder*)calloc(1, sizeof(PprofBuilder));
+
+  if (!builder) {
+    return nullptr;
+  }
+
+  builder->strings = kh_init(PprofStrings);
+  builder->functions = kh_init(PprofIds);
+  builder->locations = kh_init(PprofIds);
+  ProtobufBufferInit(&builder->sampleTypeData);
+  ProtobufBufferInit(&builder->sampleData);
+  ProtobufBufferInit(&builder->locationData);
+  ProtobufBufferInit(&builder->functionData);
+  ProtobufBufferInit(&builder->stringData);
+
+  const char* wellKnown[] = {"", "source.event.time", "trace_id", "span_id", "source.event.period"};
+  for (const char* str : wellKnown) {
+    if (PprofStringIndex(builder, str, strlen(str)) < 0) {
+      PprofBuilderFree(builder);
+      return nullptr;
+    }
+  }
+
+  return builder;
+}
+
+void PprofBuilderFree(PprofBuilder* builder) {
+  if (!builder) {
+    return;
+  }
+
+  kh_destroy(PprofStrings, builder->strings);
+  kh_destroy(PprofIds, builder->functions);
+  kh_destroy(PprofIds, builder->locations);
+  ProtobufBufferFree(&builder->sampleTypeData);
+  ProtobufBufferFree(&builder->sampleData);
+  ProtobufBufferFree(&builder->locationData);
+  ProtobufBufferFree(&builder->functionData);
+  ProtobufBufferFree(&builder->stringData);
+  free(builder);
+}
+
+int64_t PprofStringIndex(PprofBuilder* builder, const char* str, size_t length) {
+  uint64_t hash = XXH3_64bits(str, length);
+
+  int ret;
+  khiter_t it = kh_put(PprofStrings, builder->strings, hash, &ret);
+
+  if (ret == -1) {
+    return -1;
+  }
+
+  if (ret == 0) {
+    return kh_value(builder->strings, it);
+  }
+
+  if (!ProtobufWriteBytesField(&builder->stringData, ProfileField_StringTable, str, length)) {
+    kh_del(PprofStrings, builder->strings, it);
+    return -1;
+  }
+
+  int64_t index = builder->stringCount++;
+  kh_value(builder->strings, it) = index;
+  return index;
+}
+
+uint64_t PprofLocationId(
+  PprofBuilder* builder, const char* fileName, const char* functionName, int64_t line) {
+  uint64_t functionId = FunctionId(builder, fileName, functionName);
+
+  if (functionId == 0) {
+    return 0;
+  }
+
+  // Same as the JS serializer: a missing line number is reported as -1.
+  if (line == 0) {
+    line = -1;
+  }
+
+  khiter_t it;
+  bool isNew;
+  uint64_t key = (functionId << 32) ^ uint64_t(uint32_t(line));
+
+  if (!InternId(builder->locations, key, &it, &isNew)) {
+    return 0;
+  }
+
+  if (!isNew) {
+    return kh_value(builder->locations, it);
+  }
+
+  uint64_t id = ++builder->locationCount;
+  kh_value(builder->locations, it) = id;
+
+  size_t lineSize = ProtobufVarintFieldSize(LineField_FunctionId, int64_t(functionId)) +
+                    ProtobufVarintFieldSize(LineField_Line, line);
+  size_t size = ProtobufVarintFieldSize(LocationField_Id, int64_t(id)) +
+                ProtobufLengthDelimitedFieldSize(LocationField_Line, lineSize);
+
+  ProtobufBuffer* out = &builder->locationData;
+  bool ok = ProtobufWriteLengthDelimitedHeader(out, ProfileField_Location, size) &&
+            ProtobufWriteVarintField(out, LocationField_Id, int64_t(id)) &&
+            ProtobufWriteLengthDelimitedHeader(out, LocationField_Line, lineSize) &&
+            ProtobufWriteVarintField(out, LineField_FunctionId, int64_t(functionId)) &&
+            ProtobufWriteVarintField(out, LineField_Line, line);
+
+  return ok ? id : 0;
+}
+
+bool PprofAddSampleType(PprofBuilder* builder, const char* type, const char* unit) {
+  int64_t typeIndex = PprofStringIndex(builder, type, strlen(type));
+  int64_t unitIndex = PprofStringIndex(builder, unit, strlen(unit));
+
+  if (typeIndex < 0 || unitIndex < 0) {
+    return false;
+  }
+
+  size_t size = ProtobufVarintFieldSize(ValueTypeField_Type, typeIndex) +
+                ProtobufVarintFieldSize(ValueTypeField_Unit, unitIndex);
+
+  ProtobufBuffer* out = &builder->sampleTypeData;
+  return ProtobufWriteLengthDelimitedHeader(out, ProfileField_SampleType, size) &&
+         ProtobufWriteVarintField(out, ValueTypeField_Type, typeIndex) &&
+         ProtobufWriteVarintField(out, ValueTypeField_Unit, unitIndex);
+}
+
+bool PprofAddSample(
+  PprofBuilder* builder, const uint64_t* locationIds, size_t locationCount, const int64_t* values,
+  size_t valueCount, const PprofLabel* labels, size_t labelCount) {
+  size_t locationsSize = 0;
+  for (size_t i = 0; i < locationCount; i++) {
+    locationsSize += ProtobufVarintSize(locationIds[i]);
+  }
+
+  size_t valuesSize = 0;
+  for (size_t i = 0; i < valueCount; i++) {
+    valuesSize += ProtobufVarintSize(uint64_t(values[i]));
+  }
+
+  size_t size = 0;
+
+  if (locationCount > 0) {
+    size += ProtobufLengthDelimitedFieldSize(SampleField_LocationId, locationsSize);
+  }
+
+  if (valueCount > 0) {
+    size += ProtobufLengthDelimitedFieldSize(SampleField_Value, valuesSize);
+  }
+
+  for (size_t i = 0; i < labelCount; i++) {
+    size += ProtobufLengthDelimitedFieldSize(SampleField_Label, LabelSize(&labels[i]));
+  }
+
+  ProtobufBuffer* out = &builder->sampleData;
+
+  if (!ProtobufBufferReserve(out, ProtobufLengthDelimitedFieldSize(ProfileField_Sample, size))) {
+    return false;
+  }
+
+  bool ok = ProtobufWriteLengthDelimitedHeader(out, ProfileField_Sample, size);
+
+  if (ok && locationCount > 0) {
+    ok = ProtobufWriteLengthDelimitedHeader(out, SampleField_LocationId, locationsSize);
+    for (size_t i = 0; ok && i < locationCount; i++) {
+      ok = ProtobufWriteVarint(out, locationIds[i]);
+    }
+  }
+
+  if (ok && valueCount > 0) {
+    ok = ProtobufWriteLengthDelimitedHeader(out, SampleField_Value, valuesSize);
+    for (size_t i = 0; ok && i < valueCount; i++) {
+      ok = ProtobufWriteVarint(out, uint64_t(values[i]));
+    }
+  }
+
+  for (size_t i = 0; ok && i < labelCount; i++) {
+    const PprofLabel* label = &labels[i];
+    ok = ProtobufWriteLengthDelimitedHeader(out, SampleField_Label, LabelSize(label)) &&
+         ProtobufWriteVarintField(out, LabelField_Key, label->key) &&
+         (label->isString ? ProtobufWriteVarintField(out, LabelField_Str, label->str)
+                          : ProtobufWriteVarintField(out, LabelField_Num, label->num));
+  }
+
+  if (ok) {
+    builder->sampleCount++;
+  }
+
+  return ok;
+}
+
+size_t PprofSampleCount(const PprofBuilder* builder) { return builder->sampleCount; }
+
+bool PprofFinish(PprofBuilder* builder, uint8_t** data, size_t* length) {
+  ProtobufBuffer* out = &builder->sampleTypeData;
+
+  // Field order follows the JS serializer: sample types, samples, locations,
+  // functions, strings.
+  bool ok =
+    ProtobufBufferAppend(out, builder->sampleData.data, builder->sampleData.size) &&
+    ProtobufBufferAppend(out, builder->locationData.data, builder->locationData.size) &&
+    ProtobufBufferAppend(out, builder->functionData.data, builder->functionData.size) &&
+    ProtobufBufferAppend(out, builder->stringData.data, builder->stringData.size);
+
+  if (!ok) {
+    return false;
+  }
+
+  // An empty profile is still a valid (empty) message, but hand out a real
+  // allocation so the caller can always take ownership.
+  if (!out->data && !ProtobufBufferReserve(out, 1)) {
+    return false;
+  }
+
+  *data = out->data;
+  *length = out->size;
+  ProtobufBufferInit(out);
+  return true;
+}
+
+} // namespace Profiling
+} // namespace Splunk
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Splunk {
+namespace Profiling {
+
+/**
+ * Incremental pprof (perftools.profiles.Profile) encoder.
+ * Strings, functions and locations are deduplicated and encoded as soon as they
+ * are first seen, samples are encoded as they are added. Nothing is kept around
+ * per sample, so the memory cost is proportional to the encoded output.
+ */
+struct PprofBuilder;
+
+/* String table entries interned up front, in the order the JS serializer uses. */
+enum PprofString {
+  PprofString_Empty = 0,
+  PprofString_SourceEventTime,
+  PprofString_TraceId,
+  PprofString_SpanId,
+  PprofString_SourceEventPeriod,
+};
+
+struct PprofLabel {
+  int64_t key;
+  // Index into the string table, used instead of num when isString is set.
+  int64_t str;
+  int64_t num;
+  bool isString;
+};
+
+PprofBuilder* PprofBuilderNew();
+void PprofBuilderFree(PprofBuilder* builder);
+
+/* Sample types describe the sample values, in the order they are added. */
+bool PprofAddSampleType(PprofBuilder* builder, const char* type, const char* unit);
+/* Returns -1 on allocation failure. */
+int64_t PprofStringIndex(PprofBuilder* builder, const char* str, size_t length);
+/* Returns 0 on allocation failure, valid location ids start at 1. */
+uint64_t PprofLocationId(
+  PprofBuilder* builder, const char* fileName, const char* functionName, int64_t line);
+bool PprofAddSample(
+  PprofBuilder* builder, const uint64_t* locationIds, size_t locationCount, const int64_t* values,
+  size_t valueCount, const PprofLabel* labels, size_t labelCount);
+size_t PprofSampleCount(const PprofBuilder* builder);
+
+/**
+ * Encodes the profile. On success the malloc'd output is owned by the caller,
+ * the builder can only be freed afterwards.
+ */
+bool PprofFinish(PprofBuilder* builder, uint8_t** data, size_t* length);
+
+} // namespace Profiling
+} // namespace Splunk
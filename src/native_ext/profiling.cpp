@@ -1,179 +1,235 @@
 #include "profiling.h"
+#include "activations.h"
+#include "context_stacks.h"
+#include "frame_rules.h"
+#include "frames.h"
 #include "khash.h"
 #include "memory_profiling.h"
+#include "pprof.h"
 #include "tinystl/vector.h"
 #include "util/arena.h"
 #include "util/hex.h"
 #include "util/modp_numtoa.h"
 #include "util/platform.h"
+#include "util/reservoir.h"
 #include "xxhash/xxh3.h"
 #include <cstdint>
 #include <inttypes.h>
+#include <memory>
 #include <nan.h>
 #include <stdio.h>
 #include <v8-profiler.h>
 
-/* Collecting debug info is not compiled in by default to reduce memory usage.
- */
-#define PROFILER_DEBUG_EXPORT 0
+// Fast API calls taking one-byte string views are only usable from V8 11
+// (Node.js 20) onwards, older versions only get the regular callbacks.
+#if defined(__has_include)
+#if __has_include(<v8-fast-api-calls.h>) && V8_MAJOR_VERSION >= 11
+#define SPLK_FAST_API_CALLS 1
+#include <v8-fast-api-calls.h>
+#endif
+#endif
 
 namespace Splunk {
 namespace Profiling {
 
 namespace {
 
-/* Nanoseconds each activation bin represents. */
-const int64_t kActivationBinWidth = 100L * 1000000L;
-/**
- * Span activations are grouped into chains of bins,
- * where each bin represents a small time period, e.g. 100ms.
- * This is done to ease matching against stacktrace timestamps
- * without requiring more complicated data structures (interval trees)
- * or matching against the whole profiling period.
- */
-const int64_t kActivationsPerBin = 64;
-const int64_t kBinsPerActivationPeriod = 384;
-
-struct SpanActivation {
-  char traceId[32];
-  char spanId[16];
-  int64_t startTime;
-  int64_t endTime;
-#if PROFILER_DEBUG_EXPORT
-  int32_t depth;
-  bool is_intersected;
-#endif
-};
-
-struct ActivationPeriod;
-
-struct ActivationBin {
-  SpanActivation activations[kActivationsPerBin];
-  int64_t count;
-  int32_t index;
-  ActivationPeriod *period;
-  ActivationBin *next;
-};
-
-struct ActivationPeriod {
-  ActivationBin activationBins[kBinsPerActivationPeriod];
-  ActivationPeriod *next;
-};
-
-/* Only used while tracking activations */
-struct ActivationStack {
-  static const int32_t kMaxActivations = 2;
-  int32_t count;
-  int32_t capacity;
-  SpanActivation activations[kMaxActivations];
-  SpanActivation *extra;
-};
-
-void ActivationStackInit(ActivationStack *stack) {
-  memset(stack, 0, sizeof(ActivationStack));
-  stack->capacity = ActivationStack::kMaxActivations;
-}
-
-SpanActivation *ActivationStackPush(ActivationStack *stack, PagedArena *arena) {
-  if (!stack->extra) {
-    if (stack->count < ActivationStack::kMaxActivations) {
-      return &stack->activations[stack->count++];
-    }
-
-    int32_t newCapacity = ActivationStack::kMaxActivations * 4;
-    stack->extra = (SpanActivation *)PagedArenaAlloc(
-        arena, sizeof(SpanActivation) * newCapacity);
-
-    if (!stack->extra) {
-      return nullptr;
-    }
-
-    for (int32_t i = 0; i < stack->count; i++) {
-      stack->extra[i] = stack->activations[i];
-    }
-
-    stack->capacity = newCapacity;
-  }
-
-  if (stack->count < stack->capacity) {
-    return &stack->extra[stack->count++];
-  }
-
-  int32_t newCapacity = stack->capacity * 1.5;
-  SpanActivation *extra = (SpanActivation *)PagedArenaAlloc(
-      arena, sizeof(SpanActivation) * newCapacity);
-
-  if (!extra) {
-    return nullptr;
-  }
-
-  for (int32_t i = 0; i < stack->count; i++) {
-    extra[i] = stack->extra[i];
-  }
-
-  stack->extra = extra;
-  stack->capacity = newCapacity;
-
-  return &stack->extra[stack->count++];
-}
-
-SpanActivation *ActivationStackPop(ActivationStack *stack) {
-  if (stack->count == 0) {
-    return nullptr;
-  }
-
-  int32_t index = stack->count - 1;
-  stack->count--;
-
-  if (!stack->extra) {
-    return &stack->activations[index];
-  }
-
-  return &stack->extra[index];
-}
+// Trace id hash to the bitmask of profilers filtering for it.
+KHASH_MAP_INIT_INT64(TraceIdFilters, uint64_t);
 
-KHASH_MAP_INIT_INT(ActivationStack, ActivationStack);
-KHASH_SET_INIT_INT64(TraceIdFilter);
+// Bounded by the width of the TraceIdFilters masks.
+const size_t kMaxProfilers = 64;
 
 // Maximum offset in nanoseconds from profiling start from which a sample is
 // considered always valid.
 const int64_t DEFAULT_MAX_SAMPLE_CUTOFF_DELAY_NANOS = 500LL * 1000LL * 1000LL;
 
+struct SampleAccumulator;
+struct LineTickTable;
+struct SamplingSource;
+
+// v8 attributes the samples taken outside of JS to these nodes.
+enum PseudoFrame {
+  PseudoFrame_Idle,
+  PseudoFrame_Program,
+  PseudoFrame_GarbageCollector,
+  PseudoFrame_Count,
+  PseudoFrame_None = PseudoFrame_Count,
+};
+
 struct Profiling {
   PagedArena arena;
-  ActivationPeriod *activationPeriod;
-  v8::CpuProfiler *profiler;
+  ActivationBins activations;
+  // Shared with the other profilers of the same naming and logging modes.
+  SamplingSource *source;
   int64_t wallStartTime;
   int64_t startTime;
+  // Start of the v8 profile being recorded, later than startTime once the
+  // profile has been rotated.
+  int64_t sliceStartTime;
+  // Timestamp of the last sample of the previous profile, or of the start
+  // request before the first one.
+  int64_t lastSampleTime;
+  // Largest gap between the samples of consecutive profiles since the last
+  // collect, see ProfilingRecordSampleGap.
+  int64_t maxSampleGap;
   int64_t maxSampleCutoffDelayNanos;
   // Point in time before which a sample is considered invalid, necessary to
   // avoid biases with self-sampling.
   int64_t sampleCutoffPoint;
   int32_t activationDepth;
+  // Activations coalesced into the preceding one since the last collect, see
+  // ProfilingExitContext.
+  int64_t activationsMerged;
+  // Self-overhead counters reported by stats(), never reset. See also
+  // activations.stats.
+  int64_t activationsDropped;
+  int64_t samplesDiscarded;
+  // Samples dropped to stay within maxMemoryBytes, never reset.
+  int64_t samplesDropped;
+  // Totals of the dropped activations and samples as of the last collect, see
+  // ProfilingTakeDropped.
+  int64_t reportedActivationsDropped;
+  int64_t reportedSamplesDropped;
+  // Sample buffer size v8 is started with, see ProfilingApplyMemoryBudget.
+  unsigned maxSamples;
+  // Samples kept by the accumulator, 0 for no limit.
+  size_t maxAccumulatedSamples;
   bool running;
   bool recordDebugInfo;
   bool onlyFilteredStacktraces;
+  bool aggregateSamples;
+  // Samples of the shared profile are downsampled to this interval.
   int64_t samplingIntervalNanos;
-  int32_t profilerSeq;
+  // Of the last profile rotated out, and the timestamp of the last sample
+  // taken from the profiles, see ProfilingVisitSamples.
+  int64_t profileIntervalNanos;
+  int64_t lastTakenSampleTime;
   int32_t handle;
-  khash_t(ActivationStack) * spanActivations;
-  khash_t(TraceIdFilter) * traceIdFilter;
+  // This profiler's bit in the TraceIdFilters masks.
+  uint64_t filterBit;
+  // Select the sampling source, only changed while not running.
+  v8::CpuProfilingNamingMode namingMode;
+  v8::CpuProfilingLoggingMode loggingMode;
+  // 0 when the profile is only rotated on collect.
+  int64_t rotationIntervalNanos;
+  bool rotating;
+  bool rotationTimerInitialized;
+  uv_timer_t rotationTimer;
+  // Samples of the profiles rotated since the last collect, see
+  // ProfilingFoldProfile.
+  SampleAccumulator *accumulator;
+  // Whether slices were folded into the accumulator since the last collect,
+  // by the rotation timer or by another consumer of the sampling source.
+  bool folded;
+  // Frames handed out by collectFrames, kept across collections until the
+  // profiler is started again.
+  FrameDictionary *frames;
+  size_t maxFrames;
+  // Line ticks gathered since the last collect, see ProfilingGatherLineTicks.
+  LineTickTable *lineTicks;
+  int32_t maxLineTickNodes;
+  // Whether pseudo frame samples are counted instead of exported, see
+  // PseudoFrameClassifier.
+  bool countPseudoFrames;
+  int64_t pseudoFrameTicks[PseudoFrame_Count];
+  // Applied to the stacks of every profile, see RawProfileCopy.
+  FrameRules frameRules;
+  ContextStacks spanActivations;
   // The name/prefix given via JS.
   char name[64];
 
   bool ShouldRecordDebugInfo() const { return recordDebugInfo; }
 };
 
+/**
+ * The v8 profiler shared by all profilers with the same naming and logging
+ * modes. A single profile is recorded at the finest sampling interval among
+ * the running ones, so that the isolate is only sampled once however many
+ * profilers are running. Every profile rotated out is handed to all of them,
+ * each downsampling and filtering the samples on its own, see
+ * SamplingSourceRotate.
+ */
+struct SamplingSource {
+  v8::CpuProfiler *profiler;
+  v8::CpuProfilingNamingMode namingMode;
+  v8::CpuProfilingLoggingMode loggingMode;
+  // Profilers set up with these modes, running or not.
+  int32_t users;
+  bool recording;
+  // Profiles alternate between two titles.
+  int32_t profileSeq;
+  // Of the profile being recorded, 0 if none.
+  int64_t samplingIntervalNanos;
+  unsigned maxSamples;
+};
+
+const int32_t kTimingBuckets = 12;
+const int64_t kTimingBucketBase = 64;
+const int64_t kTimedCallInterval = 16;
+
+/**
+ * Time spent in a hot callback. Every call is counted, but only one in
+ * kTimedCallInterval is timed so that reading the clock doesn't add to what is
+ * measured. Bucket i holds durations below kTimingBucketBase << i nanoseconds,
+ * the last one everything longer.
+ */
+struct CallTimings {
+  int64_t calls;
+  int64_t timedCalls;
+  int64_t timedNanos;
+  int64_t buckets[kTimingBuckets];
+};
+
+bool CallTimingsCount(CallTimings *timings) {
+  return timings->calls++ % kTimedCallInterval == 0;
+}
+
+void CallTimingsRecord(CallTimings *timings, int64_t nanos) {
+  int32_t bucket = 0;
+  while (bucket < kTimingBuckets - 1 &&
+         nanos >= (kTimingBucketBase << bucket)) {
+    bucket++;
+  }
+
+  timings->timedCalls++;
+  timings->timedNanos += nanos;
+  timings->buckets[bucket]++;
+}
+
 struct ProfilingGlobals {
   tinystl::vector<Profiling *> profilers;
+  tinystl::vector<SamplingSource *> samplingSources;
   int32_t handle = 0;
-
-  void Init() { handle = 0; }
+  // Checked first thing on every context switch.
+  bool anyRunning = false;
+  khash_t(TraceIdFilters) *traceIdFilters = nullptr;
+  // Shared with JS, see GetActivationRing.
+  Nan::Persistent<v8::SharedArrayBuffer> activationRingBuffer;
+  // Allocated once and never freed. A backing store held here would be
+  // released by the static destructors, after v8 is already gone.
+  ActivationRingHeader *activationRing = nullptr;
+  // Reported by stats(), see ProfilingStats.
+  CallTimings enterContextTimings = {};
+  CallTimings exitContextTimings = {};
+  // Timed on every drain, which is cheap next to replaying the events.
+  CallTimings ringDrainTimings = {};
+  int64_t ringEventsReplayed = 0;
+
+  void Init() {
+    handle = 0;
+    traceIdFilters = kh_init(TraceIdFilters);
+  }
 
   Profiling *NewProfiling() {
+    if (profilers.size() >= kMaxProfilers) {
+      return nullptr;
+    }
+
     Profiling *profiling = (Profiling *)calloc(1, sizeof(Profiling));
 
     if (profiling) {
+      profiling->filterBit = uint64_t(1) << profilers.size();
       profiling->handle = handle++;
       profilers.push_back(profiling);
     }
@@ -184,6 +240,12 @@ struct ProfilingGlobals {
 
 ProfilingGlobals globals;
 
+void DrainActivationRing();
+void UpdateRunningState();
+void ProfilingStartRotation(Profiling *profiling);
+void ProfilingStopRotation(Profiling *profiling);
+void SamplingSourceAttach(Profiling *profiling);
+
 Profiling *GetProfilingByHandle(int32_t handle) {
   for (size_t i = 0; i < globals.profilers.size(); i++) {
     Profiling *profiling = globals.profilers[i];
@@ -210,134 +272,64 @@ Profiling *GetProfilingByName(const char *name, size_t name_length) {
   return nullptr;
 }
 
+// Activations are binned relative to the monotonic start time.
+void ProfilingSetStartTime(Profiling *profiling, int64_t startTime,
+                           int64_t wallStartTime) {
+  profiling->startTime = startTime;
+  profiling->sliceStartTime = startTime;
+  profiling->wallStartTime = wallStartTime;
+  profiling->activations.startTime = startTime;
+}
+
 void ProfilingInit(Profiling *profiling, const char *name, size_t name_length) {
+  // Only reserved, memory is committed as activations come in and trimmed
+  // back on reset.
   const size_t kArenaPageSize = 1024ULL * 1024ULL * 64ULL;
   PagedArenaInit(&profiling->arena, kArenaPageSize);
-  profiling->spanActivations = kh_init(ActivationStack);
-  profiling->traceIdFilter = kh_init(TraceIdFilter);
+  ContextStacksInit(&profiling->spanActivations);
+  ActivationBinsInit(&profiling->activations, &profiling->arena);
 
   snprintf(profiling->name, sizeof(profiling->name), "%.*s", (int)name_length,
            name);
 }
 
-void *ArenaAlloc(Profiling *profiling, size_t size) {
-  return PagedArenaAlloc(&profiling->arena, size);
-}
-
-ActivationPeriod *NewActivationPeriod(Profiling *profiling) {
-  ActivationPeriod *period =
-      (ActivationPeriod *)ArenaAlloc(profiling, sizeof(ActivationPeriod));
-
-  if (!period) {
-    return nullptr;
-  }
-
-  int32_t index = 0;
-  for (ActivationBin &bin : period->activationBins) {
-    bin.index = index++;
-    bin.period = period;
-  }
-
-  return period;
-}
-
-int64_t ActivationBinIndex(Profiling *profiling, int64_t timestamp) {
-  int64_t delta = timestamp - profiling->startTime;
-  return delta / kActivationBinWidth;
-}
-
-ActivationBin *ProfilingGetActivationBin(Profiling *profiling,
-                                         int64_t binIndex) {
-  int64_t periodIndex = binIndex / kBinsPerActivationPeriod;
-
-  int64_t currentPeriod = 0;
-
-  ActivationPeriod *period = profiling->activationPeriod;
-  while (currentPeriod < periodIndex) {
-    if (period->next) {
-      period = period->next;
-    } else {
-      ActivationPeriod *newPeriod = NewActivationPeriod(profiling);
-      period->next = newPeriod;
-      period = newPeriod;
-    }
-    currentPeriod++;
-  }
-
-  int64_t index = binIndex - periodIndex * kBinsPerActivationPeriod;
-
-  return &period->activationBins[index];
-}
-
-SpanActivation *FindClosestActivation(Profiling *profiling, int64_t ts) {
-  SpanActivation *t = nullptr;
-  ActivationBin *bin =
-      ProfilingGetActivationBin(profiling, ActivationBinIndex(profiling, ts));
-
-  while (bin) {
-    for (int64_t i = 0; i < bin->count; i++) {
-      SpanActivation *activation = &bin->activations[i];
-      if (activation->startTime <= ts && ts <= activation->endTime) {
-        if (!t || activation->startTime > t->startTime) {
-          t = activation;
-        }
-      }
-    }
-    bin = bin->next;
-  }
-
-  return t;
-}
-
-void BinInsertActivation(Profiling *profiling, ActivationBin *bin,
-                         SpanActivation *activation) {
-  // Iterate until last bin
-  while (bin->next) {
-    bin = bin->next;
-  }
-
-  // If the last bin is empty, expand
-  if (bin->count == kActivationsPerBin) {
-    ActivationBin *newBin =
-        (ActivationBin *)ArenaAlloc(profiling, sizeof(ActivationBin));
-
-    if (!newBin) {
-      return;
-    }
-
-    newBin->index = bin->index;
-    newBin->period = bin->period;
-    bin->next = newBin;
-    bin = newBin;
+// Whoever collects frames next starts over with an empty dictionary.
+void ProfilingFreeFrames(Profiling *profiling) {
+  if (profiling->frames) {
+    FrameDictionaryFree(profiling->frames);
+    profiling->frames = nullptr;
   }
-
-  bin->activations[bin->count++] = *activation;
 }
 
-void InsertActivation(Profiling *profiling, SpanActivation *activation) {
-  int64_t startBinIndex = ActivationBinIndex(profiling, activation->startTime);
-  int64_t endBinIndex = ActivationBinIndex(profiling, activation->endTime);
-
-  {
-    ActivationBin *startBin =
-        ProfilingGetActivationBin(profiling, startBinIndex);
-    BinInsertActivation(profiling, startBin, activation);
-  }
+struct DroppedCounts {
+  int64_t activations;
+  int64_t samples;
+};
 
-  // Spread the activation into overlapping bins
-  for (int64_t i = startBinIndex + 1; i <= endBinIndex; i++) {
-    ActivationBin *bin = ProfilingGetActivationBin(profiling, i);
-    BinInsertActivation(profiling, bin, activation);
-  }
+// Returns the activations and samples dropped since the previous call.
+DroppedCounts ProfilingTakeDropped(Profiling *profiling) {
+  int64_t activations =
+      profiling->activations.stats.dropped + profiling->activationsDropped;
+  DroppedCounts dropped = {
+      activations - profiling->reportedActivationsDropped,
+      profiling->samplesDropped - profiling->reportedSamplesDropped};
+  profiling->reportedActivationsDropped = activations;
+  profiling->reportedSamplesDropped = profiling->samplesDropped;
+  return dropped;
 }
 
-void V8StartProfiling(v8::CpuProfiler *profiler, const char *title) {
+// Past maxSamples v8 keeps counting the hits of the nodes, without recording
+// the samples themselves.
+void V8StartProfiling(v8::CpuProfiler *profiler, const char *title,
+                      unsigned maxSamples) {
   v8::Local<v8::String> v8Title = Nan::New(title).ToLocalChecked();
   const bool recordSamples = true;
   profiler->StartProfiling(v8Title, v8::kLeafNodeLineNumbers, recordSamples,
-                           v8::CpuProfilingOptions::kNoSampleLimit);
+                           maxSamples);
 }
 
+const char *const kSamplingSourceTitle = "splunk-sampling-source";
+
 void ProfileTitle(char *buffer, size_t length, const char *prefix,
                   int32_t sequence) {
   snprintf(buffer, length, "%s-%d", prefix, sequence);
@@ -347,51 +339,225 @@ struct ProfilingOptions {
   int32_t samplingIntervalMicros;
   bool recordDebugInfo;
   bool onlyFilteredStacktraces;
+  bool aggregateSamples;
   int64_t maxSampleCutoffDelayNanos;
+  int64_t rotationIntervalNanos;
+  v8::CpuProfilingNamingMode namingMode;
+  v8::CpuProfilingLoggingMode loggingMode;
+  size_t maxFrames;
+  int32_t maxLineTickNodes;
+  bool countPseudoFrames;
+  size_t maxMemoryBytes;
+  // Owned until taken over by ApplyProfilingOptions.
+  FrameRules frameRules;
   char name[64];
   size_t name_length;
 };
 
 // Defined below; reused profilers are reset before restart (see StartProfiling).
 void ProfilingReset(Profiling *profiling);
+void ProfilingApplyMemoryBudget(Profiling *profiling, size_t budget);
+
+/**
+ * Returns the sampling source of the given modes, created on first use, or
+ * nullptr on allocation failure. To be released by every profiler it is
+ * acquired for.
+ *
+ * With eager logging v8 keeps logging code events for as long as the profiler
+ * exists, instead of logging all existing code on every start. That costs some
+ * work on every code creation, but starting a profile becomes cheap and
+ * sampling starts right away, which suits profilers that are started often or
+ * have to start quickly (snapshots).
+ */
+SamplingSource *AcquireSamplingSource(v8::CpuProfilingNamingMode namingMode,
+                                      v8::CpuProfilingLoggingMode loggingMode) {
+  for (size_t i = 0; i < globals.samplingSources.size(); i++) {
+    SamplingSource *source = globals.samplingSources[i];
+
+    if (source->namingMode == namingMode &&
+        source->loggingMode == loggingMode) {
+      source->users++;
+      return source;
+    }
+  }
+
+  SamplingSource *source = (SamplingSource *)calloc(1, sizeof(SamplingSource));
+
+  if (!source) {
+    return nullptr;
+  }
+
+  source->profiler = v8::CpuProfiler::New(v8::Isolate::GetCurrent(),
+                                          namingMode, loggingMode);
+  source->namingMode = namingMode;
+  source->loggingMode = loggingMode;
+  source->users = 1;
+  globals.samplingSources.push_back(source);
+  return source;
+}
+
+// Disposes of the v8 profiler once no profiler uses it anymore.
+void ReleaseSamplingSource(SamplingSource *source) {
+  if (--source->users > 0) {
+    return;
+  }
+
+  for (size_t i = 0; i < globals.samplingSources.size(); i++) {
+    if (globals.samplingSources[i] == source) {
+      globals.samplingSources.erase_unordered(
+          globals.samplingSources.begin() + i);
+      break;
+    }
+  }
+
+  source->profiler->Dispose();
+  free(source);
+}
 
 // Applies the (re)configurable knobs to an existing profiler. Split out so a
 // reused profiler (see StartProfiling) can pick up a changed sampling interval
-// without reallocating; the sampling interval is only honored by the next
-// StartProfiling because v8 bakes it in at start.
+// without reallocating; the sampling source only starts sampling at a changed
+// interval with the next profile it starts. Takes over the frame rules.
 void ApplyProfilingOptions(Profiling *profiling,
                            const ProfilingOptions *options) {
+  FrameRulesFree(&profiling->frameRules);
+  profiling->frameRules = options->frameRules;
   profiling->recordDebugInfo = options->recordDebugInfo;
   profiling->onlyFilteredStacktraces = options->onlyFilteredStacktraces;
+  profiling->aggregateSamples = options->aggregateSamples;
   profiling->maxSampleCutoffDelayNanos = options->maxSampleCutoffDelayNanos;
+  profiling->rotationIntervalNanos = options->rotationIntervalNanos;
+  profiling->maxFrames = options->maxFrames;
+  profiling->maxLineTickNodes = options->maxLineTickNodes;
+  profiling->countPseudoFrames = options->countPseudoFrames;
   profiling->samplingIntervalNanos =
       int64_t(options->samplingIntervalMicros) * 1000L;
-  profiling->profiler->SetSamplingInterval(options->samplingIntervalMicros);
+  // Last, it may shorten the rotation interval.
+  ProfilingApplyMemoryBudget(profiling, options->maxMemoryBytes);
+
+  // The timer of a running profiler still ticks at the previous interval.
+  if (profiling->running) {
+    ProfilingStopRotation(profiling);
+    ProfilingStartRotation(profiling);
+  }
+
+  bool modesChanged = options->namingMode != profiling->namingMode ||
+                      options->loggingMode != profiling->loggingMode;
+
+  if (modesChanged && !profiling->running) {
+    SamplingSource *source =
+        AcquireSamplingSource(options->namingMode, options->loggingMode);
+
+    // Otherwise keeps sampling with the previous modes.
+    if (source) {
+      ReleaseSamplingSource(profiling->source);
+      profiling->source = source;
+      profiling->namingMode = options->namingMode;
+      profiling->loggingMode = options->loggingMode;
+    }
+  }
 }
 
 Profiling *SetupProfiling(const ProfilingOptions *options,
                           v8::Isolate *isolate) {
+  SamplingSource *source =
+      AcquireSamplingSource(options->namingMode, options->loggingMode);
+
+  if (!source) {
+    return nullptr;
+  }
+
   Profiling *profiling = globals.NewProfiling();
 
   if (!profiling) {
+    ReleaseSamplingSource(source);
     return nullptr;
   }
 
   ProfilingInit(profiling, options->name, options->name_length);
-  profiling->profiler = v8::CpuProfiler::New(isolate);
+  profiling->source = source;
+  profiling->namingMode = options->namingMode;
+  profiling->loggingMode = options->loggingMode;
 
-  PagedArenaReset(&profiling->arena);
-  profiling->activationPeriod = NewActivationPeriod(profiling);
+  ApplyProfilingOptions(profiling, options);
+  ProfilingReset(profiling);
 
-  if (!profiling->activationPeriod) {
-    globals.profilers.pop_back();
-    free(profiling);
-    return nullptr;
+  return profiling;
+}
+
+// Whether the option is set to the given string.
+bool StringOption(v8::Local<v8::Object> options, const char *key,
+                  const char *expected) {
+  auto maybeValue = Nan::Get(options, Nan::New(key).ToLocalChecked());
+
+  if (maybeValue.IsEmpty() || !maybeValue.ToLocalChecked()->IsString()) {
+    return false;
   }
 
-  ApplyProfilingOptions(profiling, options);
+  Nan::Utf8String value(maybeValue.ToLocalChecked());
+  return strcmp(*value, expected) == 0;
+}
 
-  return profiling;
+// Returns false on allocation failure.
+bool ParseFrameRules(v8::Local<v8::Object> options, FrameRules *rules) {
+  FrameRulesInit(rules);
+
+  auto maybeMaxStackDepth =
+      Nan::Get(options, Nan::New("maxStackDepth").ToLocalChecked());
+
+  if (!maybeMaxStackDepth.IsEmpty() &&
+      maybeMaxStackDepth.ToLocalChecked()->IsNumber()) {
+    int32_t value =
+        Nan::To<int32_t>(maybeMaxStackDepth.ToLocalChecked()).FromJust();
+
+    // Room for at least the leaf, the root end and the truncation frame.
+    if (value > 0) {
+      rules->maxStackDepth = value < 3 ? 3 : value;
+    }
+  }
+
+  auto maybeFoldRecursion =
+      Nan::Get(options, Nan::New("foldRecursion").ToLocalChecked());
+
+  if (!maybeFoldRecursion.IsEmpty() &&
+      maybeFoldRecursion.ToLocalChecked()->IsBoolean()) {
+    rules->foldRecursion =
+        Nan::To<bool>(maybeFoldRecursion.ToLocalChecked()).FromJust();
+  }
+
+  auto maybePrefixes =
+      Nan::Get(options, Nan::New("excludedScriptPrefixes").ToLocalChecked());
+
+  if (maybePrefixes.IsEmpty() || !maybePrefixes.ToLocalChecked()->IsArray()) {
+    return true;
+  }
+
+  auto jsPrefixes = maybePrefixes.ToLocalChecked().As<v8::Array>();
+  // NUL terminated, back to back.
+  tinystl::vector<char> storage;
+  tinystl::vector<size_t> offsets;
+
+  for (uint32_t i = 0; i < jsPrefixes->Length(); i++) {
+    auto maybePrefix = Nan::Get(jsPrefixes, i);
+
+    if (maybePrefix.IsEmpty() || !maybePrefix.ToLocalChecked()->IsString()) {
+      continue;
+    }
+
+    Nan::Utf8String prefix(maybePrefix.ToLocalChecked());
+    size_t offset = storage.size();
+    storage.resize(offset + prefix.length() + 1);
+    memcpy(&storage[offset], *prefix, prefix.length() + 1);
+    offsets.push_back(offset);
+  }
+
+  tinystl::vector<const char *> prefixes;
+  for (size_t i = 0; i < offsets.size(); i++) {
+    prefixes.push_back(&storage[offsets[i]]);
+  }
+
+  return FrameRulesSetExcludedPrefixes(rules, prefixes.data(),
+                                       prefixes.size());
 }
 
 // Will return false if a JS error is thrown.
@@ -464,6 +630,30 @@ bool CreateCpuProfilingOptions(const Nan::FunctionCallbackInfo<v8::Value> &info,
     }
   }
 
+  auto maybeAggregateSamples =
+      Nan::Get(options, Nan::New("aggregateSamples").ToLocalChecked());
+
+  bool aggregateSamples = false;
+
+  if (!maybeAggregateSamples.IsEmpty() &&
+      maybeAggregateSamples.ToLocalChecked()->IsBoolean()) {
+    if (Nan::To<bool>(maybeAggregateSamples.ToLocalChecked()).FromJust()) {
+      aggregateSamples = true;
+    }
+  }
+
+  auto maybeCountPseudoFrames =
+      Nan::Get(options, Nan::New("countPseudoFrames").ToLocalChecked());
+
+  bool countPseudoFrames = false;
+
+  if (!maybeCountPseudoFrames.IsEmpty() &&
+      maybeCountPseudoFrames.ToLocalChecked()->IsBoolean()) {
+    if (Nan::To<bool>(maybeCountPseudoFrames.ToLocalChecked()).FromJust()) {
+      countPseudoFrames = true;
+    }
+  }
+
   auto maybeMaxSampleCutoffDelay = Nan::Get(
       options, Nan::New("maxSampleCutoffDelayMicroseconds").ToLocalChecked());
   int64_t maxSampleCutoffDelayNanos = DEFAULT_MAX_SAMPLE_CUTOFF_DELAY_NANOS;
@@ -475,13 +665,92 @@ bool CreateCpuProfilingOptions(const Nan::FunctionCallbackInfo<v8::Value> &info,
     maxSampleCutoffDelayNanos = maxSampleCutoffDelayMicros * 1000LL;
   }
 
+  auto maybeRotationInterval =
+      Nan::Get(options, Nan::New("rotationIntervalMillis").ToLocalChecked());
+  int64_t rotationIntervalNanos = 0;
+
+  if (!maybeRotationInterval.IsEmpty() &&
+      maybeRotationInterval.ToLocalChecked()->IsNumber()) {
+    int64_t rotationIntervalMillis =
+        Nan::To<int64_t>(maybeRotationInterval.ToLocalChecked()).FromJust();
+
+    if (rotationIntervalMillis > 0) {
+      rotationIntervalNanos = rotationIntervalMillis * 1000000LL;
+    }
+  }
+
+  auto maybeMaxFrames =
+      Nan::Get(options, Nan::New("maxFrames").ToLocalChecked());
+  size_t maxFrames = kDefaultMaxFrames;
+
+  if (!maybeMaxFrames.IsEmpty() &&
+      maybeMaxFrames.ToLocalChecked()->IsNumber()) {
+    int64_t value =
+        Nan::To<int64_t>(maybeMaxFrames.ToLocalChecked()).FromJust();
+
+    if (value > 0) {
+      maxFrames = size_t(value);
+    }
+  }
+
+  auto maybeMaxLineTickNodes =
+      Nan::Get(options, Nan::New("maxLineTickNodes").ToLocalChecked());
+  int32_t maxLineTickNodes = 0;
+
+  if (!maybeMaxLineTickNodes.IsEmpty() &&
+      maybeMaxLineTickNodes.ToLocalChecked()->IsNumber()) {
+    int32_t value =
+        Nan::To<int32_t>(maybeMaxLineTickNodes.ToLocalChecked()).FromJust();
+
+    if (value > 0) {
+      maxLineTickNodes = value;
+    }
+  }
+
+  auto maybeMaxMemoryBytes =
+      Nan::Get(options, Nan::New("maxMemoryBytes").ToLocalChecked());
+  size_t maxMemoryBytes = 0;
+
+  if (!maybeMaxMemoryBytes.IsEmpty() &&
+      maybeMaxMemoryBytes.ToLocalChecked()->IsNumber()) {
+    int64_t value =
+        Nan::To<int64_t>(maybeMaxMemoryBytes.ToLocalChecked()).FromJust();
+
+    if (value > 0) {
+      maxMemoryBytes = size_t(value);
+    }
+  }
+
+  profilingOptions->namingMode = v8::kDebugNaming;
+  profilingOptions->loggingMode = v8::kLazyLogging;
+
+  if (StringOption(options, "namingMode", "standard")) {
+    profilingOptions->namingMode = v8::kStandardNaming;
+  }
+
+  if (StringOption(options, "loggingMode", "eager")) {
+    profilingOptions->loggingMode = v8::kEagerLogging;
+  }
+
   profilingOptions->samplingIntervalMicros = samplingIntervalMicros;
   profilingOptions->maxSampleCutoffDelayNanos = maxSampleCutoffDelayNanos;
+  profilingOptions->rotationIntervalNanos = rotationIntervalNanos;
+  profilingOptions->maxFrames = maxFrames;
+  profilingOptions->maxLineTickNodes = maxLineTickNodes;
+  profilingOptions->countPseudoFrames = countPseudoFrames;
+  profilingOptions->maxMemoryBytes = maxMemoryBytes;
   profilingOptions->recordDebugInfo = recordDebugInfo;
   profilingOptions->onlyFilteredStacktraces = onlyFilteredStacktraces;
+  profilingOptions->aggregateSamples = aggregateSamples;
   memcpy(profilingOptions->name, *profilerNameUtf8, profilerNameUtf8.length());
   profilingOptions->name_length = profilerNameUtf8.length();
 
+  // Last, nothing is thrown once the rules are allocated.
+  if (!ParseFrameRules(options, &profilingOptions->frameRules)) {
+    Nan::ThrowError("CpuProfiler: unable to allocate frame rules.");
+    return false;
+  }
+
   return true;
 }
 
@@ -507,6 +776,7 @@ NAN_METHOD(GetOrCreateCpuProfiler) {
   }
 
   if (!profiling) {
+    FrameRulesFree(&opts.frameRules);
     Nan::ThrowError("GetOrCreateCpuProfiler: unable to allocate profiler.");
     return;
   }
@@ -514,6 +784,27 @@ NAN_METHOD(GetOrCreateCpuProfiler) {
   info.GetReturnValue().Set(profiling->handle);
 }
 
+void ProfilingStart(Profiling *profiling) {
+  // Events recorded so far belong to the other profilers.
+  DrainActivationRing();
+
+  profiling->activationDepth = 0;
+  ProfilingSetStartTime(profiling, HrTime(), MicroSecondsSinceEpoch() * 1000L);
+  profiling->lastSampleTime = profiling->startTime;
+  profiling->maxSampleGap = 0;
+  profiling->lastTakenSampleTime = 0;
+  profiling->activationsMerged = 0;
+  // Only the ones of this run get reported.
+  ProfilingTakeDropped(profiling);
+  ProfilingFreeFrames(profiling);
+  // Before attaching, for the sampling source to sample at its interval.
+  profiling->running = true;
+  SamplingSourceAttach(profiling);
+  profiling->sampleCutoffPoint = HrTime();
+  UpdateRunningState();
+  ProfilingStartRotation(profiling);
+}
+
 NAN_METHOD(StartCpuProfiler) {
   auto handle = Nan::To<int32_t>(info[0]).ToChecked();
 
@@ -529,20 +820,24 @@ NAN_METHOD(StartCpuProfiler) {
     return;
   }
 
-  char title[128];
-  ProfileTitle(title, sizeof(title), profiling->name, profiling->profilerSeq);
-
-  profiling->activationDepth = 0;
-  profiling->startTime = HrTime();
-  profiling->wallStartTime = MicroSecondsSinceEpoch() * 1000L;
-  V8StartProfiling(profiling->profiler, title);
-  profiling->sampleCutoffPoint = HrTime();
-  profiling->running = true;
-
+  ProfilingStart(profiling);
   info.GetReturnValue().Set(true);
   return;
 }
 
+// Filters are keyed by the binary trace id, the form activations keep.
+bool TraceIdFilterHash(const v8::String::Utf8Value &traceIdHex,
+                       uint64_t *hash) {
+  uint8_t traceId[kTraceIdSize];
+  if (!HexToBinary(*traceIdHex, traceIdHex.length(), traceId,
+                   sizeof(traceId))) {
+    return false;
+  }
+
+  *hash = XXH3_64bits(traceId, sizeof(traceId));
+  return true;
+}
+
 NAN_METHOD(AddTraceIdFilter) {
   info.GetReturnValue().SetUndefined();
 
@@ -562,10 +857,23 @@ NAN_METHOD(AddTraceIdFilter) {
   //auto traceId = Nan::To<v8::String>(info[1]).ToLocalChecked();
   v8::String::Utf8Value traceIdUtf8(info.GetIsolate(), traceId);
 
-  uint64_t hash = XXH3_64bits(*traceIdUtf8, traceIdUtf8.length());
+  uint64_t hash;
+  if (!TraceIdFilterHash(traceIdUtf8, &hash)) {
+    return;
+  }
 
   int ret;
-  kh_put(TraceIdFilter, profiling->traceIdFilter, hash, &ret);
+  khiter_t it = kh_put(TraceIdFilters, globals.traceIdFilters, hash, &ret);
+
+  if (ret == -1) {
+    return;
+  }
+
+  if (ret != 0) {
+    kh_value(globals.traceIdFilters, it) = 0;
+  }
+
+  kh_value(globals.traceIdFilters, it) |= profiling->filterBit;
 
   return;
 }
@@ -583,12 +891,23 @@ NAN_METHOD(RemoveTraceIdFilter) {
   auto traceId = Nan::To<v8::String>(info[1]).ToLocalChecked();
   v8::String::Utf8Value traceIdUtf8(info.GetIsolate(), traceId);
 
-  uint64_t traceIdHash = XXH3_64bits(*traceIdUtf8, traceIdUtf8.length());
+  uint64_t traceIdHash;
+  if (!TraceIdFilterHash(traceIdUtf8, &traceIdHash)) {
+    return;
+  }
+
+  khiter_t it = kh_get(TraceIdFilters, globals.traceIdFilters, traceIdHash);
 
-  khiter_t it = kh_get(TraceIdFilter, profiling->traceIdFilter, traceIdHash);
+  if (it == kh_end(globals.traceIdFilters)) {
+    return;
+  }
 
-  if (it != kh_end(profiling->traceIdFilter)) {
-    kh_del(TraceIdFilter, profiling->traceIdFilter, it);
+  uint64_t mask = kh_value(globals.traceIdFilters, it) & ~profiling->filterBit;
+
+  if (mask == 0) {
+    kh_del(TraceIdFilters, globals.traceIdFilters, it);
+  } else {
+    kh_value(globals.traceIdFilters, it) = mask;
   }
 
   return;
@@ -613,6 +932,7 @@ NAN_METHOD(StartProfiling) {
 
   if (profiling) {
     if (profiling->running) {
+      FrameRulesFree(&opts.frameRules);
       Nan::ThrowError("CpuProfiler: profiler already running.");
       return;
     }
@@ -623,20 +943,12 @@ NAN_METHOD(StartProfiling) {
   }
 
   if (!profiling) {
+    FrameRulesFree(&opts.frameRules);
     Nan::ThrowError("StartProfiling: unable to allocate profiler.");
     return;
   }
 
-  char title[128];
-  ProfileTitle(title, sizeof(title), profiling->name, profiling->profilerSeq);
-
-  profiling->activationDepth = 0;
-  profiling->startTime = HrTime();
-  profiling->wallStartTime = MicroSecondsSinceEpoch() * 1000L;
-  V8StartProfiling(profiling->profiler, title);
-  profiling->sampleCutoffPoint = HrTime();
-  profiling->running = true;
-
+  ProfilingStart(profiling);
   info.GetReturnValue().Set(profiling->handle);
 }
 
@@ -647,7 +959,7 @@ bool ShouldIncludeSample(Profiling *profiling, int64_t sampleTimestamp) {
   // - the profiler collect step is way too slow
   // - the sample is not one of the first few samples, so exit early
   if (sampleTimestamp >=
-      profiling->startTime + profiling->maxSampleCutoffDelayNanos) {
+      profiling->sliceStartTime + profiling->maxSampleCutoffDelayNanos) {
     return true;
   }
 
@@ -675,13 +987,15 @@ v8::Local<v8::Object> JsActivation(Profiling *profiling,
            Nan::New<v8::String>(startTs, startTsLen).ToLocalChecked());
   Nan::Set(jsActivation, Nan::New<v8::String>("end").ToLocalChecked(),
            Nan::New<v8::String>(endTs, endTsLen).ToLocalChecked());
-  Nan::Set(
-      jsActivation, Nan::New<v8::String>("traceId").ToLocalChecked(),
-      Nan::New<v8::String>(activation->traceId, sizeof(activation->traceId))
-          .ToLocalChecked());
+  char traceId[kTraceIdSize * 2];
+  char spanId[kSpanIdSize * 2];
+  BinaryToHex(activation->traceId, kTraceIdSize, traceId);
+  BinaryToHex(activation->spanId, kSpanIdSize, spanId);
+
+  Nan::Set(jsActivation, Nan::New<v8::String>("traceId").ToLocalChecked(),
+           Nan::New<v8::String>(traceId, sizeof(traceId)).ToLocalChecked());
   Nan::Set(jsActivation, Nan::New<v8::String>("spanId").ToLocalChecked(),
-           Nan::New<v8::String>(activation->spanId, sizeof(activation->spanId))
-               .ToLocalChecked());
+           Nan::New<v8::String>(spanId, sizeof(spanId)).ToLocalChecked());
   Nan::Set(jsActivation, Nan::New<v8::String>("depth").ToLocalChecked(),
            Nan::New<v8::Int32>(activation->depth));
   Nan::Set(jsActivation, Nan::New<v8::String>("hit").ToLocalChecked(),
@@ -690,6 +1004,20 @@ v8::Local<v8::Object> JsActivation(Profiling *profiling,
 }
 #endif
 
+#if PROFILER_DEBUG_EXPORT
+void AppendDebugActivations(Profiling *profiling, const ActivationSlot *slot,
+                            v8::Local<v8::Array> jsActivations,
+                            int32_t *activationIndex) {
+  for (ActivationBin *bin = slot->head; bin; bin = bin->next) {
+    for (int64_t i = 0; i < bin->count; i++) {
+      const SpanActivation *activation = &bin->activations[i];
+      Nan::Set(jsActivations, (*activationIndex)++,
+               JsActivation(profiling, activation));
+    }
+  }
+}
+#endif
+
 void ProfilingRecordDebugInfo(Profiling *profiling,
                               v8::Local<v8::Object> profilingData) {
 #if PROFILER_DEBUG_EXPORT
@@ -700,36 +1028,88 @@ void ProfilingRecordDebugInfo(Profiling *profiling,
   int32_t activationIndex = 0;
   auto jsActivations = Nan::New<v8::Array>();
 
-  ActivationPeriod *period = profiling->activationPeriod;
+  const ActivationBins *bins = &profiling->activations;
+  int64_t slotCount = bins->pageCount * kActivationSlotsPerPage;
 
-  while (period) {
-    for (const ActivationBin &bin : period->activationBins) {
-      for (int64_t i = 0; i < bin.count; i++) {
-        const SpanActivation *activation = &bin.activations[i];
-        Nan::Set(jsActivations, activationIndex++,
-                 JsActivation(profiling, activation));
-      }
-
-      ActivationBin *nextBin = bin.next;
+  for (int64_t slotIndex = 0; slotIndex < slotCount; slotIndex++) {
+    ActivationSlot *slot = ActivationBinsGet(bins, slotIndex);
 
-      while (nextBin) {
-        for (int64_t i = 0; i < nextBin->count; i++) {
-          SpanActivation *activation = &nextBin->activations[i];
-          Nan::Set(jsActivations, activationIndex++,
-                   JsActivation(profiling, activation));
-        }
-        nextBin = nextBin->next;
-      }
+    if (slot) {
+      AppendDebugActivations(profiling, slot, jsActivations, &activationIndex);
     }
-    period = period->next;
   }
 
+  AppendDebugActivations(profiling, &bins->longActivations, jsActivations,
+                         &activationIndex);
+
   Nan::Set(profilingData, Nan::New<v8::String>("activations").ToLocalChecked(),
            jsActivations);
 #endif
 }
 
-v8::Local<v8::Array> makeStackLine(const v8::CpuProfileNode *node) {
+/**
+ * A sample handed to the output formats. With aggregateSamples, all samples
+ * sharing the leaf node and the matched span are merged into one.
+ */
+template <typename Node> struct ProfileSample {
+  const Node *node;
+  SpanActivation *match;
+  // Monotonic timestamps of the first and the last merged sample.
+  int64_t firstTs;
+  int64_t lastTs;
+  int64_t count;
+  // Nanoseconds elapsed since the preceding sample, summed when merged.
+  int64_t weight;
+};
+
+KHASH_MAP_INIT_INT64(SampleAggregates, size_t);
+
+uint64_t SpanHash(const SpanActivation *activation) {
+  return XXH3_64bits_withSeed(
+      activation->spanId, sizeof(activation->spanId),
+      XXH3_64bits(activation->traceId, sizeof(activation->traceId)));
+}
+
+/**
+ * The parts of a v8::CpuProfile needed to encode it, copied so that the
+ * profile can be deleted right away and the encoding done off the main
+ * thread. The accessors mirror the v8::CpuProfile and v8::CpuProfileNode ones
+ * used by ProfilingVisitSamples and PprofVisitor.
+ */
+struct RawProfileNode {
+  const RawProfileNode *parent;
+  const char *functionName;
+  const char *scriptName;
+  // Index into RawProfile::nodes, -1 for the root.
+  int32_t parentIndex;
+  // Offsets into RawProfile::strings.
+  uint32_t functionNameOffset;
+  uint32_t scriptNameOffset;
+  uint32_t nodeId;
+  int32_t scriptId;
+  int32_t lineNumber;
+  int32_t columnNumber;
+  // Length of the run of recursive frames folded into this one, see
+  // FrameRules.
+  int32_t repeatCount;
+
+  unsigned GetNodeId() const { return nodeId; }
+  int GetScriptId() const { return scriptId; }
+  const RawProfileNode *GetParent() const { return parent; }
+  const char *GetFunctionNameStr() const { return functionName; }
+  const char *GetScriptResourceNameStr() const { return scriptName; }
+  int GetLineNumber() const { return lineNumber; }
+  int GetColumnNumber() const { return columnNumber; }
+};
+
+// v8 nodes are never folded.
+int32_t NodeRepeatCount(const v8::CpuProfileNode *node) { return 1; }
+int32_t NodeRepeatCount(const RawProfileNode *node) {
+  return node->repeatCount;
+}
+
+template <typename Node>
+v8::Local<v8::Array> makeStackLine(const Node *node) {
   auto jsResult = Nan::New<v8::Array>();
 
   const char *rawFunction = node->GetFunctionNameStr();
@@ -748,70 +1128,330 @@ v8::Local<v8::Array> makeStackLine(const v8::CpuProfileNode *node) {
   Nan::Set(jsResult, 2, Nan::New<v8::Number>(node->GetLineNumber()));
   Nan::Set(jsResult, 3, Nan::New<v8::Number>(node->GetColumnNumber()));
 
+  int32_t repeatCount = NodeRepeatCount(node);
+  if (repeatCount > 1) {
+    Nan::Set(jsResult, 4, Nan::New<v8::Number>(repeatCount));
+  }
+
   return jsResult;
 }
 
-void ProfilingBuildStacktraces(Profiling *profiling, v8::CpuProfile *profile,
-                               v8::Local<v8::Object> profilingData) {
-  auto jsTraces = Nan::New<v8::Array>();
-  Nan::Set(profilingData, Nan::New("stacktraces").ToLocalChecked(), jsTraces);
+struct RawProfile {
+  tinystl::vector<RawProfileNode> nodes;
+  // NUL terminated names, each stored once.
+  tinystl::vector<char> strings;
+  tinystl::vector<int32_t> sampleNodes;
+  // Microseconds, same as v8.
+  tinystl::vector<int64_t> sampleTimestamps;
+  int64_t startTime;
 
-  char startTimeNanos[32];
-  size_t startTimeNanosLen =
-      TimestampString(profiling->wallStartTime, startTimeNanos);
+  int GetSamplesCount() const { return int(sampleNodes.size()); }
+  const RawProfileNode *GetSample(int index) const {
+    return &nodes[sampleNodes[index]];
+  }
+  int64_t GetSampleTimestamp(int index) const {
+    return sampleTimestamps[index];
+  }
+  int64_t GetStartTime() const { return startTime; }
+};
 
-  Nan::Set(profilingData, Nan::New("startTimeNanos").ToLocalChecked(),
-           Nan::New(startTimeNanos, startTimeNanosLen).ToLocalChecked());
+struct AccumulatedSample {
+  int32_t node;
+  // Index into SampleAccumulator::spans, -1 if no activation matched.
+  int32_t span;
+  int64_t firstTs;
+  int64_t lastTs;
+  int64_t count;
+  int64_t weight;
+};
 
-#if PROFILER_DEBUG_EXPORT
-  {
-    char tpBuf[32];
-    size_t tpLen = TimestampString(profiling->startTime, tpBuf);
-    Nan::Set(profilingData,
-             Nan::New<v8::String>("startTimepoint").ToLocalChecked(),
-             Nan::New<v8::String>(tpBuf, tpLen).ToLocalChecked());
+KHASH_MAP_INIT_INT64(AccumulatorIndex, int32_t);
+
+/**
+ * Samples of consecutive rotated profiles, filtered and matched against the
+ * activations when folded in (see ProfilingFoldProfile). Frames are interned
+ * into a single node tree, so that a stack seen in several profiles is stored
+ * once. With aggregateSamples, samples are merged as they come in.
+ *
+ * Past maxAccumulatedSamples, samples are reservoir sampled, aggregates only
+ * keep counting the (stack, span) pairs already seen.
+ */
+struct SampleAccumulator {
+  tinystl::vector<RawProfileNode> nodes;
+  tinystl::vector<char> strings;
+  tinystl::vector<SpanActivation> spans;
+  tinystl::vector<AccumulatedSample> samples;
+  // Keyed by hashes of the parent and frame of a node, of the string
+  // contents, of the span ids and of the (node, span) of merged samples.
+  khash_t(AccumulatorIndex) * nodeIndexes;
+  khash_t(AccumulatorIndex) * stringOffsets;
+  khash_t(AccumulatorIndex) * spanIndexes;
+  khash_t(AccumulatorIndex) * sampleIndexes;
+  // Samples offered since the last clear, see ReservoirIndex.
+  int64_t offered;
+  uint64_t random;
+};
+
+const size_t kMinMemoryBudget = 4ULL * 1024ULL * 1024ULL;
+// v8 keeps a node pointer, a timestamp, a line and state tags per sample.
+const size_t kV8SampleBytes = 32;
+const int64_t kMinRotationIntervalNanos = 10LL * 1000000LL;
+
+/**
+ * Splits maxMemoryBytes between v8's sample buffer and the accumulated samples
+ * (a quarter each), and the activation arena and reservoir (three eighths and
+ * an eighth). Frames and line ticks are left out, they grow with the number of
+ * distinct stacks rather than with time.
+ *
+ * v8 stops recording samples once its buffer is full, so the profile is
+ * rotated well before that can happen and the samples are bounded by the
+ * accumulator instead, which keeps a uniform sample of the whole window.
+ */
+void ProfilingApplyMemoryBudget(Profiling *profiling, size_t budget) {
+  if (budget == 0) {
+    profiling->maxSamples = v8::CpuProfilingOptions::kNoSampleLimit;
+    profiling->maxAccumulatedSamples = 0;
+    PagedArenaSetLimit(&profiling->arena, 0);
+    ActivationBinsSetReservoir(&profiling->activations, 0);
+    return;
   }
-#endif
 
-  int32_t traceCount = 0;
+  if (budget < kMinMemoryBudget) {
+    budget = kMinMemoryBudget;
+  }
+
+  profiling->maxSamples = unsigned(budget / 4 / kV8SampleBytes);
+  profiling->maxAccumulatedSamples = budget / 4 / sizeof(AccumulatedSample);
+  PagedArenaSetLimit(&profiling->arena, budget / 8 * 3);
+  // Without one, activations that don't fit are dropped.
+  ActivationBinsSetReservoir(&profiling->activations,
+                             int64_t(budget / 8 / sizeof(SpanActivation)));
+
+  // Samples come at most about once per interval, half the buffer leaves room
+  // for the late ones.
+  int64_t maxRotationInterval =
+      int64_t(profiling->maxSamples / 2) * profiling->samplingIntervalNanos;
+
+  if (maxRotationInterval < kMinRotationIntervalNanos) {
+    maxRotationInterval = kMinRotationIntervalNanos;
+  }
+
+  if (profiling->rotationIntervalNanos == 0 ||
+      profiling->rotationIntervalNanos > maxRotationInterval) {
+    profiling->rotationIntervalNanos = maxRotationInterval;
+  }
+}
+
+int32_t PseudoFrameKind(const char *functionName) {
+  if (strcmp(functionName, "(idle)") == 0) {
+    return PseudoFrame_Idle;
+  }
+
+  if (strcmp(functionName, "(program)") == 0) {
+    return PseudoFrame_Program;
+  }
+
+  if (strcmp(functionName, "(garbage collector)") == 0) {
+    return PseudoFrame_GarbageCollector;
+  }
+
+  return PseudoFrame_None;
+}
+
+/**
+ * Pseudo frames are always direct children of the root. Each child of the root
+ * is only classified by name once per profile, other samples are told apart
+ * by their depth alone.
+ */
+struct PseudoFrameClassifier {
+  tinystl::vector<const void *> nodes;
+  tinystl::vector<int32_t> kinds;
+
+  template <typename Node> int32_t Classify(const Node *node) {
+    const Node *parent = node->GetParent();
+
+    if (!parent || parent->GetParent()) {
+      return PseudoFrame_None;
+    }
+
+    for (size_t i = 0; i < nodes.size(); i++) {
+      if (nodes[i] == node) {
+        return kinds[i];
+      }
+    }
+
+    int32_t kind = PseudoFrameKind(node->GetFunctionNameStr());
+    nodes.push_back(node);
+    kinds.push_back(kind);
+    return kind;
+  }
+};
+
+/**
+ * Runs the sample filtering and span activation matching shared by all output
+ * formats, calling visitor->OnSample(sample) for every sample (or aggregate)
+ * that should be exported.
+ *
+ * Profile is either a v8::CpuProfile or a RawProfile copied off one.
+ */
+template <typename Profile, typename Visitor>
+void ProfilingVisitSamples(Profiling *profiling, const Profile *profile,
+                           ActivationMatcher *matcher, Visitor *visitor) {
+  typedef typename Visitor::Sample Sample;
+  khash_t(SampleAggregates) *aggregateIndexes = nullptr;
+  tinystl::vector<Sample> aggregates;
+  PseudoFrameClassifier classifier;
+
+  if (profiling->aggregateSamples) {
+    aggregateIndexes = kh_init(SampleAggregates);
+  }
 
-  int64_t nextSampleTs = profile->GetStartTime() * 1000LL;
+  // The profile may be sampled more often than this profiler asked for when
+  // its sampling source is shared, see SamplingSource. Samples are taken about
+  // an interval apart, half an interval of the profile is left for jitter.
+  int64_t minSampleGap =
+      profiling->samplingIntervalNanos - profiling->profileIntervalNanos / 2;
+  int64_t prevTs = -1;
   for (int i = 0; i < profile->GetSamplesCount(); i++) {
     int64_t monotonicTs = profile->GetSampleTimestamp(i) * 1000LL;
 
-    bool isValidSample = ShouldIncludeSample(profiling, monotonicTs) &&
-                         monotonicTs >= nextSampleTs;
-    if (!isValidSample) {
+    // Taken by a shared profile before this profiler was started.
+    if (monotonicTs < profiling->sliceStartTime) {
+      continue;
+    }
+
+    if (!ShouldIncludeSample(profiling, monotonicTs)) {
+      profiling->samplesDiscarded++;
+      continue;
+    }
+
+    if (monotonicTs - profiling->lastTakenSampleTime < minSampleGap) {
       continue;
     }
 
-    SpanActivation *match = FindClosestActivation(profiling, monotonicTs);
+    int64_t elapsed = prevTs < 0 ? profiling->samplingIntervalNanos
+                                 : monotonicTs - prevTs;
+    prevTs = monotonicTs;
+
+    if (profiling->countPseudoFrames) {
+      int32_t kind = classifier.Classify(profile->GetSample(i));
+
+      if (kind != PseudoFrame_None) {
+        profiling->pseudoFrameTicks[kind]++;
+        profiling->lastTakenSampleTime = monotonicTs;
+        continue;
+      }
+    }
+
+    SpanActivation *match = ActivationMatcherFind(matcher, monotonicTs);
 
     if (profiling->onlyFilteredStacktraces && match == nullptr) {
       continue;
     }
 
-    nextSampleTs += profiling->samplingIntervalNanos;
+    profiling->lastTakenSampleTime = monotonicTs;
 
-    const v8::CpuProfileNode *sample = profile->GetSample(i);
+    Sample sample;
+    sample.node = profile->GetSample(i);
+    sample.match = match;
+    sample.firstTs = monotonicTs;
+    sample.lastTs = monotonicTs;
+    sample.count = 1;
+    sample.weight = elapsed;
 
-    auto stackTraceLines = Nan::New<v8::Array>();
-    int32_t stackTraceLineCount = 0;
-    Nan::Set(stackTraceLines, stackTraceLineCount++, makeStackLine(sample));
+    if (!aggregateIndexes) {
+      visitor->OnSample(&sample);
+      continue;
+    }
 
-    int64_t monotonicDelta = monotonicTs - profiling->startTime;
-    int64_t sampleTimestamp = profiling->wallStartTime + monotonicDelta;
+    uint32_t nodeId = sample.node->GetNodeId();
+    uint64_t key = XXH3_64bits_withSeed(&nodeId, sizeof(nodeId),
+                                        match ? SpanHash(match) : 0);
 
-    const v8::CpuProfileNode *parent = sample->GetParent();
-    while (parent) {
-      const v8::CpuProfileNode *next = parent->GetParent();
+    int ret;
+    khiter_t it = kh_put(SampleAggregates, aggregateIndexes, key, &ret);
 
-      // Skip the root node as it does not contain useful information.
-      if (next) {
-        Nan::Set(stackTraceLines, stackTraceLineCount++, makeStackLine(parent));
-      }
+    if (ret == -1) {
+      // Out of memory, the sample is still exported, just not merged.
+      visitor->OnSample(&sample);
+    } else if (ret == 0) {
+      Sample *aggregate = &aggregates[kh_value(aggregateIndexes, it)];
+      aggregate->lastTs = monotonicTs;
+      aggregate->count++;
+      aggregate->weight += elapsed;
+    } else {
+      kh_value(aggregateIndexes, it) = aggregates.size();
+      aggregates.push_back(sample);
+    }
+  }
+
+  for (size_t i = 0; i < aggregates.size(); i++) {
+    visitor->OnSample(&aggregates[i]);
+  }
+
+  if (aggregateIndexes) {
+    kh_destroy(SampleAggregates, aggregateIndexes);
+  }
+}
+
+template <typename Profile, typename Visitor>
+void ProfilingVisitSamples(Profiling *profiling, const Profile *profile,
+                           Visitor *visitor) {
+  ActivationMatcher matcher;
+  ActivationMatcherInit(&matcher, &profiling->activations,
+                        profile->GetSamplesCount());
+  ProfilingVisitSamples(profiling, profile, &matcher, visitor);
+}
+
+/**
+ * Replays the accumulated samples, they were already filtered, matched and
+ * merged. The node pointers have to be resolved (ResolveRawNodes) beforehand.
+ */
+template <typename Visitor>
+void ProfilingVisitSamples(Profiling *profiling,
+                           SampleAccumulator *accumulator, Visitor *visitor) {
+  typedef typename Visitor::Sample Sample;
+
+  for (size_t i = 0; i < accumulator->samples.size(); i++) {
+    const AccumulatedSample *accumulated = &accumulator->samples[i];
+
+    Sample sample;
+    sample.node = &accumulator->nodes[accumulated->node];
+    sample.match = accumulated->span < 0
+                       ? nullptr
+                       : &accumulator->spans[accumulated->span];
+    sample.firstTs = accumulated->firstTs;
+    sample.lastTs = accumulated->lastTs;
+    sample.count = accumulated->count;
+    sample.weight = accumulated->weight;
+    visitor->OnSample(&sample);
+  }
+}
+
+int64_t WallTime(Profiling *profiling, int64_t monotonicTs) {
+  return profiling->wallStartTime + (monotonicTs - profiling->startTime);
+}
+
+template <typename Node> struct StacktraceVisitor {
+  typedef ProfileSample<Node> Sample;
+
+  Profiling *profiling;
+  v8::Local<v8::Array> jsTraces;
+  int32_t traceCount;
 
-      parent = next;
+  void OnSample(const Sample *sample) {
+    auto stackTraceLines = Nan::New<v8::Array>();
+    int32_t stackTraceLineCount = 0;
+
+    int64_t monotonicTs = sample->firstTs;
+    int64_t sampleTimestamp = WallTime(profiling, monotonicTs);
+    SpanActivation *match = sample->match;
+
+    // Skip the root node as it does not contain useful information. Frame
+    // rules may leave nothing else.
+    for (const Node *node = sample->node; node && node->GetParent();
+         node = node->GetParent()) {
+      Nan::Set(stackTraceLines, stackTraceLineCount++, makeStackLine(node));
     }
 
     char tsBuf[32];
@@ -824,6 +1464,18 @@ void ProfilingBuildStacktraces(Profiling *profiling, v8::CpuProfile *profile,
     Nan::Set(jsTrace, Nan::New<v8::String>("stacktrace").ToLocalChecked(),
              stackTraceLines);
 
+    if (profiling->aggregateSamples) {
+      char lastTsBuf[32];
+      size_t lastTsLen =
+          TimestampString(WallTime(profiling, sample->lastTs), lastTsBuf);
+      Nan::Set(jsTrace, Nan::New<v8::String>("lastTimestamp").ToLocalChecked(),
+               Nan::New<v8::String>(lastTsBuf, lastTsLen).ToLocalChecked());
+      Nan::Set(jsTrace, Nan::New<v8::String>("count").ToLocalChecked(),
+               Nan::New<v8::Number>((double)sample->count));
+      Nan::Set(jsTrace, Nan::New<v8::String>("weight").ToLocalChecked(),
+               Nan::New<v8::Number>((double)sample->weight));
+    }
+
 #if PROFILER_DEBUG_EXPORT
     char tpBuf[32];
     size_t tpLen = TimestampString(monotonicTs, tpBuf);
@@ -832,15 +1484,12 @@ void ProfilingBuildStacktraces(Profiling *profiling, v8::CpuProfile *profile,
 #endif
 
     if (match) {
-      uint8_t spanId[8];
-      uint8_t traceId[16];
-      HexToBinary(match->spanId, 16, spanId, sizeof(spanId));
-      HexToBinary(match->traceId, 32, traceId, sizeof(traceId));
-
       Nan::Set(jsTrace, Nan::New<v8::String>("spanId").ToLocalChecked(),
-               Nan::CopyBuffer((const char *)spanId, 8).ToLocalChecked());
+               Nan::CopyBuffer((const char *)match->spanId, kSpanIdSize)
+                   .ToLocalChecked());
       Nan::Set(jsTrace, Nan::New<v8::String>("traceId").ToLocalChecked(),
-               Nan::CopyBuffer((const char *)traceId, 16).ToLocalChecked());
+               Nan::CopyBuffer((const char *)match->traceId, kTraceIdSize)
+                   .ToLocalChecked());
 
 #if PROFILER_DEBUG_EXPORT
       match->is_intersected = true;
@@ -849,15 +1498,1936 @@ void ProfilingBuildStacktraces(Profiling *profiling, v8::CpuProfile *profile,
 
     Nan::Set(jsTraces, traceCount++, jsTrace);
   }
+};
+
+void SetStartTimeNanos(Profiling *profiling,
+                       v8::Local<v8::Object> profilingData) {
+  char startTimeNanos[32];
+  size_t startTimeNanosLen =
+      TimestampString(profiling->wallStartTime, startTimeNanos);
+
+  Nan::Set(profilingData, Nan::New("startTimeNanos").ToLocalChecked(),
+           Nan::New(startTimeNanos, startTimeNanosLen).ToLocalChecked());
+}
+
+template <typename Node, typename Profile>
+void ProfilingBuildStacktraces(Profiling *profiling, Profile *profile,
+                               v8::Local<v8::Object> profilingData) {
+  auto jsTraces = Nan::New<v8::Array>();
+  Nan::Set(profilingData, Nan::New("stacktraces").ToLocalChecked(), jsTraces);
+
+  SetStartTimeNanos(profiling, profilingData);
+
+#if PROFILER_DEBUG_EXPORT
+  {
+    char tpBuf[32];
+    size_t tpLen = TimestampString(profiling->startTime, tpBuf);
+    Nan::Set(profilingData,
+             Nan::New<v8::String>("startTimepoint").ToLocalChecked(),
+             Nan::New<v8::String>(tpBuf, tpLen).ToLocalChecked());
+  }
+#endif
+
+  StacktraceVisitor<Node> visitor;
+  visitor.profiling = profiling;
+  visitor.jsTraces = jsTraces;
+  visitor.traceCount = 0;
+  ProfilingVisitSamples(profiling, profile, &visitor);
+}
+
+KHASH_MAP_INIT_INT(LocationByNode, uint64_t);
+
+/**
+ * Encodes the samples straight into a pprof profile, with the same layout and
+ * labels as Serializer.serializeCpuProfile in src/profiling/utils.ts.
+ * Locations are resolved once per v8 node and cached by node id, so the cost of
+ * a sample is a walk over cached ids instead of string work per frame.
+ *
+ * Does not touch V8 when Node is a RawProfileNode, so it can run off the main
+ * thread.
+ */
+template <typename Node> struct PprofVisitor {
+  typedef ProfileSample<Node> Sample;
+
+  Profiling *profiling;
+  PprofBuilder *builder;
+  khash_t(LocationByNode) * locations;
+  tinystl::vector<uint64_t> stack;
+  tinystl::vector<char> repeatedName;
+  int64_t frameCount;
+  bool failed;
+
+  uint64_t NodeLocation(const Node *node) {
+    int ret;
+    khiter_t it = kh_put(LocationByNode, locations, node->GetNodeId(), &ret);
+
+    if (ret == -1) {
+      return 0;
+    }
+
+    if (ret == 0) {
+      return kh_value(locations, it);
+    }
+
+    const char *functionName = node->GetFunctionNameStr();
+    const char *fileName = node->GetScriptResourceNameStr();
+
+    if (functionName[0] == '\0') {
+      functionName = "anonymous";
+    }
+
+    if (fileName[0] == '\0') {
+      fileName = "unknown";
+    }
+
+    // A folded recursion run gets its own location, named like
+    // Serializer.serializeCpuProfile does, so the depth is not lost.
+    int32_t repeatCount = NodeRepeatCount(node);
+    if (repeatCount > 1) {
+      size_t size = strlen(functionName) + 16;
+      repeatedName.resize(size);
+      snprintf(&repeatedName[0], size, "%s (x%" PRId32 ")", functionName,
+               repeatCount);
+      functionName = &repeatedName[0];
+    }
+
+    uint64_t locationId = PprofLocationId(builder, fileName, functionName,
+                                          node->GetLineNumber());
+    kh_value(locations, it) = locationId;
+    return locationId;
+  }
+
+  void OnSample(const Sample *sample) {
+    if (failed) {
+      return;
+    }
+
+    stack.clear();
+
+    // Skip the root node as it does not contain useful information.
+    for (const Node *node = sample->node;
+         node && node->GetParent();
+         node = node->GetParent()) {
+      uint64_t locationId = NodeLocation(node);
+
+      if (locationId == 0) {
+        failed = true;
+        return;
+      }
+
+      stack.push_back(locationId);
+    }
+
+    int64_t sampleTimestamp = WallTime(profiling, sample->firstTs);
+    SpanActivation *match = sample->match;
+
+    PprofLabel labels[4];
+    size_t labelCount = 0;
+    labels[labelCount++] = PprofLabel{PprofString_SourceEventTime, 0,
+                                      sampleTimestamp / 1000000LL, false};
+    labels[labelCount++] =
+        PprofLabel{PprofString_SourceEventPeriod, 0,
+                   profiling->samplingIntervalNanos / 1000000LL, false};
+
+    if (match) {
+      char traceIdHex[kTraceIdSize * 2];
+      char spanIdHex[kSpanIdSize * 2];
+      BinaryToHex(match->traceId, kTraceIdSize, traceIdHex);
+      BinaryToHex(match->spanId, kSpanIdSize, spanIdHex);
+
+      int64_t traceId =
+          PprofStringIndex(builder, traceIdHex, sizeof(traceIdHex));
+      int64_t spanId = PprofStringIndex(builder, spanIdHex, sizeof(spanIdHex));
+
+      if (traceId < 0 || spanId < 0) {
+        failed = true;
+        return;
+      }
+
+      labels[labelCount++] = PprofLabel{PprofString_TraceId, traceId, 0, true};
+      labels[labelCount++] = PprofLabel{PprofString_SpanId, spanId, 0, true};
+    }
+
+    // Aggregated samples carry [count, weight] values matching the sample
+    // types, otherwise there are no values, same as the JS serializer.
+    int64_t values[2] = {sample->count, sample->weight};
+    size_t valueCount = profiling->aggregateSamples ? 2 : 0;
+
+    if (!PprofAddSample(builder, stack.data(), stack.size(), values,
+                        valueCount, labels, labelCount)) {
+      failed = true;
+      return;
+    }
+
+    frameCount += int64_t(stack.size());
+  }
+};
+
+struct EncodedPprof {
+  // malloc'd, owned by whoever takes it into a Buffer.
+  uint8_t *data;
+  size_t length;
+  int64_t sampleCount;
+  int64_t frameCount;
+};
+
+// Returns false if the profile could not be encoded (allocation failure).
+template <typename Node, typename Profile>
+bool ProfilingEncodePprof(Profiling *profiling, Profile *profile,
+                          EncodedPprof *encoded) {
+  PprofVisitor<Node> visitor;
+  visitor.profiling = profiling;
+  visitor.builder = PprofBuilderNew();
+  visitor.locations = kh_init(LocationByNode);
+  visitor.frameCount = 0;
+  visitor.failed = visitor.builder == nullptr;
+
+  if (!visitor.failed && profiling->aggregateSamples) {
+    visitor.failed =
+        !PprofAddSampleType(visitor.builder, "samples", "count") ||
+        !PprofAddSampleType(visitor.builder, "cpu", "nanoseconds");
+  }
+
+  ProfilingVisitSamples(profiling, profile, &visitor);
+
+  encoded->data = nullptr;
+  encoded->length = 0;
+  bool finished =
+      !visitor.failed &&
+      PprofFinish(visitor.builder, &encoded->data, &encoded->length);
+
+  if (finished) {
+    encoded->sampleCount = PprofSampleCount(visitor.builder);
+    encoded->frameCount = visitor.frameCount;
+  }
+
+  kh_destroy(LocationByNode, visitor.locations);
+  PprofBuilderFree(visitor.builder);
+  return finished;
+}
+
+// Takes ownership of the encoded data.
+void SetEncodedPprof(v8::Local<v8::Object> profilingData,
+                     const EncodedPprof *encoded) {
+  Nan::Set(profilingData, Nan::New("pprof").ToLocalChecked(),
+           Nan::NewBuffer((char *)encoded->data, encoded->length)
+               .ToLocalChecked());
+  Nan::Set(profilingData, Nan::New("sampleCount").ToLocalChecked(),
+           Nan::New<v8::Number>((double)encoded->sampleCount));
+  Nan::Set(profilingData, Nan::New("frameCount").ToLocalChecked(),
+           Nan::New<v8::Number>((double)encoded->frameCount));
+}
+
+template <typename Node, typename Profile>
+bool ProfilingBuildPprof(Profiling *profiling, Profile *profile,
+                         v8::Local<v8::Object> profilingData) {
+  SetStartTimeNanos(profiling, profilingData);
+
+  EncodedPprof encoded;
+  if (!ProfilingEncodePprof<Node>(profiling, profile, &encoded)) {
+    return false;
+  }
+
+  SetEncodedPprof(profilingData, &encoded);
+  return true;
+}
+
+KHASH_MAP_INIT_INT(NodeIndex, int32_t);
+KHASH_MAP_INIT_INT64(StringIndex, int32_t);
+KHASH_MAP_INIT_INT64(SpanIndex, int32_t);
+
+// Bytes per entry in the columnar span table: binary trace ID + span ID.
+const size_t kColumnarSpanSize = 24;
+
+/**
+ * Builds a columnar profile: a node table with one row per v8 node referenced
+ * by the samples (parents are always indexed before their children) and
+ * per-sample columns referencing it. Compared to the stacktrace format this
+ * allocates per node instead of per frame of every sample.
+ *
+ * With a frame dictionary, nodes reference frames interned across collections
+ * instead of carrying their names and positions.
+ */
+template <typename Node> struct ColumnarVisitor {
+  typedef ProfileSample<Node> Sample;
+
+  Profiling *profiling;
+  FrameDictionary *frames;
+  khash_t(NodeIndex) * nodeIndexes;
+  khash_t(StringIndex) * stringIndexes;
+  khash_t(SpanIndex) * spanIndexes;
+  tinystl::vector<const char *> strings;
+  tinystl::vector<const Node *> pending;
+
+  tinystl::vector<int32_t> nodeParents;
+  tinystl::vector<int32_t> nodeFunctionNames;
+  tinystl::vector<int32_t> nodeScriptNames;
+  tinystl::vector<int32_t> nodeLines;
+  tinystl::vector<int32_t> nodeColumns;
+  // Only filled with a frame dictionary, instead of the columns above.
+  tinystl::vector<int32_t> nodeFrames;
+  tinystl::vector<int32_t> nodeRepeatCounts;
+
+  tinystl::vector<int32_t> sampleNodes;
+  tinystl::vector<int64_t> sampleTimestamps;
+  tinystl::vector<int32_t> sampleSpans;
+  // Only filled with aggregateSamples.
+  tinystl::vector<int64_t> sampleLastTimestamps;
+  tinystl::vector<int32_t> sampleCounts;
+  tinystl::vector<int64_t> sampleWeights;
+  tinystl::vector<uint8_t> spans;
+  bool failed;
+
+  int32_t StringIndex(const char *str) {
+    int ret;
+    khiter_t it = kh_put(StringIndex, stringIndexes,
+                         XXH3_64bits(str, strlen(str)), &ret);
+
+    if (ret == -1) {
+      return -1;
+    }
+
+    if (ret == 0) {
+      return kh_value(stringIndexes, it);
+    }
+
+    int32_t index = int32_t(strings.size());
+    strings.push_back(str);
+    kh_value(stringIndexes, it) = index;
+    return index;
+  }
+
+  bool AddNode(const Node *node, int32_t parent) {
+    const char *functionName = node->GetFunctionNameStr();
+    const char *scriptName = node->GetScriptResourceNameStr();
+
+    if (functionName[0] == '\0') {
+      functionName = "anonymous";
+    }
+
+    if (scriptName[0] == '\0') {
+      scriptName = "unknown";
+    }
+
+    if (frames) {
+      Frame frame = {functionName, scriptName, node->GetScriptId(),
+                     node->GetLineNumber(), node->GetColumnNumber()};
+      int32_t id = FrameDictionaryIntern(frames, &frame);
+
+      if (id < 0) {
+        return false;
+      }
+
+      nodeParents.push_back(parent);
+      nodeFrames.push_back(id);
+      nodeRepeatCounts.push_back(NodeRepeatCount(node));
+      return true;
+    }
+
+    int32_t functionNameIndex = StringIndex(functionName);
+    int32_t scriptNameIndex = StringIndex(scriptName);
+
+    if (functionNameIndex < 0 || scriptNameIndex < 0) {
+      return false;
+    }
+
+    nodeParents.push_back(parent);
+    nodeFunctionNames.push_back(functionNameIndex);
+    nodeScriptNames.push_back(scriptNameIndex);
+    nodeLines.push_back(node->GetLineNumber());
+    nodeColumns.push_back(node->GetColumnNumber());
+    nodeRepeatCounts.push_back(NodeRepeatCount(node));
+    return true;
+  }
+
+  // Returns -1 for the root node, -2 on allocation failure.
+  int32_t NodeIndex(const Node *node) {
+    // Collect the ancestors missing from the node table.
+    pending.clear();
+    int32_t parent = -1;
+    for (; node && node->GetParent(); node = node->GetParent()) {
+      khiter_t it = kh_get(NodeIndex, nodeIndexes, node->GetNodeId());
+
+      if (it != kh_end(nodeIndexes)) {
+        parent = kh_value(nodeIndexes, it);
+        break;
+      }
+
+      pending.push_back(node);
+    }
+
+    // Add them top-down so that parents are indexed first.
+    for (size_t i = pending.size(); i > 0; i--) {
+      const Node *missing = pending[i - 1];
+      int ret;
+      khiter_t it =
+          kh_put(NodeIndex, nodeIndexes, missing->GetNodeId(), &ret);
+
+      if (ret == -1 || !AddNode(missing, parent)) {
+        return -2;
+      }
+
+      parent = int32_t(nodeParents.size() - 1);
+      kh_value(nodeIndexes, it) = parent;
+    }
+
+    return parent;
+  }
+
+  int32_t SpanIndex(const SpanActivation *activation) {
+    uint64_t hash = SpanHash(activation);
+
+    int ret;
+    khiter_t it = kh_put(SpanIndex, spanIndexes, hash, &ret);
+
+    if (ret == -1) {
+      return -2;
+    }
+
+    if (ret == 0) {
+      return kh_value(spanIndexes, it);
+    }
+
+    size_t offset = spans.size();
+    spans.resize(offset + kColumnarSpanSize);
+    memcpy(&spans[offset], activation->traceId, kTraceIdSize);
+    memcpy(&spans[offset + kTraceIdSize], activation->spanId, kSpanIdSize);
+
+    int32_t index = int32_t(offset / kColumnarSpanSize);
+    kh_value(spanIndexes, it) = index;
+    return index;
+  }
+
+  void OnSample(const Sample *sample) {
+    if (failed) {
+      return;
+    }
+
+    int32_t nodeIndex = NodeIndex(sample->node);
+    int32_t spanIndex = sample->match ? SpanIndex(sample->match) : -1;
+
+    if (nodeIndex == -2 || spanIndex == -2) {
+      failed = true;
+      return;
+    }
+
+    sampleNodes.push_back(nodeIndex);
+    sampleTimestamps.push_back(WallTime(profiling, sample->firstTs));
+    sampleSpans.push_back(spanIndex);
+
+    if (profiling->aggregateSamples) {
+      sampleLastTimestamps.push_back(WallTime(profiling, sample->lastTs));
+      sampleCounts.push_back(int32_t(sample->count));
+      sampleWeights.push_back(sample->weight);
+    }
+  }
+};
+
+template <typename TypedArray, typename T>
+v8::Local<TypedArray> NewTypedArray(const T *values, size_t count) {
+  size_t byteLength = count * sizeof(T);
+  v8::Local<v8::ArrayBuffer> buffer =
+      v8::ArrayBuffer::New(v8::Isolate::GetCurrent(), byteLength);
+
+  if (byteLength > 0) {
+    memcpy(buffer->GetBackingStore()->Data(), values, byteLength);
+  }
+
+  return TypedArray::New(buffer, 0, count);
+}
+
+template <typename TypedArray, typename T>
+v8::Local<TypedArray> NewTypedArray(const tinystl::vector<T> &values) {
+  return NewTypedArray<TypedArray>(values.data(), values.size());
+}
+
+// Frames the consumer has not seen yet, and the ids it has to drop first.
+void SetFrameDelta(FrameDictionary *frames,
+                   v8::Local<v8::Object> profilingData) {
+  const int32_t *added;
+  size_t addedCount;
+  const int32_t *evicted;
+  size_t evictedCount;
+  FrameDictionaryDelta(frames, &added, &addedCount, &evicted, &evictedCount);
+
+  auto jsFunctionNames = Nan::New<v8::Array>(int32_t(addedCount));
+  auto jsScriptNames = Nan::New<v8::Array>(int32_t(addedCount));
+  tinystl::vector<int32_t> lines;
+  tinystl::vector<int32_t> columns;
+  lines.reserve(addedCount);
+  columns.reserve(addedCount);
+
+  for (size_t i = 0; i < addedCount; i++) {
+    const Frame *frame = FrameDictionaryGet(frames, added[i]);
+    Nan::Set(jsFunctionNames, uint32_t(i),
+             Nan::New(frame->functionName).ToLocalChecked());
+    Nan::Set(jsScriptNames, uint32_t(i),
+             Nan::New(frame->scriptName).ToLocalChecked());
+    lines.push_back(frame->lineNumber);
+    columns.push_back(frame->columnNumber);
+  }
+
+  auto jsFrames = Nan::New<v8::Object>();
+  Nan::Set(jsFrames, Nan::New("id").ToLocalChecked(),
+           NewTypedArray<v8::Int32Array>(added, addedCount));
+  Nan::Set(jsFrames, Nan::New("functionName").ToLocalChecked(),
+           jsFunctionNames);
+  Nan::Set(jsFrames, Nan::New("scriptName").ToLocalChecked(), jsScriptNames);
+  Nan::Set(jsFrames, Nan::New("lineNumber").ToLocalChecked(),
+           NewTypedArray<v8::Int32Array>(lines));
+  Nan::Set(jsFrames, Nan::New("columnNumber").ToLocalChecked(),
+           NewTypedArray<v8::Int32Array>(columns));
+
+  Nan::Set(profilingData, Nan::New("frames").ToLocalChecked(), jsFrames);
+  Nan::Set(profilingData, Nan::New("evictedFrames").ToLocalChecked(),
+           NewTypedArray<v8::Int32Array>(evicted, evictedCount));
+}
+
+// Returns false if the profile could not be built (allocation failure).
+template <typename Node, typename Profile>
+bool ProfilingBuildColumnar(Profiling *profiling, Profile *profile,
+                            v8::Local<v8::Object> profilingData,
+                            FrameDictionary *frames) {
+  SetStartTimeNanos(profiling, profilingData);
+
+  if (frames) {
+    FrameDictionaryBeginCollection(frames);
+  }
+
+  ColumnarVisitor<Node> visitor;
+  visitor.profiling = profiling;
+  visitor.frames = frames;
+  visitor.nodeIndexes = kh_init(NodeIndex);
+  visitor.stringIndexes = kh_init(StringIndex);
+  visitor.spanIndexes = kh_init(SpanIndex);
+  visitor.failed = false;
+
+  ProfilingVisitSamples(profiling, profile, &visitor);
+
+  bool built = !visitor.failed;
+
+  if (built) {
+    auto jsNodes = Nan::New<v8::Object>();
+    Nan::Set(jsNodes, Nan::New("parent").ToLocalChecked(),
+             NewTypedArray<v8::Int32Array>(visitor.nodeParents));
+
+    if (profiling->frameRules.foldRecursion) {
+      Nan::Set(jsNodes, Nan::New("repeatCount").ToLocalChecked(),
+               NewTypedArray<v8::Int32Array>(visitor.nodeRepeatCounts));
+    }
+
+    if (frames) {
+      Nan::Set(jsNodes, Nan::New("frame").ToLocalChecked(),
+               NewTypedArray<v8::Int32Array>(visitor.nodeFrames));
+      SetFrameDelta(frames, profilingData);
+      // Otherwise the delta is handed over by the next collection.
+      FrameDictionaryCommit(frames);
+    } else {
+      auto jsStrings = Nan::New<v8::Array>(int32_t(visitor.strings.size()));
+      for (size_t i = 0; i < visitor.strings.size(); i++) {
+        Nan::Set(jsStrings, uint32_t(i),
+                 Nan::New(visitor.strings[i]).ToLocalChecked());
+      }
+
+      Nan::Set(jsNodes, Nan::New("functionName").ToLocalChecked(),
+               NewTypedArray<v8::Int32Array>(visitor.nodeFunctionNames));
+      Nan::Set(jsNodes, Nan::New("scriptName").ToLocalChecked(),
+               NewTypedArray<v8::Int32Array>(visitor.nodeScriptNames));
+      Nan::Set(jsNodes, Nan::New("lineNumber").ToLocalChecked(),
+               NewTypedArray<v8::Int32Array>(visitor.nodeLines));
+      Nan::Set(jsNodes, Nan::New("columnNumber").ToLocalChecked(),
+               NewTypedArray<v8::Int32Array>(visitor.nodeColumns));
+      Nan::Set(profilingData, Nan::New("strings").ToLocalChecked(), jsStrings);
+    }
+
+    Nan::Set(profilingData, Nan::New("nodes").ToLocalChecked(), jsNodes);
+    Nan::Set(profilingData, Nan::New("sampleNodes").ToLocalChecked(),
+             NewTypedArray<v8::Int32Array>(visitor.sampleNodes));
+    Nan::Set(profilingData, Nan::New("sampleTimestamps").ToLocalChecked(),
+             NewTypedArray<v8::BigInt64Array>(visitor.sampleTimestamps));
+    Nan::Set(profilingData, Nan::New("sampleSpans").ToLocalChecked(),
+             NewTypedArray<v8::Int32Array>(visitor.sampleSpans));
+    if (profiling->aggregateSamples) {
+      Nan::Set(profilingData,
+               Nan::New("sampleLastTimestamps").ToLocalChecked(),
+               NewTypedArray<v8::BigInt64Array>(visitor.sampleLastTimestamps));
+      Nan::Set(profilingData, Nan::New("sampleCounts").ToLocalChecked(),
+               NewTypedArray<v8::Int32Array>(visitor.sampleCounts));
+      Nan::Set(profilingData, Nan::New("sampleWeights").ToLocalChecked(),
+               NewTypedArray<v8::BigInt64Array>(visitor.sampleWeights));
+    }
+
+    Nan::Set(profilingData, Nan::New("spans").ToLocalChecked(),
+             Nan::CopyBuffer((const char *)visitor.spans.data(),
+                             visitor.spans.size())
+                 .ToLocalChecked());
+  }
+
+  kh_destroy(NodeIndex, visitor.nodeIndexes);
+  kh_destroy(StringIndex, visitor.stringIndexes);
+  kh_destroy(SpanIndex, visitor.spanIndexes);
+  return built;
+}
+
+KHASH_MAP_INIT_INT64(RawStringOffset, uint32_t);
+
+// Turns the indexes and offsets into pointers, once nothing gets added anymore.
+void ResolveRawNodes(tinystl::vector<RawProfileNode> *nodes,
+                     tinystl::vector<char> *strings) {
+  for (size_t i = 0; i < nodes->size(); i++) {
+    RawProfileNode *node = &(*nodes)[i];
+    node->parent =
+        node->parentIndex < 0 ? nullptr : &(*nodes)[node->parentIndex];
+    node->functionName = &(*strings)[node->functionNameOffset];
+    node->scriptName = &(*strings)[node->scriptNameOffset];
+  }
+}
+
+KHASH_MAP_INIT_INT64(RawNodeIndex, int32_t);
+
+struct RawProfileCopier {
+  RawProfile *raw;
+  const FrameRules *rules;
+  // From v8 node ids to the index of the node standing in for them.
+  khash_t(NodeIndex) * nodeIndexes;
+  // V8 interns the names, so the same pointer is the same string.
+  khash_t(RawStringOffset) * stringOffsets;
+  // Keyed by hashes of the parent and frame of a node. Frame rules can map
+  // several v8 nodes to the same one.
+  khash_t(RawNodeIndex) * internedNodes;
+  // Depth of each node below the root, indexed alike.
+  tinystl::vector<int32_t> depths;
+  // Stand-ins of the nodes deeper than the rules allow, see TruncatedIndex.
+  khash_t(NodeIndex) * truncatedIndexes;
+  tinystl::vector<RawProfileNode> tail;
+
+  bool StringOffset(const char *str, uint32_t *offset) {
+    int ret;
+    khiter_t it =
+        kh_put(RawStringOffset, stringOffsets, (uint64_t)(uintptr_t)str, &ret);
+
+    if (ret == -1) {
+      return false;
+    }
+
+    if (ret == 0) {
+      *offset = kh_value(stringOffsets, it);
+      return true;
+    }
+
+    size_t length = strlen(str) + 1;
+    size_t start = raw->strings.size();
+    raw->strings.resize(start + length);
+    memcpy(&raw->strings[start], str, length);
+
+    *offset = uint32_t(start);
+    kh_value(stringOffsets, it) = *offset;
+    return true;
+  }
+
+  // Returns the index of the node, -1 on allocation failure.
+  int32_t InternNode(RawProfileNode node, int32_t parentIndex) {
+    node.parentIndex = parentIndex;
+
+    int32_t key[7] = {node.parentIndex,
+                      int32_t(node.functionNameOffset),
+                      int32_t(node.scriptNameOffset),
+                      node.scriptId,
+                      node.lineNumber,
+                      node.columnNumber,
+                      node.repeatCount};
+    int ret;
+    khiter_t it = kh_put(RawNodeIndex, internedNodes,
+                         XXH3_64bits(key, sizeof(key)), &ret);
+
+    if (ret == -1) {
+      return -1;
+    }
+
+    if (ret == 0) {
+      return kh_value(internedNodes, it);
+    }
+
+    int32_t index = int32_t(raw->nodes.size());
+    // Unique within the profile, used by the visitors to cache nodes.
+    node.nodeId = uint32_t(index);
+    raw->nodes.push_back(node);
+    depths.push_back(parentIndex < 0 ? 0 : depths[parentIndex] + 1);
+    kh_value(internedNodes, it) = index;
+    return index;
+  }
+
+  static bool SameFrame(const RawProfileNode *a, const RawProfileNode *b) {
+    return a->functionNameOffset == b->functionNameOffset &&
+           a->scriptNameOffset == b->scriptNameOffset &&
+           a->scriptId == b->scriptId && a->lineNumber == b->lineNumber &&
+           a->columnNumber == b->columnNumber;
+  }
+
+  /**
+   * Returns the index of the node standing in for the v8 node, -1 on
+   * allocation failure. Its children are attached to that node, parents are
+   * always added before their children.
+   */
+  int32_t AddNode(const v8::CpuProfileNode *node, int32_t parentIndex) {
+    if (parentIndex >= 0 && rules->excludedPrefixCount > 0 &&
+        FrameRulesExcludes(rules, node->GetScriptResourceNameStr())) {
+      return parentIndex;
+    }
+
+    RawProfileNode copy;
+    memset(&copy, 0, sizeof(copy));
+    copy.scriptId = node->GetScriptId();
+    copy.lineNumber = node->GetLineNumber();
+    copy.columnNumber = node->GetColumnNumber();
+    copy.repeatCount = 1;
+
+    if (!StringOffset(node->GetFunctionNameStr(), &copy.functionNameOffset) ||
+        !StringOffset(node->GetScriptResourceNameStr(),
+                      &copy.scriptNameOffset)) {
+      return -1;
+    }
+
+    // The parent itself is replaced by a copy counting one more repeat, so
+    // that stacks with runs of different lengths remain apart.
+    if (parentIndex > 0 && rules->foldRecursion) {
+      const RawProfileNode *parent = &raw->nodes[parentIndex];
+
+      if (SameFrame(parent, &copy)) {
+        copy.repeatCount = parent->repeatCount + 1;
+        return InternNode(copy, parent->parentIndex);
+      }
+    }
+
+    return InternNode(copy, parentIndex);
+  }
+
+  /**
+   * Stacks deeper than maxStackDepth keep their outermost half, a truncation
+   * frame and the innermost frames filling the rest. Built once per node that
+   * is sampled that deep. Returns -1 on allocation failure.
+   */
+  int32_t TruncatedIndex(int32_t index) {
+    int32_t maxDepth = rules->maxStackDepth;
+
+    if (maxDepth <= 0 || depths[index] <= maxDepth) {
+      return index;
+    }
+
+    int ret;
+    khiter_t it = kh_put(NodeIndex, truncatedIndexes, index, &ret);
+
+    if (ret == -1) {
+      return -1;
+    }
+
+    if (ret == 0) {
+      return kh_value(truncatedIndexes, it);
+    }
+
+    int32_t rootFrames = maxDepth / 2;
+    int32_t leafFrames = maxDepth - rootFrames - 1;
+
+    // Copied, interning may move the nodes.
+    tail.clear();
+    int32_t ancestor = index;
+    while (depths[ancestor] > rootFrames) {
+      if (int32_t(tail.size()) < leafFrames) {
+        tail.push_back(raw->nodes[ancestor]);
+      }
+
+      ancestor = raw->nodes[ancestor].parentIndex;
+    }
+
+    RawProfileNode truncated;
+    memset(&truncated, 0, sizeof(truncated));
+    truncated.scriptId = v8::UnboundScript::kNoScriptId;
+    truncated.lineNumber = v8::CpuProfileNode::kNoLineNumberInfo;
+    truncated.columnNumber = v8::CpuProfileNode::kNoColumnNumberInfo;
+    truncated.repeatCount = 1;
+
+    if (!StringOffset(kTruncatedFrameName, &truncated.functionNameOffset) ||
+        !StringOffset("", &truncated.scriptNameOffset)) {
+      return -1;
+    }
+
+    int32_t parent = InternNode(truncated, ancestor);
+    for (size_t i = tail.size(); parent >= 0 && i > 0; i--) {
+      parent = InternNode(tail[i - 1], parent);
+    }
+
+    kh_value(truncatedIndexes, it) = parent;
+    return parent;
+  }
+};
+
+/**
+ * Returns false if the profile could not be copied (allocation failure). The
+ * frame rules are applied to the copy, which shares nodes between stacks
+ * wherever they end up with the same frames.
+ */
+bool RawProfileCopy(RawProfile *raw, const v8::CpuProfile *profile,
+                    const FrameRules *rules) {
+  RawProfileCopier copier;
+  copier.raw = raw;
+  copier.rules = rules;
+  copier.nodeIndexes = kh_init(NodeIndex);
+  copier.stringOffsets = kh_init(RawStringOffset);
+  copier.internedNodes = kh_init(RawNodeIndex);
+  copier.truncatedIndexes = kh_init(NodeIndex);
+
+  raw->startTime = profile->GetStartTime();
+
+  // Parents are always copied before their children.
+  tinystl::vector<const v8::CpuProfileNode *> pending;
+  tinystl::vector<int32_t> pendingParents;
+  pending.push_back(profile->GetTopDownRoot());
+  pendingParents.push_back(-1);
+
+  bool copied = true;
+  while (copied && !pending.empty()) {
+    const v8::CpuProfileNode *node = pending.back();
+    int32_t parentIndex = pendingParents.back();
+    pending.pop_back();
+    pendingParents.pop_back();
+
+    int32_t index = copier.AddNode(node, parentIndex);
+    int ret;
+    khiter_t it =
+        kh_put(NodeIndex, copier.nodeIndexes, node->GetNodeId(), &ret);
+
+    if (index < 0 || ret == -1) {
+      copied = false;
+      break;
+    }
+
+    kh_value(copier.nodeIndexes, it) = index;
+
+    for (int i = 0; i < node->GetChildrenCount(); i++) {
+      pending.push_back(node->GetChild(i));
+      pendingParents.push_back(index);
+    }
+  }
+
+  int sampleCount = profile->GetSamplesCount();
+  raw->sampleNodes.reserve(sampleCount);
+  raw->sampleTimestamps.reserve(sampleCount);
+
+  for (int i = 0; copied && i < sampleCount; i++) {
+    khiter_t it = kh_get(NodeIndex, copier.nodeIndexes,
+                         profile->GetSample(i)->GetNodeId());
+
+    if (it == kh_end(copier.nodeIndexes)) {
+      copied = false;
+      break;
+    }
+
+    int32_t index = copier.TruncatedIndex(kh_value(copier.nodeIndexes, it));
+
+    if (index < 0) {
+      copied = false;
+      break;
+    }
+
+    raw->sampleNodes.push_back(index);
+    raw->sampleTimestamps.push_back(profile->GetSampleTimestamp(i));
+  }
+
+  if (copied) {
+    ResolveRawNodes(&raw->nodes, &raw->strings);
+  }
+
+  kh_destroy(NodeIndex, copier.nodeIndexes);
+  kh_destroy(RawStringOffset, copier.stringOffsets);
+  kh_destroy(RawNodeIndex, copier.internedNodes);
+  kh_destroy(NodeIndex, copier.truncatedIndexes);
+  return copied;
+}
+
+SampleAccumulator *SampleAccumulatorNew() {
+  SampleAccumulator *accumulator = new SampleAccumulator();
+  accumulator->nodeIndexes = kh_init(AccumulatorIndex);
+  accumulator->stringOffsets = kh_init(AccumulatorIndex);
+  accumulator->spanIndexes = kh_init(AccumulatorIndex);
+  accumulator->sampleIndexes = kh_init(AccumulatorIndex);
+  accumulator->offered = 0;
+  accumulator->random = 0x9e3779b97f4a7c15ULL;
+  return accumulator;
+}
+
+void SampleAccumulatorFree(SampleAccumulator *accumulator) {
+  kh_destroy(AccumulatorIndex, accumulator->nodeIndexes);
+  kh_destroy(AccumulatorIndex, accumulator->stringOffsets);
+  kh_destroy(AccumulatorIndex, accumulator->spanIndexes);
+  kh_destroy(AccumulatorIndex, accumulator->sampleIndexes);
+  delete accumulator;
+}
+
+// Keeps the memory around for the next window.
+void SampleAccumulatorClear(SampleAccumulator *accumulator) {
+  accumulator->nodes.clear();
+  accumulator->strings.clear();
+  accumulator->spans.clear();
+  accumulator->samples.clear();
+  kh_clear(AccumulatorIndex, accumulator->nodeIndexes);
+  kh_clear(AccumulatorIndex, accumulator->stringOffsets);
+  kh_clear(AccumulatorIndex, accumulator->spanIndexes);
+  kh_clear(AccumulatorIndex, accumulator->sampleIndexes);
+  accumulator->offered = 0;
+}
+
+struct LineTickRow {
+  int32_t functionName;
+  int32_t scriptName;
+  int32_t lineNumber;
+  int32_t ticks;
+};
+
+/* Ticks per source line, summed over the profiles since the last collect. */
+struct LineTickTable {
+  tinystl::vector<LineTickRow> rows;
+  // NUL terminated names, the rows index stringStarts.
+  tinystl::vector<char> strings;
+  tinystl::vector<uint32_t> stringStarts;
+  // Keyed by hashes of the string contents and of the function, script and
+  // line of a row.
+  khash_t(AccumulatorIndex) * stringIndexes;
+  khash_t(AccumulatorIndex) * rowIndexes;
+};
+
+LineTickTable *LineTickTableNew() {
+  LineTickTable *table = new LineTickTable();
+  table->stringIndexes = kh_init(AccumulatorIndex);
+  table->rowIndexes = kh_init(AccumulatorIndex);
+  return table;
+}
+
+void LineTickTableFree(LineTickTable *table) {
+  kh_destroy(AccumulatorIndex, table->stringIndexes);
+  kh_destroy(AccumulatorIndex, table->rowIndexes);
+  delete table;
+}
+
+void LineTickTableClear(LineTickTable *table) {
+  table->rows.clear();
+  table->strings.clear();
+  table->stringStarts.clear();
+  kh_clear(AccumulatorIndex, table->stringIndexes);
+  kh_clear(AccumulatorIndex, table->rowIndexes);
+}
+
+// Returns -1 on allocation failure.
+int32_t LineTickString(LineTickTable *table, const char *str) {
+  size_t length = strlen(str);
+  int ret;
+  khiter_t it = kh_put(AccumulatorIndex, table->stringIndexes,
+                       XXH3_64bits(str, length), &ret);
+
+  if (ret == -1) {
+    return -1;
+  }
+
+  if (ret == 0) {
+    return kh_value(table->stringIndexes, it);
+  }
+
+  size_t start = table->strings.size();
+  table->strings.resize(start + length + 1);
+  memcpy(&table->strings[start], str, length + 1);
+
+  int32_t index = int32_t(table->stringStarts.size());
+  table->stringStarts.push_back(uint32_t(start));
+  kh_value(table->stringIndexes, it) = index;
+  return index;
+}
+
+bool LineTickTableAdd(LineTickTable *table, const v8::CpuProfileNode *node,
+                      const v8::CpuProfileNode::LineTick *ticks,
+                      size_t count) {
+  const char *functionNameStr = node->GetFunctionNameStr();
+  const char *scriptNameStr = node->GetScriptResourceNameStr();
+
+  if (functionNameStr[0] == '\0') {
+    functionNameStr = "anonymous";
+  }
+
+  if (scriptNameStr[0] == '\0') {
+    scriptNameStr = "unknown";
+  }
+
+  int32_t functionName = LineTickString(table, functionNameStr);
+  int32_t scriptName = LineTickString(table, scriptNameStr);
+
+  if (functionName < 0 || scriptName < 0) {
+    return false;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    int32_t key[3] = {functionName, scriptName, ticks[i].line};
+    int ret;
+    khiter_t it = kh_put(AccumulatorIndex, table->rowIndexes,
+                         XXH3_64bits(key, sizeof(key)), &ret);
+
+    if (ret == -1) {
+      return false;
+    }
+
+    if (ret == 0) {
+      table->rows[kh_value(table->rowIndexes, it)].ticks +=
+          int32_t(ticks[i].hit_count);
+      continue;
+    }
+
+    LineTickRow row = {functionName, scriptName, ticks[i].line,
+                       int32_t(ticks[i].hit_count)};
+    kh_value(table->rowIndexes, it) = int32_t(table->rows.size());
+    table->rows.push_back(row);
+  }
+
+  return true;
+}
+
+struct HotNode {
+  const v8::CpuProfileNode *node;
+  unsigned hitCount;
+};
+
+int CompareHotNodes(const void *a, const void *b) {
+  unsigned lhs = ((const HotNode *)a)->hitCount;
+  unsigned rhs = ((const HotNode *)b)->hitCount;
+  return lhs > rhs ? -1 : (lhs < rhs ? 1 : 0);
+}
+
+/**
+ * Adds the per line ticks of the maxLineTickNodes nodes with the most samples
+ * of their own. Finding those is a walk over the node tree, only their line
+ * ticks are copied out of v8. Like the v8 hit counts these cover the whole
+ * profile, sample cutoff and trace id filters do not apply.
+ */
+void ProfilingGatherLineTicks(Profiling *profiling,
+                              const v8::CpuProfile *profile) {
+  if (profiling->maxLineTickNodes <= 0) {
+    return;
+  }
+
+  if (!profiling->lineTicks) {
+    profiling->lineTicks = LineTickTableNew();
+  }
+
+  tinystl::vector<HotNode> hot;
+  tinystl::vector<const v8::CpuProfileNode *> pending;
+  pending.push_back(profile->GetTopDownRoot());
+
+  while (!pending.empty()) {
+    const v8::CpuProfileNode *node = pending.back();
+    pending.pop_back();
+
+    if (node->GetHitCount() > 0 && node->GetHitLineCount() > 0) {
+      HotNode entry = {node, node->GetHitCount()};
+      hot.push_back(entry);
+    }
+
+    for (int i = 0; i < node->GetChildrenCount(); i++) {
+      pending.push_back(node->GetChild(i));
+    }
+  }
+
+  if (hot.empty()) {
+    return;
+  }
+
+  qsort(hot.data(), hot.size(), sizeof(HotNode), CompareHotNodes);
+
+  size_t count = hot.size() < size_t(profiling->maxLineTickNodes)
+                     ? hot.size()
+                     : size_t(profiling->maxLineTickNodes);
+  tinystl::vector<v8::CpuProfileNode::LineTick> ticks;
+
+  for (size_t i = 0; i < count; i++) {
+    const v8::CpuProfileNode *node = hot[i].node;
+    unsigned lineCount = node->GetHitLineCount();
+    ticks.resize(lineCount);
+
+    if (!node->GetLineTicks(ticks.data(), lineCount)) {
+      continue;
+    }
+
+    if (!LineTickTableAdd(profiling->lineTicks, node, ticks.data(),
+                          lineCount)) {
+      return;
+    }
+  }
+}
+
+// Hands the gathered line ticks over to JS and clears them.
+void SetLineTicks(LineTickTable *table, v8::Local<v8::Object> profilingData) {
+  if (!table) {
+    return;
+  }
+
+  auto jsStrings = Nan::New<v8::Array>(int32_t(table->stringStarts.size()));
+  for (size_t i = 0; i < table->stringStarts.size(); i++) {
+    Nan::Set(jsStrings, uint32_t(i),
+             Nan::New(&table->strings[table->stringStarts[i]])
+                 .ToLocalChecked());
+  }
+
+  size_t rowCount = table->rows.size();
+  tinystl::vector<int32_t> functionNames;
+  tinystl::vector<int32_t> scriptNames;
+  tinystl::vector<int32_t> lines;
+  tinystl::vector<int32_t> ticks;
+  functionNames.reserve(rowCount);
+  scriptNames.reserve(rowCount);
+  lines.reserve(rowCount);
+  ticks.reserve(rowCount);
+
+  for (size_t i = 0; i < rowCount; i++) {
+    const LineTickRow *row = &table->rows[i];
+    functionNames.push_back(row->functionName);
+    scriptNames.push_back(row->scriptName);
+    lines.push_back(row->lineNumber);
+    ticks.push_back(row->ticks);
+  }
+
+  auto jsLineTicks = Nan::New<v8::Object>();
+  Nan::Set(jsLineTicks, Nan::New("strings").ToLocalChecked(), jsStrings);
+  Nan::Set(jsLineTicks, Nan::New("functionName").ToLocalChecked(),
+           NewTypedArray<v8::Int32Array>(functionNames));
+  Nan::Set(jsLineTicks, Nan::New("scriptName").ToLocalChecked(),
+           NewTypedArray<v8::Int32Array>(scriptNames));
+  Nan::Set(jsLineTicks, Nan::New("lineNumber").ToLocalChecked(),
+           NewTypedArray<v8::Int32Array>(lines));
+  Nan::Set(jsLineTicks, Nan::New("ticks").ToLocalChecked(),
+           NewTypedArray<v8::Int32Array>(ticks));
+  Nan::Set(profilingData, Nan::New("lineTicks").ToLocalChecked(),
+           jsLineTicks);
+
+  LineTickTableClear(table);
+}
+
+bool AccumulatorString(SampleAccumulator *accumulator, const char *str,
+                       uint32_t *offset) {
+  size_t length = strlen(str);
+  int ret;
+  khiter_t it = kh_put(AccumulatorIndex, accumulator->stringOffsets,
+                       XXH3_64bits(str, length), &ret);
+
+  if (ret == -1) {
+    return false;
+  }
+
+  if (ret == 0) {
+    *offset = uint32_t(kh_value(accumulator->stringOffsets, it));
+    return true;
+  }
+
+  size_t start = accumulator->strings.size();
+  accumulator->strings.resize(start + length + 1);
+  memcpy(&accumulator->strings[start], str, length + 1);
+
+  *offset = uint32_t(start);
+  kh_value(accumulator->stringOffsets, it) = int32_t(start);
+  return true;
+}
+
+// Returns the index of the interned node, -1 on allocation failure.
+template <typename Node>
+int32_t AccumulatorNode(SampleAccumulator *accumulator, int32_t parent,
+                        const Node *node) {
+  RawProfileNode copy;
+  memset(&copy, 0, sizeof(copy));
+  copy.parentIndex = parent;
+  copy.scriptId = node->GetScriptId();
+  copy.lineNumber = node->GetLineNumber();
+  copy.columnNumber = node->GetColumnNumber();
+  copy.repeatCount = NodeRepeatCount(node);
+
+  if (!AccumulatorString(accumulator, node->GetFunctionNameStr(),
+                         &copy.functionNameOffset) ||
+      !AccumulatorString(accumulator, node->GetScriptResourceNameStr(),
+                         &copy.scriptNameOffset)) {
+    return -1;
+  }
+
+  int32_t key[7] = {copy.parentIndex,
+                    int32_t(copy.functionNameOffset),
+                    int32_t(copy.scriptNameOffset),
+                    copy.scriptId,
+                    copy.lineNumber,
+                    copy.columnNumber,
+                    copy.repeatCount};
+  int ret;
+  khiter_t it = kh_put(AccumulatorIndex, accumulator->nodeIndexes,
+                       XXH3_64bits(key, sizeof(key)), &ret);
+
+  if (ret == -1) {
+    return -1;
+  }
+
+  if (ret == 0) {
+    return kh_value(accumulator->nodeIndexes, it);
+  }
+
+  int32_t index = int32_t(accumulator->nodes.size());
+  // Unique within the accumulator, used by the visitors to cache nodes.
+  copy.nodeId = uint32_t(index);
+  accumulator->nodes.push_back(copy);
+  kh_value(accumulator->nodeIndexes, it) = index;
+  return index;
+}
+
+// Returns -2 on allocation failure.
+int32_t AccumulatorSpan(SampleAccumulator *accumulator,
+                        const SpanActivation *activation) {
+  int ret;
+  khiter_t it = kh_put(AccumulatorIndex, accumulator->spanIndexes,
+                       SpanHash(activation), &ret);
+
+  if (ret == -1) {
+    return -2;
+  }
+
+  if (ret == 0) {
+    return kh_value(accumulator->spanIndexes, it);
+  }
+
+  int32_t index = int32_t(accumulator->spans.size());
+  accumulator->spans.push_back(*activation);
+  kh_value(accumulator->spanIndexes, it) = index;
+  return index;
+}
+
+template <typename Node> struct AccumulatorVisitor {
+  typedef ProfileSample<Node> Sample;
+
+  SampleAccumulator *accumulator;
+  bool aggregate;
+  // 0 for no limit.
+  size_t maxSamples;
+  // Samples dropped to stay within maxSamples.
+  int64_t dropped;
+  // From node ids, which are only valid within a single profile.
+  khash_t(NodeIndex) * nodeIndexes;
+  tinystl::vector<const Node *> pending;
+  bool failed;
+
+  // Returns -1 on allocation failure.
+  int32_t NodeIndex(const Node *node) {
+    // Unlike the output formats, the root node is kept so that every profile
+    // shares it.
+    pending.clear();
+    int32_t parent = -1;
+    for (; node; node = node->GetParent()) {
+      khiter_t it = kh_get(NodeIndex, nodeIndexes, node->GetNodeId());
+
+      if (it != kh_end(nodeIndexes)) {
+        parent = kh_value(nodeIndexes, it);
+        break;
+      }
+
+      pending.push_back(node);
+    }
+
+    for (size_t i = pending.size(); i > 0; i--) {
+      const Node *missing = pending[i - 1];
+      parent = AccumulatorNode(accumulator, parent, missing);
+
+      int ret;
+      khiter_t it =
+          kh_put(NodeIndex, nodeIndexes, missing->GetNodeId(), &ret);
+
+      if (parent < 0 || ret == -1) {
+        return -1;
+      }
+
+      kh_value(nodeIndexes, it) = parent;
+    }
+
+    return parent;
+  }
+
+  void OnSample(const Sample *sample) {
+    if (failed) {
+      return;
+    }
+
+    // Decided up front, so that no frames are interned for a dropped sample.
+    int64_t replaced = -1;
+
+    if (!aggregate && maxSamples > 0) {
+      int64_t index = ReservoirIndex(++accumulator->offered,
+                                     int64_t(maxSamples), &accumulator->random);
+
+      if (index < 0) {
+        dropped += sample->count;
+        return;
+      }
+
+      if (size_t(index) < accumulator->samples.size()) {
+        replaced = index;
+      }
+    }
+
+    int32_t node = NodeIndex(sample->node);
+    int32_t span =
+        sample->match ? AccumulatorSpan(accumulator, sample->match) : -1;
+
+    if (node < 0 || span == -2) {
+      failed = true;
+      return;
+    }
+
+    AccumulatedSample accumulated = {node,
+                                     span,
+                                     sample->firstTs,
+                                     sample->lastTs,
+                                     sample->count,
+                                     sample->weight};
+
+    if (!aggregate) {
+      if (replaced < 0) {
+        accumulator->samples.push_back(accumulated);
+      } else {
+        dropped += accumulator->samples[replaced].count;
+        accumulator->samples[replaced] = accumulated;
+      }
+
+      return;
+    }
+
+    int32_t key[2] = {node, span};
+    int ret;
+    khiter_t it = kh_put(AccumulatorIndex, accumulator->sampleIndexes,
+                         XXH3_64bits(key, sizeof(key)), &ret);
+
+    if (ret == 0) {
+      AccumulatedSample *merged =
+          &accumulator->samples[kh_value(accumulator->sampleIndexes, it)];
+      merged->firstTs =
+          accumulated.firstTs < merged->firstTs ? accumulated.firstTs
+                                                : merged->firstTs;
+      merged->lastTs = accumulated.lastTs > merged->lastTs ? accumulated.lastTs
+                                                           : merged->lastTs;
+      merged->count += accumulated.count;
+      merged->weight += accumulated.weight;
+      return;
+    }
+
+    if (maxSamples > 0 && accumulator->samples.size() >= maxSamples) {
+      if (ret != -1) {
+        kh_del(AccumulatorIndex, accumulator->sampleIndexes, it);
+      }
+
+      dropped += accumulated.count;
+      return;
+    }
+
+    // Out of memory (ret == -1), the sample is still kept, just not merged.
+    if (ret != -1) {
+      kh_value(accumulator->sampleIndexes, it) =
+          int32_t(accumulator->samples.size());
+    }
+
+    accumulator->samples.push_back(accumulated);
+  }
+};
+
+// Copies of the activations on the context stacks, as if they ended now.
+void CopyActivationsInProgress(Profiling *profiling,
+                               tinystl::vector<SpanActivation> *out) {
+  ContextStacks *stacks = &profiling->spanActivations;
+
+  for (size_t i = 0; i < stacks->size; i++) {
+    const ActivationStack *stack = ContextStacksAt(stacks, i, nullptr);
+    const SpanActivation *activations =
+        stack->extra ? stack->extra : stack->activations;
+
+    for (int32_t i = 0; i < stack->count; i++) {
+      SpanActivation activation = activations[i];
+      activation.endTime = INT64_MAX;
+      out->push_back(activation);
+    }
+  }
+}
+
+/**
+ * Drops all ended activations and starts a new window of bins at startTime.
+ * Context stacks that outgrew their inline storage live in the arena, they
+ * are moved out of it and back around the reset.
+ */
+void ProfilingCompactActivations(Profiling *profiling, int64_t startTime) {
+  ContextStacks *stacks = &profiling->spanActivations;
+  tinystl::vector<SpanActivation> moved;
+
+  for (size_t index = 0; index < stacks->size; index++) {
+    const ActivationStack *stack = ContextStacksAt(stacks, index, nullptr);
+
+    if (stack->extra) {
+      for (int32_t i = 0; i < stack->count; i++) {
+        moved.push_back(stack->extra[i]);
+      }
+    }
+  }
+
+  PagedArenaReset(&profiling->arena);
+  // Pooled spill buffers went away with the arena.
+  ActivationSpillPoolClear(&stacks->spills);
+  ActivationBinsReset(&profiling->activations, startTime,
+                      ActivationBinWidth(profiling->samplingIntervalNanos));
+
+  size_t next = 0;
+  for (size_t index = 0; index < stacks->size; index++) {
+    ActivationStack *stack = ContextStacksAt(stacks, index, nullptr);
+
+    if (!stack->extra) {
+      continue;
+    }
+
+    int32_t count = stack->count;
+    SpanActivation lastClosed = stack->lastClosed;
+    bool hasLastClosed = stack->hasLastClosed;
+    ActivationStackInit(stack);
+    stack->lastClosed = lastClosed;
+    stack->hasLastClosed = hasLastClosed;
+
+    for (int32_t i = 0; i < count; i++) {
+      SpanActivation *activation =
+          ActivationStackPush(stack, &profiling->arena, &stacks->spills);
+
+      if (!activation) {
+        profiling->activationsDropped += count - i;
+        break;
+      }
+
+      *activation = moved[next + i];
+    }
+
+    next += count;
+  }
+}
+
+template <typename Node, typename Profile>
+void ProfilingFoldSamples(Profiling *profiling, const Profile *profile,
+                          ActivationMatcher *matcher) {
+  AccumulatorVisitor<Node> visitor;
+  visitor.accumulator = profiling->accumulator;
+  visitor.aggregate = profiling->aggregateSamples;
+  visitor.maxSamples = profiling->maxAccumulatedSamples;
+  visitor.dropped = 0;
+  visitor.nodeIndexes = kh_init(NodeIndex);
+  visitor.failed = false;
+  ProfilingVisitSamples(profiling, profile, matcher, &visitor);
+  kh_destroy(NodeIndex, visitor.nodeIndexes);
+  profiling->samplesDropped += visitor.dropped;
+}
+
+/**
+ * Folds the samples of a profile that has just been rotated out into the
+ * accumulator. Samples are matched against the ended activations and the ones
+ * still in progress, after which the ended ones can't match anything recorded
+ * later and are dropped. The arena thus only holds the activations of a single
+ * rotation.
+ */
+void ProfilingFoldProfile(Profiling *profiling, const v8::CpuProfile *profile,
+                          int64_t nextStartTime) {
+  if (!profiling->accumulator) {
+    profiling->accumulator = SampleAccumulatorNew();
+  }
+
+  tinystl::vector<SpanActivation> inProgress;
+  CopyActivationsInProgress(profiling, &inProgress);
+
+  ActivationMatcher matcher;
+  ActivationMatcherInitWith(&matcher, &profiling->activations,
+                            inProgress.data(), inProgress.size(),
+                            profile->GetSamplesCount());
+
+  if (FrameRulesActive(&profiling->frameRules)) {
+    RawProfile raw;
+
+    // Without the copy the slice is lost. Folding it unfiltered would export
+    // the frames the rules leave out, so its samples are counted as dropped.
+    if (RawProfileCopy(&raw, profile, &profiling->frameRules)) {
+      ProfilingFoldSamples<RawProfileNode>(profiling, &raw, &matcher);
+    } else {
+      profiling->samplesDropped += profile->GetSamplesCount();
+    }
+  } else {
+    ProfilingFoldSamples<v8::CpuProfileNode>(profiling, profile, &matcher);
+  }
+
+  ProfilingCompactActivations(profiling, nextStartTime);
+  profiling->folded = true;
+}
+
+void ProfilingReset(Profiling *profiling) {
+  if (profiling->accumulator) {
+    SampleAccumulatorClear(profiling->accumulator);
+  }
+
+  profiling->folded = false;
+
+  if (profiling->lineTicks) {
+    LineTickTableClear(profiling->lineTicks);
+  }
+
+  memset(profiling->pseudoFrameTicks, 0, sizeof(profiling->pseudoFrameTicks));
+  ContextStacksClear(&profiling->spanActivations);
+  PagedArenaReset(&profiling->arena);
+  // Picks up a changed sampling interval, only safe with no activations left.
+  ActivationBinsReset(&profiling->activations, profiling->startTime,
+                      ActivationBinWidth(profiling->samplingIntervalNanos));
+}
+
+enum ProfileFormat {
+  ProfileFormat_Stacktraces,
+  ProfileFormat_Pprof,
+  ProfileFormat_Columnar,
+  // Columnar, with frames from the profiler's frame dictionary.
+  ProfileFormat_Frames,
+};
+
+// Returns false if the profile could not be built.
+template <typename Node, typename Profile>
+bool ProfilingBuildProfile(Profiling *profiling, Profile *profile,
+                           ProfileFormat format,
+                           v8::Local<v8::Object> profilingData) {
+  switch (format) {
+  case ProfileFormat_Stacktraces:
+    ProfilingBuildStacktraces<Node>(profiling, profile, profilingData);
+    return true;
+  case ProfileFormat_Pprof:
+    return ProfilingBuildPprof<Node>(profiling, profile, profilingData);
+  case ProfileFormat_Columnar:
+    return ProfilingBuildColumnar<Node>(profiling, profile, profilingData,
+                                        nullptr);
+  case ProfileFormat_Frames:
+    if (!profiling->frames) {
+      profiling->frames = FrameDictionaryNew(profiling->maxFrames);
+    }
+
+    return ProfilingBuildColumnar<Node>(profiling, profile, profilingData,
+                                        profiling->frames);
+  }
+
+  return false;
+}
+
+// Builds straight off the v8 profile, unless frame rules have to be applied.
+bool ProfilingBuildV8Profile(Profiling *profiling, const v8::CpuProfile *profile,
+                             ProfileFormat format,
+                             v8::Local<v8::Object> profilingData) {
+  if (!FrameRulesActive(&profiling->frameRules)) {
+    return ProfilingBuildProfile<v8::CpuProfileNode>(profiling, profile,
+                                                     format, profilingData);
+  }
+
+  RawProfile raw;
+  if (!RawProfileCopy(&raw, profile, &profiling->frameRules)) {
+    return false;
+  }
+
+  return ProfilingBuildProfile<RawProfileNode>(profiling, &raw, format,
+                                               profilingData);
+}
+
+struct ProfileRotation {
+  // The profile of the window that just ended, nullptr if there was none.
+  v8::CpuProfile *profile;
+  // What the ended profile was started with.
+  int64_t samplingIntervalNanos;
+  unsigned maxSamples;
+  int64_t newStartTime;
+  int64_t newWallStart;
+  int64_t startDuration;
+  int64_t stopDuration;
+  // When the previous profile was stopped.
+  int64_t stopEnd;
+};
+
+/**
+ * The next profile is started before the previous one is stopped, so samples
+ * should continue without a gap. The gap that actually occurred, between the
+ * last sample of the previous profile and the first one of this profile (or
+ * the start request for the first profile), is tracked to verify that.
+ */
+void ProfilingRecordSampleGap(Profiling *profiling,
+                              const v8::CpuProfile *profile) {
+  int sampleCount = profile->GetSamplesCount();
+
+  if (sampleCount == 0) {
+    return;
+  }
+
+  int64_t first = profile->GetSampleTimestamp(0) * 1000LL;
+  int64_t gap = first - profiling->lastSampleTime;
+
+  if (gap > profiling->maxSampleGap) {
+    profiling->maxSampleGap = gap;
+  }
+
+  profiling->lastSampleTime =
+      profile->GetSampleTimestamp(sampleCount - 1) * 1000LL;
+}
+
+// Returns the largest sample gap since the previous call.
+int64_t ProfilingTakeSampleGap(Profiling *profiling) {
+  int64_t gap = profiling->maxSampleGap;
+  profiling->maxSampleGap = 0;
+  return gap;
+}
+
+/**
+ * Counts the samples v8 didn't record because its buffer was full, from the
+ * hits of the nodes, which keep being counted. Scaled to the sampling interval
+ * of the profiler, the profile may have been sampled more often.
+ */
+void ProfilingCountTruncatedSamples(Profiling *profiling,
+                                    const ProfileRotation *rotation) {
+  const v8::CpuProfile *profile = rotation->profile;
+  int sampleCount = profile->GetSamplesCount();
+
+  if (rotation->maxSamples == v8::CpuProfilingOptions::kNoSampleLimit ||
+      sampleCount < int(rotation->maxSamples)) {
+    return;
+  }
+
+  int64_t hits = 0;
+  tinystl::vector<const v8::CpuProfileNode *> pending;
+  pending.push_back(profile->GetTopDownRoot());
+
+  while (!pending.empty()) {
+    const v8::CpuProfileNode *node = pending.back();
+    pending.pop_back();
+    hits += node->GetHitCount();
+
+    for (int i = 0; i < node->GetChildrenCount(); i++) {
+      pending.push_back(node->GetChild(i));
+    }
+  }
+
+  if (hits > sampleCount) {
+    profiling->samplesDropped += (hits - sampleCount) *
+                                 rotation->samplingIntervalNanos /
+                                 profiling->samplingIntervalNanos;
+  }
+}
+
+// Returns the number of coalesced activations since the previous call.
+int64_t ProfilingTakeActivationsMerged(Profiling *profiling) {
+  int64_t merged = profiling->activationsMerged;
+  profiling->activationsMerged = 0;
+  return merged;
+}
+
+/**
+ * Inserts the activations held back for coalescing into the bins and drops
+ * the context stacks left empty.
+ */
+void ProfilingFlushClosedActivations(Profiling *profiling) {
+  ContextStacks *stacks = &profiling->spanActivations;
+
+  // Backwards, an erase moves the last stack into the erased one's place.
+  for (size_t i = stacks->size; i-- > 0;) {
+    ActivationStack *stack = ContextStacksAt(stacks, i, nullptr);
+
+    if (stack->hasLastClosed) {
+      InsertActivation(&profiling->activations, &stack->lastClosed);
+      stack->hasLastClosed = false;
+    }
+
+    if (stack->count == 0) {
+      ContextStacksErase(stacks, stack);
+    }
+  }
+}
+
+// Stops the profile being recorded into rotation.
+void SamplingSourceStop(SamplingSource *source, const char *title,
+                        ProfileRotation *rotation) {
+  int64_t stopBegin = HrTime();
+  rotation->profile =
+      source->profiler->StopProfiling(Nan::New(title).ToLocalChecked());
+  rotation->stopEnd = HrTime();
+  rotation->stopDuration = rotation->stopEnd - stopBegin;
+}
+
+/**
+ * Hands a profile rotated out by another profiler of the sampling source to
+ * this one, which folds it in as its rotation timer would.
+ */
+void ProfilingFoldShared(Profiling *profiling,
+                         const ProfileRotation *rotation) {
+  ProfilingFlushClosedActivations(profiling);
+  profiling->activationDepth = 0;
+  profiling->profileIntervalNanos = rotation->samplingIntervalNanos;
+  ProfilingRecordSampleGap(profiling, rotation->profile);
+  ProfilingCountTruncatedSamples(profiling, rotation);
+  ProfilingGatherLineTicks(profiling, rotation->profile);
+  ProfilingFoldProfile(profiling, rotation->profile, rotation->newStartTime);
+  profiling->sliceStartTime = rotation->newStartTime;
+  profiling->sampleCutoffPoint = HrTime();
+}
+
+/**
+ * Ends the profile being recorded and, unless no profiler of the source is
+ * left running, starts the next one at the finest sampling interval among
+ * them. The profiles alternate between two titles, the next one is started
+ * before the previous one is stopped so that samples continue without a gap.
+ * v8 only takes a new sampling interval with no profile being recorded, so the
+ * previous profile is stopped first when the interval changes.
+ *
+ * The ended profile is folded into every running profiler of the source but
+ * owner, which gets it in rotation->profile to delete once done with it. The
+ * activation ring has to be drained beforehand.
+ */
+void SamplingSourceRotate(SamplingSource *source, Profiling *owner,
+                          ProfileRotation *rotation) {
+  int64_t samplingIntervalNanos = 0;
+  unsigned maxSamples = 0;
+
+  for (size_t i = 0; i < globals.profilers.size(); i++) {
+    const Profiling *profiling = globals.profilers[i];
+
+    if (profiling->source != source || !profiling->running) {
+      continue;
+    }
+
+    if (samplingIntervalNanos == 0 ||
+        profiling->samplingIntervalNanos < samplingIntervalNanos) {
+      samplingIntervalNanos = profiling->samplingIntervalNanos;
+    }
+
+    if (profiling->maxSamples > maxSamples) {
+      maxSamples = profiling->maxSamples;
+    }
+  }
+
+  char prevTitle[128];
+  ProfileTitle(prevTitle, sizeof(prevTitle), kSamplingSourceTitle,
+               source->profileSeq);
+  source->profileSeq = (source->profileSeq + 1) % 2;
+  char nextTitle[128];
+  ProfileTitle(nextTitle, sizeof(nextTitle), kSamplingSourceTitle,
+               source->profileSeq);
+
+  rotation->profile = nullptr;
+  rotation->samplingIntervalNanos = source->samplingIntervalNanos;
+  rotation->maxSamples = source->maxSamples;
+  rotation->startDuration = 0;
+  rotation->stopDuration = 0;
+
+  bool intervalChanged = samplingIntervalNanos != source->samplingIntervalNanos;
+
+  if (source->recording && intervalChanged) {
+    SamplingSourceStop(source, prevTitle, rotation);
+  }
+
+  rotation->newStartTime = HrTime();
+  rotation->newWallStart = MicroSecondsSinceEpoch() * 1000L;
+
+  if (samplingIntervalNanos > 0) {
+    if (intervalChanged) {
+      source->profiler->SetSamplingInterval(
+          int(samplingIntervalNanos / 1000LL));
+    }
+
+    V8StartProfiling(source->profiler, nextTitle, maxSamples);
+    rotation->startDuration = HrTime() - rotation->newStartTime;
+  }
+
+  if (source->recording && !intervalChanged) {
+    SamplingSourceStop(source, prevTitle, rotation);
+  }
+
+  if (!rotation->profile) {
+    rotation->stopEnd = HrTime();
+  }
+
+  source->recording = samplingIntervalNanos > 0;
+  source->samplingIntervalNanos = samplingIntervalNanos;
+  source->maxSamples = maxSamples;
+
+  if (!rotation->profile) {
+    return;
+  }
+
+  for (size_t i = 0; i < globals.profilers.size(); i++) {
+    Profiling *profiling = globals.profilers[i];
+
+    if (profiling != owner && profiling->source == source &&
+        profiling->running) {
+      ProfilingFoldShared(profiling, rotation);
+    }
+  }
+}
+
+/**
+ * Starts sampling for a profiler that has just been marked as running. The
+ * profile being recorded is only rotated if it is sampled less often than the
+ * profiler asked for, otherwise the profiler just starts taking its samples.
+ */
+void SamplingSourceAttach(Profiling *profiling) {
+  SamplingSource *source = profiling->source;
+
+  if (source->recording &&
+      source->samplingIntervalNanos <= profiling->samplingIntervalNanos) {
+    return;
+  }
+
+  ProfileRotation rotation;
+  SamplingSourceRotate(source, profiling, &rotation);
+
+  // Recorded before this profiler was started.
+  if (rotation.profile) {
+    rotation.profile->Delete();
+  }
+}
+
+/**
+ * Rotates the profile of the sampling source, handing the ended one to the
+ * caller. The profiling start time is left for the caller to update once it is
+ * done with the activations of the ended window.
+ */
+void ProfilingRotate(Profiling *profiling, ProfileRotation *rotation) {
+  // Activations ended so far have to be in the bins before matching.
+  DrainActivationRing();
+  ProfilingFlushClosedActivations(profiling);
+  profiling->activationDepth = 0;
+
+  SamplingSourceRotate(profiling->source, profiling, rotation);
+
+  if (rotation->profile) {
+    profiling->profileIntervalNanos = rotation->samplingIntervalNanos;
+    ProfilingRecordSampleGap(profiling, rotation->profile);
+    ProfilingCountTruncatedSamples(profiling, rotation);
+  }
+}
+
+void SetProfilerDurations(v8::Local<v8::Object> profilingData,
+                          int64_t startDuration, int64_t stopDuration,
+                          int64_t processingDuration, int64_t sampleGap) {
+  Nan::Set(profilingData, Nan::New("profilerStartDuration").ToLocalChecked(),
+           Nan::New<v8::Number>((double)startDuration));
+  Nan::Set(profilingData, Nan::New("profilerStopDuration").ToLocalChecked(),
+           Nan::New<v8::Number>((double)stopDuration));
+  Nan::Set(profilingData,
+           Nan::New("profilerProcessingStepDuration").ToLocalChecked(),
+           Nan::New<v8::Number>((double)processingDuration));
+  Nan::Set(profilingData, Nan::New("profilerSampleGap").ToLocalChecked(),
+           Nan::New<v8::Number>((double)sampleGap));
+}
+
+void SetActivationsMerged(v8::Local<v8::Object> profilingData,
+                          int64_t activationsMerged) {
+  Nan::Set(profilingData, Nan::New("activationsMerged").ToLocalChecked(),
+           Nan::New<v8::Number>((double)activationsMerged));
+}
+
+void SetDropped(v8::Local<v8::Object> profilingData,
+                const DroppedCounts *dropped) {
+  Nan::Set(profilingData, Nan::New("activationsDropped").ToLocalChecked(),
+           Nan::New<v8::Number>((double)dropped->activations));
+  Nan::Set(profilingData, Nan::New("samplesDropped").ToLocalChecked(),
+           Nan::New<v8::Number>((double)dropped->samples));
+}
+
+/**
+ * Sets the pseudo frame samples counted since the last collect and starts
+ * counting anew. Nothing is set unless they are counted.
+ */
+void SetPseudoFrameTicks(Profiling *profiling,
+                         v8::Local<v8::Object> profilingData) {
+  if (!profiling->countPseudoFrames) {
+    return;
+  }
+
+  int64_t *ticks = profiling->pseudoFrameTicks;
+  auto jsTicks = Nan::New<v8::Object>();
+  Nan::Set(jsTicks, Nan::New("idle").ToLocalChecked(),
+           Nan::New<v8::Number>((double)ticks[PseudoFrame_Idle]));
+  Nan::Set(jsTicks, Nan::New("program").ToLocalChecked(),
+           Nan::New<v8::Number>((double)ticks[PseudoFrame_Program]));
+  Nan::Set(jsTicks, Nan::New("gc").ToLocalChecked(),
+           Nan::New<v8::Number>((double)ticks[PseudoFrame_GarbageCollector]));
+  Nan::Set(profilingData, Nan::New("pseudoFrameTicks").ToLocalChecked(),
+           jsTicks);
+
+  memset(ticks, 0, sizeof(profiling->pseudoFrameTicks));
+}
+
+void ProfilingRotationTick(uv_timer_t *timer) {
+  Profiling *profiling = (Profiling *)timer->data;
+
+  if (!profiling->running || !profiling->rotating) {
+    return;
+  }
+
+  Nan::HandleScope scope;
+  ProfileRotation rotation;
+  ProfilingRotate(profiling, &rotation);
+
+  if (rotation.profile) {
+    ProfilingGatherLineTicks(profiling, rotation.profile);
+    ProfilingFoldProfile(profiling, rotation.profile, rotation.newStartTime);
+    rotation.profile->Delete();
+  }
+
+  // Only the v8 profile is restarted, the window still spans from the last
+  // collect.
+  profiling->sliceStartTime = rotation.newStartTime;
+  profiling->sampleCutoffPoint = HrTime();
+}
+
+/**
+ * With rotationIntervalMillis, the v8 profile is rotated into the accumulator
+ * by a timer, so that each slice is processed while it is still small and
+ * collect only has to hand over the accumulated samples.
+ */
+void ProfilingStartRotation(Profiling *profiling) {
+  profiling->rotating = profiling->rotationIntervalNanos > 0;
+
+  if (!profiling->rotating) {
+    return;
+  }
+
+  if (!profiling->rotationTimerInitialized) {
+    uv_timer_init(Nan::GetCurrentEventLoop(), &profiling->rotationTimer);
+    // The profiler should not keep the process alive.
+    uv_unref((uv_handle_t *)&profiling->rotationTimer);
+    profiling->rotationTimer.data = profiling;
+    profiling->rotationTimerInitialized = true;
+  }
+
+  uint64_t intervalMillis =
+      uint64_t(profiling->rotationIntervalNanos / 1000000LL);
+  uv_timer_start(&profiling->rotationTimer, ProfilingRotationTick,
+                 intervalMillis, intervalMillis);
+}
+
+void ProfilingStopRotation(Profiling *profiling) {
+  if (profiling->rotationTimerInitialized) {
+    uv_timer_stop(&profiling->rotationTimer);
+  }
+
+  profiling->rotating = false;
 }
 
-void ProfilingReset(Profiling *profiling) {
-  kh_clear(ActivationStack, profiling->spanActivations);
-  PagedArenaReset(&profiling->arena);
-  profiling->activationPeriod = NewActivationPeriod(profiling);
+// Builds the output from the accumulated samples and clears them.
+bool ProfilingBuildAccumulated(Profiling *profiling, ProfileFormat format,
+                               v8::Local<v8::Object> profilingData) {
+  SampleAccumulator *accumulator = profiling->accumulator;
+  ResolveRawNodes(&accumulator->nodes, &accumulator->strings);
+  bool built = ProfilingBuildProfile<RawProfileNode>(profiling, accumulator,
+                                                     format, profilingData);
+  SampleAccumulatorClear(accumulator);
+  profiling->folded = false;
+  return built;
 }
 
-NAN_METHOD(CollectProfilingData) {
+void CollectProfile(const Nan::FunctionCallbackInfo<v8::Value> &info,
+                    ProfileFormat format) {
   info.GetReturnValue().SetNull();
 
   auto handle = Nan::To<int32_t>(info[0]).ToChecked();
@@ -872,59 +3442,65 @@ NAN_METHOD(CollectProfilingData) {
     return;
   }
 
-  char prevTitle[128];
-  ProfileTitle(prevTitle, sizeof(prevTitle), profiling->name,
-               profiling->profilerSeq);
-  profiling->profilerSeq = (profiling->profilerSeq + 1) % 2;
-  char nextTitle[128];
-  ProfileTitle(nextTitle, sizeof(nextTitle), profiling->name,
-               profiling->profilerSeq);
-
-  profiling->activationDepth = 0;
-  int64_t newStartTime = HrTime();
-  int64_t newWallStart = MicroSecondsSinceEpoch() * 1000L;
-
-  V8StartProfiling(profiling->profiler, nextTitle);
-  int64_t profilerStopBegin = HrTime();
-  int64_t profilerStartDuration = profilerStopBegin - newStartTime;
-
-  v8::CpuProfile *profile =
-      profiling->profiler->StopProfiling(Nan::New(prevTitle).ToLocalChecked());
-  int64_t profilerStopEnd = HrTime();
-  int64_t profilerStopDuration = profilerStopEnd - profilerStopBegin;
+  ProfileRotation rotation;
+  ProfilingRotate(profiling, &rotation);
+  v8::CpuProfile *profile = rotation.profile;
 
   if (!profile) {
     // profile with this title might've already be ended using a previous stop
     // call
-    profiling->startTime = newStartTime;
-    profiling->wallStartTime = newWallStart;
+    ProfilingSetStartTime(profiling, rotation.newStartTime,
+                          rotation.newWallStart);
     return;
   }
 
+  ProfilingGatherLineTicks(profiling, profile);
+
   auto jsProfilingData = Nan::New<v8::Object>();
-  info.GetReturnValue().Set(jsProfilingData);
+  // Slices may have been folded in even without a rotation timer, whenever
+  // another profiler of the sampling source rotated the shared profile.
+  bool accumulated = profiling->rotating || profiling->folded;
+  bool built;
+
+  if (accumulated) {
+    ProfilingFoldProfile(profiling, profile, rotation.newStartTime);
+    built = ProfilingBuildAccumulated(profiling, format, jsProfilingData);
+  } else {
+    built =
+        ProfilingBuildV8Profile(profiling, profile, format, jsProfilingData);
+  }
 
-  ProfilingBuildStacktraces(profiling, profile, jsProfilingData);
-  int64_t profilerProcessingStepDuration = HrTime() - profilerStopEnd;
+  if (built) {
+    info.GetReturnValue().Set(jsProfilingData);
+  }
 
-  Nan::Set(jsProfilingData, Nan::New("profilerStartDuration").ToLocalChecked(),
-           Nan::New<v8::Number>((double)profilerStartDuration));
-  Nan::Set(jsProfilingData, Nan::New("profilerStopDuration").ToLocalChecked(),
-           Nan::New<v8::Number>((double)profilerStopDuration));
-  Nan::Set(jsProfilingData,
-           Nan::New("profilerProcessingStepDuration").ToLocalChecked(),
-           Nan::New<v8::Number>((double)profilerProcessingStepDuration));
+  SetProfilerDurations(jsProfilingData, rotation.startDuration,
+                       rotation.stopDuration, HrTime() - rotation.stopEnd,
+                       ProfilingTakeSampleGap(profiling));
+  SetActivationsMerged(jsProfilingData,
+                       ProfilingTakeActivationsMerged(profiling));
+  DroppedCounts dropped = ProfilingTakeDropped(profiling);
+  SetDropped(jsProfilingData, &dropped);
+  SetLineTicks(profiling->lineTicks, jsProfilingData);
+  SetPseudoFrameTicks(profiling, jsProfilingData);
 
   ProfilingRecordDebugInfo(profiling, jsProfilingData);
-  ProfilingReset(profiling);
+
+  // Folding already dropped the ended activations, the ones in progress are
+  // kept for the next window.
+  if (!accumulated) {
+    ProfilingReset(profiling);
+  }
+
   profile->Delete();
 
-  profiling->startTime = newStartTime;
-  profiling->wallStartTime = newWallStart;
+  ProfilingSetStartTime(profiling, rotation.newStartTime,
+                        rotation.newWallStart);
   profiling->sampleCutoffPoint = HrTime();
 }
 
-NAN_METHOD(StopProfiling) {
+void StopProfile(const Nan::FunctionCallbackInfo<v8::Value> &info,
+                 ProfileFormat format) {
   info.GetReturnValue().SetNull();
 
   auto handle = Nan::To<int32_t>(info[0]).ToChecked();
@@ -939,29 +3515,305 @@ NAN_METHOD(StopProfiling) {
     return;
   }
 
+  DrainActivationRing();
+  ProfilingFlushClosedActivations(profiling);
   profiling->running = false;
+  UpdateRunningState();
+  bool accumulated = profiling->rotating || profiling->folded;
+  ProfilingStopRotation(profiling);
 
-  char title[128];
-  ProfileTitle(title, sizeof(title), profiling->name, profiling->profilerSeq);
+  // The sampling source keeps sampling for the other profilers, if any.
+  ProfileRotation rotation;
+  ProfilingRotate(profiling, &rotation);
+  v8::CpuProfile *profile = rotation.profile;
 
-  v8::CpuProfile *profile =
-      profiling->profiler->StopProfiling(Nan::New(title).ToLocalChecked());
   if (!profile) {
-    // profile with this title might've already be ended using a previous stop
-    // call
     ProfilingReset(profiling);
     return;
   }
 
+  ProfilingGatherLineTicks(profiling, profile);
+
   auto jsProfilingData = Nan::New<v8::Object>();
-  info.GetReturnValue().Set(jsProfilingData);
+  bool built;
+
+  if (accumulated) {
+    ProfilingFoldProfile(profiling, profile, rotation.newStartTime);
+    built = ProfilingBuildAccumulated(profiling, format, jsProfilingData);
+  } else {
+    built =
+        ProfilingBuildV8Profile(profiling, profile, format, jsProfilingData);
+  }
+
+  if (built) {
+    info.GetReturnValue().Set(jsProfilingData);
+  }
 
-  ProfilingBuildStacktraces(profiling, profile, jsProfilingData);
+  SetActivationsMerged(jsProfilingData,
+                       ProfilingTakeActivationsMerged(profiling));
+  DroppedCounts dropped = ProfilingTakeDropped(profiling);
+  SetDropped(jsProfilingData, &dropped);
+  SetLineTicks(profiling->lineTicks, jsProfilingData);
+  SetPseudoFrameTicks(profiling, jsProfilingData);
   ProfilingRecordDebugInfo(profiling, jsProfilingData);
   ProfilingReset(profiling);
   profile->Delete();
 }
 
+NAN_METHOD(CollectProfilingData) {
+  CollectProfile(info, ProfileFormat_Stacktraces);
+}
+
+NAN_METHOD(StopProfiling) { StopProfile(info, ProfileFormat_Stacktraces); }
+
+NAN_METHOD(CollectProfilingDataPprof) {
+  CollectProfile(info, ProfileFormat_Pprof);
+}
+
+NAN_METHOD(StopProfilingPprof) { StopProfile(info, ProfileFormat_Pprof); }
+
+NAN_METHOD(CollectProfilingDataColumnar) {
+  CollectProfile(info, ProfileFormat_Columnar);
+}
+
+NAN_METHOD(StopProfilingColumnar) {
+  StopProfile(info, ProfileFormat_Columnar);
+}
+
+NAN_METHOD(CollectProfilingDataFrames) {
+  CollectProfile(info, ProfileFormat_Frames);
+}
+
+NAN_METHOD(StopProfilingFrames) { StopProfile(info, ProfileFormat_Frames); }
+
+/**
+ * Moves the activations of the ended window into detached, leaving profiling
+ * with a fresh arena and no activations, as ProfilingReset would. Only the
+ * activation index and the sample filtering settings of detached are used.
+ */
+void ProfilingDetachActivations(Profiling *profiling, Profiling *detached) {
+  *detached = *profiling;
+  detached->activations.arena = &detached->arena;
+  // The table stays with profiling.
+  ContextStacksInit(&detached->spanActivations);
+
+  // Activations still in progress point into the detached arena.
+  ContextStacksClear(&profiling->spanActivations);
+  PagedArenaInit(&profiling->arena, detached->arena.pageSize);
+  PagedArenaSetHighWaterMark(&profiling->arena, detached->arena.highWaterMark);
+  PagedArenaSetLimit(&profiling->arena, detached->arena.limit);
+  ActivationBinsInit(&profiling->activations, &profiling->arena);
+  ActivationBinsReset(&profiling->activations, profiling->startTime,
+                      ActivationBinWidth(profiling->samplingIntervalNanos));
+  ActivationBinsSetReservoir(&profiling->activations,
+                             detached->activations.reservoir.capacity);
+  profiling->activations.stats = detached->activations.stats;
+}
+
+struct CollectJob {
+  uv_work_t request;
+  // Snapshot of the profiler, owning the activations of the ended window
+  // unless the samples were accumulated.
+  Profiling profiling;
+  RawProfile profile;
+  // Taken over from a rotating profiler, used instead of profile.
+  SampleAccumulator *accumulator;
+  // Taken over from the profiler, nullptr unless line ticks are gathered.
+  LineTickTable *lineTicks;
+  EncodedPprof encoded;
+  bool copied;
+  bool encodedOk;
+  int64_t startDuration;
+  int64_t stopDuration;
+  // Copying on the main thread and encoding on the thread pool.
+  int64_t processingDuration;
+  int64_t sampleGap;
+  int64_t activationsMerged;
+  DroppedCounts dropped;
+  Nan::Persistent<v8::Promise::Resolver> resolver;
+  Nan::Persistent<v8::Context> context;
+  Nan::Persistent<v8::Object> resource;
+  node::async_context asyncContext;
+};
+
+void CollectJobFree(CollectJob *job) {
+  if (job->lineTicks) {
+    LineTickTableFree(job->lineTicks);
+  }
+
+  if (job->accumulator) {
+    SampleAccumulatorFree(job->accumulator);
+  } else if (job->copied) {
+    PagedArenaDestroy(&job->profiling.arena);
+    ActivationBinsFree(&job->profiling.activations);
+  }
+
+  job->resolver.Reset();
+  job->context.Reset();
+  job->resource.Reset();
+  delete job;
+}
+
+void CollectJobExecute(uv_work_t *request) {
+  CollectJob *job = (CollectJob *)request->data;
+  int64_t start = HrTime();
+
+  if (job->accumulator) {
+    ResolveRawNodes(&job->accumulator->nodes, &job->accumulator->strings);
+    job->encodedOk = ProfilingEncodePprof<RawProfileNode>(
+        &job->profiling, job->accumulator, &job->encoded);
+  } else {
+    job->encodedOk = ProfilingEncodePprof<RawProfileNode>(
+        &job->profiling, &job->profile, &job->encoded);
+  }
+
+  job->processingDuration += HrTime() - start;
+}
+
+void CollectJobComplete(uv_work_t *request, int status) {
+  CollectJob *job = (CollectJob *)request->data;
+  v8::Isolate *isolate = v8::Isolate::GetCurrent();
+  Profiling *profiling = GetProfilingByHandle(job->profiling.handle);
+
+  if (profiling) {
+    profiling->samplesDiscarded += job->profiling.samplesDiscarded;
+  }
+
+  Nan::HandleScope scope;
+  v8::Local<v8::Context> context = Nan::New(job->context);
+  v8::Context::Scope contextScope(context);
+
+  {
+    // Runs the promise reactions once the resolver is done.
+    node::CallbackScope callbackScope(isolate, Nan::New(job->resource),
+                                      job->asyncContext);
+    v8::Local<v8::Promise::Resolver> resolver = Nan::New(job->resolver);
+
+    if (status == 0 && job->encodedOk) {
+      auto jsProfilingData = Nan::New<v8::Object>();
+      SetStartTimeNanos(&job->profiling, jsProfilingData);
+      SetEncodedPprof(jsProfilingData, &job->encoded);
+      SetProfilerDurations(jsProfilingData, job->startDuration,
+                           job->stopDuration, job->processingDuration,
+                           job->sampleGap);
+      SetActivationsMerged(jsProfilingData, job->activationsMerged);
+      SetDropped(jsProfilingData, &job->dropped);
+      SetLineTicks(job->lineTicks, jsProfilingData);
+      SetPseudoFrameTicks(&job->profiling, jsProfilingData);
+      resolver->Resolve(context, jsProfilingData).Check();
+    } else {
+      if (job->encodedOk) {
+        free(job->encoded.data);
+      }
+
+      resolver->Resolve(context, Nan::Null()).Check();
+    }
+  }
+
+  node::EmitAsyncDestroy(isolate, job->asyncContext);
+  CollectJobFree(job);
+}
+
+/**
+ * Same as collectPprof, but only stops the profile and copies what is needed
+ * of it on the main thread. Matching, aggregation and encoding run on the
+ * libuv thread pool, the returned promise resolves with the encoded profile,
+ * or null. A rotating profiler, or one that slices of a shared profile were
+ * folded into, folds the last slice and hands over its accumulated samples
+ * instead, leaving only the encoding to the thread pool.
+ *
+ * Debug info is not recorded.
+ */
+NAN_METHOD(CollectProfilingDataAsync) {
+  v8::Local<v8::Context> context = Nan::GetCurrentContext();
+  v8::Local<v8::Promise::Resolver> resolver =
+      v8::Promise::Resolver::New(context).ToLocalChecked();
+  info.GetReturnValue().Set(resolver->GetPromise());
+
+  auto handle = Nan::To<int32_t>(info[0]).ToChecked();
+
+  Profiling *profiling = GetProfilingByHandle(handle);
+
+  if (!profiling || !profiling->running) {
+    resolver->Resolve(context, Nan::Null()).Check();
+    return;
+  }
+
+  ProfileRotation rotation;
+  ProfilingRotate(profiling, &rotation);
+  v8::CpuProfile *profile = rotation.profile;
+
+  if (!profile) {
+    ProfilingSetStartTime(profiling, rotation.newStartTime,
+                          rotation.newWallStart);
+    resolver->Resolve(context, Nan::Null()).Check();
+    return;
+  }
+
+  CollectJob *job = new CollectJob();
+  job->request.data = job;
+  job->startDuration = rotation.startDuration;
+  job->stopDuration = rotation.stopDuration;
+  job->sampleGap = ProfilingTakeSampleGap(profiling);
+  job->activationsMerged = ProfilingTakeActivationsMerged(profiling);
+  ProfilingGatherLineTicks(profiling, profile);
+  // The next collect starts a new one.
+  job->lineTicks = profiling->lineTicks;
+  profiling->lineTicks = nullptr;
+
+  if (profiling->rotating || profiling->folded) {
+    ProfilingFoldProfile(profiling, profile, rotation.newStartTime);
+    job->profiling = *profiling;
+    job->accumulator = profiling->accumulator;
+    job->copied = true;
+    // The next fold starts a new one.
+    profiling->accumulator = nullptr;
+    profiling->folded = false;
+  } else {
+    job->copied =
+        RawProfileCopy(&job->profile, profile, &profiling->frameRules);
+
+    if (job->copied) {
+      ProfilingDetachActivations(profiling, &job->profiling);
+    } else {
+      ProfilingReset(profiling);
+    }
+  }
+
+  job->dropped = ProfilingTakeDropped(profiling);
+  // The job counts the ones of the copied profile into its snapshot.
+  memset(profiling->pseudoFrameTicks, 0, sizeof(profiling->pseudoFrameTicks));
+  // Added back to the profiler once the job completes.
+  job->profiling.samplesDiscarded = 0;
+  profile->Delete();
+
+  ProfilingSetStartTime(profiling, rotation.newStartTime,
+                        rotation.newWallStart);
+  profiling->sampleCutoffPoint = HrTime();
+
+  if (!job->copied) {
+    resolver->Resolve(context, Nan::Null()).Check();
+    CollectJobFree(job);
+    return;
+  }
+
+  job->processingDuration = HrTime() - rotation.stopEnd;
+
+  v8::Local<v8::Object> resource = Nan::New<v8::Object>();
+  job->resolver.Reset(resolver);
+  job->context.Reset(context);
+  job->resource.Reset(resource);
+  job->asyncContext = node::EmitAsyncInit(info.GetIsolate(), resource,
+                                          "SplunkCollectCpuProfile");
+
+  if (uv_queue_work(Nan::GetCurrentEventLoop(), &job->request,
+                    CollectJobExecute, CollectJobComplete) != 0) {
+    resolver->Resolve(context, Nan::Null()).Check();
+    node::EmitAsyncDestroy(info.GetIsolate(), job->asyncContext);
+    CollectJobFree(job);
+  }
+}
+
 bool IsValidSpanId(const char *id, int32_t length) {
   if (length != 16) {
     return false;
@@ -980,50 +3832,38 @@ bool IsValidTraceId(const char *id, int32_t length) {
   return memcmp(id, emptyTraceId, 32) != 0;
 }
 
+// filterMask holds the bits of the profilers filtering for traceId.
 void ProfilingEnterContext(Profiling *profiling, int32_t contextHash,
-                           int64_t timestamp,
-                           const v8::String::Utf8Value &traceId,
-                           const v8::String::Utf8Value &spanId) {
+                           int64_t timestamp, const uint8_t *traceId,
+                           const uint8_t *spanId, uint64_t filterMask) {
 
   if (!profiling->running) {
     return;
   }
 
-  if (profiling->onlyFilteredStacktraces) {
-    uint64_t traceIdHash = XXH3_64bits(*traceId, traceId.length());
-    if (kh_get(TraceIdFilter, profiling->traceIdFilter, traceIdHash) ==
-        kh_end(profiling->traceIdFilter)) {
-      return;
-    }
+  if (profiling->onlyFilteredStacktraces &&
+      (filterMask & profiling->filterBit) == 0) {
+    return;
   }
 
-  khiter_t it =
-      kh_get(ActivationStack, profiling->spanActivations, contextHash);
-
-  ActivationStack *stack;
+  ContextStacks *stacks = &profiling->spanActivations;
+  ActivationStack *stack = ContextStacksFindOrInsert(stacks, contextHash);
 
-  if (it == kh_end(profiling->spanActivations)) {
-    int ret;
-    it = kh_put(ActivationStack, profiling->spanActivations, contextHash, &ret);
-
-    if (ret == -1) {
-      return;
-    }
-
-    stack = &kh_value(profiling->spanActivations, it);
-    ActivationStackInit(stack);
-  } else {
-    stack = &kh_value(profiling->spanActivations, it);
+  if (!stack) {
+    profiling->activationsDropped++;
+    return;
   }
 
-  SpanActivation *activation = ActivationStackPush(stack, &profiling->arena);
+  SpanActivation *activation =
+      ActivationStackPush(stack, &profiling->arena, &stacks->spills);
 
   if (!activation) {
+    profiling->activationsDropped++;
     return;
   }
 
-  memcpy(activation->traceId, *traceId, 32);
-  memcpy(activation->spanId, *spanId, 16);
+  memcpy(activation->traceId, traceId, kTraceIdSize);
+  memcpy(activation->spanId, spanId, kSpanIdSize);
   activation->startTime = timestamp;
 #if PROFILER_DEBUG_EXPORT
   activation->depth = profiling->activationDepth;
@@ -1038,14 +3878,13 @@ void ProfilingExitContext(Profiling *profiling, int32_t contextHash,
     return;
   }
 
-  khiter_t it =
-      kh_get(ActivationStack, profiling->spanActivations, contextHash);
+  ActivationStack *stack =
+      ContextStacksFind(&profiling->spanActivations, contextHash);
 
-  if (it == kh_end(profiling->spanActivations)) {
+  if (!stack) {
     return;
   }
 
-  ActivationStack *stack = &kh_value(profiling->spanActivations, it);
   SpanActivation *activation = ActivationStackPop(stack);
 
   if (!activation) {
@@ -1054,55 +3893,373 @@ void ProfilingExitContext(Profiling *profiling, int32_t contextHash,
 
   activation->endTime = timestamp;
 
-  InsertActivation(profiling, activation);
-
-  if (stack->count == 0) {
-    kh_del(ActivationStack, profiling->spanActivations, it);
+  // Promise heavy code enters and exits the same span over and over. Gaps
+  // shorter than the sampling interval can't be told apart from the span
+  // going on, so the activation is held back until one that can't be merged
+  // into it is closed, or until the next collect. The stack stays around with
+  // it, see ProfilingFlushClosedActivations.
+  if (!stack->hasLastClosed) {
+    stack->lastClosed = *activation;
+    stack->hasLastClosed = true;
+  } else if (ActivationsCoalesce(&stack->lastClosed, activation,
+                                 profiling->samplingIntervalNanos)) {
+    profiling->activationsMerged++;
+  } else {
+    InsertActivation(&profiling->activations, &stack->lastClosed);
+    stack->lastClosed = *activation;
   }
 
   profiling->activationDepth--;
 }
 
-NAN_METHOD(EnterContext) {
-  if (globals.profilers.empty()) {
+void EnterContextAt(int32_t contextId, int64_t timestamp,
+                    const uint8_t *traceId, const uint8_t *spanId) {
+  // A single lookup for all the profilers.
+  uint64_t filterMask = 0;
+
+  if (kh_size(globals.traceIdFilters) > 0) {
+    khiter_t it = kh_get(TraceIdFilters, globals.traceIdFilters,
+                         XXH3_64bits(traceId, kTraceIdSize));
+
+    if (it != kh_end(globals.traceIdFilters)) {
+      filterMask = kh_value(globals.traceIdFilters, it);
+    }
+  }
+
+  for (size_t i = 0; i < globals.profilers.size(); i++) {
+    Profiling *profiling = globals.profilers[i];
+    ProfilingEnterContext(profiling, contextId, timestamp, traceId, spanId,
+                          filterMask);
+  }
+}
+
+void ExitContextAt(int32_t contextId, int64_t timestamp) {
+  for (size_t i = 0; i < globals.profilers.size(); i++) {
+    Profiling *profiling = globals.profilers[i];
+    ProfilingExitContext(profiling, contextId, timestamp);
+  }
+}
+
+void EnterContextNow(int32_t contextId, const char *traceIdHex,
+                     int32_t traceIdLength, const char *spanIdHex,
+                     int32_t spanIdLength) {
+  if (!IsValidTraceId(traceIdHex, traceIdLength) ||
+      !IsValidSpanId(spanIdHex, spanIdLength)) {
+    return;
+  }
+
+  // Decoded once here instead of for every sample matched against the span.
+  uint8_t traceId[kTraceIdSize];
+  uint8_t spanId[kSpanIdSize];
+  if (!HexToBinary(traceIdHex, traceIdLength, traceId, sizeof(traceId)) ||
+      !HexToBinary(spanIdHex, spanIdLength, spanId, sizeof(spanId))) {
+    return;
+  }
+
+  // Keep the order with events still sitting in the ring.
+  DrainActivationRing();
+  EnterContextAt(contextId, HrTime(), traceId, spanId);
+}
+
+/**
+ * Shared by the regular and fast API entry points, must not touch the JS heap.
+ */
+void EnterContextImpl(int32_t contextId, const char *traceIdHex,
+                      int32_t traceIdLength, const char *spanIdHex,
+                      int32_t spanIdLength) {
+  CallTimings *timings = &globals.enterContextTimings;
+  bool timed = CallTimingsCount(timings);
+  int64_t start = timed ? HrTime() : 0;
+
+  EnterContextNow(contextId, traceIdHex, traceIdLength, spanIdHex,
+                  spanIdLength);
+
+  if (timed) {
+    CallTimingsRecord(timings, HrTime() - start);
+  }
+}
+
+void ExitContextImpl(int32_t contextId) {
+  CallTimings *timings = &globals.exitContextTimings;
+  bool timed = CallTimingsCount(timings);
+  int64_t start = timed ? HrTime() : 0;
+
+  DrainActivationRing();
+  ExitContextAt(contextId, HrTime());
+
+  if (timed) {
+    CallTimingsRecord(timings, HrTime() - start);
+  }
+}
+
+bool IsZeroId(const uint8_t *id, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    if (id[i] != 0) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/**
+ * Replays the events appended from JS into the activation stacks, in the order
+ * they were written.
+ */
+void DrainActivationRing() {
+  ActivationRingHeader *ring = globals.activationRing;
+
+  if (!ring || ring->count <= 0) {
+    return;
+  }
+
+  int64_t start = HrTime();
+  int32_t count =
+      ring->count < ring->capacity ? ring->count : ring->capacity;
+  const ActivationEvent *events = (const ActivationEvent *)(ring + 1);
+  int64_t clockOffset = UvHrTimeOffset();
+
+  for (int32_t i = 0; i < count; i++) {
+    const ActivationEvent *event = &events[i];
+    int64_t timestamp = event->timestamp + clockOffset;
+
+    if (event->kind == ActivationEvent_Enter) {
+      if (!IsZeroId(event->traceId, kTraceIdSize) &&
+          !IsZeroId(event->spanId, kSpanIdSize)) {
+        EnterContextAt(event->contextId, timestamp, event->traceId,
+                       event->spanId);
+      }
+    } else if (event->kind == ActivationEvent_Exit) {
+      ExitContextAt(event->contextId, timestamp);
+    }
+  }
+
+  ring->count = 0;
+  globals.ringDrainTimings.calls++;
+  globals.ringEventsReplayed += count;
+  CallTimingsRecord(&globals.ringDrainTimings, HrTime() - start);
+}
+
+// To be called whenever a profiler starts or stops.
+void UpdateRunningState() {
+  globals.anyRunning = false;
+
+  for (size_t i = 0; i < globals.profilers.size(); i++) {
+    if (globals.profilers[i]->running) {
+      globals.anyRunning = true;
+      break;
+    }
+  }
+
+  if (globals.activationRing) {
+    globals.activationRing->active = globals.anyRunning ? 1 : 0;
+  }
+}
+
+/**
+ * Returns the SharedArrayBuffer context enter and exit events are appended to
+ * from JS, created on first use.
+ */
+NAN_METHOD(GetActivationRing) {
+  if (globals.activationRingBuffer.IsEmpty()) {
+    size_t byteLength = sizeof(ActivationRingHeader) +
+                        sizeof(ActivationEvent) * kActivationRingCapacity;
+    ActivationRingHeader *ring = (ActivationRingHeader *)calloc(1, byteLength);
+
+    if (!ring) {
+      return Nan::ThrowError("Unable to allocate the activation ring");
+    }
+
+    std::shared_ptr<v8::BackingStore> store =
+        v8::SharedArrayBuffer::NewBackingStore(
+            ring, byteLength, [](void *, size_t, void *) {}, nullptr);
+    v8::Local<v8::SharedArrayBuffer> buffer =
+        v8::SharedArrayBuffer::New(info.GetIsolate(), store);
+
+    globals.activationRing = ring;
+    globals.activationRing->capacity = kActivationRingCapacity;
+    globals.activationRing->highWaterMark = kActivationRingCapacity / 4 * 3;
+    globals.activationRingBuffer.Reset(buffer);
+    UpdateRunningState();
+  }
+
+  info.GetReturnValue().Set(Nan::New(globals.activationRingBuffer));
+}
+
+NAN_METHOD(FlushActivationRing) { DrainActivationRing(); }
+
+void SetStat(v8::Local<v8::Object> stats, const char *name, int64_t value) {
+  Nan::Set(stats, Nan::New(name).ToLocalChecked(),
+           Nan::New<v8::Number>((double)value));
+}
+
+v8::Local<v8::Object> JsCallTimings(const CallTimings *timings) {
+  auto jsTimings = Nan::New<v8::Object>();
+  SetStat(jsTimings, "calls", timings->calls);
+  SetStat(jsTimings, "timedCalls", timings->timedCalls);
+  SetStat(jsTimings, "timedNanos", timings->timedNanos);
+
+  auto buckets = Nan::New<v8::Array>(kTimingBuckets);
+  for (int32_t i = 0; i < kTimingBuckets; i++) {
+    Nan::Set(buckets, i, Nan::New<v8::Number>((double)timings->buckets[i]));
+  }
+
+  Nan::Set(jsTimings, Nan::New("buckets").ToLocalChecked(), buckets);
+  return jsTimings;
+}
+
+/**
+ * Self-overhead counters of all the profilers, counted since the module was
+ * loaded. Only reads counters kept up to date anyway, cheap enough to be
+ * polled by a metric reader.
+ */
+NAN_METHOD(ProfilingStats) {
+  auto stats = Nan::New<v8::Object>();
+
+  Nan::Set(stats, Nan::New("enterContext").ToLocalChecked(),
+           JsCallTimings(&globals.enterContextTimings));
+  Nan::Set(stats, Nan::New("exitContext").ToLocalChecked(),
+           JsCallTimings(&globals.exitContextTimings));
+  Nan::Set(stats, Nan::New("activationRingDrain").ToLocalChecked(),
+           JsCallTimings(&globals.ringDrainTimings));
+
+  auto bounds = Nan::New<v8::Array>(kTimingBuckets - 1);
+  for (int32_t i = 0; i < kTimingBuckets - 1; i++) {
+    Nan::Set(bounds, i,
+             Nan::New<v8::Number>((double)(kTimingBucketBase << i)));
+  }
+
+  Nan::Set(stats, Nan::New("durationBucketBounds").ToLocalChecked(), bounds);
+  SetStat(stats, "timedCallInterval", kTimedCallInterval);
+  SetStat(stats, "activationRingEvents", globals.ringEventsReplayed);
+  SetStat(stats, "activationRingOverflows",
+          globals.activationRing ? globals.activationRing->overflowCount : 0);
+
+  int64_t recorded = 0;
+  int64_t dropped = 0;
+  int64_t overflowBins = 0;
+  int64_t samplesDiscarded = 0;
+  int64_t samplesDropped = 0;
+  int64_t arenaUsed = 0;
+  int64_t arenaCommitted = 0;
+  int64_t arenaReserved = 0;
+  int64_t contextStacks = 0;
+
+  for (size_t i = 0; i < globals.profilers.size(); i++) {
+    Profiling *profiling = globals.profilers[i];
+    const ActivationBinsStats *bins = &profiling->activations.stats;
+    recorded += bins->inserted;
+    dropped += bins->dropped + profiling->activationsDropped;
+    overflowBins += bins->overflowBins;
+    samplesDiscarded += profiling->samplesDiscarded;
+    samplesDropped += profiling->samplesDropped;
+
+    PagedArenaStats arena;
+    PagedArenaGetStats(&profiling->arena, &arena);
+    arenaUsed += PagedArenaUsedMemory(&profiling->arena);
+    arenaCommitted += arena.committed;
+    arenaReserved += arena.reserved;
+    contextStacks += profiling->spanActivations.size;
+  }
+
+  SetStat(stats, "activationsRecorded", recorded);
+  SetStat(stats, "activationsDropped", dropped);
+  SetStat(stats, "overflowBins", overflowBins);
+  SetStat(stats, "samplesDiscarded", samplesDiscarded);
+  SetStat(stats, "samplesDropped", samplesDropped);
+  SetStat(stats, "arenaUsedBytes", arenaUsed);
+  SetStat(stats, "arenaCommittedBytes", arenaCommitted);
+  SetStat(stats, "arenaReservedBytes", arenaReserved);
+  SetStat(stats, "contextStacks", contextStacks);
+  SetStat(stats, "traceIdFilters", kh_size(globals.traceIdFilters));
+
+  int64_t cpuProfiles = 0;
+  for (size_t i = 0; i < globals.samplingSources.size(); i++) {
+    cpuProfiles += globals.samplingSources[i]->recording ? 1 : 0;
+  }
+
+  SetStat(stats, "cpuProfilesRecording", cpuProfiles);
+
+  info.GetReturnValue().Set(stats);
+}
+
+// Contexts are identified either by an integer id assigned on the JS side, or
+// by the identity hash of the context object.
+int32_t ContextId(v8::Local<v8::Value> context) {
+  if (context->IsInt32()) {
+    return context.As<v8::Int32>()->Value();
+  }
+
+  return context.As<v8::Object>()->GetIdentityHash();
+}
+
+// Regular callbacks, also used by V8 whenever the fast ones can't be called.
+void EnterContext(const v8::FunctionCallbackInfo<v8::Value> &info) {
+  if (!globals.anyRunning) {
     return;
   }
 
-  int hash = info[0].As<v8::Object>()->GetIdentityHash();
+  int32_t contextId = ContextId(info[0]);
 
   v8::Isolate *isolate = info.GetIsolate();
-  v8::String::Utf8Value traceId(
+  v8::String::Utf8Value traceIdHex(
       isolate,
       Nan::MaybeLocal<v8::String>(info[1].As<v8::String>()).ToLocalChecked());
-  v8::String::Utf8Value spanId(
+  v8::String::Utf8Value spanIdHex(
       isolate,
       Nan::MaybeLocal<v8::String>(info[2].As<v8::String>()).ToLocalChecked());
 
-  if (!IsValidTraceId(*traceId, traceId.length()) ||
-      !IsValidSpanId(*spanId, spanId.length())) {
+  EnterContextImpl(contextId, *traceIdHex, traceIdHex.length(), *spanIdHex,
+                   spanIdHex.length());
+}
+
+void ExitContext(const v8::FunctionCallbackInfo<v8::Value> &info) {
+  if (!globals.anyRunning) {
     return;
   }
 
-  int64_t timestamp = HrTime();
+  ExitContextImpl(ContextId(info[0]));
+}
 
-  for (size_t i = 0; i < globals.profilers.size(); i++) {
-    Profiling *profiling = globals.profilers[i];
-    ProfilingEnterContext(profiling, hash, timestamp, traceId, spanId);
+#if SPLK_FAST_API_CALLS
+#if V8_MAJOR_VERSION >= 12
+typedef v8::Local<v8::Value> FastApiReceiver;
+#else
+typedef v8::Local<v8::Object> FastApiReceiver;
+#endif
+
+// Only taken from optimized code calling with an integer context id and
+// one-byte strings, skipping the string copies and the identity hash lookup.
+void FastEnterContext(FastApiReceiver receiver, int32_t contextId,
+                      const v8::FastOneByteString &traceIdHex,
+                      const v8::FastOneByteString &spanIdHex) {
+  if (!globals.anyRunning) {
+    return;
   }
+
+  EnterContextImpl(contextId, traceIdHex.data, int32_t(traceIdHex.length),
+                   spanIdHex.data, int32_t(spanIdHex.length));
 }
 
-NAN_METHOD(ExitContext) {
-  if (globals.profilers.empty()) {
+void FastExitContext(FastApiReceiver receiver, int32_t contextId) {
+  if (!globals.anyRunning) {
     return;
   }
 
-  int hash = info[0].As<v8::Object>()->GetIdentityHash();
-  int64_t timestamp = HrTime();
+  ExitContextImpl(contextId);
+}
 
-  for (size_t i = 0; i < globals.profilers.size(); i++) {
-    Profiling *profiling = globals.profilers[i];
-    ProfilingExitContext(profiling, hash, timestamp);
-  }
+const v8::CFunction fastEnterContext = v8::CFunction::Make(FastEnterContext);
+const v8::CFunction fastExitContext = v8::CFunction::Make(FastExitContext);
+#endif
+
+v8::Local<v8::Function> NewContextFunction(v8::FunctionCallback callback,
+                                           const v8::CFunction *fastCallback) {
+  v8::Local<v8::FunctionTemplate> tpl = v8::FunctionTemplate::New(
+      v8::Isolate::GetCurrent(), callback, v8::Local<v8::Value>(),
+      v8::Local<v8::Signature>(), 0, v8::ConstructorBehavior::kThrow,
+      v8::SideEffectType::kHasSideEffect, fastCallback);
+  return Nan::GetFunction(tpl).ToLocalChecked();
 }
 
 } // namespace
@@ -1141,12 +4298,65 @@ void Initialize(v8::Local<v8::Object> target) {
       Nan::GetFunction(Nan::New<v8::FunctionTemplate>(CollectProfilingData))
           .ToLocalChecked());
 
-  Nan::Set(profilingModule, Nan::New("enterContext").ToLocalChecked(),
-           Nan::GetFunction(Nan::New<v8::FunctionTemplate>(EnterContext))
+  Nan::Set(profilingModule, Nan::New("stopPprof").ToLocalChecked(),
+           Nan::GetFunction(Nan::New<v8::FunctionTemplate>(StopProfilingPprof))
+               .ToLocalChecked());
+
+  Nan::Set(profilingModule, Nan::New("collectPprof").ToLocalChecked(),
+           Nan::GetFunction(
+               Nan::New<v8::FunctionTemplate>(CollectProfilingDataPprof))
+               .ToLocalChecked());
+
+  Nan::Set(profilingModule, Nan::New("collectAsync").ToLocalChecked(),
+           Nan::GetFunction(
+               Nan::New<v8::FunctionTemplate>(CollectProfilingDataAsync))
+               .ToLocalChecked());
+
+  Nan::Set(
+      profilingModule, Nan::New("stopColumnar").ToLocalChecked(),
+      Nan::GetFunction(Nan::New<v8::FunctionTemplate>(StopProfilingColumnar))
+          .ToLocalChecked());
+
+  Nan::Set(profilingModule, Nan::New("collectColumnar").ToLocalChecked(),
+           Nan::GetFunction(
+               Nan::New<v8::FunctionTemplate>(CollectProfilingDataColumnar))
+               .ToLocalChecked());
+
+  Nan::Set(
+      profilingModule, Nan::New("stopFrames").ToLocalChecked(),
+      Nan::GetFunction(Nan::New<v8::FunctionTemplate>(StopProfilingFrames))
+          .ToLocalChecked());
+
+  Nan::Set(profilingModule, Nan::New("collectFrames").ToLocalChecked(),
+           Nan::GetFunction(
+               Nan::New<v8::FunctionTemplate>(CollectProfilingDataFrames))
                .ToLocalChecked());
 
+#if SPLK_FAST_API_CALLS
+  const v8::CFunction *fastEnter = &fastEnterContext;
+  const v8::CFunction *fastExit = &fastExitContext;
+#else
+  const v8::CFunction *fastEnter = nullptr;
+  const v8::CFunction *fastExit = nullptr;
+#endif
+
+  Nan::Set(profilingModule, Nan::New("enterContext").ToLocalChecked(),
+           NewContextFunction(EnterContext, fastEnter));
+
   Nan::Set(profilingModule, Nan::New("exitContext").ToLocalChecked(),
-           Nan::GetFunction(Nan::New<v8::FunctionTemplate>(ExitContext))
+           NewContextFunction(ExitContext, fastExit));
+
+  Nan::Set(profilingModule, Nan::New("getActivationRing").ToLocalChecked(),
+           Nan::GetFunction(Nan::New<v8::FunctionTemplate>(GetActivationRing))
+               .ToLocalChecked());
+
+  Nan::Set(
+      profilingModule, Nan::New("drainActivationRing").ToLocalChecked(),
+      Nan::GetFunction(Nan::New<v8::FunctionTemplate>(FlushActivationRing))
+          .ToLocalChecked());
+
+  Nan::Set(profilingModule, Nan::New("stats").ToLocalChecked(),
+           Nan::GetFunction(Nan::New<v8::FunctionTemplate>(ProfilingStats))
                .ToLocalChecked());
 
   Nan::Set(
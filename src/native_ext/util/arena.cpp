@@ -3,8 +3,18 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
 namespace {
 constexpr uintptr_t kAlignment = 2 * sizeof(void*);
+// Granularity memory is committed and trimmed at, a multiple of the OS page size.
+constexpr size_t kCommitChunk = 1024 * 1024;
+constexpr size_t kDefaultHighWaterMark = 8 * kCommitChunk;
+
 uintptr_t align(uintptr_t ptr, uintptr_t alignment) {
   uintptr_t m = ptr & (alignment - 1);
 
@@ -14,6 +24,213 @@ uintptr_t align(uintptr_t ptr, uintptr_t alignment) {
 
   return ptr + (alignment - m);
 }
+
+size_t RoundUpToChunk(size_t size) { return (size + kCommitChunk - 1) / kCommitChunk * kCommitChunk; }
+
+// Whether committing size more bytes keeps the arena within its limit.
+bool WithinLimit(PagedArena* arena, size_t size) {
+  if (arena->limit == 0 || arena->stats.committed + size <= arena->limit) {
+    return true;
+  }
+
+  arena->stats.limitFailures++;
+  return false;
+}
+
+#ifdef _WIN32
+void* ReserveMemory(size_t size) { return VirtualAlloc(nullptr, size, MEM_RESERVE, PAGE_NOACCESS); }
+
+bool CommitMemory(void* addr, size_t size) {
+  return VirtualAlloc(addr, size, MEM_COMMIT, PAGE_READWRITE) != nullptr;
+}
+
+void DecommitMemory(void* addr, size_t size) { VirtualFree(addr, size, MEM_DECOMMIT); }
+
+void ReleaseMemory(void* addr, size_t size) { VirtualFree(addr, 0, MEM_RELEASE); }
+#else
+void* ReserveMemory(size_t size) {
+  void* mem = mmap(nullptr, size, PROT_NONE, MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+  return mem == MAP_FAILED ? nullptr : mem;
+}
+
+bool CommitMemory(void* addr, size_t size) {
+  return mprotect(addr, size, PROT_READ | PROT_WRITE) == 0;
+}
+
+void DecommitMemory(void* addr, size_t size) {
+#if defined(__linux__)
+  madvise(addr, size, MADV_DONTNEED);
+  mprotect(addr, size, PROT_NONE);
+#else
+  // MADV_DONTNEED doesn't give the pages back right away everywhere, mapping
+  // over them does.
+  mmap(addr, size, PROT_NONE, MAP_FIXED | MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+#endif
+}
+
+void ReleaseMemory(void* addr, size_t size) { munmap(addr, size); }
+#endif
+
+ArenaNode* NewNode(PagedArena* arena, size_t capacity) {
+  ArenaNode* node = (ArenaNode*)calloc(1, sizeof(ArenaNode));
+
+  if (!node) {
+    return nullptr;
+  }
+
+  uint8_t* mem = (uint8_t*)ReserveMemory(capacity);
+
+  if (!mem) {
+    free(node);
+    return nullptr;
+  }
+
+  node->memory = mem;
+  MemArenaInit(&node->arena, mem, capacity);
+  arena->stats.reserved += capacity;
+
+  return node;
+}
+
+void FreeNode(PagedArena* arena, ArenaNode* node) {
+  ReleaseMemory(node->memory, node->arena.capacity);
+  arena->stats.reserved -= node->arena.capacity;
+  arena->stats.committed -= node->committed;
+  free(node);
+}
+
+void FreeNodes(PagedArena* arena, ArenaNode* node) {
+  while (node) {
+    ArenaNode* next = node->next;
+    FreeNode(arena, node);
+    node = next;
+  }
+}
+
+bool NodeCommit(PagedArena* arena, ArenaNode* node, size_t end) {
+  if (end <= node->committed) {
+    return true;
+  }
+
+  size_t target = RoundUpToChunk(end);
+
+  if (target > node->arena.capacity) {
+    target = node->arena.capacity;
+  }
+
+  if (!WithinLimit(arena, target - node->committed)) {
+    return false;
+  }
+
+  if (!CommitMemory(node->memory + node->committed, target - node->committed)) {
+    return false;
+  }
+
+  PagedArenaStats* stats = &arena->stats;
+  stats->committed += target - node->committed;
+
+  if (stats->committed > stats->peakCommitted) {
+    stats->peakCommitted = stats->committed;
+  }
+
+  node->committed = target;
+  return true;
+}
+
+// Gives back the committed memory past keep (a multiple of kCommitChunk).
+void NodeTrim(PagedArena* arena, ArenaNode* node, size_t keep) {
+  if (node->committed <= keep) {
+    return;
+  }
+
+  size_t trimmed = node->committed - keep;
+  DecommitMemory(node->memory + keep, trimmed);
+  arena->stats.committed -= trimmed;
+  arena->stats.trimmed += trimmed;
+  node->committed = keep;
+}
+
+void* NodeAlloc(PagedArena* arena, ArenaNode* node, size_t size) {
+  uintptr_t base = (uintptr_t)node->memory;
+  size_t offset = align(base + node->arena.offset, kAlignment) - base;
+
+  if (offset + size > node->arena.capacity || !NodeCommit(arena, node, offset + size)) {
+    return nullptr;
+  }
+
+  node->arena.offset = offset + size;
+  return node->memory + offset;
+}
+
+void* AllocLarge(PagedArena* arena, size_t size) {
+  // Not even reserved past the limit.
+  if (!WithinLimit(arena, RoundUpToChunk(size))) {
+    return nullptr;
+  }
+
+  ArenaNode* node = NewNode(arena, RoundUpToChunk(size));
+
+  if (!node) {
+    return nullptr;
+  }
+
+  void* mem = NodeAlloc(arena, node, size);
+
+  if (!mem) {
+    FreeNode(arena, node);
+    return nullptr;
+  }
+
+  node->next = arena->largeNodes;
+  arena->largeNodes = node;
+  arena->stats.largeAllocations++;
+
+  // Freshly committed, already zeroed.
+  return mem;
+}
+
+void* Alloc(PagedArena* arena, size_t size, bool zero) {
+  assert(size > 0);
+
+  if (size > arena->pageSize / 2) {
+    return AllocLarge(arena, size);
+  }
+
+  void* mem = arena->nodes ? NodeAlloc(arena, arena->nodes, size) : nullptr;
+
+  if (!mem) {
+    ArenaNode* node = arena->freeNodes;
+
+    if (node) {
+      arena->freeNodes = node->next;
+    } else {
+      // A new page would have to commit its first chunk, don't bother
+      // reserving it past the limit.
+      if (!WithinLimit(arena, RoundUpToChunk(size))) {
+        return nullptr;
+      }
+
+      node = NewNode(arena, arena->pageSize);
+      if (!node) {
+        return nullptr;
+      }
+    }
+
+    node->next = arena->nodes;
+    arena->nodes = node;
+    mem = NodeAlloc(arena, node, size);
+
+    if (!mem) {
+      return nullptr;
+    }
+  }
+
+  if (zero) {
+    memset(mem, 0, size);
+  }
+
+  return mem;
+}
 } // namespace
 
 void MemArenaInit(MemArena* arena, void* mem, size_t capacity) {
@@ -40,70 +257,96 @@ void* MemArenaAlloc(MemArena* arena, size_t size) {
 
 void MemArenaReset(MemArena* arena) { arena->offset = 0; }
 
-static ArenaNode* PagedArenaNewNode(size_t capacity) {
-  uint8_t* mem = (uint8_t*)calloc(1, capacity + sizeof(ArenaNode));
+void PagedArenaInit(PagedArena* arena, size_t pageSize) {
+  memset(arena, 0, sizeof(PagedArena));
+  arena->pageSize = pageSize;
+  arena->highWaterMark = kDefaultHighWaterMark;
+  arena->nodes = NewNode(arena, pageSize);
+}
 
-  if (!mem) {
-    return nullptr;
-  }
+void PagedArenaSetHighWaterMark(PagedArena* arena, size_t highWaterMark) {
+  arena->highWaterMark = highWaterMark;
+}
 
-  ArenaNode* node = (ArenaNode*)mem;
-  node->memory = mem + sizeof(ArenaNode);
-  MemArenaInit(&node->arena, node->memory, capacity);
+void PagedArenaSetLimit(PagedArena* arena, size_t limit) { arena->limit = limit; }
 
-  return node;
+void* SPLK_ASSUME_ALIGNED(16) PagedArenaAlloc(PagedArena* arena, size_t size) {
+  return Alloc(arena, size, true);
 }
 
-void PagedArenaInit(PagedArena* arena, size_t pageSize) {
-  arena->nodes = PagedArenaNewNode(pageSize);
-  arena->freeNodes = nullptr;
-  arena->pageSize = pageSize;
+void* SPLK_ASSUME_ALIGNED(16) PagedArenaAllocUninitialized(PagedArena* arena, size_t size) {
+  return Alloc(arena, size, false);
 }
 
-void* SPLK_ASSUME_ALIGNED(16) PagedArenaAlloc(PagedArena* arena, size_t size) {
-  void* mem = MemArenaAlloc(&arena->nodes->arena, size);
+void PagedArenaReset(PagedArena* arena) {
+  FreeNodes(arena, arena->largeNodes);
+  arena->largeNodes = nullptr;
 
-  if (mem != nullptr) {
-    return mem;
-  }
+  ArenaNode* current = arena->nodes;
 
-  ArenaNode* node = arena->freeNodes;
+  if (!current) {
+    return;
+  }
 
-  if (node) {
-    arena->freeNodes = node->next;
-  } else {
-    node = PagedArenaNewNode(arena->pageSize);
-    if (!node) {
-      return nullptr;
-    }
+  // Pages used in this round, followed by the ones left over from the last.
+  // Spliced before the walk starts, the current page may have no successor.
+  ArenaNode* last = current;
+  while (last->next) {
+    last = last->next;
   }
+  last->next = arena->freeNodes;
 
-  node->next = arena->nodes;
-  arena->nodes = node;
+  ArenaNode* node = current->next;
+  current->next = nullptr;
+  arena->freeNodes = nullptr;
 
-  return MemArenaAlloc(&node->arena, size);
-}
+  // The current page is kept, the rest only while within the high water mark.
+  size_t budget = arena->highWaterMark / kCommitChunk * kCommitChunk;
+  ArenaNode** freeTail = &arena->freeNodes;
 
-void PagedArenaReset(PagedArena* arena) {
-  ArenaNode* node = arena->nodes;
+  MemArenaReset(&current->arena);
+  size_t keep = current->committed < budget ? current->committed : budget;
+  NodeTrim(arena, current, keep);
+  budget -= keep;
 
   while (node) {
+    ArenaNode* next = node->next;
     MemArenaReset(&node->arena);
-    node = node->next;
+    keep = node->committed < budget ? node->committed : budget;
+    NodeTrim(arena, node, keep);
+    budget -= keep;
+
+    if (node->committed == 0) {
+      FreeNode(arena, node);
+    } else {
+      node->next = nullptr;
+      *freeTail = node;
+      freeTail = &node->next;
+    }
+
+    node = next;
   }
+}
 
-  arena->freeNodes = arena->nodes->next;
-  arena->nodes->next = nullptr;
+void PagedArenaDestroy(PagedArena* arena) {
+  FreeNodes(arena, arena->nodes);
+  FreeNodes(arena, arena->freeNodes);
+  FreeNodes(arena, arena->largeNodes);
+  memset(arena, 0, sizeof(PagedArena));
 }
 
 size_t PagedArenaUsedMemory(const PagedArena* arena) {
   size_t used = 0;
 
-  ArenaNode* node = arena->nodes;
-  while (node) {
+  for (ArenaNode* node = arena->nodes; node; node = node->next) {
+    used += node->arena.offset;
+  }
+
+  for (ArenaNode* node = arena->largeNodes; node; node = node->next) {
     used += node->arena.offset;
-    node = node->next;
   }
 
   return used;
 }
+
+void PagedArenaGetStats(const PagedArena* arena, PagedArenaStats* stats) { *stats = arena->stats; }
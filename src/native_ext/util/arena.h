@@ -12,14 +12,47 @@ struct MemArena {
 
 struct ArenaNode {
   uint8_t* memory;
+  // arena.capacity bytes of address space are reserved, of which only the
+  // first committed bytes are backed by memory.
   MemArena arena;
+  size_t committed;
   ArenaNode* next;
 };
 
+struct PagedArenaStats {
+  // Address space reserved for pages and large allocations.
+  size_t reserved;
+  // Memory actually backing them.
+  size_t committed;
+  size_t peakCommitted;
+  // Allocations that got a node of their own, since init.
+  size_t largeAllocations;
+  // Memory given back to the OS on resets, since init.
+  size_t trimmed;
+  // Commits refused because of the limit, since init.
+  size_t limitFailures;
+};
+
+/**
+ * Pages are reserved up front but only committed as allocations reach them,
+ * so a large page size costs address space rather than memory. On reset the
+ * committed memory beyond highWaterMark is given back to the OS.
+ *
+ * Allocations larger than half a page get a node of their own, released on
+ * reset.
+ *
+ * With a limit, allocations that would take the committed memory past it
+ * fail instead, memory already committed is still handed out.
+ */
 struct PagedArena {
   ArenaNode* nodes;
   ArenaNode* freeNodes;
+  ArenaNode* largeNodes;
   size_t pageSize;
+  size_t highWaterMark;
+  // 0 for no limit.
+  size_t limit;
+  PagedArenaStats stats;
 };
 
 void MemArenaInit(MemArena* arena, void* mem, size_t capacity);
@@ -27,6 +60,16 @@ void* SPLK_ASSUME_ALIGNED(16) MemArenaAlloc(MemArena* arena, size_t size);
 void MemArenaReset(MemArena* arena);
 
 void PagedArenaInit(PagedArena* arena, size_t pageSize);
+/* Committed memory kept across resets, the rest is trimmed. */
+void PagedArenaSetHighWaterMark(PagedArena* arena, size_t highWaterMark);
+/* Committed memory allocations may not take the arena past, 0 for no limit. */
+void PagedArenaSetLimit(PagedArena* arena, size_t limit);
+/* Returns zeroed memory. */
 void* SPLK_ASSUME_ALIGNED(16) PagedArenaAlloc(PagedArena* arena, size_t size);
+/* Same as PagedArenaAlloc, without zeroing memory reused after a reset. */
+void* SPLK_ASSUME_ALIGNED(16) PagedArenaAllocUninitialized(PagedArena* arena, size_t size);
 void PagedArenaReset(PagedArena* arena);
+/* Releases all memory, the arena has to be initialized again before use. */
+void PagedArenaDestroy(PagedArena* arena);
 size_t PagedArenaUsedMemory(const PagedArena* arena);
+void PagedArenaGetStats(const PagedArena* arena, PagedArenaStats* stats);
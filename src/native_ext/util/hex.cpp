@@ -1,6 +1,14 @@
 #include "hex.h"
 #include <string.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HEX_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#define HEX_NEON 1
+#include <arm_neon.h>
+#endif
+
 namespace {
 constexpr int8_t kHexDigits[256] = {
   -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
@@ -16,8 +24,101 @@ constexpr int8_t kHexDigits[256] = {
   -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
 };
 
+const char kHexChars[] = "0123456789abcdef";
+
 inline int8_t HexToInt(char c) { return kHexDigits[uint8_t(c)]; }
 
+#if HEX_SSE2
+// 16 hex characters into 8 bytes, false if any of them isn't a hex digit.
+bool DecodeBlock(const char* hex, uint8_t* out) {
+  __m128i chars = _mm_loadu_si128((const __m128i*)hex);
+
+  // '0'..'9' map to 0..9, everything else falls outside of that range.
+  __m128i digits = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+  __m128i isDigit = _mm_and_si128(
+    _mm_cmpgt_epi8(digits, _mm_set1_epi8(-1)), _mm_cmplt_epi8(digits, _mm_set1_epi8(10)));
+
+  // 'a'..'f' and 'A'..'F' map to 10..15.
+  __m128i letters =
+    _mm_sub_epi8(_mm_or_si128(chars, _mm_set1_epi8(0x20)), _mm_set1_epi8('a' - 10));
+  __m128i isLetter = _mm_and_si128(
+    _mm_cmpgt_epi8(letters, _mm_set1_epi8(9)), _mm_cmplt_epi8(letters, _mm_set1_epi8(16)));
+
+  if (_mm_movemask_epi8(_mm_or_si128(isDigit, isLetter)) != 0xffff) {
+    return false;
+  }
+
+  __m128i nibbles =
+    _mm_or_si128(_mm_and_si128(isDigit, digits), _mm_and_si128(isLetter, letters));
+
+  // Even characters are the high nibbles, i.e. the low byte of each 16 bit lane.
+  __m128i high = _mm_slli_epi16(_mm_and_si128(nibbles, _mm_set1_epi16(0x00ff)), 4);
+  __m128i low = _mm_srli_epi16(nibbles, 8);
+  __m128i bytes = _mm_packus_epi16(_mm_or_si128(high, low), _mm_setzero_si128());
+  _mm_storel_epi64((__m128i*)out, bytes);
+  return true;
+}
+
+// 8 bytes into 16 hex characters.
+void EncodeBlock(const uint8_t* in, char* hex) {
+  __m128i bytes = _mm_loadl_epi64((const __m128i*)in);
+  __m128i mask = _mm_set1_epi8(0x0f);
+  __m128i high = _mm_and_si128(_mm_srli_epi16(bytes, 4), mask);
+  __m128i low = _mm_and_si128(bytes, mask);
+  __m128i nibbles = _mm_unpacklo_epi8(high, low);
+
+  // '0' + n, plus the gap between '9' + 1 and 'a' for n > 9.
+  __m128i letterOffset =
+    _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)), _mm_set1_epi8('a' - '0' - 10));
+  __m128i chars = _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')), letterOffset);
+  _mm_storeu_si128((__m128i*)hex, chars);
+}
+#elif HEX_NEON
+uint8x8_t DecodeNibbles(uint8x8_t chars, uint8x8_t* valid) {
+  uint8x8_t digits = vsub_u8(chars, vdup_n_u8('0'));
+  uint8x8_t isDigit = vclt_u8(digits, vdup_n_u8(10));
+  uint8x8_t letters = vsub_u8(vorr_u8(chars, vdup_n_u8(0x20)), vdup_n_u8('a'));
+  uint8x8_t isLetter = vclt_u8(letters, vdup_n_u8(6));
+  *valid = vand_u8(*valid, vorr_u8(isDigit, isLetter));
+  return vorr_u8(
+    vand_u8(isDigit, digits), vand_u8(isLetter, vadd_u8(letters, vdup_n_u8(10))));
+}
+
+// 16 hex characters into 8 bytes, false if any of them isn't a hex digit.
+bool DecodeBlock(const char* hex, uint8_t* out) {
+  // Deinterleaves the high (even) and low (odd) nibble characters.
+  uint8x8x2_t chars = vld2_u8((const uint8_t*)hex);
+  uint8x8_t valid = vdup_n_u8(0xff);
+  uint8x8_t high = DecodeNibbles(chars.val[0], &valid);
+  uint8x8_t low = DecodeNibbles(chars.val[1], &valid);
+
+  if (vget_lane_u64(vreinterpret_u64_u8(valid), 0) != ~uint64_t(0)) {
+    return false;
+  }
+
+  vst1_u8(out, vorr_u8(vshl_n_u8(high, 4), low));
+  return true;
+}
+
+// 8 bytes into 16 hex characters.
+void EncodeBlock(const uint8_t* in, char* hex) {
+  uint8x8_t bytes = vld1_u8(in);
+  uint8x8x2_t nibbles;
+  nibbles.val[0] = vshr_n_u8(bytes, 4);
+  nibbles.val[1] = vand_u8(bytes, vdup_n_u8(0x0f));
+
+  for (int i = 0; i < 2; i++) {
+    // '0' + n, plus the gap between '9' + 1 and 'a' for n > 9.
+    uint8x8_t letterOffset =
+      vand_u8(vcgt_u8(nibbles.val[i], vdup_n_u8(9)), vdup_n_u8('a' - '0' - 10));
+    nibbles.val[i] = vadd_u8(vadd_u8(nibbles.val[i], vdup_n_u8('0')), letterOffset);
+  }
+
+  // Interleaves back into high, low character pairs.
+  vst2_u8((uint8_t*)hex, nibbles);
+}
+#endif
+
 } // namespace
 
 bool HexToBinary(const char* hex, size_t hex_len, uint8_t* buffer, size_t buffer_size) {
@@ -32,13 +133,50 @@ bool HexToBinary(const char* hex, size_t hex_len, uint8_t* buffer, size_t buffer
   int64_t last_hex_pos = hex_size - 1;
 
   int64_t i = 0;
+
+#if HEX_SSE2 || HEX_NEON
+  for (; i + 16 <= hex_size; i += 16, buffer_pos += 8) {
+    if (!DecodeBlock(&hex[i], &buffer[buffer_pos])) {
+      return false;
+    }
+  }
+#endif
+
   for (; i < last_hex_pos; i += 2) {
-    buffer[buffer_pos++] = (HexToInt(hex[i]) << 4) | HexToInt(hex[i + 1]);
+    int8_t high = HexToInt(hex[i]);
+    int8_t low = HexToInt(hex[i + 1]);
+
+    if (high < 0 || low < 0) {
+      return false;
+    }
+
+    buffer[buffer_pos++] = (high << 4) | low;
   }
 
   if (i == last_hex_pos) {
-    buffer[buffer_pos] = HexToInt(hex[i]);
+    int8_t value = HexToInt(hex[i]);
+
+    if (value < 0) {
+      return false;
+    }
+
+    buffer[buffer_pos] = value;
   }
 
   return true;
 }
+
+void BinaryToHex(const uint8_t* buffer, size_t buffer_size, char* hex) {
+  size_t i = 0;
+
+#if HEX_SSE2 || HEX_NEON
+  for (; i + 8 <= buffer_size; i += 8) {
+    EncodeBlock(&buffer[i], &hex[i * 2]);
+  }
+#endif
+
+  for (; i < buffer_size; i++) {
+    hex[i * 2] = kHexChars[buffer[i] >> 4];
+    hex[i * 2 + 1] = kHexChars[buffer[i] & 0x0f];
+  }
+}
@@ -3,4 +3,10 @@
 #include <stddef.h>
 #include <stdint.h>
 
+/**
+ * Decodes hex_len hex characters into the end of buffer, zero padding the
+ * front. Returns false if the input doesn't fit or contains non-hex characters.
+ */
 bool HexToBinary(const char* hex, size_t hex_len, uint8_t* buffer, size_t buffer_size);
+/* Encodes buffer_size bytes as lowercase hex, writes exactly 2 * buffer_size characters. */
+void BinaryToHex(const uint8_t* buffer, size_t buffer_size, char* hex);
@@ -16,8 +16,12 @@ int64_t HrTime() {
 
   return int64_t(mach_absolute_time() * timebase.numer / timebase.denom);
 }
+
+int64_t UvHrTimeOffset() { return HrTime() - int64_t(uv_hrtime()); }
 #else
 int64_t HrTime() { return uv_hrtime(); }
+
+int64_t UvHrTimeOffset() { return 0; }
 #endif
 
 #ifdef _WIN32
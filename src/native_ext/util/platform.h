@@ -4,6 +4,8 @@
 
 namespace Splunk {
 int64_t HrTime();
+/* Offset to add to uv_hrtime (process.hrtime) timestamps to get HrTime ones. */
+int64_t UvHrTimeOffset();
 int64_t MicroSecondsSinceEpoch();
 int64_t MilliSecondsSinceEpoch();
 }
@@ -0,0 +1,109 @@
+#include "protobuf.h"
+#include <stdlib.h>
+#include <string.h>
+
+void ProtobufBufferInit(ProtobufBuffer* buffer) {
+  buffer->data = nullptr;
+  buffer->size = 0;
+  buffer->capacity = 0;
+}
+
+void ProtobufBufferFree(ProtobufBuffer* buffer) {
+  free(buffer->data);
+  ProtobufBufferInit(buffer);
+}
+
+bool ProtobufBufferReserve(ProtobufBuffer* buffer, size_t additional) {
+  size_t required = buffer->size + additional;
+
+  if (required <= buffer->capacity) {
+    return true;
+  }
+
+  size_t capacity = buffer->capacity < 256 ? 256 : buffer->capacity;
+  while (capacity < required) {
+    capacity *= 2;
+  }
+
+  uint8_t* data = (uint8_t*)realloc(buffer->data, capacity);
+
+  if (!data) {
+    return false;
+  }
+
+  buffer->data = data;
+  buffer->capacity = capacity;
+  return true;
+}
+
+bool ProtobufBufferAppend(ProtobufBuffer* buffer, const void* data, size_t length) {
+  if (length == 0) {
+    return true;
+  }
+
+  if (!ProtobufBufferReserve(buffer, length)) {
+    return false;
+  }
+
+  memcpy(buffer->data + buffer->size, data, length);
+  buffer->size += length;
+  return true;
+}
+
+size_t ProtobufVarintSize(uint64_t value) {
+  size_t size = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    size++;
+  }
+  return size;
+}
+
+size_t ProtobufTagSize(uint32_t field) { return ProtobufVarintSize(uint64_t(field) << 3); }
+
+size_t ProtobufVarintFieldSize(uint32_t field, int64_t value) {
+  return ProtobufTagSize(field) + ProtobufVarintSize(uint64_t(value));
+}
+
+size_t ProtobufLengthDelimitedFieldSize(uint32_t field, size_t length) {
+  return ProtobufTagSize(field) + ProtobufVarintSize(length) + length;
+}
+
+bool ProtobufWriteVarint(ProtobufBuffer* buffer, uint64_t value) {
+  const size_t kMaxVarintSize = 10;
+  if (!ProtobufBufferReserve(buffer, kMaxVarintSize)) {
+    return false;
+  }
+
+  uint8_t* out = buffer->data + buffer->size;
+  size_t written = 0;
+
+  while (value >= 0x80) {
+    out[written++] = uint8_t(value) | 0x80;
+    value >>= 7;
+  }
+
+  out[written++] = uint8_t(value);
+  buffer->size += written;
+  return true;
+}
+
+bool ProtobufWriteTag(ProtobufBuffer* buffer, uint32_t field, ProtobufWireType type) {
+  return ProtobufWriteVarint(buffer, (uint64_t(field) << 3) | uint64_t(type));
+}
+
+bool ProtobufWriteVarintField(ProtobufBuffer* buffer, uint32_t field, int64_t value) {
+  return ProtobufWriteTag(buffer, field, ProtobufWireType_Varint) &&
+         ProtobufWriteVarint(buffer, uint64_t(value));
+}
+
+bool ProtobufWriteLengthDelimitedHeader(ProtobufBuffer* buffer, uint32_t field, size_t length) {
+  return ProtobufWriteTag(buffer, field, ProtobufWireType_LengthDelimited) &&
+         ProtobufWriteVarint(buffer, length);
+}
+
+bool ProtobufWriteBytesField(
+  ProtobufBuffer* buffer, uint32_t field, const void* data, size_t length) {
+  return ProtobufWriteLengthDelimitedHeader(buffer, field, length) &&
+         ProtobufBufferAppend(buffer, data, length);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum ProtobufWireType {
+  ProtobufWireType_Varint = 0,
+  ProtobufWireType_LengthDelimited = 2,
+};
+
+/* Growable, malloc-backed output buffer for protobuf encoding. */
+struct ProtobufBuffer {
+  uint8_t* data;
+  size_t size;
+  size_t capacity;
+};
+
+void ProtobufBufferInit(ProtobufBuffer* buffer);
+void ProtobufBufferFree(ProtobufBuffer* buffer);
+bool ProtobufBufferReserve(ProtobufBuffer* buffer, size_t additional);
+bool ProtobufBufferAppend(ProtobufBuffer* buffer, const void* data, size_t length);
+
+size_t ProtobufVarintSize(uint64_t value);
+size_t ProtobufTagSize(uint32_t field);
+/* Size of a varint field (tag + value), negative values take 10 bytes. */
+size_t ProtobufVarintFieldSize(uint32_t field, int64_t value);
+/* Size of a length delimited field (tag + length prefix + payload). */
+size_t ProtobufLengthDelimitedFieldSize(uint32_t field, size_t length);
+
+bool ProtobufWriteVarint(ProtobufBuffer* buffer, uint64_t value);
+bool ProtobufWriteTag(ProtobufBuffer* buffer, uint32_t field, ProtobufWireType type);
+bool ProtobufWriteVarintField(ProtobufBuffer* buffer, uint32_t field, int64_t value);
+/* Writes the tag and length prefix, the caller writes the payload. */
+bool ProtobufWriteLengthDelimitedHeader(ProtobufBuffer* buffer, uint32_t field, size_t length);
+bool ProtobufWriteBytesField(
+  ProtobufBuffer* buffer, uint32_t field, const void* data, size_t length);
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+
+/* xorshift64, only used for sampling decisions. The state must not be 0. */
+inline uint64_t ReservoirRandom(uint64_t* state) {
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  *state = x;
+  // The low bits of consecutive outputs are correlated.
+  return x >> 32;
+}
+
+/**
+ * Algorithm R: the offered-th item (counting from 1, including the ones that
+ * fit) takes the place of a random one once the reservoir is full, with
+ * probability capacity / offered. This keeps a uniform sample of all the items
+ * offered. Returns the index to store the item at, -1 if it is dropped.
+ */
+inline int64_t ReservoirIndex(int64_t offered, int64_t capacity, uint64_t* random) {
+  if (offered <= capacity) {
+    return offered - 1;
+  }
+
+  int64_t index = int64_t(ReservoirRandom(random) % uint64_t(offered));
+  return index < capacity ? index : -1;
+}
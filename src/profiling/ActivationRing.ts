@@ -0,0 +1,152 @@
+/*
+ * Copyright Splunk Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+import type { ProfilingExtension } from './types';
+
+// Layout shared with ActivationRingHeader and ActivationEvent in
+// src/native_ext/activations.h.
+const HEADER_SIZE = 32;
+const HEADER_COUNT = 0;
+const HEADER_OVERFLOW_COUNT = 1;
+const HEADER_CAPACITY = 2;
+const HEADER_HIGH_WATER_MARK = 3;
+const HEADER_ACTIVE = 4;
+
+const EVENT_SIZE = 40;
+const EVENT_CONTEXT_ID = 0;
+const EVENT_KIND = 4;
+const EVENT_TIMESTAMP = 8;
+const EVENT_TRACE_ID = 16;
+const EVENT_SPAN_ID = 32;
+
+const EVENT_ENTER = 1;
+const EVENT_EXIT = 2;
+
+const HEX_DIGITS = new Int8Array(128).fill(-1);
+for (let i = 0; i < 10; i++) {
+  HEX_DIGITS[48 + i] = i;
+}
+for (let i = 0; i < 6; i++) {
+  HEX_DIGITS[65 + i] = 10 + i;
+  HEX_DIGITS[97 + i] = 10 + i;
+}
+
+function hexToBytes(hex: string, out: Uint8Array, offset: number, length: number) {
+  if (hex.length !== length * 2) {
+    return false;
+  }
+
+  for (let i = 0; i < length; i++) {
+    const highCode = hex.charCodeAt(i * 2);
+    const lowCode = hex.charCodeAt(i * 2 + 1);
+
+    // Past ASCII, the table would be indexed by a truncated code unit.
+    if (highCode > 127 || lowCode > 127) {
+      return false;
+    }
+
+    const high = HEX_DIGITS[highCode];
+    const low = HEX_DIGITS[lowCode];
+
+    if (high < 0 || low < 0) {
+      return false;
+    }
+
+    out[offset + i] = (high << 4) | low;
+  }
+
+  return true;
+}
+
+/**
+ * Records context enters and exits into a buffer shared with the native
+ * extension, instead of calling into it for every context switch. The
+ * extension replays the events before building a profile, or when asked to
+ * once the buffer fills past its high water mark.
+ */
+export class ActivationRing {
+  protected _header: Int32Array;
+  protected _bytes: Uint8Array;
+  protected _view: DataView;
+  protected _drain: () => void;
+
+  constructor(extension: ProfilingExtension) {
+    const buffer = extension.getActivationRing();
+    this._header = new Int32Array(buffer, 0, HEADER_SIZE / 4);
+    this._bytes = new Uint8Array(buffer);
+    this._view = new DataView(buffer);
+    this._drain = () => extension.drainActivationRing();
+  }
+
+  /** Number of events dropped because the buffer was full. */
+  get droppedEvents() {
+    return this._header[HEADER_OVERFLOW_COUNT];
+  }
+
+  enterContext(contextId: number, traceId: string, spanId: string) {
+    const offset = this._reserve();
+
+    if (offset < 0) return;
+
+    if (
+      !hexToBytes(traceId, this._bytes, offset + EVENT_TRACE_ID, 16) ||
+      !hexToBytes(spanId, this._bytes, offset + EVENT_SPAN_ID, 8)
+    ) {
+      return;
+    }
+
+    this._commit(offset, contextId, EVENT_ENTER);
+  }
+
+  exitContext(contextId: number) {
+    const offset = this._reserve();
+
+    if (offset < 0) return;
+
+    this._commit(offset, contextId, EVENT_EXIT);
+  }
+
+  // Returns the offset of the next free event, -1 if nothing should be written.
+  protected _reserve() {
+    const header = this._header;
+
+    if (header[HEADER_ACTIVE] === 0) {
+      return -1;
+    }
+
+    const count = header[HEADER_COUNT];
+
+    if (count >= header[HEADER_CAPACITY]) {
+      header[HEADER_OVERFLOW_COUNT]++;
+      return -1;
+    }
+
+    return HEADER_SIZE + count * EVENT_SIZE;
+  }
+
+  protected _commit(offset: number, contextId: number, kind: number) {
+    const view = this._view;
+    view.setInt32(offset + EVENT_CONTEXT_ID, contextId, true);
+    view.setInt32(offset + EVENT_KIND, kind, true);
+    view.setBigInt64(offset + EVENT_TIMESTAMP, process.hrtime.bigint(), true);
+
+    const header = this._header;
+    const count = ++header[HEADER_COUNT];
+
+    if (count >= header[HEADER_HIGH_WATER_MARK]) {
+      this._drain();
+    }
+  }
+}
@@ -15,6 +15,7 @@
  */
 import {
   CpuProfile,
+  EncodedCpuProfile,
   HeapProfile,
   ProfilingExporter,
   ProfilingStacktrace,
@@ -32,7 +33,7 @@ import {
   ATTR_TELEMETRY_SDK_LANGUAGE,
   ATTR_TELEMETRY_SDK_VERSION,
 } from '@opentelemetry/semantic-conventions';
-import { serialize, serializeHeapProfile, encode } from './utils';
+import { serialize, serializeHeapProfile, encode, compress } from './utils';
 import { ReadableLogRecord } from '@opentelemetry/sdk-logs';
 
 export type ProfilerInstrumentationSource = 'continuous' | 'snapshot';
@@ -119,27 +120,26 @@ export class OtlpHttpProfilingExporter implements ProfilingExporter {
       serialize(profile, { samplingPeriodMillis: this._callstackInterval })
     )
       .then((serializedProfile) => {
-        const ts = hrTime();
-
-        const logs: ReadableLogRecord[] = [
-          {
-            hrTime: ts,
-            hrTimeObserved: ts,
-            body: serializedProfile.toString('base64'),
-            resource: this._resource,
-            instrumentationScope: this._scope,
-            attributes,
-            droppedAttributesCount: 0,
-          },
-        ];
-
-        context.with(suppressTracing(context.active()), () => {
-          this._getExporter().export(logs, (result) => {
-            if (result.error !== undefined) {
-              diag.error('Error exporting profiling data', result.error);
-            }
-          });
-        });
+        this._exportProfile(serializedProfile, attributes);
+      })
+      .catch((err: unknown) => {
+        diag.error('Error encoding cpu profile', err);
+      });
+  }
+
+  async sendEncoded(profile: EncodedCpuProfile) {
+    const { frameCount } = profile;
+
+    diag.debug(`profiling: Exporting ${frameCount} encoded CPU samples`);
+    const attributes = commonAttributes(
+      'cpu',
+      frameCount,
+      this._instrumentationSource
+    );
+
+    return compress(profile.pprof)
+      .then((serializedProfile) => {
+        this._exportProfile(serializedProfile, attributes);
       })
       .catch((err: unknown) => {
         diag.error('Error encoding cpu profile', err);
@@ -157,33 +157,40 @@ export class OtlpHttpProfilingExporter implements ProfilingExporter {
     diag.debug(`profiling: Exporting ${sampleCount} heap samples`);
     return encode(serialized)
       .then((serializedProfile) => {
-        const ts = hrTime();
-
-        const logs: ReadableLogRecord[] = [
-          {
-            hrTime: ts,
-            hrTimeObserved: ts,
-            body: serializedProfile.toString('base64'),
-            resource: this._resource,
-            instrumentationScope: this._scope,
-            attributes,
-            droppedAttributesCount: 0,
-          },
-        ];
-
-        context.with(suppressTracing(context.active()), () => {
-          this._getExporter().export(logs, (result) => {
-            if (result.error !== undefined) {
-              diag.error('Error exporting profiling data', result.error);
-            }
-          });
-        });
+        this._exportProfile(serializedProfile, attributes);
       })
       .catch((err: unknown) => {
         diag.error('Error encoding heap profile', err);
       });
   }
 
+  _exportProfile(
+    serializedProfile: Buffer,
+    attributes: ReturnType<typeof commonAttributes>
+  ) {
+    const ts = hrTime();
+
+    const logs: ReadableLogRecord[] = [
+      {
+        hrTime: ts,
+        hrTimeObserved: ts,
+        body: serializedProfile.toString('base64'),
+        resource: this._resource,
+        instrumentationScope: this._scope,
+        attributes,
+        droppedAttributesCount: 0,
+      },
+    ];
+
+    context.with(suppressTracing(context.active()), () => {
+      this._getExporter().export(logs, (result) => {
+        if (result.error !== undefined) {
+          diag.error('Error exporting profiling data', result.error);
+        }
+      });
+    });
+  }
+
   _getExporter(): OTLPLogExporter {
     if (this._exporter !== undefined) {
       return this._exporter;
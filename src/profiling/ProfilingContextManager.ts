@@ -17,28 +17,62 @@ import * as opentelemetry from '@opentelemetry/api';
 import type { Context } from '@opentelemetry/api';
 import { AsyncHooksContextManager } from '@opentelemetry/context-async-hooks';
 import { loadExtension } from '.';
+import { ActivationRing } from './ActivationRing';
 import type { ProfilingExtension } from './types';
 
-type ContextRecorder = Pick<ProfilingExtension, 'enterContext' | 'exitContext'>;
+interface ContextRecorder {
+  enterContext(contextId: number, traceId: string, spanId: string): void;
+  exitContext(contextId: number): void;
+}
+
+export interface ProfilingContextManagerOptions {
+  // Append context switches to a buffer shared with the extension instead of
+  // calling into it on each switch. Defaults to true, calls are used anyway
+  // when SharedArrayBuffer is not available.
+  activationRing?: boolean;
+}
+
+function createRecorder(
+  extension: ProfilingExtension,
+  activationRing: boolean
+): ContextRecorder {
+  if (activationRing && typeof SharedArrayBuffer === 'function') {
+    try {
+      return new ActivationRing(extension);
+    } catch {
+      // Falls back to the calls below.
+    }
+  }
+
+  // Integer context ids take the V8 fast API path once optimized.
+  return extension;
+}
 
 export class ProfilingContextManager extends AsyncHooksContextManager {
   protected _enterContextOriginal: (context: Context) => void;
   protected _recorder: ContextRecorder;
+  // Contexts are passed to the extension as small integers, which is cheaper
+  // than an identity hash lookup.
+  protected _contextIds = new WeakMap<Context, number>();
+  protected _nextContextId = 0;
 
-  constructor() {
+  constructor(options: ProfilingContextManagerOptions = {}) {
     super();
 
-    let recorder: ContextRecorder | undefined = loadExtension();
+    const extension = loadExtension();
 
-    if (recorder === undefined) {
-      recorder = {
+    if (extension === undefined) {
+      this._recorder = {
         enterContext: () => {},
         exitContext: () => {},
       };
+    } else {
+      this._recorder = createRecorder(
+        extension,
+        options.activationRing ?? true
+      );
     }
 
-    this._recorder = recorder;
-
     this._enterContextOriginal = this['_enterContext'];
     this['_enterContext'] = this._enterContextOverride;
     this['_exitContext'] = this._exitContextOverride;
@@ -51,14 +85,28 @@ export class ProfilingContextManager extends AsyncHooksContextManager {
 
     if (!spanCtx) return;
 
+    let contextId = this._contextIds.get(context);
+
+    if (contextId === undefined) {
+      contextId = this._nextContextId;
+      this._nextContextId = (this._nextContextId + 1) | 0;
+      this._contextIds.set(context, contextId);
+    }
+
     const { traceId, spanId } = spanCtx;
-    this._recorder.enterContext(context, traceId, spanId);
+    this._recorder.enterContext(contextId, traceId, spanId);
   }
 
   _exitContextOverride() {
     const context = this['_stack'].pop();
-    if (context) {
-      this._recorder.exitContext(context);
+
+    if (!context) return;
+
+    // Contexts without a span were never entered.
+    const contextId = this._contextIds.get(context);
+
+    if (contextId !== undefined) {
+      this._recorder.exitContext(contextId);
     }
   }
 }
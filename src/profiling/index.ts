@@ -30,11 +30,14 @@ import {
 import {
   recordCpuProfilerMetrics,
   recordHeapProfilerMetrics,
+  setProfilingStatsSource,
 } from '../metrics/debug_metrics';
 import { getDetectedResource } from '../resource';
 import { recordEffectiveState } from '../opamp/effective-state';
 import { ATTR_SERVICE_NAME } from '@opentelemetry/semantic-conventions';
 import type {
+  CpuProfile,
+  EncodedCpuProfile,
   HeapProfile,
   MemoryProfilingOptions,
   ProfilingExporter,
@@ -49,6 +52,10 @@ import { isTracingContextManagerEnabled } from '../tracing';
 
 export type { StartProfilingOptions, ProfilingOptions };
 
+// Keeps the v8 sample buffer and the activations processed in small slices,
+// independently of the collection interval.
+const CPU_PROFILE_ROTATION_INTERVAL_MS = 5_000;
+
 /* The following are wrappers around native functions to give more context to profiling samples. */
 function extStopProfiling(handle: number, extension: ProfilingExtension) {
   diag.debug('profiling: Stopping');
@@ -85,6 +92,62 @@ function extCollectCpuProfile(handle: number, extension: ProfilingExtension) {
   return extension.collect(handle);
 }
 
+function extStopEncodedProfiling(
+  handle: number,
+  extension: ProfilingExtension
+) {
+  diag.debug('profiling: Stopping');
+  return extension.stopPprof(handle);
+}
+
+function extCollectEncodedCpuProfile(
+  handle: number,
+  extension: ProfilingExtension
+) {
+  diag.debug('profiling: Collecting encoded CPU profile');
+  return extension.collectAsync(handle);
+}
+
+/*
+ * Collects (or stops and collects) the CPU profile and hands it to the exporters.
+ * When every exporter can send a natively encoded profile, the per-sample JS
+ * objects are never built and periodic collects are encoded off the main thread.
+ */
+async function exportCpuProfile(
+  handle: number,
+  extension: ProfilingExtension,
+  exporters: ProfilingExporter[],
+  stop: boolean
+): Promise<{
+  profile: CpuProfile | EncodedCpuProfile;
+  sends: Promise<void>[];
+} | null> {
+  if (exporters.every((e) => e.sendEncoded !== undefined)) {
+    const profile = stop
+      ? extStopEncodedProfiling(handle, extension)
+      : await extCollectEncodedCpuProfile(handle, extension);
+
+    if (profile === null) {
+      return null;
+    }
+
+    return {
+      profile,
+      sends: exporters.map((e) => e.sendEncoded!(profile)),
+    };
+  }
+
+  const profile = stop
+    ? extStopProfiling(handle, extension)
+    : extCollectCpuProfile(handle, extension);
+
+  if (profile === null) {
+    return null;
+  }
+
+  return { profile, sends: exporters.map((e) => e.send(profile)) };
+}
+
 export function defaultExporterFactory(
   options: ProfilingOptions
 ): ProfilingExporter[] {
@@ -160,9 +223,19 @@ export function startProfiling(options: ProfilingOptions) {
     samplingIntervalMicroseconds,
     maxSampleCutoffDelayMicroseconds: samplingIntervalMicroseconds / 2,
     recordDebugInfo: false,
+    aggregateSamples: options.aggregateSamples,
+    countPseudoFrames: !options.keepPseudoFrames,
+    excludedScriptPrefixes: options.excludedScriptPrefixes,
+    maxStackDepth: options.maxStackDepth,
+    foldRecursion: options.foldRecursion,
+    maxMemoryBytes: options.maxMemoryBytes,
+    rotationIntervalMillis: CPU_PROFILE_ROTATION_INTERVAL_MS,
+    // Rotated every few seconds for the lifetime of the process.
+    loggingMode: 'eager' as const,
   };
 
   const handle = extStartProfiling(extension, startOptions);
+  setProfilingStatsSource(() => extension.stats());
 
   let cpuSamplesCollectInterval: NodeJS.Timeout;
   let memSamplesCollectInterval: NodeJS.Timeout;
@@ -174,12 +247,16 @@ export function startProfiling(options: ProfilingOptions) {
   setImmediate(() => {
     exporters = options.exporterFactory(options);
     cpuSamplesCollectInterval = setInterval(async () => {
-      const cpuProfile = extCollectCpuProfile(handle, extension);
-
-      if (cpuProfile) {
-        recordCpuProfilerMetrics(cpuProfile);
-        const sends = exporters.map((exporter) => exporter.send(cpuProfile));
-        await Promise.allSettled(sends);
+      const exported = await exportCpuProfile(
+        handle,
+        extension,
+        exporters,
+        false
+      );
+
+      if (exported) {
+        recordCpuProfilerMetrics(exported.profile);
+        await Promise.allSettled(exported.sends);
       }
     }, options.collectionDuration);
 
@@ -212,11 +289,15 @@ export function startProfiling(options: ProfilingOptions) {
       }
 
       clearInterval(cpuSamplesCollectInterval);
-      const cpuProfile = extStopProfiling(handle, extension);
-
-      if (cpuProfile) {
-        const sends = exporters.map((e) => e.send(cpuProfile));
-        await Promise.allSettled(sends).then((results) => {
+      const exported = await exportCpuProfile(
+        handle,
+        extension,
+        exporters,
+        true
+      );
+
+      if (exported) {
+        await Promise.allSettled(exported.sends).then((results) => {
           for (const result of results) {
             if (result.status === 'rejected') {
               diag.error(
@@ -246,6 +327,13 @@ export function loadExtension(): ProfilingExtension | undefined {
 }
 
 export function noopExtension(): ProfilingExtension {
+  const noCalls = () => ({
+    calls: 0,
+    timedCalls: 0,
+    timedNanos: 0,
+    buckets: [],
+  });
+
   return {
     getOrCreateCpuProfiler: (_options: NativeProfilingOptions) => -1,
     startCpuProfiler: (_handle: number) => false,
@@ -254,11 +342,41 @@ export function noopExtension(): ProfilingExtension {
     start: (_options: NativeProfilingOptions) => -1,
     stop: (_handle: number) => null,
     collect: (_handle: number) => null,
+    stopPprof: (_handle: number) => null,
+    collectPprof: (_handle: number) => null,
+    collectAsync: async (_handle: number) => null,
+    stopColumnar: (_handle: number) => null,
+    collectColumnar: (_handle: number) => null,
+    stopFrames: (_handle: number) => null,
+    collectFrames: (_handle: number) => null,
     enterContext: (_context: unknown, _traceId: string, _spanId: string) => {},
     exitContext: (_context: unknown) => {},
+    // An all-zero header is never active, nothing gets written to it.
+    getActivationRing: () => new SharedArrayBuffer(32),
+    drainActivationRing: () => {},
     startMemoryProfiling: (_options?: MemoryProfilingOptions) => {},
     stopMemoryProfiling: () => {},
     collectHeapProfile: () => null,
+    stats: () => ({
+      enterContext: noCalls(),
+      exitContext: noCalls(),
+      activationRingDrain: noCalls(),
+      durationBucketBounds: [],
+      timedCallInterval: 1,
+      activationRingEvents: 0,
+      activationRingOverflows: 0,
+      activationsRecorded: 0,
+      activationsDropped: 0,
+      overflowBins: 0,
+      samplesDiscarded: 0,
+      samplesDropped: 0,
+      arenaUsedBytes: 0,
+      arenaCommittedBytes: 0,
+      arenaReservedBytes: 0,
+      contextStacks: 0,
+      traceIdFilters: 0,
+      cpuProfilesRecording: 0,
+    }),
   };
 }
 
@@ -305,6 +423,12 @@ export function _setDefaultOptions(
     exporterFactory: options.exporterFactory ?? defaultExporterFactory,
     memoryProfilingEnabled,
     memoryProfilingOptions: options.memoryProfilingOptions,
+    aggregateSamples: options.aggregateSamples ?? false,
+    keepPseudoFrames: options.keepPseudoFrames ?? false,
+    excludedScriptPrefixes: options.excludedScriptPrefixes,
+    maxStackDepth: options.maxStackDepth,
+    foldRecursion: options.foldRecursion ?? false,
+    maxMemoryBytes: options.maxMemoryBytes,
   };
 }
 
@@ -318,4 +442,10 @@ export const allowedProfilingOptions = [
   'exporterFactory',
   'memoryProfilingEnabled',
   'memoryProfilingOptions',
+  'aggregateSamples',
+  'keepPseudoFrames',
+  'excludedScriptPrefixes',
+  'maxStackDepth',
+  'foldRecursion',
+  'maxMemoryBytes',
 ];
@@ -24,6 +24,43 @@ export interface NativeProfilingOptions {
   // Stacktraces not matching a filter will be discarded.
   // If no filter is active, everything is discarded.
   onlyFilteredStacktraces?: boolean;
+  // Merge samples with the same leaf frame and span into a single sample
+  // carrying a count, first and last timestamp and elapsed time weight.
+  aggregateSamples?: boolean;
+  // Rotate the v8 profile natively at this interval, folding the samples into
+  // a compact accumulator that collect hands over. Disabled by default.
+  rotationIntervalMillis?: number;
+  // v8 CPU profiler modes, both fixed for as long as the profiler is running.
+  // 'debug' naming (default) resolves anonymous function names, 'standard'
+  // does not. 'eager' logging keeps code events logged between profiles, which
+  // makes starting a profile cheap for always-on profilers, 'lazy' (default)
+  // only logs them while profiling.
+  namingMode?: 'standard' | 'debug';
+  loggingMode?: 'lazy' | 'eager';
+  // Frames kept by the frame dictionary of collectFrames, the least recently
+  // used ones are evicted past this. Defaults to 16384.
+  maxFrames?: number;
+  // Report the ticks per source line of this many of the nodes with the most
+  // samples, see LineTicks. Disabled by default.
+  maxLineTickNodes?: number;
+  // Count the samples v8 attributes to its (idle), (program) and
+  // (garbage collector) pseudo frames instead of exporting them, see
+  // PseudoFrameTicks. Disabled by default.
+  countPseudoFrames?: boolean;
+  // Frame rules, applied natively while the stacks are built. Frames of
+  // scripts starting with one of the prefixes are dropped, runs of identical
+  // recursive frames are folded into one frame with a repeat count, and stacks
+  // deeper than maxStackDepth keep their outermost and innermost frames around
+  // a '(truncated)' frame. All disabled by default.
+  excludedScriptPrefixes?: string[];
+  maxStackDepth?: number;
+  foldRecursion?: boolean;
+  // Memory the profiler may take for its samples and activations, at least
+  // 4 MiB. Past it activations and samples are reservoir sampled, and the
+  // profile is rotated at least often enough for v8's sample buffer to never
+  // fill up. The dropped ones are reported by activationsDropped and
+  // samplesDropped. Unlimited by default.
+  maxMemoryBytes?: number;
 }
 
 export interface ProfilingStacktrace {
@@ -33,16 +70,234 @@ export interface ProfilingStacktrace {
   stacktrace: ProfilingStackFrame[];
   traceId: Buffer;
   spanId: Buffer;
+  /** The following are only set for aggregated samples. */
+  /** Timestamp of the last merged sample (nanoseconds since Unix epoch). */
+  lastTimestamp?: string;
+  /** Number of merged samples. */
+  count?: number;
+  /** Nanoseconds elapsed since the preceding samples, summed. */
+  weight?: number;
+}
+
+/**
+ * Ticks per source line of the hottest functions, summed over the profiles
+ * since the previous collect. One row per function and line, all columns are
+ * indexed alike.
+ */
+export interface LineTicks {
+  /** Function and script names referenced by the rows. */
+  strings: string[];
+  /** Index into strings. */
+  functionName: Int32Array;
+  /** Index into strings. */
+  scriptName: Int32Array;
+  lineNumber: Int32Array;
+  ticks: Int32Array;
+}
+
+/**
+ * Samples of the v8 pseudo frames since the previous collect, counted in place
+ * of exporting them.
+ */
+export interface PseudoFrameTicks {
+  idle: number;
+  program: number;
+  gc: number;
+}
+
+/**
+ * Time spent in a native callback. Every call is counted, only one in
+ * timedCallInterval is timed.
+ */
+export interface CallTimings {
+  calls: number;
+  timedCalls: number;
+  timedNanos: number;
+  /** Timed calls per duration bucket, see ProfilingStats.durationBucketBounds. */
+  buckets: number[];
+}
+
+/**
+ * Self-overhead of the profilers, summed over all of them. Counters only
+ * grow from the moment the extension is loaded, the rest are current values.
+ */
+export interface ProfilingStats {
+  enterContext: CallTimings;
+  exitContext: CallTimings;
+  activationRingDrain: CallTimings;
+  /** Exclusive upper bounds in nanoseconds, the last bucket has none. */
+  durationBucketBounds: number[];
+  timedCallInterval: number;
+  activationRingEvents: number;
+  /** Context switches lost because the activation ring was full. */
+  activationRingOverflows: number;
+  activationsRecorded: number;
+  /** Lost to allocation failures. */
+  activationsDropped: number;
+  /** Bins chained onto a full one, a sign of crowded activation slots. */
+  overflowBins: number;
+  /** Samples taken while the profiler was collecting, see ShouldIncludeSample. */
+  samplesDiscarded: number;
+  /** Samples dropped to stay within maxMemoryBytes. */
+  samplesDropped: number;
+  arenaUsedBytes: number;
+  arenaCommittedBytes: number;
+  arenaReservedBytes: number;
+  /** Contexts with activations in progress or held back for coalescing. */
+  contextStacks: number;
+  traceIdFilters: number;
+  /**
+   * v8 profiles being recorded, one for all the profilers sharing a naming and
+   * logging mode however many are running.
+   */
+  cpuProfilesRecording: number;
 }
 
 export interface CpuProfile {
   /** Timestamp when profiling was started (nanoseconds since Unix epoch). */
   startTimeNanos: string;
   stacktraces: ProfilingStacktrace[];
+  /** Only set with maxLineTickNodes. */
+  lineTicks?: LineTicks;
+  /** Only set with countPseudoFrames. */
+  pseudoFrameTicks?: PseudoFrameTicks;
 
   profilerStartDuration: number;
   profilerStopDuration: number;
   profilerProcessingStepDuration: number;
+  /**
+   * Largest gap between the last sample of a profile and the first sample of
+   * the next one since the previous collect (nanoseconds).
+   */
+  profilerSampleGap: number;
+  /**
+   * Activations of a span coalesced into the preceding one of the same span,
+   * less than a sampling interval apart, since the previous collect.
+   */
+  activationsMerged: number;
+  /**
+   * Activations and samples dropped since the previous collect, either to
+   * stay within maxMemoryBytes or on allocation failure.
+   */
+  activationsDropped: number;
+  samplesDropped: number;
+}
+
+/**
+ * CPU profile encoded natively as an uncompressed pprof `Profile` message,
+ * with the same layout as the one produced by `serialize` in ./utils.
+ */
+export interface EncodedCpuProfile {
+  /** Timestamp when profiling was started (nanoseconds since Unix epoch). */
+  startTimeNanos: string;
+  pprof: Buffer;
+  sampleCount: number;
+  /** Total number of frames over all samples. */
+  frameCount: number;
+  lineTicks?: LineTicks;
+  pseudoFrameTicks?: PseudoFrameTicks;
+
+  profilerStartDuration: number;
+  profilerStopDuration: number;
+  profilerProcessingStepDuration: number;
+  profilerSampleGap: number;
+  activationsMerged: number;
+  activationsDropped: number;
+  samplesDropped: number;
+}
+
+/**
+ * CPU profile in a columnar layout: each frame is stored once in the node
+ * table and samples reference their leaf node.
+ */
+export interface ColumnarCpuProfile {
+  /** Timestamp when profiling was started (nanoseconds since Unix epoch). */
+  startTimeNanos: string;
+  /** Function and script names referenced by the node table. */
+  strings: string[];
+  /** Node table, all columns are indexed by node index. */
+  nodes: {
+    /** Index of the parent node, -1 for top level frames. */
+    parent: Int32Array;
+    /** Index into strings. */
+    functionName: Int32Array;
+    /** Index into strings. */
+    scriptName: Int32Array;
+    lineNumber: Int32Array;
+    columnNumber: Int32Array;
+    /** Only set with foldRecursion, 1 for frames that were not folded. */
+    repeatCount?: Int32Array;
+  };
+  /** Index of the leaf node of each sample, -1 for an empty stack. */
+  sampleNodes: Int32Array;
+  /** Timestamp of each sample (nanoseconds since Unix epoch). */
+  sampleTimestamps: BigInt64Array;
+  /** Index into spans for each sample, -1 if no span was active. */
+  sampleSpans: Int32Array;
+  /** 24 bytes per span: a 16 byte trace ID followed by an 8 byte span ID. */
+  spans: Buffer;
+  /** Only set for aggregated samples, see ProfilingStacktrace. */
+  sampleLastTimestamps?: BigInt64Array;
+  sampleCounts?: Int32Array;
+  sampleWeights?: BigInt64Array;
+  lineTicks?: LineTicks;
+  pseudoFrameTicks?: PseudoFrameTicks;
+
+  profilerStartDuration: number;
+  profilerStopDuration: number;
+  profilerProcessingStepDuration: number;
+  profilerSampleGap: number;
+  activationsMerged: number;
+  activationsDropped: number;
+  samplesDropped: number;
+}
+
+/**
+ * Columnar CPU profile whose nodes reference frames of a dictionary the
+ * profiler keeps across collections. Each profile only carries the frames
+ * added since the previous one, see FrameTable in ./utils.
+ */
+export interface FrameDeltaCpuProfile {
+  /** Timestamp when profiling was started (nanoseconds since Unix epoch). */
+  startTimeNanos: string;
+  /** Frames added since the previous collection, all columns indexed alike. */
+  frames: {
+    id: Int32Array;
+    functionName: string[];
+    scriptName: string[];
+    lineNumber: Int32Array;
+    columnNumber: Int32Array;
+  };
+  /**
+   * Ids of the frames dropped since the previous collection. Ids are reused,
+   * so these have to be applied before the added frames.
+   */
+  evictedFrames: Int32Array;
+  nodes: {
+    /** Index of the parent node, -1 for top level frames. */
+    parent: Int32Array;
+    /** Frame id. */
+    frame: Int32Array;
+    repeatCount?: Int32Array;
+  };
+  /** Same as in ColumnarCpuProfile. */
+  sampleNodes: Int32Array;
+  sampleTimestamps: BigInt64Array;
+  sampleSpans: Int32Array;
+  spans: Buffer;
+  sampleLastTimestamps?: BigInt64Array;
+  sampleCounts?: Int32Array;
+  sampleWeights?: BigInt64Array;
+  lineTicks?: LineTicks;
+  pseudoFrameTicks?: PseudoFrameTicks;
+
+  profilerStartDuration: number;
+  profilerStopDuration: number;
+  profilerProcessingStepDuration: number;
+  profilerSampleGap: number;
+  activationsMerged: number;
+  activationsDropped: number;
+  samplesDropped: number;
 }
 
 export interface ProfilingStackFrame extends Array<string | number> {
@@ -54,6 +309,8 @@ export interface ProfilingStackFrame extends Array<string | number> {
   2: number;
   /** column number */
   3: number;
+  /** recursive calls folded into the frame, only set when more than 1 */
+  4?: number;
 }
 
 export interface HeapProfileNode {
@@ -92,11 +349,29 @@ export interface ProfilingExtension {
   start(options: NativeProfilingOptions): number;
   stop(handle: number): CpuProfile | null;
   collect(handle: number): CpuProfile | null;
+  // Same as stop/collect, but the profile is encoded natively into pprof
+  // instead of being returned as per-sample JS objects.
+  stopPprof(handle: number): EncodedCpuProfile | null;
+  collectPprof(handle: number): EncodedCpuProfile | null;
+  // Same as collectPprof, with the encoding done on the libuv thread pool.
+  collectAsync(handle: number): Promise<EncodedCpuProfile | null>;
+  stopColumnar(handle: number): ColumnarCpuProfile | null;
+  collectColumnar(handle: number): ColumnarCpuProfile | null;
+  // Starting the profiler clears its frame dictionary.
+  stopFrames(handle: number): FrameDeltaCpuProfile | null;
+  collectFrames(handle: number): FrameDeltaCpuProfile | null;
+  // The context is either an int32 id or an object, identified by its identity
+  // hash. Passing an id lets optimized code take the V8 fast API path.
   enterContext(context: unknown, traceId: string, spanId: string): void;
   exitContext(context: unknown): void;
+  // Buffer of context enter/exit events written from JS, see ActivationRing.
+  getActivationRing(): SharedArrayBuffer;
+  // Replays the events written to the activation ring so far.
+  drainActivationRing(): void;
   startMemoryProfiling(options?: MemoryProfilingOptions): void;
   stopMemoryProfiling(): void;
   collectHeapProfile(): HeapProfile | null;
+  stats(): ProfilingStats;
 }
 
 export type ProfilingExporterFactory = (
@@ -118,6 +393,21 @@ export interface ProfilingOptions {
   exporterFactory: ProfilingExporterFactory;
   memoryProfilingEnabled: boolean;
   memoryProfilingOptions?: MemoryProfilingOptions;
+  // Merge identical (stack, span) samples before exporting them.
+  aggregateSamples?: boolean;
+  // Export the samples of v8's (idle), (program) and (garbage collector)
+  // pseudo frames, which are otherwise only counted, in the
+  // splunk.profiler.cpu.pseudo_frames debug metric.
+  keepPseudoFrames?: boolean;
+  // Script path prefixes whose frames are left out of the stacktraces.
+  excludedScriptPrefixes?: string[];
+  // Deeper stacktraces keep their outermost and innermost frames only.
+  maxStackDepth?: number;
+  // Fold runs of identical recursive frames into a single frame.
+  foldRecursion?: boolean;
+  // Memory budget of the CPU profiler's samples and activations, see
+  // NativeProfilingOptions.
+  maxMemoryBytes?: number;
 }
 
 export type StartProfilingOptions = Partial<
@@ -128,5 +418,8 @@ export type StartProfilingOptions = Partial<
 
 export interface ProfilingExporter {
   send(profile: CpuProfile): Promise<void>;
+  // When every exporter implements this, CPU profiles are collected natively
+  // encoded and `send` is not used.
+  sendEncoded?(profile: EncodedCpuProfile): Promise<void>;
   sendHeapProfile(profile: HeapProfile): Promise<void>;
 }
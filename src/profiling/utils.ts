@@ -17,7 +17,12 @@ import { gzip } from 'zlib';
 import { promisify } from 'util';
 
 import { perftools } from './proto/profile';
-import type { CpuProfile, HeapProfile } from './types';
+import type {
+  ColumnarCpuProfile,
+  CpuProfile,
+  FrameDeltaCpuProfile,
+  HeapProfile,
+} from './types';
 
 const gzipPromise = promisify(gzip);
 
@@ -47,16 +52,77 @@ export interface PProfSerializationOptions {
   samplingPeriodMillis: number;
 }
 
+/**
+ * Mirror of a profiler's frame dictionary, kept up to date by applying the
+ * frame deltas of collectFrames in order. Starting the profiler clears the
+ * native dictionary, so a table must not outlive the profiling session. The
+ * SDK's exporters don't use it, they send natively encoded profiles.
+ */
+export class FrameTable {
+  functionName: string[] = [];
+  scriptName: string[] = [];
+  lineNumber: number[] = [];
+  columnNumber: number[] = [];
+
+  apply(profile: FrameDeltaCpuProfile) {
+    // Evicted ids may be reused by the added frames.
+    for (const id of profile.evictedFrames) {
+      this.functionName[id] = '';
+      this.scriptName[id] = '';
+    }
+
+    const { frames } = profile;
+    for (let i = 0; i < frames.id.length; i++) {
+      const id = frames.id[i];
+      this.functionName[id] = frames.functionName[i];
+      this.scriptName[id] = frames.scriptName[i];
+      this.lineNumber[id] = frames.lineNumber[i];
+      this.columnNumber[id] = frames.columnNumber[i];
+    }
+  }
+}
+
+// The sample columns shared by the columnar layouts.
+type NodeSamples = Pick<
+  ColumnarCpuProfile,
+  | 'sampleNodes'
+  | 'sampleTimestamps'
+  | 'sampleSpans'
+  | 'spans'
+  | 'sampleCounts'
+  | 'sampleWeights'
+> & { nodes: { parent: Int32Array } };
+
 class Serializer {
   stringTable = new StringTable();
   locationsMap = new Map();
   functionsMap = new Map();
 
+  // Aggregated samples carry [count, weight] values.
+  getAggregatedSampleTypes(): perftools.profiles.IValueType[] {
+    return [
+      {
+        type: this.stringTable.getIndex('samples'),
+        unit: this.stringTable.getIndex('count'),
+      },
+      {
+        type: this.stringTable.getIndex('cpu'),
+        unit: this.stringTable.getIndex('nanoseconds'),
+      },
+    ];
+  }
+
   getLocation(
     fileName: string,
     functionName: string,
-    lineNumber: number
+    lineNumber: number,
+    repeatCount = 1
   ): perftools.profiles.Location {
+    // Frames folded by foldRecursion keep their depth in the function name.
+    if (repeatCount > 1) {
+      functionName = `${functionName} (x${repeatCount})`;
+    }
+
     const key = `${fileName}:${functionName}:${lineNumber}`;
     let location = this.locationsMap.get(key);
     if (!location) {
@@ -154,8 +220,11 @@ class Serializer {
       num: options.samplingPeriodMillis,
     });
 
+    const aggregated = stacktraces.some((s) => s.count !== undefined);
+    const sampleType = aggregated ? this.getAggregatedSampleTypes() : [];
+
     const samples = stacktraces.map(
-      ({ stacktrace, timestamp, spanId, traceId }) => {
+      ({ stacktrace, timestamp, spanId, traceId, count, weight }) => {
         const labels = [
           new perftools.profiles.Label({
             key: STR.TIMESTAMP,
@@ -181,16 +250,142 @@ class Serializer {
         }
 
         return new perftools.profiles.Sample({
-          locationId: stacktrace.map(([fileName, functionName, lineNumber]) => {
-            return this.getLocation(fileName, functionName, lineNumber).id;
-          }),
-          value: [],
+          locationId: stacktrace.map(
+            ([fileName, functionName, lineNumber, , repeatCount]) => {
+              return this.getLocation(
+                fileName,
+                functionName,
+                lineNumber,
+                repeatCount
+              ).id;
+            }
+          ),
+          value: aggregated ? [count ?? 1, weight ?? 0] : [],
           label: labels,
         });
       }
     );
 
     return perftools.profiles.Profile.create({
+      sampleType,
+      sample: samples,
+      location: [...this.locationsMap.values()],
+      function: [...this.functionsMap.values()],
+      stringTable: this.stringTable.serialize(),
+    });
+  }
+
+  serializeColumnarCpuProfile(
+    profile: ColumnarCpuProfile,
+    options: PProfSerializationOptions
+  ) {
+    const { strings, nodes } = profile;
+    return this.serializeNodeSamples(profile, options, (node) =>
+      this.getLocation(
+        strings[nodes.scriptName[node]],
+        strings[nodes.functionName[node]],
+        nodes.lineNumber[node],
+        nodes.repeatCount?.[node]
+      )
+    );
+  }
+
+  serializeNodeSamples(
+    profile: NodeSamples,
+    options: PProfSerializationOptions,
+    getLocation: (node: number) => perftools.profiles.Location
+  ) {
+    const {
+      nodes,
+      sampleNodes,
+      sampleTimestamps,
+      sampleSpans,
+      sampleCounts,
+      sampleWeights,
+    } = profile;
+
+    const STR = {
+      TIMESTAMP: this.stringTable.getIndex('source.event.time'),
+      TRACE_ID: this.stringTable.getIndex('trace_id'),
+      SPAN_ID: this.stringTable.getIndex('span_id'),
+      SOURCE_EVENT_PERIOD: this.stringTable.getIndex('source.event.period'),
+    };
+
+    const eventPeriodLabel = new perftools.profiles.Label({
+      key: STR.SOURCE_EVENT_PERIOD,
+      num: options.samplingPeriodMillis,
+    });
+
+    const aggregated = sampleCounts !== undefined;
+    const sampleType = aggregated ? this.getAggregatedSampleTypes() : [];
+
+    // Both are resolved once per node / span rather than once per sample.
+    const nodeLocations: number[] = [];
+    const spanLabels: perftools.profiles.Label[][] = [];
+
+    const getNodeLocation = (node: number) => {
+      let locationId = nodeLocations[node];
+      if (locationId === undefined) {
+        locationId = getLocation(node).id as number;
+        nodeLocations[node] = locationId;
+      }
+      return locationId;
+    };
+
+    const getSpanLabels = (span: number) => {
+      let labels = spanLabels[span];
+      if (labels === undefined) {
+        const offset = span * 24;
+        const traceId = profile.spans.toString('hex', offset, offset + 16);
+        const spanId = profile.spans.toString('hex', offset + 16, offset + 24);
+        labels = [
+          new perftools.profiles.Label({
+            key: STR.TRACE_ID,
+            str: this.stringTable.getIndex(traceId),
+          }),
+          new perftools.profiles.Label({
+            key: STR.SPAN_ID,
+            str: this.stringTable.getIndex(spanId),
+          }),
+        ];
+        spanLabels[span] = labels;
+      }
+      return labels;
+    };
+
+    const samples: perftools.profiles.Sample[] = [];
+
+    for (let i = 0; i < sampleNodes.length; i++) {
+      const labels = [
+        new perftools.profiles.Label({
+          key: STR.TIMESTAMP,
+          num: Number(sampleTimestamps[i] / BigInt(1_000_000)),
+        }),
+        eventPeriodLabel,
+      ];
+
+      if (sampleSpans[i] >= 0) {
+        labels.push(...getSpanLabels(sampleSpans[i]));
+      }
+
+      const locationId: number[] = [];
+      for (let node = sampleNodes[i]; node >= 0; node = nodes.parent[node]) {
+        locationId.push(getNodeLocation(node));
+      }
+
+      samples.push(
+        new perftools.profiles.Sample({
+          locationId,
+          value: aggregated
+            ? [sampleCounts[i], Number(sampleWeights?.[i] ?? 0)]
+            : [],
+          label: labels,
+        })
+      );
+    }
+
+    return perftools.profiles.Profile.create({
+      sampleType,
       sample: samples,
       location: [...this.locationsMap.values()],
       function: [...this.functionsMap.values()],
@@ -206,6 +401,13 @@ export const serialize = (
   return new Serializer().serializeCpuProfile(profile, options);
 };
 
+export const serializeColumnar = (
+  profile: ColumnarCpuProfile,
+  options: PProfSerializationOptions
+) => {
+  return new Serializer().serializeColumnarCpuProfile(profile, options);
+};
+
 export function serializeHeapProfile(profile: HeapProfile) {
   return new Serializer().serializeHeapProfile(profile);
 }
@@ -216,3 +418,10 @@ export const encode = async function encode(
   const buffer = perftools.profiles.Profile.encode(profile).finish();
   return gzipPromise(buffer);
 };
+
+// Compresses an already encoded pprof profile, e.g. one encoded natively.
+export const compress = async function compress(
+  buffer: Uint8Array
+): Promise<Buffer> {
+  return gzipPromise(buffer);
+};
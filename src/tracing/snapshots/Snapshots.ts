@@ -52,6 +52,9 @@ function nativeSnapshotOptions(samplingIntervalMs: number) {
     maxSampleCutoffDelayMicroseconds: samplingIntervalMicroseconds / 2,
     recordDebugInfo: false,
     onlyFilteredStacktraces: true,
+    // The profiler is restarted by the first snapshot after a linger period,
+    // eager logging keeps that restart from rescanning all the code.
+    loggingMode: 'eager' as const,
   };
 }
 
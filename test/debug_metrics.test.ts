@@ -73,13 +73,48 @@ test('debug metrics', async () => {
     'splunk.profiler.cpu.start.duration',
     'splunk.profiler.cpu.stop.duration',
     'splunk.profiler.cpu.process.duration',
+    'splunk.profiler.cpu.sample.gap',
     'splunk.profiler.heap.collect.duration',
     'splunk.profiler.heap.process.duration',
   ]);
 
-  assert.deepStrictEqual(debugMetrics.length, allowedNames.size);
+  // Counted per collect, pseudo frames are not exported by default.
+  const counterNames = new Set(['splunk.profiler.cpu.pseudo_frames']);
+
+  // Observed from profiling.stats().
+  const statsNames = new Set([
+    'splunk.profiler.context.switches',
+    'splunk.profiler.context.switch.time',
+    'splunk.profiler.activations',
+    'splunk.profiler.activation.overflow_bins',
+    'splunk.profiler.activation_ring.overflows',
+    'splunk.profiler.samples.discarded',
+    'splunk.profiler.samples.dropped',
+    'splunk.profiler.arena.memory',
+    'splunk.profiler.context_stacks',
+    'splunk.profiler.trace_id_filters',
+  ]);
+
+  assert.deepStrictEqual(
+    debugMetrics.length,
+    allowedNames.size + counterNames.size + statsNames.size
+  );
 
   for (const { descriptor, dataPoints, dataPointType } of debugMetrics) {
+    if (counterNames.has(descriptor.name)) {
+      assert.deepStrictEqual(dataPointType, DataPointType.SUM);
+      assert.deepStrictEqual(
+        dataPoints.map(({ attributes }) => attributes['category']).sort(),
+        ['gc', 'idle', 'program']
+      );
+      continue;
+    }
+
+    if (statsNames.has(descriptor.name)) {
+      assert(dataPoints.length > 0, `no datapoints for ${descriptor.name}`);
+      continue;
+    }
+
     assert.deepStrictEqual(dataPointType, DataPointType.HISTOGRAM);
     assert(
       allowedNames.has(descriptor.name),
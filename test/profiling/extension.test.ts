@@ -22,6 +22,9 @@ import {
   HeapProfileNode,
   ProfilingExtension,
 } from '../../src/profiling/types';
+import { ActivationRing } from '../../src/profiling/ActivationRing';
+import { FrameTable } from '../../src/profiling/utils';
+import { perftools } from '../../src/profiling/proto/profile.js';
 import * as utils from '../utils';
 import { RandomIdGenerator } from '@opentelemetry/sdk-trace-base';
 
@@ -200,6 +203,109 @@ describe('profiling native extension', () => {
     assert.strictEqual(profile2.stacktraces.length, 0);
   });
 
+  it('is possible to identify contexts by integer ids', () => {
+    const handle = extension.getOrCreateCpuProfiler({
+      name: 'context-id-test',
+      samplingIntervalMicroseconds: 1000,
+    });
+
+    const idGenerator = new RandomIdGenerator();
+    const traceId = idGenerator.generateTraceId();
+    const spanId = idGenerator.generateSpanId();
+
+    assert.ok(extension.startCpuProfiler(handle));
+
+    // Enough calls for the entry points to get optimized, so that the fast
+    // API path is taken where available.
+    for (let i = 0; i < 100_000; i++) {
+      extension.enterContext(i, idGenerator.generateTraceId(), spanId);
+      extension.exitContext(i);
+    }
+
+    extension.enterContext(42, traceId, spanId);
+    utils.spinMs(100);
+    extension.exitContext(42);
+
+    const profile = extension.stop(handle)!;
+    const traceIdBuffer = Buffer.from(traceId, 'hex');
+    const spanIdBuffer = Buffer.from(spanId, 'hex');
+    const matched = profile.stacktraces.filter(
+      (st) => st.traceId && st.traceId.equals(traceIdBuffer)
+    );
+
+    assert.ok(matched.length > 0);
+    assert.ok(matched.every((st) => st.spanId.equals(spanIdBuffer)));
+  });
+
+  it('is possible to record contexts through the activation ring', () => {
+    const handle = extension.getOrCreateCpuProfiler({
+      name: 'activation-ring-test',
+      samplingIntervalMicroseconds: 1000,
+    });
+
+    const idGenerator = new RandomIdGenerator();
+    const traceId = idGenerator.generateTraceId();
+    const spanId = idGenerator.generateSpanId();
+    const ring = new ActivationRing(extension);
+
+    assert.ok(extension.startCpuProfiler(handle));
+
+    ring.enterContext(1, traceId, spanId);
+    utils.spinMs(100);
+    ring.exitContext(1);
+
+    const profile = extension.stop(handle)!;
+    const traceIdBuffer = Buffer.from(traceId, 'hex');
+    const matched = profile.stacktraces.filter(
+      (st) => st.traceId && st.traceId.equals(traceIdBuffer)
+    );
+
+    assert.ok(matched.length > 0);
+  });
+
+  it('rejects activation ring ids with non-ASCII characters', () => {
+    const handle = extension.getOrCreateCpuProfiler({
+      name: 'activation-ring-hex-test',
+      samplingIntervalMicroseconds: 1000,
+    });
+
+    const ring = new ActivationRing(extension);
+    assert.ok(extension.startCpuProfiler(handle));
+
+    const header = new Int32Array(extension.getActivationRing(), 0, 4);
+    const countBefore = header[0];
+    // U+0130 truncated to 7 bits would read as '0'.
+    ring.enterContext(1, '\u0130'.repeat(32), '0'.repeat(16));
+
+    assert.strictEqual(header[0], countBefore);
+    assert.notEqual(extension.stop(handle), null);
+  });
+
+  it('counts activation ring events dropped when it is full', () => {
+    const handle = extension.getOrCreateCpuProfiler({
+      name: 'activation-ring-overflow-test',
+      samplingIntervalMicroseconds: 1000,
+    });
+
+    // Never drained until the profiler is stopped.
+    const ring = new ActivationRing({
+      ...extension,
+      drainActivationRing: () => {},
+    });
+
+    assert.ok(extension.startCpuProfiler(handle));
+
+    const droppedBefore = ring.droppedEvents;
+    const capacity = new Int32Array(extension.getActivationRing(), 0, 4)[2];
+
+    for (let i = 0; i < capacity + 10; i++) {
+      ring.exitContext(i);
+    }
+
+    assert.strictEqual(ring.droppedEvents - droppedBefore, 10);
+    assert.notEqual(extension.stop(handle), null);
+  });
+
   it('is possible to collect a cpu profile', () => {
     // returns null if no profiling started
     assert.equal(extension.collect(0), null);
@@ -266,6 +372,784 @@ describe('profiling native extension', () => {
     extension.stop(handle);
   });
 
+  it('is possible to aggregate identical samples', () => {
+    const handle = extension.start({
+      name: 'test-aggregating-profiler',
+      samplingIntervalMicroseconds: 1_000,
+      recordDebugInfo: false,
+      aggregateSamples: true,
+    });
+
+    utils.spinMs(200);
+
+    const result = extension.collect(handle);
+    assert.ok(result);
+
+    const { stacktraces } = result;
+    let totalCount = 0;
+
+    for (const { timestamp, lastTimestamp, count, weight } of stacktraces) {
+      assertNanoSecondString(timestamp);
+      assertNanoSecondString(lastTimestamp);
+      assert(BigInt(lastTimestamp!) >= BigInt(timestamp));
+      assert.strictEqual(typeof count, 'number');
+      assert(count! >= 1);
+      assert.strictEqual(typeof weight, 'number');
+      assert(weight! > 0);
+      totalCount += count!;
+    }
+
+    // A busy loop keeps hitting the same few frames.
+    assert(
+      stacktraces.length < totalCount,
+      `expected samples to be merged, got ${stacktraces.length} entries for ${totalCount} samples`
+    );
+
+    const encoded = extension.stopPprof(handle);
+    assert.ok(encoded);
+
+    const profile = perftools.profiles.Profile.decode(encoded.pprof);
+    assert.deepStrictEqual(
+      profile.sampleType.map(({ type, unit }) => [
+        profile.stringTable[Number(type)],
+        profile.stringTable[Number(unit)],
+      ]),
+      [
+        ['samples', 'count'],
+        ['cpu', 'nanoseconds'],
+      ]
+    );
+
+    for (const sample of profile.sample) {
+      assert.strictEqual(sample.value.length, 2);
+      assert(Number(sample.value[0]) >= 1);
+    }
+  });
+
+  it('is possible to collect a pprof encoded cpu profile', () => {
+    assert.equal(extension.collectPprof(0), null);
+
+    const handle = extension.start({
+      name: 'test-pprof-profiler',
+      samplingIntervalMicroseconds: 1_000,
+      recordDebugInfo: false,
+    });
+
+    utils.spinMs(200);
+
+    const result = extension.collectPprof(handle);
+
+    assert.ok(result);
+    assertNanoSecondString(result.startTimeNanos);
+    assert(Buffer.isBuffer(result.pprof));
+    assert.strictEqual(typeof result.profilerStartDuration, 'number');
+    assert.strictEqual(typeof result.profilerStopDuration, 'number');
+    assert.strictEqual(typeof result.profilerProcessingStepDuration, 'number');
+
+    const profile = perftools.profiles.Profile.decode(result.pprof);
+    const { stringTable } = profile;
+
+    assert.deepStrictEqual(stringTable.slice(0, 5), [
+      '',
+      'source.event.time',
+      'trace_id',
+      'span_id',
+      'source.event.period',
+    ]);
+
+    const expectedSampleCount = 5;
+    assert(
+      result.sampleCount >= expectedSampleCount,
+      `expected at least ${expectedSampleCount} samples, got ${result.sampleCount}`
+    );
+    assert.strictEqual(profile.sample.length, result.sampleCount);
+
+    const locationIds = new Set(profile.location.map((l) => Number(l.id)));
+    const functionIds = new Set(profile.function.map((f) => Number(f.id)));
+
+    let frameCount = 0;
+    for (const sample of profile.sample) {
+      frameCount += sample.locationId.length;
+
+      for (const id of sample.locationId) {
+        assert(locationIds.has(Number(id)));
+      }
+
+      const timeLabel = sample.label.find(
+        (l) => stringTable[Number(l.key)] === 'source.event.time'
+      );
+      assert.ok(timeLabel);
+      assert(Number(timeLabel.num) > 0);
+    }
+
+    assert.strictEqual(result.frameCount, frameCount);
+
+    for (const location of profile.location) {
+      assert.strictEqual(location.line.length, 1);
+      assert(functionIds.has(Number(location.line[0].functionId)));
+    }
+
+    for (const fun of profile.function) {
+      assert.strictEqual(typeof stringTable[Number(fun.name)], 'string');
+      assert.strictEqual(typeof stringTable[Number(fun.filename)], 'string');
+    }
+
+    const stopped = extension.stopPprof(handle);
+    assert.ok(stopped);
+    assert(Buffer.isBuffer(stopped.pprof));
+    assert.strictEqual(extension.stopPprof(handle), null);
+  });
+
+  it('is possible to collect a pprof encoded cpu profile asynchronously', async () => {
+    assert.equal(await extension.collectAsync(0), null);
+
+    const handle = extension.start({
+      name: 'test-async-profiler',
+      samplingIntervalMicroseconds: 1_000,
+      recordDebugInfo: false,
+    });
+
+    const idGenerator = new RandomIdGenerator();
+    const traceId = idGenerator.generateTraceId();
+    const spanId = idGenerator.generateSpanId();
+
+    extension.enterContext(1, traceId, spanId);
+    utils.spinMs(100);
+    extension.exitContext(1);
+
+    const pending = extension.collectAsync(handle);
+
+    // The profiler keeps going while the previous window is being encoded.
+    const nextTraceId = idGenerator.generateTraceId();
+    extension.enterContext(2, nextTraceId, spanId);
+    utils.spinMs(100);
+    extension.exitContext(2);
+
+    const result = await pending;
+
+    assert.ok(result);
+    assertNanoSecondString(result.startTimeNanos);
+    assert(Buffer.isBuffer(result.pprof));
+    assert.strictEqual(typeof result.profilerProcessingStepDuration, 'number');
+
+    const profile = perftools.profiles.Profile.decode(result.pprof);
+    assert.strictEqual(profile.sample.length, result.sampleCount);
+
+    const traceIds = new Set(
+      profile.sample.flatMap((sample) =>
+        sample.label
+          .filter((l) => profile.stringTable[Number(l.key)] === 'trace_id')
+          .map((l) => profile.stringTable[Number(l.str)])
+      )
+    );
+    assert.deepStrictEqual([...traceIds], [traceId]);
+
+    const next = extension.stopPprof(handle);
+    assert.ok(next);
+    const nextProfile = perftools.profiles.Profile.decode(next.pprof);
+    assert(
+      nextProfile.stringTable.includes(nextTraceId),
+      'expected the next window to be matched against its own activations'
+    );
+  });
+
+  it('is possible to rotate the cpu profile natively', async () => {
+    const handle = extension.start({
+      name: 'test-rotating-profiler',
+      samplingIntervalMicroseconds: 1_000,
+      rotationIntervalMillis: 20,
+      recordDebugInfo: false,
+    });
+
+    const idGenerator = new RandomIdGenerator();
+    const traceId = idGenerator.generateTraceId();
+    const spanId = idGenerator.generateSpanId();
+
+    // The activation spans several rotations, which only happen while the
+    // event loop is free.
+    extension.enterContext(1, traceId, spanId);
+    for (let i = 0; i < 5; i++) {
+      utils.spinMs(30);
+      await utils.sleep(30);
+    }
+    extension.exitContext(1);
+
+    const profile = extension.collect(handle);
+
+    assert.ok(profile);
+    assert(
+      profile.stacktraces.length >= 100,
+      `expected the samples of all rotations, got ${profile.stacktraces.length}`
+    );
+
+    const traceIdBuffer = Buffer.from(traceId, 'hex');
+    const matched = profile.stacktraces.filter(
+      (st) => st.traceId && st.traceId.equals(traceIdBuffer)
+    );
+    assert(matched.length >= 50, `only ${matched.length} samples matched`);
+
+    for (const { stacktrace } of profile.stacktraces) {
+      assert(stacktrace.length > 0);
+      for (const frame of stacktrace) {
+        assert.strictEqual(typeof frame[0], 'string');
+        assert.strictEqual(typeof frame[1], 'string');
+      }
+    }
+
+    utils.spinMs(50);
+    const encoded = await extension.collectAsync(handle);
+    assert.ok(encoded);
+    assert(encoded.sampleCount > 0);
+
+    assert.notEqual(extension.stop(handle), null);
+  });
+
+  it('picks up a rotation interval changed while running', async () => {
+    const options = {
+      name: 'test-reconfigured-rotation',
+      samplingIntervalMicroseconds: 1_000,
+      rotationIntervalMillis: 0,
+    };
+    const handle = extension.getOrCreateCpuProfiler(options);
+    assert.ok(extension.startCpuProfiler(handle));
+
+    extension.getOrCreateCpuProfiler({ ...options, rotationIntervalMillis: 20 });
+    for (let i = 0; i < 5; i++) {
+      utils.spinMs(20);
+      await utils.sleep(20);
+    }
+    const rotated = extension.collect(handle);
+    assert.ok(rotated);
+    assert(rotated.stacktraces.length >= 50);
+
+    // No tick folds the profile once rotation is turned off.
+    extension.getOrCreateCpuProfiler(options);
+    for (let i = 0; i < 5; i++) {
+      utils.spinMs(20);
+      await utils.sleep(20);
+    }
+    const unrotated = extension.collect(handle);
+    assert.ok(unrotated);
+    assert(unrotated.stacktraces.length >= 50);
+
+    assert.notEqual(extension.stop(handle), null);
+  });
+
+  it('reports the sample gap between rotated profiles', async () => {
+    const handle = extension.start({
+      name: 'test-eager-profiler',
+      samplingIntervalMicroseconds: 1_000,
+      rotationIntervalMillis: 20,
+      recordDebugInfo: false,
+      namingMode: 'standard',
+      loggingMode: 'eager',
+    });
+
+    for (let i = 0; i < 3; i++) {
+      utils.spinMs(30);
+      await utils.sleep(30);
+    }
+
+    const profile = extension.collect(handle);
+    assert.ok(profile);
+    assert(profile.stacktraces.length > 0);
+
+    assert.strictEqual(typeof profile.profilerSampleGap, 'number');
+    assert(
+      profile.profilerSampleGap >= 0 && profile.profilerSampleGap < 1e9,
+      `unexpected sample gap ${profile.profilerSampleGap}`
+    );
+
+    utils.spinMs(50);
+    const encoded = await extension.collectAsync(handle);
+    assert.ok(encoded);
+    assert.strictEqual(typeof encoded.profilerSampleGap, 'number');
+
+    assert.notEqual(extension.stop(handle), null);
+  });
+
+  it('shares a single v8 profile between profilers', async () => {
+    const before = extension.stats().cpuProfilesRecording;
+    const continuous = extension.start({
+      name: 'test-shared-continuous',
+      samplingIntervalMicroseconds: 10_000,
+      rotationIntervalMillis: 50,
+      recordDebugInfo: false,
+      loggingMode: 'eager',
+    });
+    const snapshot = extension.getOrCreateCpuProfiler({
+      name: 'test-shared-snapshot',
+      samplingIntervalMicroseconds: 1_000,
+      onlyFilteredStacktraces: true,
+      loggingMode: 'eager',
+    });
+
+    const idGenerator = new RandomIdGenerator();
+    const traceId = idGenerator.generateTraceId();
+    extension.addTraceIdFilter(snapshot, traceId);
+    assert.ok(extension.startCpuProfiler(snapshot));
+    assert(extension.stats().cpuProfilesRecording <= before + 1);
+
+    extension.enterContext(1, traceId, idGenerator.generateSpanId());
+    for (let i = 0; i < 4; i++) {
+      utils.spinMs(50);
+      await utils.sleep(20);
+    }
+    extension.exitContext(1);
+
+    const continuousProfile = extension.collect(continuous);
+    const snapshotProfile = extension.collect(snapshot);
+    assert.ok(continuousProfile);
+    assert.ok(snapshotProfile);
+
+    // Each profiler takes the samples at its own interval.
+    const timestamps = continuousProfile.stacktraces
+      .map((st) => BigInt(st.timestamp))
+      .sort((a, b) => (a < b ? -1 : a > b ? 1 : 0));
+    for (let i = 1; i < timestamps.length; i++) {
+      const gap = Number(timestamps[i] - timestamps[i - 1]);
+      assert(gap >= 5_000_000, `samples only ${gap}ns apart`);
+    }
+
+    const traceIdBuffer = Buffer.from(traceId, 'hex');
+    assert(
+      snapshotProfile.stacktraces.length >= 2 * timestamps.length,
+      `${snapshotProfile.stacktraces.length} snapshot samples`
+    );
+    for (const st of snapshotProfile.stacktraces) {
+      assert.ok(st.traceId && st.traceId.equals(traceIdBuffer));
+    }
+
+    assert.ok(extension.stop(snapshot));
+    assert.ok(extension.stop(continuous));
+    assert(extension.stats().cpuProfilesRecording <= before);
+  });
+
+  it('is possible to collect a columnar cpu profile', () => {
+    assert.equal(extension.collectColumnar(0), null);
+
+    const handle = extension.start({
+      name: 'test-columnar-profiler',
+      samplingIntervalMicroseconds: 1_000,
+      recordDebugInfo: false,
+    });
+
+    utils.spinMs(200);
+
+    const result = extension.collectColumnar(handle);
+
+    assert.ok(result);
+    assertNanoSecondString(result.startTimeNanos);
+    assert.strictEqual(typeof result.profilerProcessingStepDuration, 'number');
+
+    const { strings, nodes, sampleNodes, sampleTimestamps, sampleSpans } =
+      result;
+    const nodeCount = nodes.parent.length;
+
+    assert(Array.isArray(strings));
+    for (const column of Object.values(nodes)) {
+      assert(column instanceof Int32Array);
+      assert.strictEqual(column.length, nodeCount);
+    }
+
+    for (let node = 0; node < nodeCount; node++) {
+      assert(nodes.parent[node] < node, 'parents are indexed first');
+      assert.strictEqual(typeof strings[nodes.functionName[node]], 'string');
+      assert.strictEqual(typeof strings[nodes.scriptName[node]], 'string');
+    }
+
+    assert(sampleNodes instanceof Int32Array);
+    assert(sampleTimestamps instanceof BigInt64Array);
+    assert(sampleSpans instanceof Int32Array);
+    assert(Buffer.isBuffer(result.spans));
+    assert.strictEqual(result.spans.length % 24, 0);
+
+    const expectedSampleCount = 5;
+    assert(
+      sampleNodes.length >= expectedSampleCount,
+      `expected at least ${expectedSampleCount} samples, got ${sampleNodes.length}`
+    );
+    assert.strictEqual(sampleTimestamps.length, sampleNodes.length);
+    assert.strictEqual(sampleSpans.length, sampleNodes.length);
+
+    const startTime = BigInt(result.startTimeNanos);
+    for (let i = 0; i < sampleNodes.length; i++) {
+      assert(sampleNodes[i] < nodeCount);
+      assert(sampleTimestamps[i] >= startTime);
+      assert.strictEqual(sampleSpans[i], -1);
+    }
+
+    assert.ok(extension.stopColumnar(handle));
+    assert.strictEqual(extension.stopColumnar(handle), null);
+  });
+
+  it('only returns the frames added since the previous collection', () => {
+    assert.equal(extension.collectFrames(0), null);
+
+    const handle = extension.start({
+      name: 'test-frames-profiler',
+      samplingIntervalMicroseconds: 1_000,
+      recordDebugInfo: false,
+    });
+
+    const frames = new FrameTable();
+    const addedCounts: number[] = [];
+
+    for (let i = 0; i < 3; i++) {
+      utils.spinMs(100);
+
+      const result = extension.collectFrames(handle);
+      assert.ok(result);
+      assertNanoSecondString(result.startTimeNanos);
+      assert(result.evictedFrames instanceof Int32Array);
+
+      frames.apply(result);
+      addedCounts.push(result.frames.id.length);
+
+      const { nodes, sampleNodes } = result;
+      assert(sampleNodes.length > 0);
+      assert.strictEqual(nodes.frame.length, nodes.parent.length);
+
+      for (let node = 0; node < nodes.frame.length; node++) {
+        const frame = nodes.frame[node];
+        assert.strictEqual(typeof frames.functionName[frame], 'string');
+        assert.notStrictEqual(frames.scriptName[frame], '');
+      }
+    }
+
+    assert(addedCounts[0] > 0);
+    assert(
+      addedCounts[2] < addedCounts[0],
+      `expected fewer new frames once the dictionary is warm, got ${addedCounts}`
+    );
+
+    assert.ok(extension.stopFrames(handle));
+    assert.strictEqual(extension.stopFrames(handle), null);
+  });
+
+  it('reports line ticks of the hottest nodes', () => {
+    const handle = extension.start({
+      name: 'test-line-ticks-profiler',
+      samplingIntervalMicroseconds: 1_000,
+      recordDebugInfo: false,
+      maxLineTickNodes: 4,
+    });
+
+    utils.spinMs(200);
+
+    const result = extension.collect(handle);
+    assert.ok(result);
+    assert.ok(result.lineTicks);
+
+    const { strings, functionName, scriptName, lineNumber, ticks } =
+      result.lineTicks;
+    const rowCount = ticks.length;
+    assert(rowCount > 0);
+
+    for (const column of [functionName, scriptName, lineNumber, ticks]) {
+      assert(column instanceof Int32Array);
+      assert.strictEqual(column.length, rowCount);
+    }
+
+    for (let i = 0; i < rowCount; i++) {
+      assert.strictEqual(typeof strings[functionName[i]], 'string');
+      assert.strictEqual(typeof strings[scriptName[i]], 'string');
+      assert(lineNumber[i] >= 0);
+      assert(ticks[i] > 0);
+    }
+
+    assert.notEqual(extension.stop(handle), null);
+
+    const plainHandle = extension.start({
+      name: 'test-no-line-ticks-profiler',
+      samplingIntervalMicroseconds: 1_000,
+      recordDebugInfo: false,
+    });
+    utils.spinMs(50);
+    assert.strictEqual(extension.collect(plainHandle)?.lineTicks, undefined);
+    assert.notEqual(extension.stop(plainHandle), null);
+  });
+
+  it('counts pseudo frame samples instead of exporting them', async () => {
+    const pseudoFrames = ['(idle)', '(program)', '(garbage collector)'];
+    const handle = extension.start({
+      name: 'test-pseudo-frames-profiler',
+      samplingIntervalMicroseconds: 1_000,
+      recordDebugInfo: false,
+      countPseudoFrames: true,
+    });
+
+    utils.spinMs(50);
+    await utils.sleep(100);
+
+    const result = extension.collect(handle);
+    assert.ok(result);
+    assert.ok(result.pseudoFrameTicks);
+    assert(result.pseudoFrameTicks.idle > 0);
+
+    for (const { stacktrace } of result.stacktraces) {
+      assert(!pseudoFrames.includes(stacktrace[0][1] as string));
+    }
+
+    assert.notEqual(extension.stop(handle), null);
+
+    const keepingHandle = extension.start({
+      name: 'test-keep-pseudo-frames-profiler',
+      samplingIntervalMicroseconds: 1_000,
+      recordDebugInfo: false,
+    });
+    await utils.sleep(100);
+
+    const kept = extension.collect(keepingHandle);
+    assert.ok(kept);
+    assert.strictEqual(kept.pseudoFrameTicks, undefined);
+    assert(
+      kept.stacktraces.some(({ stacktrace }) => stacktrace[0][1] === '(idle)')
+    );
+    assert.notEqual(extension.stop(keepingHandle), null);
+  });
+
+  it('applies frame rules to the stacktraces', () => {
+    function recurse(depth: number, ms: number): void {
+      if (depth > 0) {
+        recurse(depth - 1, ms);
+        return;
+      }
+
+      utils.spinMs(ms);
+    }
+
+    const foldingHandle = extension.start({
+      name: 'test-fold-recursion-profiler',
+      samplingIntervalMicroseconds: 1_000,
+      recordDebugInfo: false,
+      foldRecursion: true,
+    });
+
+    recurse(30, 100);
+
+    const folded = extension.collect(foldingHandle);
+    assert.ok(folded);
+    const recursive = folded.stacktraces
+      .flatMap(({ stacktrace }) => stacktrace)
+      .filter((frame) => frame[1] === 'recurse');
+    assert(recursive.some((frame) => (frame[4] ?? 1) >= 30));
+    assert.notEqual(extension.stop(foldingHandle), null);
+
+    const cappingHandle = extension.start({
+      name: 'test-max-stack-depth-profiler',
+      samplingIntervalMicroseconds: 1_000,
+      recordDebugInfo: false,
+      maxStackDepth: 8,
+    });
+
+    recurse(30, 100);
+
+    const capped = extension.collect(cappingHandle);
+    assert.ok(capped);
+    assert(capped.stacktraces.length > 0);
+
+    for (const { stacktrace } of capped.stacktraces) {
+      assert(stacktrace.length <= 8);
+    }
+
+    assert(
+      capped.stacktraces.some(
+        ({ stacktrace }) => stacktrace[3]?.[1] === '(truncated)'
+      )
+    );
+    assert.notEqual(extension.stop(cappingHandle), null);
+
+    const excludingHandle = extension.start({
+      name: 'test-excluded-scripts-profiler',
+      samplingIntervalMicroseconds: 1_000,
+      recordDebugInfo: false,
+      excludedScriptPrefixes: ['node:', __filename],
+    });
+
+    recurse(5, 100);
+
+    const excluded = extension.collect(excludingHandle);
+    assert.ok(excluded);
+    assert(excluded.stacktraces.length > 0);
+
+    for (const { stacktrace } of excluded.stacktraces) {
+      for (const [scriptName] of stacktrace) {
+        assert(!scriptName.startsWith('node:'));
+        assert.notStrictEqual(scriptName, __filename);
+      }
+    }
+
+    assert.notEqual(extension.stop(excludingHandle), null);
+  });
+
+  it('keeps the folded recursion depth in the pprof encoded profile', () => {
+    function recurse(depth: number, ms: number): void {
+      if (depth > 0) {
+        recurse(depth - 1, ms);
+        return;
+      }
+
+      utils.spinMs(ms);
+    }
+
+    const handle = extension.start({
+      name: 'test-fold-recursion-pprof-profiler',
+      samplingIntervalMicroseconds: 1_000,
+      recordDebugInfo: false,
+      foldRecursion: true,
+    });
+
+    recurse(30, 100);
+
+    const result = extension.collectPprof(handle);
+    assert.ok(result);
+
+    const profile = perftools.profiles.Profile.decode(result.pprof);
+    const repeatCounts = profile.function
+      .map((fun) => profile.stringTable[Number(fun.name)])
+      .map((name) => /^recurse \(x(\d+)\)$/.exec(name))
+      .filter((match) => match !== null)
+      .map((match) => Number(match![1]));
+
+    assert(repeatCounts.some((count) => count >= 30));
+    assert.notEqual(extension.stopPprof(handle), null);
+  });
+
+  it('coalesces adjacent activations of the same span', () => {
+    const handle = extension.start({
+      name: 'test-coalesced-activations-profiler',
+      samplingIntervalMicroseconds: 1_000,
+      recordDebugInfo: false,
+    });
+
+    const idGenerator = new RandomIdGenerator();
+    const traceId = idGenerator.generateTraceId();
+    const spanId = idGenerator.generateSpanId();
+    const otherSpanId = idGenerator.generateSpanId();
+    const ctx = ROOT_CONTEXT.setValue(Symbol(), 1);
+
+    const activationCount = 1_000;
+    for (let i = 0; i < activationCount; i++) {
+      extension.enterContext(ctx, traceId, spanId);
+      extension.exitContext(ctx);
+    }
+
+    extension.enterContext(ctx, traceId, spanId);
+    utils.spinMs(50);
+    extension.exitContext(ctx);
+
+    // Another span on the same context is kept apart.
+    extension.enterContext(ctx, traceId, otherSpanId);
+    utils.spinMs(50);
+    extension.exitContext(ctx);
+
+    const result = extension.collect(handle);
+    assert.ok(result);
+    assert(result.activationsMerged >= activationCount / 2);
+
+    const spanIds = new Set(
+      result.stacktraces
+        .filter((st) => st.spanId)
+        .map((st) => st.spanId.toString('hex'))
+    );
+    assert(spanIds.has(spanId));
+    assert(spanIds.has(otherSpanId));
+
+    const stopped = extension.stop(handle);
+    assert.ok(stopped);
+    assert.strictEqual(stopped.activationsMerged, 0);
+  });
+
+  it('reports the overhead of the profilers', () => {
+    const before = extension.stats();
+    const handle = extension.start({
+      name: 'test-stats-profiler',
+      samplingIntervalMicroseconds: 1_000,
+      recordDebugInfo: false,
+    });
+
+    const idGenerator = new RandomIdGenerator();
+    const traceId = idGenerator.generateTraceId();
+    const switchCount = 100;
+
+    for (let i = 0; i < switchCount; i++) {
+      const ctx = ROOT_CONTEXT.setValue(Symbol(), i);
+      extension.enterContext(ctx, traceId, idGenerator.generateSpanId());
+      extension.exitContext(ctx);
+    }
+
+    const during = extension.stats();
+    assert(during.arenaReservedBytes > 0);
+    assert(during.contextStacks > 0);
+
+    assert.ok(extension.collect(handle));
+    assert.ok(extension.stop(handle));
+
+    const after = extension.stats();
+    const enter = after.enterContext;
+    assert.strictEqual(enter.calls - before.enterContext.calls, switchCount);
+    assert.strictEqual(
+      after.exitContext.calls - before.exitContext.calls,
+      switchCount
+    );
+    assert(enter.timedCalls > before.enterContext.timedCalls);
+    assert.strictEqual(
+      enter.buckets.reduce((sum, count) => sum + count, 0),
+      enter.timedCalls
+    );
+    assert.strictEqual(
+      enter.buckets.length,
+      after.durationBucketBounds.length + 1
+    );
+    assert(
+      after.activationsRecorded - before.activationsRecorded >= switchCount
+    );
+    assert.strictEqual(after.activationsDropped, before.activationsDropped);
+    assert(after.samplesDiscarded >= before.samplesDiscarded);
+  });
+
+  it('drops activations past its memory budget', () => {
+    const handle = extension.start({
+      name: 'test-memory-budget-profiler',
+      samplingIntervalMicroseconds: 1_000,
+      recordDebugInfo: false,
+      maxMemoryBytes: 4 * 1024 * 1024,
+    });
+
+    const idGenerator = new RandomIdGenerator();
+    const traceId = idGenerator.generateTraceId();
+    const ctx = ROOT_CONTEXT.setValue(Symbol(), 1);
+
+    // A new span each time, so that none of them are coalesced.
+    const activationCount = 200_000;
+    for (let i = 0; i < activationCount; i++) {
+      extension.enterContext(ctx, traceId, idGenerator.generateSpanId());
+      extension.exitContext(ctx);
+    }
+
+    const flooded = extension.collect(handle);
+    assert.ok(flooded);
+    assert(flooded.activationsDropped > 0);
+    assert(flooded.activationsDropped < activationCount);
+    assert.strictEqual(flooded.samplesDropped, 0);
+
+    // The next window starts with the whole budget again.
+    const spanId = idGenerator.generateSpanId();
+    extension.enterContext(ctx, traceId, spanId);
+    utils.spinMs(50);
+    extension.exitContext(ctx);
+
+    const result = extension.stop(handle);
+    assert.ok(result);
+    assert.strictEqual(result.activationsDropped, 0);
+    assert(
+      result.stacktraces.some(
+        (st) => st.spanId && st.spanId.toString('hex') === spanId
+      )
+    );
+  });
+
   it('is possible to collect a heap profile', () => {
     assert.equal(extension.collectHeapProfile(), null);
 
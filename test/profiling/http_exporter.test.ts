@@ -22,8 +22,11 @@ import {
 import { strict as assert } from 'assert';
 import { describe, it, mock } from 'node:test';
 import { OtlpHttpProfilingExporter } from '../../src/profiling/OtlpHttpProfilingExporter';
+import { serialize } from '../../src/profiling/utils';
+import { perftools } from '../../src/profiling/proto/profile.js';
 import { cpuProfile, heapProfile } from './profiles';
 import { InMemoryLogRecordExporter } from '@opentelemetry/sdk-logs';
+import { gunzipSync } from 'zlib';
 
 const OTEL_SDK_VERSION = dependencies['@opentelemetry/core'];
 
@@ -84,6 +87,55 @@ describe('profiling OTLP HTTP exporter', () => {
     });
   });
 
+  it('attaches common attributes when exporting encoded CPU profiles', async () => {
+    const exporter = new OtlpHttpProfilingExporter({
+      endpoint: 'http://foobar:8181',
+      callstackInterval: 1000,
+      instrumentationSource: 'snapshot',
+      resource: resourceFromAttributes({ xyz: 'foo' }),
+    });
+
+    const logExporter = new InMemoryLogRecordExporter();
+    mock.method(exporter, '_getExporter', () => logExporter);
+
+    const pprof = Buffer.from(
+      perftools.profiles.Profile.encode(
+        serialize(cpuProfile, { samplingPeriodMillis: 1000 })
+      ).finish()
+    );
+
+    await exporter.sendEncoded({
+      startTimeNanos: cpuProfile.startTimeNanos,
+      pprof,
+      sampleCount: cpuProfile.stacktraces.length,
+      frameCount: 2,
+      profilerStartDuration: 0,
+      profilerStopDuration: 0,
+      profilerProcessingStepDuration: 0,
+      profilerSampleGap: 0,
+      activationsMerged: 0,
+      activationsDropped: 0,
+      samplesDropped: 0,
+    });
+
+    const logs = logExporter.getFinishedLogRecords();
+
+    assert.strictEqual(logs.length, 1);
+
+    const [log] = logs;
+
+    assert.deepStrictEqual(log.attributes, {
+      'profiling.data.format': 'pprof-gzip-base64',
+      'profiling.data.type': 'cpu',
+      'com.splunk.sourcetype': 'otel.profiling',
+      'profiling.data.total.frame.count': 2,
+      'profiling.instrumentation.source': 'snapshot',
+    });
+
+    const body = gunzipSync(Buffer.from(log.body as string, 'base64'));
+    assert.deepStrictEqual(body, pprof);
+  });
+
   it('attaches common attributes when exporting heap profiles', async () => {
     const exporter = new OtlpHttpProfilingExporter({
       endpoint: 'http://foobar:8181',
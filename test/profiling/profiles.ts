@@ -14,7 +14,12 @@
  * limitations under the License.
  */
 
-import type { CpuProfile, HeapProfile } from '../../src/profiling/types';
+import type {
+  ColumnarCpuProfile,
+  CpuProfile,
+  FrameDeltaCpuProfile,
+  HeapProfile,
+} from '../../src/profiling/types';
 
 export const cpuProfile: CpuProfile = {
   stacktraces: [
@@ -33,6 +38,70 @@ export const cpuProfile: CpuProfile = {
   profilerStartDuration: 100,
   profilerStopDuration: 110,
   profilerProcessingStepDuration: 120,
+  profilerSampleGap: 0,
+  activationsMerged: 0,
+  activationsDropped: 0,
+  samplesDropped: 0,
+};
+
+// Same samples as cpuProfile, in the columnar layout.
+export const columnarCpuProfile: ColumnarCpuProfile = {
+  startTimeNanos: '1657707471456450000',
+  strings: ['noline', '/app/foo.ts', 'doWork', '/app/file.ts'],
+  nodes: {
+    parent: Int32Array.of(-1, 0),
+    functionName: Int32Array.of(0, 2),
+    scriptName: Int32Array.of(1, 3),
+    lineNumber: Int32Array.of(0, 44),
+    columnNumber: Int32Array.of(2, 1),
+  },
+  sampleNodes: Int32Array.of(1),
+  sampleTimestamps: BigInt64Array.of(BigInt('1657707471544258336')),
+  sampleSpans: Int32Array.of(0),
+  spans: Buffer.from(
+    '10192d1c807161471ad2011522853770' + 'adbfe5ed33c9a3ff',
+    'hex'
+  ),
+
+  profilerStartDuration: 100,
+  profilerStopDuration: 110,
+  profilerProcessingStepDuration: 120,
+  profilerSampleGap: 0,
+  activationsMerged: 0,
+  activationsDropped: 0,
+  samplesDropped: 0,
+};
+
+// Same samples as cpuProfile, as the first delta of a frame dictionary.
+export const frameDeltaCpuProfile: FrameDeltaCpuProfile = {
+  startTimeNanos: '1657707471456450000',
+  frames: {
+    id: Int32Array.of(0, 1),
+    functionName: ['noline', 'doWork'],
+    scriptName: ['/app/foo.ts', '/app/file.ts'],
+    lineNumber: Int32Array.of(0, 44),
+    columnNumber: Int32Array.of(2, 1),
+  },
+  evictedFrames: new Int32Array(0),
+  nodes: {
+    parent: Int32Array.of(-1, 0),
+    frame: Int32Array.of(0, 1),
+  },
+  sampleNodes: Int32Array.of(1),
+  sampleTimestamps: BigInt64Array.of(BigInt('1657707471544258336')),
+  sampleSpans: Int32Array.of(0),
+  spans: Buffer.from(
+    '10192d1c807161471ad2011522853770' + 'adbfe5ed33c9a3ff',
+    'hex'
+  ),
+
+  profilerStartDuration: 100,
+  profilerStopDuration: 110,
+  profilerProcessingStepDuration: 120,
+  profilerSampleGap: 0,
+  activationsMerged: 0,
+  activationsDropped: 0,
+  samplesDropped: 0,
 };
 
 export const heapProfile: HeapProfile = {
@@ -64,6 +64,12 @@ describe('profiling', () => {
         exporterFactory: defaultExporterFactory,
         memoryProfilingEnabled: false,
         memoryProfilingOptions: undefined,
+        aggregateSamples: false,
+        keepPseudoFrames: false,
+        excludedScriptPrefixes: undefined,
+        maxStackDepth: undefined,
+        foldRecursion: false,
+        maxMemoryBytes: undefined,
       });
 
       assert.deepStrictEqual(
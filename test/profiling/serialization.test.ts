@@ -17,11 +17,18 @@ import { strict as assert } from 'assert';
 import { describe, it } from 'node:test';
 import { perftools } from '../../src/profiling/proto/profile.js';
 import {
+  FrameTable,
   StringTable,
   serialize,
+  serializeColumnar,
   serializeHeapProfile,
 } from '../../src/profiling/utils';
-import { cpuProfile, heapProfile } from './profiles';
+import {
+  columnarCpuProfile,
+  cpuProfile,
+  frameDeltaCpuProfile,
+  heapProfile,
+} from './profiles';
 
 const proto = perftools.profiles;
 const toBuffer = (profile: any) => {
@@ -109,6 +116,153 @@ describe('profiling:serialization', () => {
       );
     });
 
+    it('serializes aggregated samples with count and weight values', () => {
+      const [stacktrace] = cpuProfile.stacktraces;
+      const serializedProfile = serialize(
+        {
+          ...cpuProfile,
+          stacktraces: [
+            {
+              ...stacktrace,
+              lastTimestamp: '1657707471574258336',
+              count: 3,
+              weight: 30_000_000,
+            },
+          ],
+        },
+        { samplingPeriodMillis: 1_000 }
+      );
+
+      const json = serializedProfile.toJSON();
+      assert.deepEqual(json.sampleType, [
+        { type: '5', unit: '6' },
+        { type: '7', unit: '8' },
+      ]);
+      assert.deepEqual(json.stringTable.slice(5, 9), [
+        'samples',
+        'count',
+        'cpu',
+        'nanoseconds',
+      ]);
+      assert.deepEqual(json.sample[0].value, ['3', '30000000']);
+      assert.deepEqual(json.sample[0].label[0], {
+        key: '1',
+        num: '1657707471544',
+      });
+    });
+
+    it('serializes a columnar profile the same as its stacktraces', () => {
+      const options = { samplingPeriodMillis: 1_000 };
+      const serializedProfile = serializeColumnar(columnarCpuProfile, options);
+
+      assert.equal(proto.Profile.verify(serializedProfile), null);
+      assert.deepEqual(
+        serializedProfile.toJSON(),
+        serialize(cpuProfile, options).toJSON()
+      );
+    });
+
+    it('keeps the repeat count of folded recursive frames', () => {
+      const options = { samplingPeriodMillis: 1_000 };
+      const [stacktrace] = cpuProfile.stacktraces;
+      const profiles = [
+        serialize(
+          {
+            ...cpuProfile,
+            stacktraces: [
+              {
+                ...stacktrace,
+                stacktrace: [
+                  ['/app/file.ts', 'doWork', 44, 1, 30],
+                  ['/app/foo.ts', 'noline', 0, 2],
+                ],
+              },
+            ],
+          },
+          options
+        ),
+        serializeColumnar(
+          {
+            ...columnarCpuProfile,
+            nodes: {
+              ...columnarCpuProfile.nodes,
+              repeatCount: Int32Array.of(1, 30),
+            },
+          },
+          options
+        ),
+      ];
+
+      for (const serializedProfile of profiles) {
+        const decoded = clone(serializedProfile);
+        const functionName = (locationId: unknown) => {
+          const location = decoded.location.find(
+            ({ id }) => Number(id) === Number(locationId)
+          );
+          const fun = decoded.function.find(
+            ({ id }) => Number(id) === Number(location?.line[0].functionId)
+          );
+          return decoded.stringTable[Number(fun?.name)];
+        };
+
+        assert.deepEqual(decoded.sample[0].locationId.map(functionName), [
+          'doWork (x30)',
+          'noline',
+        ]);
+      }
+    });
+
+    it('applies frame evictions before the added frames', () => {
+      const frames = new FrameTable();
+      frames.apply(frameDeltaCpuProfile);
+      frames.apply({
+        ...frameDeltaCpuProfile,
+        frames: {
+          id: Int32Array.of(0),
+          functionName: ['replaced'],
+          scriptName: ['/app/bar.ts'],
+          lineNumber: Int32Array.of(7),
+          columnNumber: Int32Array.of(3),
+        },
+        evictedFrames: Int32Array.of(0, 1),
+      });
+
+      assert.deepEqual(frames.functionName, ['replaced', '']);
+      assert.deepEqual(frames.scriptName, ['/app/bar.ts', '']);
+      assert.deepEqual(frames.lineNumber, [7, 44]);
+    });
+
+    it('serializes columnar samples without a span', () => {
+      const serializedProfile = serializeColumnar(
+        {
+          ...columnarCpuProfile,
+          sampleNodes: Int32Array.of(0, -1),
+          sampleTimestamps: BigInt64Array.of(
+            BigInt('1657707471544258336'),
+            BigInt('1657707471545258336')
+          ),
+          sampleSpans: Int32Array.of(-1, -1),
+        },
+        { samplingPeriodMillis: 1_000 }
+      );
+
+      assert.deepEqual(serializedProfile.toJSON().sample, [
+        {
+          locationId: ['1'],
+          label: [
+            { key: '1', num: '1657707471544' },
+            { key: '4', num: '1000' },
+          ],
+        },
+        {
+          label: [
+            { key: '1', num: '1657707471545' },
+            { key: '4', num: '1000' },
+          ],
+        },
+      ]);
+    });
+
     it('correctly serializes a heap profile', () => {
       const ts = String(heapProfile.timestamp);
       const serializedProfile = serializeHeapProfile(heapProfile);